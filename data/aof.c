@@ -86,11 +86,12 @@ void freeFakeClientArgv(struct redisClient *c) /* 释放客户端参数操作 */
 void freeFakeClient(struct redisClient *c) /* 释放客户端参数操作 */
 int loadAppendOnlyFile(char *filename) /* 加载AOF文件内容 */
 int rioWriteBulkObject(rio *r, robj *obj) /* 写入bulk对象，分为LongLong对象，和普通的String对象 */
-int rewriteListObject(rio *r, robj *key, robj *o) /* 写入List列表对象，分为ZIPLIST压缩列表和LINEDLIST普通链表操作 */
+int rewriteListObject(rio *r, robj *key, robj *o) /* 写入List列表对象，分为LISTPACK紧凑列表和QUICKLIST快速列表操作 */
 int rewriteSetObject(rio *r, robj *key, robj *o) /* 写入set对象数据 */
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) /* 写入排序好的set对象 */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) /* 写入哈希迭代器当前指向的对象 */
 int rewriteHashObject(rio *r, robj *key, robj *o) /* 写入哈希字典对象 */
+int rewriteBitmapObject(rio *r, robj *key, robj *o) /* 写入roaring位图编码的字符串对象 */
 int rewriteAppendOnlyFile(char *filename) /* 将数据库的内容按照键值，再次完全重写入文件中 */
 int rewriteAppendOnlyFileBackground(void) /* 后台进行AOF数据文件写入操作 */
 void bgrewriteaofCommand(redisClient *c) /* 后台写AOF文件操作命令模式 */
@@ -582,16 +583,18 @@ struct redisClient *createFakeClient(void) {
     c->argc = 0;
     c->argv = NULL;
     c->bufpos = 0;
+    c->buf = NULL;
     c->flags = 0;
     /* We set the fake client as a slave waiting for the synchronization
      * so that Redis will not try to send replies to this client. */
     c->replstate = REDIS_REPL_WAIT_BGSAVE_START;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_ref_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
     c->watched_keys = listCreate();
     c->peerid = NULL;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     initClientMultiState(c);
     return c;
@@ -610,6 +613,7 @@ void freeFakeClientArgv(struct redisClient *c) {
 void freeFakeClient(struct redisClient *c) {
     sdsfree(c->querybuf);
     listRelease(c->reply);
+    releaseClientReplyBuffer(c);
     listRelease(c->watched_keys);
     freeClientMultiState(c);
     zfree(c);
@@ -783,8 +787,21 @@ int rioWriteBulkObject(rio *r, robj *obj) {
      * in a child process when this function is called). */
     if (obj->encoding == REDIS_ENCODING_INT) {
         return rioWriteBulkLongLong(r,(long)obj->ptr);
-    } else if (obj->encoding == REDIS_ENCODING_RAW) {
+    } else if (sdsEncodedObject(obj)) {
         return rioWriteBulkString(r,obj->ptr,sdslen(obj->ptr));
+    } else if (obj->encoding == REDIS_ENCODING_CHUNKED) {
+        /* Written segment by segment, for the same reason. */
+        chunkString *cs = obj->ptr;
+        size_t off, len, nwritten;
+
+        if ((nwritten = rioWriteBulkCount(r,'$',cs->len)) == 0) return 0;
+        for (off = 0; off < cs->len; off += len) {
+            const unsigned char *p = csSegment(cs,off,&len);
+
+            if (rioWrite(r,p,len) == 0) return 0;
+        }
+        if (rioWrite(r,"\r\n",2) == 0) return 0;
+        return nwritten+cs->len+2;
     } else {
         redisPanic("Unknown string encoding");
     }
@@ -792,18 +809,18 @@ int rioWriteBulkObject(rio *r, robj *obj) {
 
 /* Emit the commands needed to rebuild a list object.
  * The function returns 0 on error, 1 on success. */
-/* 写入List列表对象，分为ZIPLIST压缩列表和LINEDLIST普通链表操作 */
+/* 写入List列表对象，分为LISTPACK紧凑列表和QUICKLIST快速列表操作 */
 int rewriteListObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = listTypeLength(o);
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
-        unsigned char *p = ziplistIndex(zl,0);
+        unsigned char *p = lpSeek(zl,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        while(ziplistGet(p,&vstr,&vlen,&vlong)) {
+        while(lpGetValue(p,&vstr,&vlen,&vlong)) {
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
                     REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
@@ -818,31 +835,36 @@ int rewriteListObject(rio *r, robj *key, robj *o) {
             } else {
                 if (rioWriteBulkLongLong(r,vlong) == 0) return 0;
             }
-            p = ziplistNext(zl,p);
+            p = lpNext(zl,p);
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list *list = o->ptr;
-        listNode *ln;
-        listIter li;
-
-        listRewind(list,&li);
-        while((ln = listNext(&li))) {
-            robj *eleobj = listNodeValue(ln);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter *li = quicklistGetIterator(o->ptr,AL_START_HEAD);
+        quicklistEntry entry;
 
+        /* On write errors break out of the loop so that the iterator is
+         * released: 'items' is then left greater than zero. */
+        while (quicklistNext(li,&entry)) {
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
                     REDIS_AOF_REWRITE_ITEMS_PER_CMD : items;
 
-                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) return 0;
-                if (rioWriteBulkString(r,"RPUSH",5) == 0) return 0;
-                if (rioWriteBulkObject(r,key) == 0) return 0;
+                if (rioWriteBulkCount(r,'*',2+cmd_items) == 0) break;
+                if (rioWriteBulkString(r,"RPUSH",5) == 0) break;
+                if (rioWriteBulkObject(r,key) == 0) break;
+            }
+            if (entry.value) {
+                if (rioWriteBulkString(r,(char*)entry.value,entry.sz) == 0)
+                    break;
+            } else {
+                if (rioWriteBulkLongLong(r,entry.longval) == 0) break;
             }
-            if (rioWriteBulkObject(r,eleobj) == 0) return 0;
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
+        quicklistReleaseIterator(li);
+        if (items) return 0;
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -903,7 +925,7 @@ int rewriteSetObject(rio *r, robj *key, robj *o) {
 int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
     long long count = 0, items = zsetLength(o);
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = o->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -911,13 +933,13 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
         long long vll;
         double score;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssert(eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         while (eptr != NULL) {
-            redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+            redisAssert(lpGetValue(eptr,&vstr,&vlen,&vll));
             score = zzlGetScore(sptr);
 
             if (count == 0) {
@@ -938,14 +960,16 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
         }
-    } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (o->encoding == REDIS_ENCODING_SKIPLIST ||
+               o->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = o->ptr;
         dictIterator *di = dictGetIterator(zs->dict);
         dictEntry *de;
 
         while((de = dictNext(di)) != NULL) {
             robj *eleobj = dictGetKey(de);
-            double *score = dictGetVal(de);
+            double score = zsetDictScore(o,de);
 
             if (count == 0) {
                 int cmd_items = (items > REDIS_AOF_REWRITE_ITEMS_PER_CMD) ?
@@ -955,7 +979,7 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
                 if (rioWriteBulkString(r,"ZADD",4) == 0) return 0;
                 if (rioWriteBulkObject(r,key) == 0) return 0;
             }
-            if (rioWriteBulkDouble(r,*score) == 0) return 0;
+            if (rioWriteBulkDouble(r,score) == 0) return 0;
             if (rioWriteBulkObject(r,eleobj) == 0) return 0;
             if (++count == REDIS_AOF_REWRITE_ITEMS_PER_CMD) count = 0;
             items--;
@@ -975,12 +999,12 @@ int rewriteSortedSetObject(rio *r, robj *key, robj *o) {
  * The function returns 0 on error, non-zero on success. */
 /* 写入哈希迭代器当前指向的对象 */
 static int rioWriteHashIteratorCursor(rio *r, hashTypeIterator *hi, int what) {
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             return rioWriteBulkString(r, (char*)vstr, vlen);
         } else {
@@ -1027,6 +1051,48 @@ int rewriteHashObject(rio *r, robj *key, robj *o) {
     return 1;
 }
 
+/* Emit the commands needed to rebuild a roaring bitmap string. A sparse
+ * bitmap is rebuilt with a SETBIT per set bit, after a first SETBIT that
+ * restores the length of the string, so it is loaded back as a bitmap
+ * without ever allocating the whole string. A dense one is cheaper to
+ * write as a plain SET.
+ * The function returns 0 on error, 1 on success. */
+/* 写入roaring位图编码的字符串对象 */
+int rewriteBitmapObject(rio *r, robj *key, robj *o) {
+    roaringBitmap *rb = o->ptr;
+    uint64_t end = (uint64_t)rb->len*8-1;
+    int64_t pos;
+
+    if (rb->len == 0 || rbCount(rb,0,end)*48 >= rb->len) {
+        char cmd[]="*3\r\n$3\r\nSET\r\n";
+        robj *dec = getDecodedObject(o);
+        int retval;
+
+        retval = rioWrite(r,cmd,sizeof(cmd)-1) &&
+                 rioWriteBulkObject(r,key) &&
+                 rioWriteBulkObject(r,dec);
+        decrRefCount(dec);
+        return retval;
+    }
+
+    if (rioWriteBulkCount(r,'*',4) == 0) return 0;
+    if (rioWriteBulkString(r,"SETBIT",6) == 0) return 0;
+    if (rioWriteBulkObject(r,key) == 0) return 0;
+    if (rioWriteBulkLongLong(r,end) == 0) return 0;
+    if (rioWriteBulkLongLong(r,rbGetBit(rb,end)) == 0) return 0;
+
+    pos = rbFirst(rb,1,0,end);
+    while (pos != -1 && (uint64_t)pos < end) {
+        if (rioWriteBulkCount(r,'*',4) == 0) return 0;
+        if (rioWriteBulkString(r,"SETBIT",6) == 0) return 0;
+        if (rioWriteBulkObject(r,key) == 0) return 0;
+        if (rioWriteBulkLongLong(r,pos) == 0) return 0;
+        if (rioWriteBulkLongLong(r,1) == 0) return 0;
+        pos = rbFirst(rb,1,pos+1,end);
+    }
+    return 1;
+}
+
 /* Write a sequence of commands able to fully rebuild the dataset into
  * "filename". Used both by REWRITEAOF and BGREWRITEAOF.
  *
@@ -1088,7 +1154,11 @@ int rewriteAppendOnlyFile(char *filename) {
             if (expiretime != -1 && expiretime < now) continue;
 
             /* Save the key and associated value */
-            if (o->type == REDIS_STRING) {
+            if (o->type == REDIS_STRING &&
+                o->encoding == REDIS_ENCODING_ROARING)
+            {
+                if (rewriteBitmapObject(&aof,&key,o) == 0) goto werr;
+            } else if (o->type == REDIS_STRING) {
                 /* Emit a SET command */
                 char cmd[]="*3\r\n$3\r\nSET\r\n";
                 if (rioWrite(&aof,cmd,sizeof(cmd)-1) == 0) goto werr;
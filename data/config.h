@@ -66,6 +66,23 @@
 #define HAVE_EPOLL 1
 #endif
 
+/* io_uring is preferred to epoll when the kernel headers know about it.
+ * ae_iouring.c still falls back to epoll at runtime if the running kernel
+ * does not support it. Define NO_IO_URING to force plain epoll. */
+#if defined(__linux__) && !defined(NO_IO_URING) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/* Shared memory transport for local clients: needs memfd_create() and
+ * eventfd(), see shmring.c. */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/eventfd.h>)
+#define HAVE_SHMRING 1
+#endif
+#endif
+
 #if (defined(__APPLE__) && defined(MAC_OS_X_VERSION_10_6)) || defined(__FreeBSD__) || defined(__OpenBSD__) || defined (__NetBSD__)
 #define HAVE_KQUEUE 1
 #endif
@@ -50,6 +50,7 @@ int dbExists(redisDb *db, robj *key) /* db是否存在此key */
 robj *dbRandomKey(redisDb *db) /* 随机返回没有过期的key */
 int dbDelete(redisDb *db, robj *key) /* db删除操作 */
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) /* 解除key的共享，之后就可以进行修改操作 */
+robj *dbUnshareChunkedStringValue(redisDb *db, robj *key, robj *o) /* 解除key的共享，并转换成可以修改的分段字符串 */
 long long emptyDb(void(callback)(void*)) /* 将server中的所有数据库清空，回调函数作为参数传入 */
 int selectDb(redisClient *c, int id) /* 客户端选择服务端的某个db */
 void signalModifiedKey(redisDb *db, robj *key) /* 每当key被修改时，就会调用此方法，touchWatchedKey(db,key)方法，就把此key对应的客户端锁住了 */
@@ -94,6 +95,7 @@ void getKeysFreeResult(int *result)
 int *noPreloadGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags)
 int *renameGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags)
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags)
+int *intercardGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags) /* SINTERCARD和ZINTERCARD的key位置 */
 
 /* 从db中获取key代表的值 */
 robj *lookupKey(redisDb *db, robj *key) {
@@ -268,15 +270,42 @@ int dbDelete(redisDb *db, robj *key) {
 /* 解除key的共享，之后就可以进行修改操作 */
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o) {
     redisAssert(o->type == REDIS_STRING);
+    if (o->refcount == 1 && (o->encoding == REDIS_ENCODING_ROARING ||
+                             o->encoding == REDIS_ENCODING_CHUNKED))
+    {
+        /* Bitmaps and chunked strings are turned into the string in place,
+         * without copying it a second time. */
+        stringObjectToRaw(o);
+        return o;
+    }
     if (o->refcount != 1 || o->encoding != REDIS_ENCODING_RAW) {
         robj *decoded = getDecodedObject(o);
-        o = createStringObject(decoded->ptr, sdslen(decoded->ptr));
+        o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
         decrRefCount(decoded);
         dbOverwrite(db,key,o);
     }
     return o;
 }
 
+/* Like dbUnshareStringValue(), but the object returned is a chunked string
+ * the caller can modify with csAppend() and csSetRange(). Strings of other
+ * encodings are copied into a new chunked string stored at 'key'. */
+/* 解除key的共享，并转换成可以修改的分段字符串 */
+robj *dbUnshareChunkedStringValue(redisDb *db, robj *key, robj *o) {
+    redisAssert(o->type == REDIS_STRING);
+    if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        if (o->refcount == 1) return o;
+        o = createStringChunkedObject(csDup(o->ptr));
+    } else {
+        robj *decoded = getDecodedObject(o);
+        o = createStringChunkedObject(
+            csFromBuffer(decoded->ptr,sdslen(decoded->ptr)));
+        decrRefCount(decoded);
+    }
+    dbOverwrite(db,key,o);
+    return o;
+}
+
 /* 将server中的所有数据库清空，回调函数作为参数传入 */
 long long emptyDb(void(callback)(void*)) {
     int j;
@@ -456,7 +485,7 @@ void scanCallback(void *privdata, const dictEntry *de) {
     } else if (o->type == REDIS_ZSET) {
         key = dictGetKey(de);
         incrRefCount(key);
-        val = createStringObjectFromLongDouble(*(double*)dictGetVal(de));
+        val = createStringObjectFromLongDouble(zsetDictScore(o,de));
     } else {
         redisPanic("Type not handled in SCAN callback.");
     }
@@ -549,7 +578,7 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
 
     /* Step 2: Iterate the collection.
      *
-     * Note that if the object is encoded with a ziplist, intset, or any other
+     * Note that if the object is encoded with a listpack, intset, or any other
      * representation that is not a hash table, we are sure that it is also
      * composed of a small number of elements. So to avoid taking state we
      * just return everything inside the object in a single call, setting the
@@ -564,7 +593,8 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
     } else if (o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT) {
         ht = o->ptr;
         count *= 2; /* We return key / value for this type. */
-    } else if (o->type == REDIS_ZSET && o->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (o->type == REDIS_ZSET && (o->encoding == REDIS_ENCODING_SKIPLIST ||
+                                         o->encoding == REDIS_ENCODING_BTREE)) {
         zset *zs = o->ptr;
         ht = zs->dict;
         count *= 2; /* We return key / value for this type. */
@@ -596,17 +626,17 @@ void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor) {
             listAddNodeTail(keys,createStringObjectFromLongLong(ll));
         cursor = 0;
     } else if (o->type == REDIS_HASH || o->type == REDIS_ZSET) {
-        unsigned char *p = ziplistIndex(o->ptr,0);
+        unsigned char *p = lpSeek(o->ptr,0);
         unsigned char *vstr;
         unsigned int vlen;
         long long vll;
 
         while(p) {
-            ziplistGet(p,&vstr,&vlen,&vll);
+            lpGetValue(p,&vstr,&vlen,&vll);
             listAddNodeTail(keys,
                 (vstr != NULL) ? createStringObject((char*)vstr,vlen) :
                                  createStringObjectFromLongLong(vll));
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
         cursor = 0;
     } else {
@@ -1139,3 +1169,22 @@ int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *num
     *numkeys = num;
     return keys;
 }
+
+/* SINTERCARD and ZINTERCARD: numkeys is the first argument. */
+int *intercardGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags) {
+    int i, num, *keys;
+    REDIS_NOTUSED(cmd);
+    REDIS_NOTUSED(flags);
+
+    num = atoi(argv[1]->ptr);
+    /* Sanity check. Don't return any key if the command is going to
+     * reply with an error. */
+    if (num < 1 || num > (argc-2)) {
+        *numkeys = 0;
+        return NULL;
+    }
+    keys = zmalloc(sizeof(int)*num);
+    for (i = 0; i < num; i++) keys[i] = 2+i;
+    *numkeys = num;
+    return keys;
+}
@@ -221,45 +221,51 @@ int rdbTryIntegerEncoding(char *s, size_t len, unsigned char *enc) {
     return rdbEncodeInteger(value,enc);
 }
 
-/* 将字符串对象压缩后，保存入rdb中 */
-int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
-    size_t comprlen, outlen;
+/* Write 'data', that is already LZF compressed to 'compress_len' bytes
+ * from 'original_len' bytes, as an LZF encoded string. */
+/* 将已经压缩好的数据按照LZF字符串的格式保存入rdb中 */
+int rdbSaveLzfBlob(rio *rdb, void *data, size_t compress_len,
+                   size_t original_len) {
     unsigned char byte;
     int n, nwritten = 0;
-    void *out;
 
-    /* We require at least four bytes compression for this to be worth it */
-    /* 压缩后的长度至少保证4个字节 */
-    if (len <= 4) return 0;
-    outlen = len-4;
-    if ((out = zmalloc(outlen+1)) == NULL) return 0;
-    comprlen = lzf_compress(s, len, out, outlen);
-    if (comprlen == 0) {
-        zfree(out);
-        return 0;
-    }
     /* Data compressed! Let's save it on disk */
     //将压缩好后的字节保存到disk磁盘中
     byte = (REDIS_RDB_ENCVAL<<6)|REDIS_RDB_ENC_LZF;
-    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) goto writeerr;
+    if ((n = rdbWriteRaw(rdb,&byte,1)) == -1) return -1;
     nwritten += n;
 
-    if ((n = rdbSaveLen(rdb,comprlen)) == -1) goto writeerr;
+    if ((n = rdbSaveLen(rdb,compress_len)) == -1) return -1;
     nwritten += n;
 
-    if ((n = rdbSaveLen(rdb,len)) == -1) goto writeerr;
+    if ((n = rdbSaveLen(rdb,original_len)) == -1) return -1;
     nwritten += n;
 
-    if ((n = rdbWriteRaw(rdb,out,comprlen)) == -1) goto writeerr;
+    if ((n = rdbWriteRaw(rdb,data,compress_len)) == -1) return -1;
     nwritten += n;
 
-    zfree(out);
     return nwritten;
+}
 
-writeerr:
-	//如果此时，写操作，出现问题，执行goto语句直接退出
+/* 将字符串对象压缩后，保存入rdb中 */
+int rdbSaveLzfStringObject(rio *rdb, unsigned char *s, size_t len) {
+    size_t comprlen, outlen;
+    int nwritten;
+    void *out;
+
+    /* We require at least four bytes compression for this to be worth it */
+    /* 压缩后的长度至少保证4个字节 */
+    if (len <= 4) return 0;
+    outlen = len-4;
+    if ((out = zmalloc(outlen+1)) == NULL) return 0;
+    comprlen = lzf_compress(s, len, out, outlen);
+    if (comprlen == 0) {
+        zfree(out);
+        return 0;
+    }
+    nwritten = rdbSaveLzfBlob(rdb,out,comprlen,len);
     zfree(out);
-    return -1;
+    return nwritten;
 }
 
 /* 进行解压缩读取字符串对象 */
@@ -348,7 +354,7 @@ int rdbSaveStringObject(rio *rdb, robj *obj) {
     if (obj->encoding == REDIS_ENCODING_INT) {
         return rdbSaveLongLongAsStringObject(rdb,(long)obj->ptr);
     } else {
-        redisAssertWithInfo(NULL,obj,obj->encoding == REDIS_ENCODING_RAW);
+        redisAssertWithInfo(NULL,obj,sdsEncodedObject(obj));
         return rdbSaveRawString(rdb,obj->ptr,sdslen(obj->ptr));
     }
 }
@@ -461,12 +467,14 @@ int rdbLoadDoubleValue(rio *rdb, double *val) {
 int rdbSaveObjectType(rio *rdb, robj *o) {
     switch (o->type) {
     case REDIS_STRING:
+        if (o->encoding == REDIS_ENCODING_ROARING)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_STRING_ROARING);
         return rdbSaveType(rdb,REDIS_RDB_TYPE_STRING);
     case REDIS_LIST:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_ZIPLIST);
-        else if (o->encoding == REDIS_ENCODING_LINKEDLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST);
+        if (o->encoding == REDIS_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_LISTPACK);
+        else if (o->encoding == REDIS_ENCODING_QUICKLIST)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_LIST_QUICKLIST);
         else
             redisPanic("Unknown list encoding");
     case REDIS_SET:
@@ -477,15 +485,16 @@ int rdbSaveObjectType(rio *rdb, robj *o) {
         else
             redisPanic("Unknown set encoding");
     case REDIS_ZSET:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET_ZIPLIST);
-        else if (o->encoding == REDIS_ENCODING_SKIPLIST)
+        if (o->encoding == REDIS_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET_LISTPACK);
+        else if (o->encoding == REDIS_ENCODING_SKIPLIST ||
+                 o->encoding == REDIS_ENCODING_BTREE)
             return rdbSaveType(rdb,REDIS_RDB_TYPE_ZSET);
         else
             redisPanic("Unknown sorted set encoding");
     case REDIS_HASH:
-        if (o->encoding == REDIS_ENCODING_ZIPLIST)
-            return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH_ZIPLIST);
+        if (o->encoding == REDIS_ENCODING_LISTPACK)
+            return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH_LISTPACK);
         else if (o->encoding == REDIS_ENCODING_HT)
             return rdbSaveType(rdb,REDIS_RDB_TYPE_HASH);
         else
@@ -511,7 +520,34 @@ int rdbLoadObjectType(rio *rdb) {
 int rdbSaveObject(rio *rdb, robj *o) {
     int n, nwritten = 0;
 
-    if (o->type == REDIS_STRING) {
+    if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_ROARING) {
+        /* Save a bitmap as its serialized containers */
+        //roaring位图序列化后作为一个字符串保存
+        size_t l = rbBlobLen(o->ptr);
+        unsigned char *blob = zmalloc(l);
+
+        rbSerialize(o->ptr,blob);
+        n = rdbSaveRawString(rdb,blob,l);
+        zfree(blob);
+        if (n == -1) return -1;
+        nwritten += n;
+    } else if (o->type == REDIS_STRING &&
+               o->encoding == REDIS_ENCODING_CHUNKED)
+    {
+        /* Save a chunked string verbatim, one segment at a time */
+        //分段字符串不压缩，逐段写入
+        chunkString *cs = o->ptr;
+        size_t off, l;
+
+        if ((n = rdbSaveLen(rdb,cs->len)) == -1) return -1;
+        nwritten += n;
+        for (off = 0; off < cs->len; off += l) {
+            unsigned char *p = (unsigned char*)csSegment(cs,off,&l);
+
+            if (rdbWriteRaw(rdb,p,l) == -1) return -1;
+            nwritten += l;
+        }
+    } else if (o->type == REDIS_STRING) {
         /* Save a string value */
         //如果是字符串的类型，则直接保存
         if ((n = rdbSaveStringObject(rdb,o)) == -1) return -1;
@@ -519,26 +555,31 @@ int rdbSaveObject(rio *rdb, robj *o) {
     } else if (o->type == REDIS_LIST) {
         /* Save a list value */
         //如果obj的类型为List列表类型，按照编码方式又分为2种，压缩表和普通链表
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 			
-			//压缩列表计算总长度把整个压缩字符串保存入RDB中
+			//紧凑列表计算总长度把整个字符串保存入RDB中
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
-        } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-            list *list = o->ptr;
-            listIter li;
-            listNode *ln;
+        } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = o->ptr;
+            quicklistNode *node = ql->head;
 
-            if ((n = rdbSaveLen(rdb,listLength(list))) == -1) return -1;
+            if ((n = rdbSaveLen(rdb,ql->len)) == -1) return -1;
             nwritten += n;
 
-            listRewind(list,&li);
-            while((ln = listNext(&li))) {
-                robj *eleobj = listNodeValue(ln);
-                //如果是普通链表，则获取一个结点，保存一个结点的值
-                if ((n = rdbSaveStringObject(rdb,eleobj)) == -1) return -1;
+            while(node) {
+                //如果是快速列表，则每个结点的ziplist整体作为一个字符串保存
+                if (quicklistNodeIsCompressed(node)) {
+                    /* Already compressed: write the LZF data as it is. */
+                    void *data;
+                    size_t compress_len = quicklistGetLzf(node,&data);
+                    if ((n = rdbSaveLzfBlob(rdb,data,compress_len,node->sz)) == -1) return -1;
+                } else {
+                    if ((n = rdbSaveRawString(rdb,node->zl,node->sz)) == -1) return -1;
+                }
                 nwritten += n;
+                node = node->next;
             }
         } else {
             redisPanic("Unknown list encoding");
@@ -569,8 +610,8 @@ int rdbSaveObject(rio *rdb, robj *o) {
         }
     } else if (o->type == REDIS_ZSET) {
         /* Save a sorted set value */
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -592,13 +633,32 @@ int rdbSaveObject(rio *rdb, robj *o) {
                 nwritten += n;
             }
             dictReleaseIterator(di);
+        } else if (o->encoding == REDIS_ENCODING_BTREE) {
+            zset *zs = o->ptr;
+            zbtreeIter it;
+            int valid;
+
+            if ((n = rdbSaveLen(rdb,zs->zbt->length)) == -1) return -1;
+            nwritten += n;
+
+            /* Same format of the skiplist encoding, but saved in order
+             * walking the leaves: loading appends every element to the
+             * last leaf, that yields completely filled leaves. */
+            valid = zbtFirst(zs->zbt,&it);
+            while(valid) {
+                if ((n = rdbSaveStringObject(rdb,zbtIterObj(&it))) == -1) return -1;
+                nwritten += n;
+                if ((n = rdbSaveDoubleValue(rdb,zbtIterScore(&it))) == -1) return -1;
+                nwritten += n;
+                valid = zbtNext(&it);
+            }
         } else {
             redisPanic("Unknown sorted set encoding");
         }
     } else if (o->type == REDIS_HASH) {
         /* Save a hash value */
-        if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-            size_t l = ziplistBlobLen((unsigned char*)o->ptr);
+        if (o->encoding == REDIS_ENCODING_LISTPACK) {
+            size_t l = lpBytes((unsigned char*)o->ptr);
 
             if ((n = rdbSaveRawString(rdb,o->ptr,l)) == -1) return -1;
             nwritten += n;
@@ -826,6 +886,30 @@ void rdbRemoveTempFile(pid_t childpid) {
 
 /* Load a Redis object of the specified type from the specified file.
  * On success a newly allocated object is returned, otherwise NULL. */
+/* Convert a ziplist blob found in an RDB file created by an older version
+ * into a listpack with the same elements. The ziplist is freed. */
+/* 将旧版本RDB中的ziplist转换为listpack，并释放ziplist */
+static unsigned char *rdbZiplistToListpack(unsigned char *zl) {
+    unsigned char *lp = lpNew();
+    unsigned char *p = ziplistIndex(zl,0);
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    char buf[32];
+
+    while (p != NULL && ziplistGet(p,&vstr,&vlen,&vlong)) {
+        if (vstr) {
+            lp = lpAppend(lp,vstr,vlen);
+        } else {
+            vlen = ll2string(buf,sizeof(buf),vlong);
+            lp = lpAppend(lp,(unsigned char*)buf,vlen);
+        }
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return lp;
+}
+
 /* 加载redis obj对象，有特定的Type类型 */
 robj *rdbLoadObject(int rdbtype, rio *rdb) {
     robj *o, *ele, *dec;
@@ -836,39 +920,72 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         /* Read string value */
         if ((o = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
         o = tryObjectEncoding(o);
+    } else if (rdbtype == REDIS_RDB_TYPE_STRING_ROARING) {
+        /* Read a bitmap, refusing corrupted containers */
+        roaringBitmap *rb;
+
+        if ((ele = rdbLoadStringObject(rdb)) == NULL) return NULL;
+        rb = rbDeserialize(ele->ptr,sdslen(ele->ptr));
+        decrRefCount(ele);
+        if (rb == NULL) {
+            redisLog(REDIS_WARNING,"Corrupted roaring bitmap in RDB file");
+            return NULL;
+        }
+        o = createStringRoaringObject(rb);
     } else if (rdbtype == REDIS_RDB_TYPE_LIST) {
     	///根据不同类型加载按照不同的方式加载
         /* Read list value */
         if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
 
-        /* Use a real list when there are too many entries */
+        /* Use a quicklist when there are too many entries */
         if (len > server.list_max_ziplist_entries) {
-            o = createListObject();
+            o = createQuicklistObject();
         } else {
-            o = createZiplistObject();
+            o = createListpackObject();
         }
 
         /* Load every single element of the list */
         while(len--) {
             if ((ele = rdbLoadEncodedStringObject(rdb)) == NULL) return NULL;
 
-            /* If we are using a ziplist and the value is too big, convert
-             * the object to a real list. */
-            if (o->encoding == REDIS_ENCODING_ZIPLIST &&
-                ele->encoding == REDIS_ENCODING_RAW &&
+            /* If we are using a listpack and the value is too big, convert
+             * the object to a quicklist. */
+            if (o->encoding == REDIS_ENCODING_LISTPACK &&
+                sdsEncodedObject(ele) &&
                 sdslen(ele->ptr) > server.list_max_ziplist_value)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+                    listTypeConvert(o,REDIS_ENCODING_QUICKLIST);
 
-            if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-                dec = getDecodedObject(ele);
+            dec = getDecodedObject(ele);
+            if (o->encoding == REDIS_ENCODING_LISTPACK) {
                 //最后都会通过吧值赋在obj->ptr上
-                o->ptr = ziplistPush(o->ptr,dec->ptr,sdslen(dec->ptr),REDIS_TAIL);
-                decrRefCount(dec);
-                decrRefCount(ele);
+                o->ptr = lpAppend(o->ptr,dec->ptr,sdslen(dec->ptr));
             } else {
-                ele = tryObjectEncoding(ele);
-                listAddNodeTail(o->ptr,ele);
+                quicklistPushTail(o->ptr,dec->ptr,sdslen(dec->ptr));
+            }
+            decrRefCount(dec);
+            decrRefCount(ele);
+        }
+    } else if (rdbtype == REDIS_RDB_TYPE_LIST_QUICKLIST) {
+        /* Read the quicklist nodes, every one is a ziplist saved as a
+         * string, that becomes a node again as it is. */
+        if ((len = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
+        o = createQuicklistObject();
+
+        while(len--) {
+            robj *aux = rdbLoadStringObject(rdb);
+            unsigned char *zl;
+
+            if (aux == NULL) return NULL;
+            zl = zmalloc(sdslen(aux->ptr));
+            memcpy(zl,aux->ptr,sdslen(aux->ptr));
+            decrRefCount(aux);
+
+            /* Empty nodes are never saved, skip them anyway. */
+            if (ziplistLen(zl) == 0) {
+                zfree(zl);
+                continue;
             }
+            quicklistAppendZiplist(o->ptr,zl);
         }
     } else if (rdbtype == REDIS_RDB_TYPE_SET) {
         /* Read list/set value */
@@ -917,7 +1034,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         zset *zs;
 
         if ((zsetlen = rdbLoadLen(rdb,NULL)) == REDIS_RDB_LENERR) return NULL;
-        o = createZsetObject();
+        if (zsetlen > server.zset_max_skiplist_entries)
+            o = createZsetBtreeObject();
+        else
+            o = createZsetObject();
         zs = o->ptr;
 
         /* Load every single element of the list/set */
@@ -931,19 +1051,28 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
             if (rdbLoadDoubleValue(rdb,&score) == -1) return NULL;
 
             /* Don't care about integer-encoded strings. */
-            if (ele->encoding == REDIS_ENCODING_RAW &&
+            if (sdsEncodedObject(ele) &&
                 sdslen(ele->ptr) > maxelelen)
                     maxelelen = sdslen(ele->ptr);
 
-            znode = zslInsert(zs->zsl,score,ele);
-            dictAdd(zs->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to skiplist */
+            if (o->encoding == REDIS_ENCODING_BTREE) {
+                dictEntry *de;
+
+                zbtInsert(zs->zbt,score,ele);
+                de = dictAddRaw(zs->dict,ele);
+                dictSetDoubleVal(de,score);
+                incrRefCount(ele); /* added to the tree */
+            } else {
+                znode = zslInsert(zs->zsl,score,ele);
+                dictAdd(zs->dict,ele,&znode->score);
+                incrRefCount(ele); /* added to skiplist */
+            }
         }
 
         /* Convert *after* loading, since sorted sets are not stored ordered. */
         if (zsetLength(o) <= server.zset_max_ziplist_entries &&
             maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(o,REDIS_ENCODING_ZIPLIST);
+                zsetConvert(o,REDIS_ENCODING_LISTPACK);
     } else if (rdbtype == REDIS_RDB_TYPE_HASH) {
         size_t len;
         int ret;
@@ -957,22 +1086,22 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
         if (len > server.hash_max_ziplist_entries)
             hashTypeConvert(o, REDIS_ENCODING_HT);
 
-        /* Load every field and value into the ziplist */
-        while (o->encoding == REDIS_ENCODING_ZIPLIST && len > 0) {
+        /* Load every field and value into the listpack */
+        while (o->encoding == REDIS_ENCODING_LISTPACK && len > 0) {
             robj *field, *value;
 
             len--;
             /* Load raw strings */
             field = rdbLoadStringObject(rdb);
             if (field == NULL) return NULL;
-            redisAssert(field->encoding == REDIS_ENCODING_RAW);
+            redisAssert(sdsEncodedObject(field));
             value = rdbLoadStringObject(rdb);
             if (value == NULL) return NULL;
-            redisAssert(field->encoding == REDIS_ENCODING_RAW);
+            redisAssert(sdsEncodedObject(field));
 
-            /* Add pair to ziplist */
-            o->ptr = ziplistPush(o->ptr, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-            o->ptr = ziplistPush(o->ptr, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+            /* Add pair to listpack */
+            o->ptr = lpAppend(o->ptr, field->ptr, sdslen(field->ptr));
+            o->ptr = lpAppend(o->ptr, value->ptr, sdslen(value->ptr));
             /* Convert to hash table if size threshold is exceeded */
             if (sdslen(field->ptr) > server.hash_max_ziplist_value ||
                 sdslen(value->ptr) > server.hash_max_ziplist_value)
@@ -1012,7 +1141,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST ||
                rdbtype == REDIS_RDB_TYPE_SET_INTSET   ||
                rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST ||
-               rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST)
+               rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST ||
+               rdbtype == REDIS_RDB_TYPE_LIST_LISTPACK ||
+               rdbtype == REDIS_RDB_TYPE_ZSET_LISTPACK ||
+               rdbtype == REDIS_RDB_TYPE_HASH_LISTPACK)
     {
         robj *aux = rdbLoadStringObject(rdb);
 
@@ -1030,10 +1162,10 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
          * converted. */
         switch(rdbtype) {
             case REDIS_RDB_TYPE_HASH_ZIPMAP:
-                /* Convert to ziplist encoded hash. This must be deprecated
+                /* Convert to listpack encoded hash. This must be deprecated
                  * when loading dumps created by Redis 2.4 gets deprecated. */
                 {
-                    unsigned char *zl = ziplistNew();
+                    unsigned char *lp = lpNew();
                     unsigned char *zi = zipmapRewind(o->ptr);
                     unsigned char *fstr, *vstr;
                     unsigned int flen, vlen;
@@ -1042,14 +1174,14 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     while ((zi = zipmapNext(zi, &fstr, &flen, &vstr, &vlen)) != NULL) {
                         if (flen > maxlen) maxlen = flen;
                         if (vlen > maxlen) maxlen = vlen;
-                        zl = ziplistPush(zl, fstr, flen, ZIPLIST_TAIL);
-                        zl = ziplistPush(zl, vstr, vlen, ZIPLIST_TAIL);
+                        lp = lpAppend(lp, fstr, flen);
+                        lp = lpAppend(lp, vstr, vlen);
                     }
 
                     zfree(o->ptr);
-                    o->ptr = zl;
+                    o->ptr = lp;
                     o->type = REDIS_HASH;
-                    o->encoding = REDIS_ENCODING_ZIPLIST;
+                    o->encoding = REDIS_ENCODING_LISTPACK;
 
                     if (hashTypeLength(o) > server.hash_max_ziplist_entries ||
                         maxlen > server.hash_max_ziplist_value)
@@ -1059,10 +1191,13 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                 }
                 break;
             case REDIS_RDB_TYPE_LIST_ZIPLIST:
+            case REDIS_RDB_TYPE_LIST_LISTPACK:
+                if (rdbtype == REDIS_RDB_TYPE_LIST_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
                 o->type = REDIS_LIST;
-                o->encoding = REDIS_ENCODING_ZIPLIST;
-                if (ziplistLen(o->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(o,REDIS_ENCODING_LINKEDLIST);
+                o->encoding = REDIS_ENCODING_LISTPACK;
+                if (lpLength(o->ptr) > server.list_max_ziplist_entries)
+                    listTypeConvert(o,REDIS_ENCODING_QUICKLIST);
                 break;
             case REDIS_RDB_TYPE_SET_INTSET:
                 o->type = REDIS_SET;
@@ -1071,14 +1206,22 @@ robj *rdbLoadObject(int rdbtype, rio *rdb) {
                     setTypeConvert(o,REDIS_ENCODING_HT);
                 break;
             case REDIS_RDB_TYPE_ZSET_ZIPLIST:
+            case REDIS_RDB_TYPE_ZSET_LISTPACK:
+                if (rdbtype == REDIS_RDB_TYPE_ZSET_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
                 o->type = REDIS_ZSET;
-                o->encoding = REDIS_ENCODING_ZIPLIST;
-                if (zsetLength(o) > server.zset_max_ziplist_entries)
+                o->encoding = REDIS_ENCODING_LISTPACK;
+                if (zsetLength(o) > server.zset_max_skiplist_entries)
+                    zsetConvert(o,REDIS_ENCODING_BTREE);
+                else if (zsetLength(o) > server.zset_max_ziplist_entries)
                     zsetConvert(o,REDIS_ENCODING_SKIPLIST);
                 break;
             case REDIS_RDB_TYPE_HASH_ZIPLIST:
+            case REDIS_RDB_TYPE_HASH_LISTPACK:
+                if (rdbtype == REDIS_RDB_TYPE_HASH_ZIPLIST)
+                    o->ptr = rdbZiplistToListpack(o->ptr);
                 o->type = REDIS_HASH;
-                o->encoding = REDIS_ENCODING_ZIPLIST;
+                o->encoding = REDIS_ENCODING_LISTPACK;
                 if (hashTypeLength(o) > server.hash_max_ziplist_entries)
                     hashTypeConvert(o, REDIS_ENCODING_HT);
                 break;
@@ -476,6 +476,13 @@ void syncCommand(redisClient *c) {
     /* ignore SYNC if already slave or in monitor mode */
     if (c->flags & REDIS_SLAVE) return;
 
+    /* The RDB payload is written to the socket directly, while the rest of
+     * the stream would go through the rings: refuse to mix them. */
+    if (c->flags & REDIS_SHMRING) {
+        addReplyError(c,"SYNC and PSYNC are not supported over SHMRING");
+        return;
+    }
+
     /* Refuse SYNC requests if we are a slave but the link with our master
      * is not ok... */
     /* 当没有连接到主数据库的时候，则拒绝同步请求 */
@@ -487,8 +494,11 @@ void syncCommand(redisClient *c) {
     /* SYNC can't be issued when the server has pending data to send to
      * the client about already issued commands. We need a fresh reply
      * buffer registering the differences between the BGSAVE and the current
-     * dataset, so that we can copy to other slaves if needed. */
-    if (listLength(c->reply) != 0 || c->bufpos != 0) {
+     * dataset, so that we can copy to other slaves if needed. A write still
+     * in flight with completion based I/O is pending output as well. */
+    if (listLength(c->reply) != 0 || c->bufpos != 0 ||
+        (aeIoPending(server.el,c->fd) & AE_IO_WRITE))
+    {
         addReplyError(c,"SYNC and PSYNC are invalid with pending output");
         return;
     }
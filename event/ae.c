@@ -30,6 +30,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "fmacros.h"
 #include <stdio.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -44,23 +45,44 @@
 #include "zmalloc.h"
 #include "config.h"
 
+/* Initial number of slots of the time events heap and id hash table. */
+#define AE_TIME_EVENTS_INITIAL_SIZE 16
+
 /* Include the best multiplexing layer supported by this system.
  * The following should be ordered by performances, descending. */
 /* 预处理判断是否买支持这几种事件 */
 #ifdef HAVE_EVPORT
 #include "ae_evport.c"
 #else
-    #ifdef HAVE_EPOLL
-    #include "ae_epoll.c"
+    #ifdef HAVE_IO_URING
+    #include "ae_iouring.c"
     #else
-        #ifdef HAVE_KQUEUE
-        #include "ae_kqueue.c"
+        #ifdef HAVE_EPOLL
+        #include "ae_epoll.c"
         #else
-        #include "ae_select.c"
+            #ifdef HAVE_KQUEUE
+            #include "ae_kqueue.c"
+            #else
+            #include "ae_select.c"
+            #endif
         #endif
     #endif
 #endif
 
+/* Multiplexing layers without completion based I/O never have anything to
+ * deliver. */
+#ifndef AE_API_IO
+static int aeApiIoCount(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    return 0;
+}
+
+static int aeApiIoProcess(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    return 0;
+}
+#endif
+
 /* 创建aeEventLoop，内部的fileEvent和Fired事件的个数为setSize个 */
 aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
@@ -73,11 +95,18 @@ aeEventLoop *aeCreateEventLoop(int setsize) {
     if (eventLoop->events == NULL || eventLoop->fired == NULL) goto err;
     eventLoop->setsize = setsize;
     eventLoop->lastTime = time(NULL);
-    eventLoop->timeEventHead = NULL;
+    //时间事件最小堆以及id哈希表的初始化
+    eventLoop->timeEventHeap = zmalloc(sizeof(aeTimeEvent*)*AE_TIME_EVENTS_INITIAL_SIZE);
+    eventLoop->timeEventHeapSize = 0;
+    eventLoop->timeEventHeapCap = AE_TIME_EVENTS_INITIAL_SIZE;
+    eventLoop->timeEventTable = zcalloc(sizeof(aeTimeEvent*)*AE_TIME_EVENTS_INITIAL_SIZE);
+    eventLoop->timeEventTableSize = AE_TIME_EVENTS_INITIAL_SIZE;
+    eventLoop->timeEventRunning = NULL;
     eventLoop->timeEventNextId = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
     eventLoop->beforesleep = NULL;
+    memset(&eventLoop->stats,0,sizeof(eventLoop->stats));
     if (aeApiCreate(eventLoop) == -1) goto err;
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
@@ -91,6 +120,8 @@ err:
     if (eventLoop) {
         zfree(eventLoop->events);
         zfree(eventLoop->fired);
+        zfree(eventLoop->timeEventHeap);
+        zfree(eventLoop->timeEventTable);
         zfree(eventLoop);
     }
     return NULL;
@@ -130,7 +161,13 @@ int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
 
 /* 删除EventLoop，释放相应的事件所占的空间 */
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    int j;
+
     aeApiFree(eventLoop);
+    for (j = 0; j < eventLoop->timeEventHeapSize; j++)
+        zfree(eventLoop->timeEventHeap[j]);
+    zfree(eventLoop->timeEventHeap);
+    zfree(eventLoop->timeEventTable);
     zfree(eventLoop->events);
     zfree(eventLoop->fired);
     zfree(eventLoop);
@@ -217,6 +254,142 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* ----------------------- Time events heap and id table ------------------
+ * Time events are kept in a binary min-heap ordered by fire time, so that
+ * the nearest timer is always eventLoop->timeEventHeap[0], and insertion or
+ * removal costs O(log(N)). Every event remembers its own position inside the
+ * heap (heapidx) so that it can be removed or rescheduled in place.
+ *
+ * Deleting a timer by id needs to find it first: a small chained hash table
+ * indexed by id is used for this. IDs are incremental, so using the low bits
+ * of the id as hash distributes them evenly in the buckets.
+ * ------------------------------------------------------------------------- */
+
+/* Return non zero if time event 'a' should fire before 'b'. */
+static int aeTimeEventBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    return a->when_sec < b->when_sec ||
+           (a->when_sec == b->when_sec && a->when_ms < b->when_ms);
+}
+
+/* Store 'te' at position 'idx' of the heap, updating its back reference. */
+static void aeTimeHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timeEventHeap[idx] = te;
+    te->heapidx = idx;
+}
+
+/* 将下标为idx的时间事件向堆顶方向上浮 */
+static void aeTimeHeapSiftUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timeEventHeap[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+        aeTimeEvent *p = eventLoop->timeEventHeap[parent];
+
+        if (!aeTimeEventBefore(te,p)) break;
+        aeTimeHeapSet(eventLoop,idx,p);
+        idx = parent;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+/* 将下标为idx的时间事件向堆底方向下沉 */
+static void aeTimeHeapSiftDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timeEventHeap[idx];
+    int size = eventLoop->timeEventHeapSize;
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= size) break;
+        if (child+1 < size &&
+            aeTimeEventBefore(eventLoop->timeEventHeap[child+1],
+                              eventLoop->timeEventHeap[child]))
+            child++;
+        if (!aeTimeEventBefore(eventLoop->timeEventHeap[child],te)) break;
+        aeTimeHeapSet(eventLoop,idx,eventLoop->timeEventHeap[child]);
+        idx = child;
+    }
+    aeTimeHeapSet(eventLoop,idx,te);
+}
+
+/* Restore the heap property after the fire time of the event at 'idx'
+ * was changed in either direction. */
+static void aeTimeHeapFix(aeEventLoop *eventLoop, int idx) {
+    if (idx > 0 && aeTimeEventBefore(eventLoop->timeEventHeap[idx],
+                       eventLoop->timeEventHeap[(idx-1)/2]))
+        aeTimeHeapSiftUp(eventLoop,idx);
+    else
+        aeTimeHeapSiftDown(eventLoop,idx);
+}
+
+/* 添加时间事件到最小堆中，空间不足时容量翻倍 */
+static void aeTimeHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timeEventHeapSize == eventLoop->timeEventHeapCap) {
+        eventLoop->timeEventHeapCap *= 2;
+        eventLoop->timeEventHeap = zrealloc(eventLoop->timeEventHeap,
+            sizeof(aeTimeEvent*)*eventLoop->timeEventHeapCap);
+    }
+    aeTimeHeapSet(eventLoop,eventLoop->timeEventHeapSize++,te);
+    aeTimeHeapSiftUp(eventLoop,te->heapidx);
+}
+
+/* 从最小堆中移除时间事件，用堆尾元素填补空位 */
+static void aeTimeHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapidx;
+    aeTimeEvent *last = eventLoop->timeEventHeap[--eventLoop->timeEventHeapSize];
+
+    te->heapidx = -1;
+    if (last == te) return;
+    aeTimeHeapSet(eventLoop,idx,last);
+    aeTimeHeapFix(eventLoop,idx);
+}
+
+/* Double the number of buckets of the id hash table and move every
+ * event into its new bucket. */
+static void aeTimeTableExpand(aeEventLoop *eventLoop) {
+    unsigned long newsize = eventLoop->timeEventTableSize*2, j;
+    aeTimeEvent **table = zcalloc(sizeof(aeTimeEvent*)*newsize);
+
+    for (j = 0; j < eventLoop->timeEventTableSize; j++) {
+        aeTimeEvent *te = eventLoop->timeEventTable[j];
+
+        while(te) {
+            aeTimeEvent *next = te->next;
+            unsigned long h = (unsigned long)te->id & (newsize-1);
+
+            te->next = table[h];
+            table[h] = te;
+            te = next;
+        }
+    }
+    zfree(eventLoop->timeEventTable);
+    eventLoop->timeEventTable = table;
+    eventLoop->timeEventTableSize = newsize;
+}
+
+/* 根据id在哈希表中查找时间事件，找到时如果unlink为真则将其从哈希表中摘除 */
+static aeTimeEvent *aeTimeTableFind(aeEventLoop *eventLoop, long long id,
+                                    int unlink)
+{
+    unsigned long h = (unsigned long)id & (eventLoop->timeEventTableSize-1);
+    aeTimeEvent *te = eventLoop->timeEventTable[h], *prev = NULL;
+
+    while(te) {
+        if (te->id == id) {
+            if (unlink) {
+                if (prev == NULL)
+                    eventLoop->timeEventTable[h] = te->next;
+                else
+                    prev->next = te->next;
+            }
+            return te;
+        }
+        prev = te;
+        te = te->next;
+    }
+    return NULL;
+}
+
 /* 在eventLoop中添加时间事件，创建的时间为当前时间加上自己传入的时间 */
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
@@ -224,6 +397,7 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
 {
     long long id = eventLoop->timeEventNextId++;
     aeTimeEvent *te;
+    unsigned long h;
 
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
@@ -232,36 +406,38 @@ long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    //新加的变为timeEvent的头部
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
-    
+    //放入最小堆中，最近要触发的事件位于堆顶
+    aeTimeHeapInsert(eventLoop,te);
+    //放入id哈希表中，保持负载因子不超过1
+    if ((unsigned long)eventLoop->timeEventHeapSize >
+        eventLoop->timeEventTableSize)
+        aeTimeTableExpand(eventLoop);
+    h = (unsigned long)id & (eventLoop->timeEventTableSize-1);
+    te->next = eventLoop->timeEventTable[h];
+    eventLoop->timeEventTable[h] = te;
+
     //返回新创建的时间事件的id
     return id;
 }
 
-//根据时间id，删除时间事件，涉及链表的操作
+/* Delete the time event with the specified id. This is O(log(N)): the event
+ * is found via the id hash table and removed from the heap in place.
+ *
+ * A time event handler is allowed to delete the event it is serving: in
+ * that case the memory is released by processTimeEvents() once the handler
+ * returns. */
+//根据时间id，删除时间事件，在id哈希表中查找并从最小堆中移除
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
-
-    te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-            	//被删除的时候将会调用此方法
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            return AE_OK;
-        }
-        prev = te;
-        te = te->next;
-    }
-    return AE_ERR; /* NO event with the specified ID found */
+    aeTimeEvent *te = aeTimeTableFind(eventLoop,id,1);
+
+    if (te == NULL) return AE_ERR; /* NO event with the specified ID found */
+    aeTimeHeapRemove(eventLoop,te);
+    if (te->finalizerProc)
+        //被删除的时候将会调用此方法
+        te->finalizerProc(eventLoop, te->clientData);
+    if (te != eventLoop->timeEventRunning) zfree(te);
+    return AE_OK;
 }
 
 /* Search the first timer to fire.
@@ -269,32 +445,19 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
-/* 搜索出最近的Timer时间事件 */
+ * Since time events are kept in a min-heap this is O(1): the nearest timer
+ * is always at the root of the heap. */
+/* 搜索出最近的Timer时间事件，即最小堆的堆顶 */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    if (eventLoop->timeEventHeapSize == 0) return NULL;
+    return eventLoop->timeEventHeap[0];
 }
 
 /* Process time events */
 /* 处理时间事件 */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
+    int processed = 0, budget, j;
     aeTimeEvent *te;
     long long maxId;
     time_t now = time(NULL);
@@ -306,64 +469,128 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
      * Here we try to detect system clock skews, and force all the time
      * events to be processed ASAP when this happens: the idea is that
      * processing events earlier is less dangerous than delaying them
-     * indefinitely, and practice suggests it is. */
+     * indefinitely, and practice suggests it is.
+     *
+     * Setting every fire time to the same value keeps the heap valid. */
     //如果系统当前时间和eventLoop中设置的时间不对，则重新重新设置
     if (now < eventLoop->lastTime) {
-        te = eventLoop->timeEventHead;
-        while(te) {
+        for (j = 0; j < eventLoop->timeEventHeapSize; j++) {
+            te = eventLoop->timeEventHeap[j];
             te->when_sec = 0;
-            te = te->next;
+            te->when_ms = 0;
         }
     }
     eventLoop->lastTime = now;
 
-    te = eventLoop->timeEventHead;
+    /* Pop due events from the root of the heap. We make sure to don't
+     * process events registered by event handlers itself in order to don't
+     * loop forever: to do so we saved the max ID we want to handle, and an
+     * event created by a handler reaching the root just ends this run (it
+     * is due, so the next poll will not block). The budget guards against
+     * handlers rescheduling themselves with a zero period. */
     maxId = eventLoop->timeEventNextId-1;
-    while(te) {
+    budget = eventLoop->timeEventHeapSize;
+    while(budget-- && eventLoop->timeEventHeapSize) {
         long now_sec, now_ms;
         long long id;
+        int retval;
 
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
+        te = eventLoop->timeEventHeap[0];
+        if (te->id > maxId) break;
         aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            //执行时间函数
-            retval = te->timeProc(eventLoop, id, te->clientData);
-            processed++;
-            /* After an event is processed our time event list may
-             * no longer be the same, so we restart from head.
-             * Still we make sure to don't process events registered
-             * by event handlers itself in order to don't loop forever.
-             * To do so we saved the max ID we want to handle.
-             *
-             * FUTURE OPTIMIZATIONS:
-             * Note that this is NOT great algorithmically. Redis uses
-             * a single time event so it's not a problem but the right
-             * way to do this is to add the new elements on head, and
-             * to flag deleted elements in a special way for later
-             * deletion (putting references to the nodes to delete into
-             * another linked list). */
-            if (retval != AE_NOMORE) {
-                aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-            	//处理之后，删除此时间事件
-                aeDeleteTimeEvent(eventLoop, id);
-            }
-            te = eventLoop->timeEventHead;
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+
+        id = te->id;
+        //执行时间函数
+        eventLoop->timeEventRunning = te;
+        retval = te->timeProc(eventLoop, id, te->clientData);
+        eventLoop->timeEventRunning = NULL;
+        processed++;
+        if (te->heapidx == -1) {
+            /* The handler deleted its own time event. */
+            zfree(te);
+        } else if (retval != AE_NOMORE) {
+            aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
+            aeTimeHeapFix(eventLoop,te->heapidx);
         } else {
-            te = te->next;
+            //处理之后，删除此时间事件
+            aeDeleteTimeEvent(eventLoop, id);
         }
     }
     return processed;
 }
 
+/* ------------------------- Self instrumentation -------------------------- */
+
+/* 获取当前的微秒时间 */
+static long long aeUstime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Return the bucket holding 'value': the exponent selects the power of two
+ * interval, the AE_HIST_SUB_BITS bits after the most significant one select
+ * the linear sub bucket. */
+/* 计算值所在的桶的下标 */
+static int aeHistogramBucket(unsigned long long value) {
+    int msb = 0, exp;
+    unsigned long long v = value;
+
+    if (value < AE_HIST_SUB_BUCKETS) return (int)value;
+    while (v >>= 1) msb++;
+    exp = msb-AE_HIST_SUB_BITS+1;
+    if (exp >= AE_HIST_EXPONENTS) return AE_HIST_BUCKETS-1;
+    return exp*AE_HIST_SUB_BUCKETS +
+           (int)((value >> (msb-AE_HIST_SUB_BITS)) & (AE_HIST_SUB_BUCKETS-1));
+}
+
+/* Return the highest value that falls into bucket 'idx'. */
+/* 获取桶中能保存的最大值 */
+static unsigned long long aeHistogramBucketMax(int idx) {
+    int exp = idx / AE_HIST_SUB_BUCKETS, sub = idx % AE_HIST_SUB_BUCKETS;
+    unsigned long long width;
+
+    if (exp == 0) return sub;
+    width = 1ULL << (exp-1);
+    return ((unsigned long long)(AE_HIST_SUB_BUCKETS+sub) << (exp-1))+width-1;
+}
+
+/* 在直方图中记录一个值 */
+void aeHistogramRecord(aeHistogram *h, unsigned long long value) {
+    h->buckets[aeHistogramBucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max) h->max = value;
+}
+
+/* Return the value below which 'perc' percent of the recorded values
+ * fall. The result is the upper bound of the bucket, so it is never
+ * smaller than the real percentile, and never larger than the max. */
+/* 获取直方图的百分位数 */
+unsigned long long aeHistogramPercentile(aeHistogram *h, double perc) {
+    unsigned long long target, seen = 0, v;
+    int j;
+
+    if (h->count == 0) return 0;
+    target = (unsigned long long)((perc/100)*h->count+0.5);
+    if (target == 0) target = 1;
+    for (j = 0; j < AE_HIST_BUCKETS; j++) {
+        seen += h->buckets[j];
+        if (seen >= target) break;
+    }
+    if (j == AE_HIST_BUCKETS) return h->max;
+    v = aeHistogramBucketMax(j);
+    return v > h->max ? h->max : v;
+}
+
+/* 清空事件循环的耗时统计 */
+void aeResetStats(aeEventLoop *eventLoop) {
+    memset(&eventLoop->stats,0,sizeof(eventLoop->stats));
+}
+
 /* Process every pending time event, then every pending file event
  * (that may be registered by time event callbacks just processed).
  * Without special flags the function sleeps until some file event
@@ -381,6 +608,8 @@ static int processTimeEvents(aeEventLoop *eventLoop) {
 int aeProcessEvents(aeEventLoop *eventLoop, int flags)
 {
     int processed = 0, numevents;
+    aeLoopStats *stats = &eventLoop->stats;
+    long long start, now;
 
     /* Nothing to do? return ASAP */
     if (!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)) return 0;
@@ -388,8 +617,9 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
     /* Note that we want call select() even if there are no
      * file events to process as long as we want to process time
      * events, in order to sleep until the next time event is ready
-     * to fire. */
-    if (eventLoop->maxfd != -1 ||
+     * to fire. Requests submitted with aeIoSubmitRead() and friends
+     * are waited for like file events. */
+    if (eventLoop->maxfd != -1 || aeApiIoCount(eventLoop) ||
         ((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT))) {
         int j;
         aeTimeEvent *shortest = NULL;
@@ -426,7 +656,19 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
         }
 
+        start = aeUstime();
         numevents = aeApiPoll(eventLoop, tvp);
+        now = aeUstime();
+        stats->last_poll = now-start;
+        stats->last_poll_overrun = 0;
+        if (tvp) {
+            long long timeout = (long long)tvp->tv_sec*1000000+tvp->tv_usec;
+            if (stats->last_poll > timeout)
+                stats->last_poll_overrun = stats->last_poll-timeout;
+        }
+        aeHistogramRecord(&stats->poll,stats->last_poll);
+
+        start = now;
         for (j = 0; j < numevents; j++) {
             aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
             int mask = eventLoop->fired[j].mask;
@@ -447,10 +689,24 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags)
             }
             processed++;
         }
+        /* Then the completions of the reads and writes submitted with
+         * aeIoSubmitRead() and aeIoSubmitWritev(). */
+        processed += aeApiIoProcess(eventLoop);
+        stats->last_file = aeUstime()-start;
+        aeHistogramRecord(&stats->file,stats->last_file);
+    } else {
+        stats->last_poll = stats->last_poll_overrun = stats->last_file = 0;
     }
     /* Check time events */
-    if (flags & AE_TIME_EVENTS)
+    stats->last_time = 0;
+    if (flags & AE_TIME_EVENTS) {
+        start = aeUstime();
         processed += processTimeEvents(eventLoop);
+        stats->last_time = aeUstime()-start;
+        aeHistogramRecord(&stats->time,stats->last_time);
+    }
+    stats->iterations++;
+    aeHistogramRecord(&stats->events,processed);
 
     return processed; /* return the number of processed file/time events */
 }
@@ -484,8 +740,14 @@ void aeMain(aeEventLoop *eventLoop) {
     //如果eventLoop中的stop标志位不为1，就循环处理
     while (!eventLoop->stop) {
     	//每次eventLoop事件执行完后又重新开始执行时调用
-        if (eventLoop->beforesleep != NULL)
+        if (eventLoop->beforesleep != NULL) {
+            long long start = aeUstime();
+
             eventLoop->beforesleep(eventLoop);
+            eventLoop->stats.last_beforesleep = aeUstime()-start;
+            aeHistogramRecord(&eventLoop->stats.beforesleep,
+                eventLoop->stats.last_beforesleep);
+        }
         //while循环处理所有的evetLoop的事件
         aeProcessEvents(eventLoop, AE_ALL_EVENTS);
     }
@@ -495,7 +757,173 @@ char *aeGetApiName(void) {
     return aeApiName();
 }
 
+/* Completion based I/O: instead of being notified that 'fd' is readable or
+ * writable and doing the system call itself, the caller submits the read
+ * or the write and 'proc' is called from aeProcessEvents() once the kernel
+ * completed it, with 'res' set to the number of bytes transferred or to
+ * -errno. For reads 'buf' points to the data, owned by the event loop and
+ * only valid during the callback; a read of zero bytes means EOF.
+ *
+ * At most one read and one write can be in flight for every fd. The data
+ * of a write is copied, up to AE_IO_WRITE_MAX bytes: the return value is
+ * the number of bytes taken, and short writes are completed internally so
+ * 'proc' reports either all of them as written or an error.
+ *
+ * aeIoCancel() must be called before closing the fd: after it returns the
+ * callbacks of the cancelled requests are never called. */
+/* 基于完成通知的读写，由内核完成读写后在aeProcessEvents()中回调proc */
+#ifdef AE_API_IO
+int aeIoSupported(aeEventLoop *eventLoop) {
+    return aeApiIoSupported(eventLoop);
+}
+
+int aeIoSubmitRead(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData)
+{
+    if (fd < 0 || fd >= eventLoop->setsize || len == 0 ||
+        len > AE_IO_READ_MAX)
+    {
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    return aeApiIoSubmitRead(eventLoop,fd,len,proc,clientData);
+}
+
+ssize_t aeIoSubmitWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov,
+        int iovcnt, aeIoProc *proc, void *clientData)
+{
+    if (fd < 0 || fd >= eventLoop->setsize) {
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    return aeApiIoSubmitWritev(eventLoop,fd,iov,iovcnt,proc,clientData);
+}
+
+void aeIoCancel(aeEventLoop *eventLoop, int fd) {
+    if (fd >= 0 && fd < eventLoop->setsize) aeApiIoCancel(eventLoop,fd);
+}
+
+int aeIoPending(aeEventLoop *eventLoop, int fd) {
+    if (fd < 0 || fd >= eventLoop->setsize) return 0;
+    return aeApiIoPending(eventLoop,fd);
+}
+#else
+int aeIoSupported(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    return 0;
+}
+
+int aeIoSubmitRead(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData)
+{
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(len);
+    AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    errno = ENOTSUP;
+    return AE_ERR;
+}
+
+ssize_t aeIoSubmitWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov,
+        int iovcnt, aeIoProc *proc, void *clientData)
+{
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd); AE_NOTUSED(iov);
+    AE_NOTUSED(iovcnt); AE_NOTUSED(proc); AE_NOTUSED(clientData);
+    errno = ENOTSUP;
+    return AE_ERR;
+}
+
+void aeIoCancel(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd);
+}
+
+int aeIoPending(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop); AE_NOTUSED(fd);
+    return 0;
+}
+#endif
+
 /* 每次eventLoop事件执行完后又重新开始执行时调用 */
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
     eventLoop->beforesleep = beforesleep;
 }
+
+/* 时间事件的微基准测试程序，统计不同定时器数量下每次事件循环的开销 */
+#ifdef AE_TIMER_BENCHMARK_MAIN
+/* Build with:
+ *   cc -DAE_TIMER_BENCHMARK_MAIN -I../data -I../wrapper \
+ *      ae.c ../wrapper/zmalloc.c -o ae-timer-benchmark */
+#define AE_BENCH_ITERATIONS 100000
+
+static long long benchIterations;
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Handler of a pipe that is never drained: it makes every aeProcessEvents()
+ * call return without sleeping, so that we measure just the loop overhead. */
+static void benchReadableProc(aeEventLoop *eventLoop, int fd, void *clientData,
+                              int mask)
+{
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(fd);
+    AE_NOTUSED(clientData);
+    AE_NOTUSED(mask);
+    benchIterations++;
+}
+
+/* Idle timers, think per-client deadlines that are far in the future. */
+static int benchIdleProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(clientData);
+    return 3600*1000;
+}
+
+static void benchTimers(int numtimers) {
+    aeEventLoop *el = aeCreateEventLoop(64);
+    long long *ids = zmalloc(sizeof(long long)*numtimers);
+    long long start, loop_us, create_us, delete_us;
+    int j, fds[2];
+
+    start = usec();
+    for (j = 0; j < numtimers; j++)
+        ids[j] = aeCreateTimeEvent(el,1000+(j%3600)*1000,benchIdleProc,
+                                   NULL,NULL);
+    create_us = usec()-start;
+
+    if (pipe(fds) == -1 || write(fds[1],"x",1) != 1) {
+        perror("pipe");
+        exit(1);
+    }
+    aeCreateFileEvent(el,fds[0],AE_READABLE,benchReadableProc,NULL);
+    benchIterations = 0;
+    start = usec();
+    while(benchIterations < AE_BENCH_ITERATIONS)
+        aeProcessEvents(el,AE_ALL_EVENTS);
+    loop_us = usec()-start;
+
+    start = usec();
+    for (j = 0; j < numtimers; j++) aeDeleteTimeEvent(el,ids[j]);
+    delete_us = usec()-start;
+
+    printf("Timers: %8d, %dx loop iterations: %8lld usec (%.3f usec/iter), "
+           "create: %.3f usec/op, delete: %.3f usec/op\n",
+        numtimers, AE_BENCH_ITERATIONS, loop_us,
+        (double)loop_us/AE_BENCH_ITERATIONS,
+        (double)create_us/numtimers, (double)delete_us/numtimers);
+    zfree(ids);
+    aeDeleteFileEvent(el,fds[0],AE_READABLE);
+    close(fds[0]);
+    close(fds[1]);
+    aeDeleteEventLoop(el);
+}
+
+int main(void) {
+    benchTimers(10);
+    benchTimers(1000);
+    benchTimers(100000);
+    return 0;
+}
+#endif
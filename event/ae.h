@@ -52,6 +52,7 @@
 #define AE_NOTUSED(V) ((void) V)
 
 struct aeEventLoop;
+struct iovec;
 
 /* Types and data structures */
 /* 定义了一些方法 */
@@ -59,6 +60,15 @@ typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData,
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
 typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+typedef void aeIoProc(struct aeEventLoop *eventLoop, int fd, void *clientData, char *buf, int res);
+
+/* Completion based I/O, see aeIoSubmitRead(). Only some multiplexing layers
+ * support it, check with aeIoSupported(). */
+/* 基于完成通知的读写，只有部分多路复用层支持 */
+#define AE_IO_READ 1
+#define AE_IO_WRITE 2
+#define AE_IO_READ_MAX (1024*16)  /* Max len of a single aeIoSubmitRead() */
+#define AE_IO_WRITE_MAX (1024*64) /* Max bytes a single write takes */
 
 /* File event structure */
 /* 文件事件结构体 */
@@ -88,8 +98,10 @@ typedef struct aeTimeEvent {
     aeEventFinalizerProc *finalizerProc;
     //客户端数据
     void *clientData;
-    //时间结构体内的下一个结构体
-    struct aeTimeEvent *next;
+    //在时间事件最小堆中的下标，-1表示已经从堆中移除
+    int heapidx; /* index inside eventLoop->timeEventHeap, -1 if removed. */
+    //id哈希表中同一个桶内的下一个时间事件
+    struct aeTimeEvent *next; /* next event in the same id hash bucket. */
 } aeTimeEvent;
 
 /* A fired event */
@@ -100,6 +112,40 @@ typedef struct aeFiredEvent {
     int mask;
 } aeFiredEvent;
 
+/* Log-linear latency histogram (HDR style): values below 16 get a bucket
+ * each, then every power of two is split in 16 linear sub buckets, so any
+ * recorded value is known with a relative error below 1/16. Values are in
+ * microseconds (or events, for the events per iteration histogram). */
+/* 对数线性的直方图，每个2的幂区间再平分为16个子桶 */
+#define AE_HIST_SUB_BITS 4
+#define AE_HIST_SUB_BUCKETS (1<<AE_HIST_SUB_BITS)
+#define AE_HIST_EXPONENTS 33 /* Up to 2^36-1 usec, about 19 hours. */
+#define AE_HIST_BUCKETS (AE_HIST_EXPONENTS*AE_HIST_SUB_BUCKETS)
+
+typedef struct aeHistogram {
+    unsigned long long count;   /* Number of recorded values */
+    unsigned long long sum;     /* Sum of the recorded values */
+    unsigned long long max;     /* Max recorded value */
+    unsigned long long buckets[AE_HIST_BUCKETS];
+} aeHistogram;
+
+/* Event loop self instrumentation, updated at every iteration. */
+/* 事件循环每次迭代的耗时统计 */
+typedef struct aeLoopStats {
+    long long iterations;       /* Number of aeProcessEvents() calls */
+    aeHistogram poll;           /* Time blocked in aeApiPoll() */
+    aeHistogram file;           /* Time spent in file event handlers */
+    aeHistogram time;           /* Time spent in time event handlers */
+    aeHistogram beforesleep;    /* Time spent in the beforesleep callback */
+    aeHistogram events;         /* File + time events per iteration */
+    /* Samples of the latest iteration, in microseconds. */
+    long long last_poll;
+    long long last_poll_overrun; /* Poll time exceeding the timeout asked */
+    long long last_file;
+    long long last_time;
+    long long last_beforesleep;
+} aeLoopStats;
+
 /* State of an event based program */
 typedef struct aeEventLoop {
 	//目前创建的最高的文件描述符
@@ -111,12 +157,21 @@ typedef struct aeEventLoop {
     //3种事件类型
     aeFileEvent *events; /* Registered events */
     aeFiredEvent *fired; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    //时间事件按照触发时间组织成二叉最小堆，堆顶就是最近要触发的事件
+    aeTimeEvent **timeEventHeap; /* Binary min-heap ordered by fire time */
+    int timeEventHeapSize;       /* Number of time events in the heap */
+    int timeEventHeapCap;        /* Allocated slots in timeEventHeap */
+    //根据id查找时间事件的哈希表，用于删除操作
+    aeTimeEvent **timeEventTable; /* id -> event hash table (chained) */
+    unsigned long timeEventTableSize; /* Buckets in timeEventTable, power of 2 */
+    aeTimeEvent *timeEventRunning; /* Time event whose timeProc is running */
     //事件停止标志符
     int stop;
     //这里存放的是event API的数据，包括epoll，select等事件
     void *apidata; /* This is used for polling API specific data */
     aeBeforeSleepProc *beforesleep;
+    //事件循环自身的耗时统计
+    aeLoopStats stats; /* Per iteration timing histograms */
 } aeEventLoop;
 
 /*
@@ -161,7 +216,7 @@ int aeGetFileEvents(aeEventLoop *eventLoop, int fd); //根据文件描述符id
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc); /* 在eventLoop中添加时间事件，创建的时间为当前时间加上自己传入的时间 */
-int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id); //根据时间id，删除时间事件，涉及链表的操作
+int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id); //根据时间id，删除时间事件，在id哈希表中查找并从最小堆中移除
 int aeProcessEvents(aeEventLoop *eventLoop, int flags); /* 处理eventLoop中的所有类型事件 */
 int aeWait(int fd, int mask, long long milliseconds); /* 让某事件等待 */
 void aeMain(aeEventLoop *eventLoop); /* ae事件执行主程序 */
@@ -169,5 +224,15 @@ char *aeGetApiName(void);
 void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep); /* 每次eventLoop事件执行完后又重新开始执行时调用 */
 int aeGetSetSize(aeEventLoop *eventLoop); /* 获取eventLoop的大小 */
 int aeResizeSetSize(aeEventLoop *eventLoop, int setsize); /* EventLoop重新调整大小 */
+void aeResetStats(aeEventLoop *eventLoop); /* 清空事件循环的耗时统计 */
+void aeHistogramRecord(aeHistogram *h, unsigned long long value); /* 在直方图中记录一个值 */
+unsigned long long aeHistogramPercentile(aeHistogram *h, double perc); /* 获取直方图的百分位数 */
+int aeIoSupported(aeEventLoop *eventLoop); /* 多路复用层是否支持基于完成通知的读写 */
+int aeIoSubmitRead(aeEventLoop *eventLoop, int fd, size_t len,
+        aeIoProc *proc, void *clientData); /* 提交一个读请求，完成后回调proc */
+ssize_t aeIoSubmitWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov,
+        int iovcnt, aeIoProc *proc, void *clientData); /* 复制数据并提交一个写请求 */
+void aeIoCancel(aeEventLoop *eventLoop, int fd); /* 取消fd上所有未完成的读写请求 */
+int aeIoPending(aeEventLoop *eventLoop, int fd); /* 返回fd上未完成请求的AE_IO_*掩码 */
 
 #endif
@@ -0,0 +1,980 @@
+/* Linux io_uring(7) based ae.c module, with epoll(2) as runtime fallback.
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* With epoll every change of interest (for instance installing and then
+ * removing the write handler of a client for every reply) costs an
+ * epoll_ctl() system call, plus one epoll_wait() per iteration.
+ *
+ * This module uses one-shot IORING_OP_POLL_ADD requests instead: arming,
+ * re-arming and cancelling polls just queues SQEs in the shared submission
+ * ring, and all of them are submitted with the same io_uring_enter() call
+ * that waits for completions. So every loop iteration costs a single system
+ * call regardless of the number of registered or modified file events.
+ *
+ * Polls are re-armed after they fire, so the semantic is level triggered
+ * exactly like our epoll usage. Every fd has a generation number encoded in
+ * the request user_data, so completions of polls that were cancelled or that
+ * belong to a previous user of the same fd number are just ignored.
+ *
+ * On top of that the module implements the completion based API of ae.c
+ * (aeIoSubmitRead() and friends): reads are IORING_OP_RECV requests that
+ * take their buffer from a pool registered with the kernel, so nothing is
+ * reserved for idle connections, and writes are IORING_OP_SEND requests
+ * on a private copy of the data. Their completions are collected by
+ * aeApiPoll() and delivered by aeApiIoProcess() after the file events.
+ *
+ * The ring is created by aeApiCreate(): when the kernel lacks io_uring (or
+ * the setup fails, for instance because of seccomp filters) the epoll
+ * implementation below is used instead, for that event loop. */
+
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+
+/* Pull the epoll module in with its symbols renamed, it's our fallback. */
+#define aeApiState aeEpollApiState
+#define aeApiCreate aeEpollApiCreate
+#define aeApiResize aeEpollApiResize
+#define aeApiFree aeEpollApiFree
+#define aeApiAddEvent aeEpollApiAddEvent
+#define aeApiDelEvent aeEpollApiDelEvent
+#define aeApiPoll aeEpollApiPoll
+#define aeApiName aeEpollApiName
+#include "ae_epoll.c"
+#undef aeApiState
+#undef aeApiCreate
+#undef aeApiResize
+#undef aeApiFree
+#undef aeApiAddEvent
+#undef aeApiDelEvent
+#undef aeApiPoll
+#undef aeApiName
+
+#define AE_API_IO 1 /* We implement the aeIo*() calls, see ae.c. */
+
+#define AE_URING_MAX_ENTRIES 32768 /* Kernel limit for the SQ ring size. */
+#define AE_URING_SQE_RETRIES 4     /* Attempts to make room in a full SQ. */
+
+/* The two high bits of user_data tell what a completion belongs to: polls
+ * have the fd generation (30 bits) and the fd, I/O requests the address
+ * of their aeUringIo, internal requests a constant. */
+#define AE_URING_UDATA_KIND(d) ((d) >> 62)
+#define AE_URING_KIND_POLL 0
+#define AE_URING_KIND_IO 1
+#define AE_URING_KIND_INTERNAL 3
+#define AE_URING_UDATA_TIMEOUT ((3ULL<<62)|1) /* user_data of timeouts. */
+#define AE_URING_UDATA_REMOVE ((3ULL<<62)|2)  /* user_data of poll removes. */
+#define AE_URING_UDATA_CANCEL ((3ULL<<62)|3)  /* user_data of I/O cancels. */
+#define AE_URING_GEN_MASK 0x3fffffff
+
+/* Pool of read buffers, handed to the kernel with a provided buffer ring:
+ * a read takes one only when data arrives. */
+#define AE_URING_BGID 1           /* Buffer group id of the pool. */
+#define AE_URING_RBUF_COUNT 256   /* Must be a power of two. */
+#define AE_URING_RBUF_SIZE AE_IO_READ_MAX
+
+/* A read or write submitted with the aeIo*() API. */
+typedef struct aeUringIo {
+    int fd;
+    int type;               /* AE_IO_READ or AE_IO_WRITE. */
+    int cancelled;          /* aeIoCancel() was called, drop the result. */
+    int completed;          /* The kernel is done with the request. */
+    int deferred;           /* In the deferred cancellations list. */
+    aeIoProc *proc;
+    void *clientData;
+    size_t len;             /* Bytes to read, or bytes in buf to write. */
+    size_t sent;            /* Bytes of buf already written. */
+    char buf[];             /* Private copy of the data to write. */
+} aeUringIo;
+
+/* A completed request, waiting to be delivered by aeApiIoProcess(). */
+typedef struct aeUringDone {
+    aeUringIo *io;
+    int res;
+    int bid;                /* Pool buffer holding the data read, or -1. */
+} aeUringDone;
+
+typedef struct aeApiState {
+    int ringfd;
+    unsigned features;      /* IORING_FEAT_* of the ring. */
+    /* Submission queue ring. */
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_pending;    /* SQEs queued but not yet submitted. */
+    /* Completion queue ring. */
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    /* Mappings, to release them in aeApiFree(). */
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_len, cq_ring_len, sqes_len;
+    /* Per fd state. */
+    int *armed;             /* AE_* mask of the poll armed in the kernel. */
+    uint32_t *gen;          /* Generation of the current poll request. */
+    aeUringIo **rio, **wio; /* Read and write requests in flight. */
+    /* Fds to re-arm at the next aeApiPoll() call: the ones that fired, and
+     * the ones we failed to arm because the SQ was full. */
+    int *rearm;
+    int rearm_count, rearm_size;
+    /* Completions reaped from the CQ but not yet handled. */
+    struct io_uring_cqe *stash;
+    int stash_count, stash_next, stash_size;
+    /* Cancellations that didn't find room in the SQ, user_data of the
+     * request to cancel. */
+    uint64_t *cancels;
+    int cancels_count, cancels_size;
+    /* Completion based I/O. */
+    int io_supported;       /* -1 if not yet probed, otherwise 0 or 1. */
+    struct io_uring_buf_ring *br;
+    unsigned short br_tail;
+    char *rbufs;            /* AE_URING_RBUF_COUNT buffers of the pool. */
+    aeUringDone *done;
+    int done_count, done_next, done_size;
+    aeUringIo **retry;      /* Reads that found the pool empty. */
+    int retry_count, retry_size;
+    int io_count;           /* Requests allocated and not yet released. */
+    struct __kernel_timespec ts; /* Must be valid until the SQE is consumed. */
+    /* The epoll state, if the ring couldn't be created for this loop. */
+    aeEpollApiState *epoll;
+} aeApiState;
+
+/* -1 if not yet probed, otherwise 1 when the first event loop created got
+ * a ring, 0 for epoll. When io_uring is not available at all we don't try
+ * again for later loops, and aeApiName() reports the first choice. */
+static int aeUringEnabled = -1;
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                        unsigned flags)
+{
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                         flags, NULL, 0);
+}
+
+static int aeUringRegister(int fd, unsigned opcode, void *arg, unsigned nargs) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+/* Make room for 'n' more elements in one of our dynamic arrays. */
+static void *aeUringGrow(void *array, int count, int n, int *size,
+                         size_t elemsize)
+{
+    if (count + n <= *size) return array;
+    if (*size == 0) *size = 16;
+    while (count + n > *size) *size *= 2;
+    return zrealloc(array,(size_t)*size*elemsize);
+}
+
+/* Map the rings of a freshly created io_uring instance. */
+static int aeUringMapRings(aeApiState *state, struct io_uring_params *p) {
+    state->sq_ring_len = p->sq_off.array + p->sq_entries*sizeof(unsigned);
+    state->cq_ring_len = p->cq_off.cqes +
+                         p->cq_entries*sizeof(struct io_uring_cqe);
+    state->sqes_len = p->sq_entries*sizeof(struct io_uring_sqe);
+
+    state->sq_ring = mmap(NULL,state->sq_ring_len,PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE,state->ringfd,
+                          IORING_OFF_SQ_RING);
+    if (state->sq_ring == MAP_FAILED) return -1;
+    state->cq_ring = mmap(NULL,state->cq_ring_len,PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE,state->ringfd,
+                          IORING_OFF_CQ_RING);
+    if (state->cq_ring == MAP_FAILED) goto err_cq;
+    state->sqes = mmap(NULL,state->sqes_len,PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE,state->ringfd,IORING_OFF_SQES);
+    if (state->sqes == MAP_FAILED) goto err_sqes;
+
+    state->sq_head = (unsigned*)((char*)state->sq_ring+p->sq_off.head);
+    state->sq_tail = (unsigned*)((char*)state->sq_ring+p->sq_off.tail);
+    state->sq_mask = (unsigned*)((char*)state->sq_ring+p->sq_off.ring_mask);
+    state->sq_array = (unsigned*)((char*)state->sq_ring+p->sq_off.array);
+    state->sq_entries = p->sq_entries;
+    state->cq_head = (unsigned*)((char*)state->cq_ring+p->cq_off.head);
+    state->cq_tail = (unsigned*)((char*)state->cq_ring+p->cq_off.tail);
+    state->cq_mask = (unsigned*)((char*)state->cq_ring+p->cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)((char*)state->cq_ring+p->cq_off.cqes);
+    return 0;
+
+err_sqes:
+    munmap(state->cq_ring,state->cq_ring_len);
+err_cq:
+    munmap(state->sq_ring,state->sq_ring_len);
+    return -1;
+}
+
+/* Create the io_uring instance of 'state'. Returns -1 if io_uring can't be
+ * used. */
+static int aeUringCreate(aeEventLoop *eventLoop, aeApiState *state) {
+    struct io_uring_params p;
+    unsigned entries = 1;
+    int j;
+
+    while (entries < (unsigned)eventLoop->setsize &&
+           entries < AE_URING_MAX_ENTRIES) entries *= 2;
+
+    memset(&p,0,sizeof(p));
+    state->ringfd = aeUringSetup(entries,&p);
+    if (state->ringfd == -1) return -1;
+    if (aeUringMapRings(state,&p) == -1) {
+        close(state->ringfd);
+        return -1;
+    }
+    state->features = p.features;
+    state->io_supported = -1;
+    state->armed = zmalloc(sizeof(int)*eventLoop->setsize);
+    state->gen = zmalloc(sizeof(uint32_t)*eventLoop->setsize);
+    state->rio = zmalloc(sizeof(aeUringIo*)*eventLoop->setsize);
+    state->wio = zmalloc(sizeof(aeUringIo*)*eventLoop->setsize);
+    for (j = 0; j < eventLoop->setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->gen[j] = 0;
+        state->rio[j] = state->wio[j] = NULL;
+    }
+    return 0;
+}
+
+/* Move the completions from the CQ ring to the stash, so that the kernel
+ * can post new ones. */
+static void aeUringReap(aeApiState *state) {
+    unsigned head = *state->cq_head;
+    unsigned tail = __atomic_load_n(state->cq_tail,__ATOMIC_ACQUIRE);
+
+    if (head == tail) return;
+    if (state->stash_next) {
+        memmove(state->stash,state->stash+state->stash_next,
+                sizeof(struct io_uring_cqe)*
+                (state->stash_count-state->stash_next));
+        state->stash_count -= state->stash_next;
+        state->stash_next = 0;
+    }
+    state->stash = aeUringGrow(state->stash,state->stash_count,tail-head,
+                               &state->stash_size,sizeof(struct io_uring_cqe));
+    while (head != tail)
+        state->stash[state->stash_count++] = state->cqes[head++ & *state->cq_mask];
+    __atomic_store_n(state->cq_head,head,__ATOMIC_RELEASE);
+}
+
+/* Submit the queued SQEs without waiting for completions. */
+static int aeUringFlush(aeApiState *state) {
+    int retval;
+
+    if (state->sq_pending == 0) return 0;
+    retval = aeUringEnter(state->ringfd,state->sq_pending,0,0);
+    if (retval < 0) return -1;
+    state->sq_pending -= retval;
+    return 0;
+}
+
+/* Return a zeroed SQE from the submission ring. If the ring is full the
+ * queued entries are submitted first; when the kernel refuses them because
+ * its completion backlog is full (EBUSY) the completions are moved to the
+ * stash and we try again. NULL is returned only if that keeps failing. */
+static struct io_uring_sqe *aeUringGetSqe(aeApiState *state) {
+    unsigned head, tail = *state->sq_tail, idx;
+    struct io_uring_sqe *sqe;
+    int tries = 0;
+
+    head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    while (tail - head == state->sq_entries) {
+        if (tries++ == AE_URING_SQE_RETRIES) return NULL;
+        if (aeUringFlush(state) == -1) {
+            if (errno != EBUSY && errno != EAGAIN && errno != EINTR)
+                return NULL;
+            aeUringReap(state);
+        }
+        head = __atomic_load_n(state->sq_head,__ATOMIC_ACQUIRE);
+    }
+    idx = tail & *state->sq_mask;
+    sqe = &state->sqes[idx];
+    memset(sqe,0,sizeof(*sqe));
+    state->sq_array[idx] = idx;
+    /* The kernel will not look at the entry before io_uring_enter(), but
+     * publish the new tail with release semantic anyway, as required. */
+    __atomic_store_n(state->sq_tail,tail+1,__ATOMIC_RELEASE);
+    state->sq_pending++;
+    return sqe;
+}
+
+static uint64_t aeUringPollData(aeApiState *state, int fd) {
+    return ((uint64_t)(state->gen[fd] & AE_URING_GEN_MASK) << 32) |
+           (uint32_t)fd;
+}
+
+static uint64_t aeUringIoData(aeUringIo *io) {
+    return ((uint64_t)AE_URING_KIND_IO << 62) | (uint64_t)(uintptr_t)io;
+}
+
+static aeUringIo *aeUringIoFromData(uint64_t data) {
+    return (aeUringIo*)(uintptr_t)(data & ~(3ULL << 62));
+}
+
+static void aeUringIoRelease(aeApiState *state, aeUringIo *io) {
+    state->io_count--;
+    zfree(io);
+}
+
+/* Remember that 'fd' must be re-armed by the next aeApiPoll() call. */
+static void aeUringQueueRearm(aeApiState *state, int fd) {
+    state->rearm = aeUringGrow(state->rearm,state->rearm_count,1,
+                               &state->rearm_size,sizeof(int));
+    state->rearm[state->rearm_count++] = fd;
+}
+
+/* Queue a one-shot poll for 'fd' on the given AE_* mask. */
+static int aeUringArm(aeApiState *state, int fd, int mask) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    unsigned events = 0;
+
+    if (sqe == NULL) return -1;
+    if (mask & AE_READABLE) events |= POLLIN;
+    if (mask & AE_WRITABLE) events |= POLLOUT;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = events;
+    sqe->user_data = aeUringPollData(state,fd);
+    state->armed[fd] = mask;
+    return 0;
+}
+
+/* Queue the cancellation of the request with the given user_data. If the
+ * SQ has no room it is retried by the next aeApiPoll() call: dropping it
+ * would leave the request, and the file it references, in the kernel. */
+static void aeUringCancel(aeApiState *state, uint64_t data) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+    if (sqe == NULL) {
+        state->cancels = aeUringGrow(state->cancels,state->cancels_count,1,
+                                     &state->cancels_size,sizeof(uint64_t));
+        state->cancels[state->cancels_count++] = data;
+        if (AE_URING_UDATA_KIND(data) == AE_URING_KIND_IO)
+            aeUringIoFromData(data)->deferred = 1;
+        return;
+    }
+    sqe->fd = -1;
+    sqe->addr = data;
+    if (AE_URING_UDATA_KIND(data) == AE_URING_KIND_IO) {
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->user_data = AE_URING_UDATA_CANCEL;
+    } else {
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->user_data = AE_URING_UDATA_REMOVE;
+    }
+}
+
+/* Retry the cancellations that didn't fit in the SQ. A request that
+ * completed meanwhile has nothing left to cancel: it was kept around only
+ * so that its address couldn't be reused by a new request first. */
+static void aeUringFlushCancels(aeApiState *state) {
+    int j, count = state->cancels_count;
+
+    /* aeUringCancel() appends the ones failing again, always at an index
+     * we already visited. */
+    state->cancels_count = 0;
+    for (j = 0; j < count; j++) {
+        uint64_t data = state->cancels[j];
+
+        if (AE_URING_UDATA_KIND(data) == AE_URING_KIND_IO) {
+            aeUringIo *io = aeUringIoFromData(data);
+
+            io->deferred = 0;
+            if (io->completed) {
+                aeUringIoRelease(state,io);
+                continue;
+            }
+        }
+        aeUringCancel(state,data);
+    }
+}
+
+/* Queue the cancellation of the poll armed for 'fd', if any. The generation
+ * is bumped so that a completion racing with the cancellation is ignored. */
+static void aeUringDisarm(aeApiState *state, int fd) {
+    if (state->armed[fd] == AE_NONE) return;
+    aeUringCancel(state,aeUringPollData(state,fd));
+    state->armed[fd] = AE_NONE;
+    state->gen[fd]++;
+}
+
+/* Put the pool buffer 'bid' back in the provided buffer ring. */
+static void aeUringRecycle(aeApiState *state, int bid) {
+    struct io_uring_buf *buf =
+        &state->br->bufs[state->br_tail & (AE_URING_RBUF_COUNT-1)];
+
+    buf->addr = (uint64_t)(uintptr_t)(state->rbufs +
+                                      (size_t)bid*AE_URING_RBUF_SIZE);
+    buf->len = AE_URING_RBUF_SIZE;
+    buf->bid = bid;
+    state->br_tail++;
+    __atomic_store_n(&state->br->tail,state->br_tail,__ATOMIC_RELEASE);
+}
+
+/* Check that the kernel has everything the aeIo*() API needs, and register
+ * the read buffer pool. Polling for readiness makes no sense in the kernel
+ * either without IORING_FEAT_FAST_POLL: reads of idle sockets would block
+ * a kernel worker thread each. */
+static int aeUringIoSetup(aeApiState *state) {
+    static const int ops[] = {IORING_OP_RECV, IORING_OP_SEND,
+                              IORING_OP_ASYNC_CANCEL};
+    size_t brlen = sizeof(struct io_uring_buf)*AE_URING_RBUF_COUNT;
+    struct io_uring_probe *probe;
+    struct io_uring_buf_reg reg;
+    unsigned j;
+
+    if (!(state->features & IORING_FEAT_FAST_POLL)) return 0;
+    probe = zcalloc(sizeof(*probe)+256*sizeof(struct io_uring_probe_op));
+    if (aeUringRegister(state->ringfd,IORING_REGISTER_PROBE,probe,256) < 0) {
+        zfree(probe);
+        return 0;
+    }
+    for (j = 0; j < sizeof(ops)/sizeof(ops[0]); j++) {
+        if (ops[j] > probe->last_op ||
+            !(probe->ops[ops[j]].flags & IO_URING_OP_SUPPORTED))
+        {
+            zfree(probe);
+            return 0;
+        }
+    }
+    zfree(probe);
+
+    /* The buffer ring must be page aligned. */
+    state->br = mmap(NULL,brlen,PROT_READ|PROT_WRITE,
+                     MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (state->br == MAP_FAILED) {
+        state->br = NULL;
+        return 0;
+    }
+    memset(&reg,0,sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)state->br;
+    reg.ring_entries = AE_URING_RBUF_COUNT;
+    reg.bgid = AE_URING_BGID;
+    if (aeUringRegister(state->ringfd,IORING_REGISTER_PBUF_RING,&reg,1) < 0) {
+        munmap(state->br,brlen);
+        state->br = NULL;
+        return 0;
+    }
+    state->rbufs = zmalloc((size_t)AE_URING_RBUF_COUNT*AE_URING_RBUF_SIZE);
+    state->br_tail = 0;
+    for (j = 0; j < AE_URING_RBUF_COUNT; j++) aeUringRecycle(state,j);
+    return 1;
+}
+
+/* Queue the SQE of a read or write request. */
+static int aeUringSubmitIo(aeApiState *state, aeUringIo *io) {
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+    if (sqe == NULL) {
+        errno = EBUSY;
+        return -1;
+    }
+    sqe->fd = io->fd;
+    if (io->type == AE_IO_READ) {
+        sqe->opcode = IORING_OP_RECV;
+        sqe->len = io->len;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = AE_URING_BGID;
+    } else {
+        sqe->opcode = IORING_OP_SEND;
+        sqe->addr = (uint64_t)(uintptr_t)(io->buf+io->sent);
+        sqe->len = io->len-io->sent;
+        sqe->msg_flags = MSG_NOSIGNAL;
+    }
+    sqe->user_data = aeUringIoData(io);
+    io->completed = 0;
+    return 0;
+}
+
+/* Handle the completion of a read or write request. Short writes are
+ * resubmitted, reads that found the pool empty are retried by the next
+ * aeApiPoll() call, everything else is queued for aeApiIoProcess(). */
+static void aeUringIoComplete(aeApiState *state, aeUringIo *io, int res,
+                              unsigned flags)
+{
+    int bid = (flags & IORING_CQE_F_BUFFER) ?
+              (int)(flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+
+    io->completed = 1;
+    if (io->cancelled) {
+        if (bid != -1) aeUringRecycle(state,bid);
+        if (!io->deferred) aeUringIoRelease(state,io);
+        return;
+    }
+    if (io->type == AE_IO_READ && res == -ENOBUFS) {
+        state->retry = aeUringGrow(state->retry,state->retry_count,1,
+                                   &state->retry_size,sizeof(aeUringIo*));
+        state->retry[state->retry_count++] = io;
+        return;
+    }
+    if (io->type == AE_IO_WRITE && res > 0) {
+        io->sent += res;
+        if (io->sent < io->len) {
+            if (aeUringSubmitIo(state,io) == 0) return;
+            res = -errno;
+        } else {
+            res = (int)io->len;
+        }
+    }
+    state->done = aeUringGrow(state->done,state->done_count,1,
+                              &state->done_size,sizeof(aeUringDone));
+    state->done[state->done_count].io = io;
+    state->done[state->done_count].res = res;
+    state->done[state->done_count].bid = bid;
+    state->done_count++;
+}
+
+static int aeApiCreate(aeEventLoop *eventLoop) {
+    aeApiState *state;
+
+    if (aeUringEnabled == 0) return aeEpollApiCreate(eventLoop);
+    state = zcalloc(sizeof(aeApiState));
+    if (aeUringCreate(eventLoop,state) == 0) {
+        if (aeUringEnabled == -1) aeUringEnabled = 1;
+        eventLoop->apidata = state;
+        return 0;
+    }
+    if (aeUringEnabled == -1) {
+        aeUringEnabled = 0;
+        zfree(state);
+        return aeEpollApiCreate(eventLoop);
+    }
+    /* Other loops use io_uring but this one couldn't get a ring, for
+     * instance because of RLIMIT_MEMLOCK: keep epoll inside our state. */
+    if (aeEpollApiCreate(eventLoop) == -1) {
+        zfree(state);
+        return -1;
+    }
+    state->epoll = eventLoop->apidata;
+    eventLoop->apidata = state;
+    return 0;
+}
+
+/* Run the epoll implementation with its own state as apidata. */
+#define AE_URING_EPOLL(eventLoop,state,call) do { \
+    (eventLoop)->apidata = (state)->epoll; \
+    call; \
+    (eventLoop)->apidata = (state); \
+} while(0)
+
+/* The epoll state if 'eventLoop' doesn't use io_uring, otherwise NULL. */
+static aeEpollApiState *aeUringEpollState(aeEventLoop *eventLoop) {
+    if (!aeUringEnabled) return eventLoop->apidata;
+    return ((aeApiState*)eventLoop->apidata)->epoll;
+}
+
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+    int j, retval;
+
+    if (!aeUringEnabled) return aeEpollApiResize(eventLoop,setsize);
+    if (state->epoll) {
+        AE_URING_EPOLL(eventLoop,state,
+                       retval = aeEpollApiResize(eventLoop,setsize));
+        return retval;
+    }
+    /* Fds with requests in flight are not registered file events, so
+     * aeResizeSetSize() doesn't know about them. */
+    for (j = setsize; j < eventLoop->setsize; j++)
+        if (state->rio[j] || state->wio[j]) return -1;
+    state->armed = zrealloc(state->armed,sizeof(int)*setsize);
+    state->gen = zrealloc(state->gen,sizeof(uint32_t)*setsize);
+    state->rio = zrealloc(state->rio,sizeof(aeUringIo*)*setsize);
+    state->wio = zrealloc(state->wio,sizeof(aeUringIo*)*setsize);
+    for (j = eventLoop->setsize; j < setsize; j++) {
+        state->armed[j] = AE_NONE;
+        state->gen[j] = 0;
+        state->rio[j] = state->wio[j] = NULL;
+    }
+    /* aeResizeSetSize() refuses to shrink below maxfd, so entries still
+     * in the rearm list are within the new set size. */
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int j;
+
+    if (!aeUringEnabled) {
+        aeEpollApiFree(eventLoop);
+        return;
+    }
+    if (state->epoll) {
+        AE_URING_EPOLL(eventLoop,state,aeEpollApiFree(eventLoop));
+        zfree(state);
+        return;
+    }
+    /* Closing the ring cancels whatever is still in flight. Requests that
+     * were already cancelled by the caller and are still in the kernel are
+     * not reachable from here: we only delete loops at exit. */
+    munmap(state->sqes,state->sqes_len);
+    munmap(state->cq_ring,state->cq_ring_len);
+    munmap(state->sq_ring,state->sq_ring_len);
+    close(state->ringfd);
+    for (j = 0; j < eventLoop->setsize; j++) {
+        zfree(state->rio[j]);
+        zfree(state->wio[j]);
+    }
+    for (j = state->done_next; j < state->done_count; j++)
+        if (state->done[j].io->cancelled) zfree(state->done[j].io);
+    for (j = 0; j < state->retry_count; j++)
+        if (state->retry[j]->cancelled) zfree(state->retry[j]);
+    if (state->br) {
+        munmap(state->br,sizeof(struct io_uring_buf)*AE_URING_RBUF_COUNT);
+        zfree(state->rbufs);
+    }
+    zfree(state->armed);
+    zfree(state->gen);
+    zfree(state->rio);
+    zfree(state->wio);
+    zfree(state->rearm);
+    zfree(state->stash);
+    zfree(state->cancels);
+    zfree(state->done);
+    zfree(state->retry);
+    zfree(state);
+}
+
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
+    aeApiState *state = eventLoop->apidata;
+    int retval;
+
+    if (!aeUringEnabled) return aeEpollApiAddEvent(eventLoop,fd,mask);
+    if (state->epoll) {
+        AE_URING_EPOLL(eventLoop,state,
+                       retval = aeEpollApiAddEvent(eventLoop,fd,mask));
+        return retval;
+    }
+    mask |= eventLoop->events[fd].mask; /* Merge old events */
+    if (state->armed[fd] == mask) return 0;
+    aeUringDisarm(state,fd);
+    if (aeUringArm(state,fd,mask) == -1) {
+        /* The caller won't register the new events, but the old ones
+         * must be polled again. */
+        aeUringQueueRearm(state,fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask) {
+    aeApiState *state = eventLoop->apidata;
+    int mask;
+
+    if (!aeUringEnabled) {
+        aeEpollApiDelEvent(eventLoop,fd,delmask);
+        return;
+    }
+    if (state->epoll) {
+        AE_URING_EPOLL(eventLoop,state,
+                       aeEpollApiDelEvent(eventLoop,fd,delmask));
+        return;
+    }
+    mask = eventLoop->events[fd].mask & (~delmask);
+    if (state->armed[fd] == AE_NONE || state->armed[fd] == mask) return;
+    /* Note that the cancellation is only submitted at the next poll: the
+     * kernel keeps a reference to the file meanwhile, so if the caller
+     * closes the fd right away the socket is actually released a bit
+     * later, in the same event loop iteration. */
+    aeUringDisarm(state,fd);
+    if (mask != AE_NONE && aeUringArm(state,fd,mask) == -1)
+        aeUringQueueRearm(state,fd);
+}
+
+/* Handle a completion: fired polls are stored in eventLoop->fired. */
+static void aeUringHandleCqe(aeEventLoop *eventLoop, aeApiState *state,
+                             struct io_uring_cqe *cqe, int *numevents)
+{
+    uint64_t data = cqe->user_data;
+    int res = cqe->res, fd, mask = 0;
+
+    if (AE_URING_UDATA_KIND(data) == AE_URING_KIND_INTERNAL) return;
+    if (AE_URING_UDATA_KIND(data) == AE_URING_KIND_IO) {
+        aeUringIoComplete(state,aeUringIoFromData(data),res,cqe->flags);
+        return;
+    }
+    fd = (int)(data & 0xffffffff);
+    if (fd >= eventLoop->setsize ||
+        (uint32_t)(data >> 32) != (state->gen[fd] & AE_URING_GEN_MASK))
+        return; /* Stale. */
+
+    state->armed[fd] = AE_NONE;
+    aeUringQueueRearm(state,fd);
+    if (res < 0) return;
+    if (res & POLLIN) mask |= AE_READABLE;
+    if (res & POLLOUT) mask |= AE_WRITABLE;
+    if (res & POLLERR) mask |= AE_WRITABLE;
+    if (res & POLLHUP) mask |= AE_WRITABLE;
+    eventLoop->fired[*numevents].fd = fd;
+    eventLoop->fired[*numevents].mask = mask;
+    (*numevents)++;
+}
+
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
+    aeApiState *state = eventLoop->apidata;
+    unsigned wait_nr = 1;
+    int j, count, retval, numevents = 0;
+
+    if (!aeUringEnabled) return aeEpollApiPoll(eventLoop,tvp);
+    if (state->epoll) {
+        AE_URING_EPOLL(eventLoop,state,
+                       retval = aeEpollApiPoll(eventLoop,tvp));
+        return retval;
+    }
+
+    aeUringFlushCancels(state);
+
+    /* Re-arm the one-shot polls that fired in the previous call, if the
+     * file event is still registered. Fds that had their interest changed
+     * meanwhile were already re-armed by aeApiAddEvent(). The ones that
+     * fail again stay in the list, always at an index already visited. */
+    count = state->rearm_count;
+    state->rearm_count = 0;
+    for (j = 0; j < count; j++) {
+        int fd = state->rearm[j];
+        int mask = eventLoop->events[fd].mask;
+
+        if (mask != AE_NONE && state->armed[fd] == AE_NONE &&
+            aeUringArm(state,fd,mask) == -1)
+            state->rearm[state->rearm_count++] = fd;
+    }
+
+    /* Reads that found the buffer pool empty: buffers were recycled by
+     * aeApiIoProcess() meanwhile. */
+    count = state->retry_count;
+    state->retry_count = 0;
+    for (j = 0; j < count; j++) {
+        aeUringIo *io = state->retry[j];
+
+        if (io->cancelled)
+            aeUringIoRelease(state,io);
+        else if (aeUringSubmitIo(state,io) == -1)
+            state->retry[state->retry_count++] = io;
+    }
+
+    /* Don't sleep with work left over because the rings were full. */
+    if (state->rearm_count || state->retry_count || state->cancels_count ||
+        state->stash_next < state->stash_count) wait_nr = 0;
+
+    if (wait_nr == 0 || (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0)) {
+        wait_nr = 0;
+    } else if (tvp) {
+        /* A timeout request with a completion count of one terminates as
+         * soon as any other request completes, so it never outlives this
+         * call by much and can't wake up a later poll. */
+        struct io_uring_sqe *sqe = aeUringGetSqe(state);
+
+        if (sqe != NULL) {
+            state->ts.tv_sec = tvp->tv_sec;
+            state->ts.tv_nsec = (long long)tvp->tv_usec*1000;
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = (uint64_t)(uintptr_t)&state->ts;
+            sqe->len = 1;
+            sqe->off = 1;
+            sqe->user_data = AE_URING_UDATA_TIMEOUT;
+        } else {
+            wait_nr = 0;
+        }
+    }
+
+    /* A single system call to submit everything and wait. */
+    retval = aeUringEnter(state->ringfd,state->sq_pending,wait_nr,
+                          wait_nr ? IORING_ENTER_GETEVENTS : 0);
+    if (retval >= 0) state->sq_pending -= retval;
+
+    /* Handling a completion may need SQEs (to resubmit a short write) and
+     * so reap more completions into the stash: copy every entry out first. */
+    aeUringReap(state);
+    while (state->stash_next < state->stash_count &&
+           numevents < eventLoop->setsize)
+    {
+        struct io_uring_cqe cqe = state->stash[state->stash_next++];
+
+        aeUringHandleCqe(eventLoop,state,&cqe,&numevents);
+    }
+    if (state->stash_next == state->stash_count)
+        state->stash_next = state->stash_count = 0;
+    return numevents;
+}
+
+static int aeApiIoSupported(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+
+    if (aeUringEpollState(eventLoop)) return 0;
+    if (state->io_supported == -1) state->io_supported = aeUringIoSetup(state);
+    return state->io_supported;
+}
+
+static int aeApiIoSubmitRead(aeEventLoop *eventLoop, int fd, size_t len,
+                             aeIoProc *proc, void *clientData)
+{
+    aeApiState *state = eventLoop->apidata;
+    aeUringIo *io;
+
+    if (!aeApiIoSupported(eventLoop)) {
+        errno = ENOTSUP;
+        return AE_ERR;
+    }
+    if (state->rio[fd]) {
+        errno = EBUSY;
+        return AE_ERR;
+    }
+    io = zcalloc(sizeof(*io));
+    io->fd = fd;
+    io->type = AE_IO_READ;
+    io->proc = proc;
+    io->clientData = clientData;
+    io->len = len;
+    if (aeUringSubmitIo(state,io) == -1) {
+        zfree(io);
+        return AE_ERR;
+    }
+    state->rio[fd] = io;
+    state->io_count++;
+    return AE_OK;
+}
+
+static ssize_t aeApiIoSubmitWritev(aeEventLoop *eventLoop, int fd,
+                                   const struct iovec *iov, int iovcnt,
+                                   aeIoProc *proc, void *clientData)
+{
+    aeApiState *state = eventLoop->apidata;
+    aeUringIo *io;
+    size_t len = 0;
+    int j;
+
+    if (!aeApiIoSupported(eventLoop)) {
+        errno = ENOTSUP;
+        return AE_ERR;
+    }
+    if (state->wio[fd]) {
+        errno = EAGAIN;
+        return AE_ERR;
+    }
+    for (j = 0; j < iovcnt && len < AE_IO_WRITE_MAX; j++) len += iov[j].iov_len;
+    if (len > AE_IO_WRITE_MAX) len = AE_IO_WRITE_MAX;
+    if (len == 0) return 0;
+
+    io = zmalloc(sizeof(*io)+len);
+    memset(io,0,sizeof(*io));
+    io->fd = fd;
+    io->type = AE_IO_WRITE;
+    io->proc = proc;
+    io->clientData = clientData;
+    io->len = len;
+    for (j = 0; io->sent < len; j++) {
+        size_t n = iov[j].iov_len;
+
+        if (n > len-io->sent) n = len-io->sent;
+        memcpy(io->buf+io->sent,iov[j].iov_base,n);
+        io->sent += n;
+    }
+    io->sent = 0;
+    if (aeUringSubmitIo(state,io) == -1) {
+        zfree(io);
+        return AE_ERR;
+    }
+    state->wio[fd] = io;
+    state->io_count++;
+    return len;
+}
+
+static void aeApiIoCancel(aeEventLoop *eventLoop, int fd) {
+    aeApiState *state = eventLoop->apidata;
+    aeUringIo **slots[2], *io;
+    int j;
+
+    if (aeUringEpollState(eventLoop)) return;
+    slots[0] = state->rio;
+    slots[1] = state->wio;
+    for (j = 0; j < 2; j++) {
+        if ((io = slots[j][fd]) == NULL) continue;
+        slots[j][fd] = NULL;
+        io->cancelled = 1;
+        /* Completed requests are released by aeApiIoProcess() or by the
+         * retry loop of aeApiPoll(). */
+        if (!io->completed) aeUringCancel(state,aeUringIoData(io));
+    }
+}
+
+/* Number of requests in flight, or waiting for aeApiIoProcess(). */
+static int aeApiIoCount(aeEventLoop *eventLoop) {
+    if (aeUringEpollState(eventLoop)) return 0;
+    return ((aeApiState*)eventLoop->apidata)->io_count;
+}
+
+static int aeApiIoPending(aeEventLoop *eventLoop, int fd) {
+    aeApiState *state = eventLoop->apidata;
+    int mask = 0;
+
+    if (aeUringEpollState(eventLoop)) return 0;
+    if (state->rio[fd]) mask |= AE_IO_READ;
+    if (state->wio[fd]) mask |= AE_IO_WRITE;
+    return mask;
+}
+
+/* Call the callbacks of the requests completed in the last aeApiPoll()
+ * call. The list is consumed through the state, so that a callback that
+ * processes events itself (see processEventsWhileBlocked()) doesn't
+ * deliver anything twice. */
+static int aeApiIoProcess(aeEventLoop *eventLoop) {
+    aeApiState *state = eventLoop->apidata;
+    int processed = 0;
+
+    if (aeUringEpollState(eventLoop)) return 0;
+    while (state->done_next < state->done_count) {
+        aeUringDone d = state->done[state->done_next++];
+        aeUringIo *io = d.io;
+
+        if (!io->cancelled) {
+            char *buf = d.bid == -1 ? NULL :
+                        state->rbufs + (size_t)d.bid*AE_URING_RBUF_SIZE;
+
+            if (io->type == AE_IO_READ)
+                state->rio[io->fd] = NULL;
+            else
+                state->wio[io->fd] = NULL;
+            io->proc(eventLoop,io->fd,io->clientData,buf,d.res);
+            processed++;
+        }
+        if (d.bid != -1) aeUringRecycle(state,d.bid);
+        aeUringIoRelease(state,io);
+    }
+    state->done_next = state->done_count = 0;
+    return processed;
+}
+
+static char *aeApiName(void) {
+    return aeUringEnabled == 1 ? "io_uring" : aeEpollApiName();
+}
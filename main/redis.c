@@ -30,6 +30,8 @@
 #include "redis.h"
 #include "slowlog.h"
 #include "bio.h"
+#include "respscan.h"
+#include "bitkernels.h"
 
 #include <time.h>
 #include <signal.h>
@@ -162,6 +164,7 @@ struct redisCommand redisCommandTable[] = {
     {"srandmember",srandmemberCommand,-2,"rR",0,NULL,1,1,1,0,0},
     {"sinter",sinterCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sinterstore",sinterstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
+    {"sintercard",sintercardCommand,-3,"r",0,intercardGetKeys,0,0,0,0,0},
     {"sunion",sunionCommand,-2,"rS",0,NULL,1,-1,1,0,0},
     {"sunionstore",sunionstoreCommand,-3,"wm",0,NULL,1,-1,1,0,0},
     {"sdiff",sdiffCommand,-2,"rS",0,NULL,1,-1,1,0,0},
@@ -176,6 +179,7 @@ struct redisCommand redisCommandTable[] = {
     {"zremrangebylex",zremrangebylexCommand,4,"w",0,NULL,1,1,1,0,0},
     {"zunionstore",zunionstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
     {"zinterstore",zinterstoreCommand,-4,"wm",0,zunionInterGetKeys,0,0,0,0,0},
+    {"zintercard",zintercardCommand,-3,"r",0,intercardGetKeys,0,0,0,0,0},
     {"zrange",zrangeCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrangebyscore",zrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
     {"zrevrangebyscore",zrevrangebyscoreCommand,-4,"r",0,NULL,1,1,1,0,0},
@@ -261,6 +265,7 @@ struct redisCommand redisCommandTable[] = {
     {"dump",dumpCommand,2,"ar",0,NULL,1,1,1,0,0},
     {"object",objectCommand,3,"r",0,NULL,2,2,2,0,0},
     {"client",clientCommand,-2,"ars",0,NULL,0,0,0,0,0},
+    {"shmring",shmringCommand,2,"ars",0,NULL,0,0,0,0,0},
     {"eval",evalCommand,-3,"s",0,zunionInterGetKeys,0,0,0,0,0},
     {"evalsha",evalShaCommand,-3,"s",0,zunionInterGetKeys,0,0,0,0,0},
     {"slowlog",slowlogCommand,-2,"r",0,NULL,0,0,0,0,0},
@@ -482,7 +487,7 @@ int dictEncObjKeyCompare(void *privdata, const void *key1,
 unsigned int dictEncObjHash(const void *key) {
     robj *o = (robj*) key;
 
-    if (o->encoding == REDIS_ENCODING_RAW) {
+    if (sdsEncodedObject(o)) {
         return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
     } else {
         if (o->encoding == REDIS_ENCODING_INT) {
@@ -522,6 +527,27 @@ dictType zsetDictType = {
     NULL                       /* val destructor */
 };
 
+/* B+tree callbacks for sorted sets: elements are Redis objects ordered like
+ * in the skiplist, and references are plain refcounts. */
+int zbtreeObjCompare(void *a, void *b) {
+    return compareStringObjects(a,b);
+}
+
+void zbtreeObjRetain(void *obj) {
+    incrRefCount(obj);
+}
+
+void zbtreeObjRelease(void *obj) {
+    decrRefCount(obj);
+}
+
+/* Sorted sets B+tree (note: a hash table is used in addition to the tree) */
+zbtreeType zsetBtreeType = {
+    zbtreeObjCompare,          /* compare */
+    zbtreeObjRetain,           /* retain */
+    zbtreeObjRelease           /* release */
+};
+
 /* Db->dict, keys are sds strings, vals are Redis objects. */
 dictType dbDictType = {
     dictSdsHash,                /* hash function */
@@ -899,6 +925,19 @@ int clientsCronResizeQueryBuffer(redisClient *c) {
     return 0;
 }
 
+/* The client reply buffer is allocated when there is something to send, this
+ * function gives it back to the pool once the client has nothing more to send
+ * and has been idle for a while.
+ *
+ * The function always returns 0 as it never terminates the client. */
+int clientsCronReleaseReplyBuffer(redisClient *c) {
+    time_t idletime = server.unixtime - c->lastinteraction;
+
+    if (c->buf && c->bufpos == 0 && idletime >= REDIS_REPLY_BUF_IDLE_TIME)
+        releaseClientReplyBuffer(c);
+    return 0;
+}
+
 void clientsCron(void) {
     /* Make sure to process at least 1/(server.hz*10) of clients per call.
      * Since this function is called server.hz times per second we are sure that
@@ -925,6 +964,8 @@ void clientsCron(void) {
          * terminated. */
         if (clientsCronHandleTimeout(c)) continue;
         if (clientsCronResizeQueryBuffer(c)) continue;
+        if (clientsCronReleaseReplyBuffer(c)) continue;
+        updateClientMemUsage(c);
     }
 }
 
@@ -1180,15 +1221,22 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
  * main loop of the event driven library, that is, before to sleep
  * for ready file descriptors. */
 void beforeSleep(struct aeEventLoop *eventLoop) {
-    REDIS_NOTUSED(eventLoop);
     listNode *ln;
     redisClient *c;
 
+    /* Report the phases of the previous event loop iteration that were
+     * slower than the latency monitor threshold. */
+    latencyAddEventLoopSamples(eventLoop);
+
     /* Run a fast expire cycle (the called function will return
      * ASAP if a fast cycle is not needed). */
     if (server.active_expire_enabled && server.masterhost == NULL)
         activeExpireCycle(ACTIVE_EXPIRE_CYCLE_FAST);
 
+    /* Read and execute the queries of the clients queued for the I/O
+     * threads. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Try to process pending commands for clients that were just unblocked. */
     while (listLength(server.unblocked_clients)) {
         ln = listFirst(server.unblocked_clients);
@@ -1205,8 +1253,17 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
         }
     }
 
+    /* Disconnect the biggest clients if the client buffers are over the
+     * maxmemory-clients budget. */
+    evictClients();
+
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
+
+    /* Send the replies queued for the I/O threads. This must come after
+     * the AOF flush, so that replies are never sent before the writes
+     * are persisted. */
+    handleClientsWithPendingWritesUsingThreads();
 }
 
 /* =========================== Server initialization ======================== */
@@ -1309,9 +1366,15 @@ void initServerConfig(void) {
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = REDIS_SERVERPORT;
     server.tcp_backlog = REDIS_TCP_BACKLOG;
+    server.tcp_listeners = REDIS_DEFAULT_TCP_LISTENERS;
+    server.io_threads_num = REDIS_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = REDIS_DEFAULT_IO_THREADS_DO_READS;
+    server.io_uring_completion = REDIS_DEFAULT_IO_URING_COMPLETION;
+    server.io_completion = 0;
     server.bindaddr_count = 0;
     server.unixsocket = NULL;
     server.unixsocketperm = REDIS_DEFAULT_UNIX_SOCKET_PERM;
+    server.unixsocket_shmring = REDIS_DEFAULT_UNIX_SOCKET_SHMRING;
     server.ipfd_count = 0;
     server.sofd = -1;
     server.dbnum = REDIS_DEFAULT_DBNUM;
@@ -1352,19 +1415,24 @@ void initServerConfig(void) {
     server.rdb_checksum = REDIS_DEFAULT_RDB_CHECKSUM;
     server.stop_writes_on_bgsave_err = REDIS_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = REDIS_DEFAULT_ACTIVE_REHASHING;
+    server.keyspace_table = REDIS_DEFAULT_KEYSPACE_TABLE;
     server.notify_keyspace_events = 0;
     server.maxclients = REDIS_MAX_CLIENTS;
     server.bpop_blocked_clients = 0;
     server.maxmemory = REDIS_DEFAULT_MAXMEMORY;
+    server.maxmemory_clients = REDIS_DEFAULT_MAXMEMORY_CLIENTS;
     server.maxmemory_policy = REDIS_DEFAULT_MAXMEMORY_POLICY;
     server.maxmemory_samples = REDIS_DEFAULT_MAXMEMORY_SAMPLES;
     server.hash_max_ziplist_entries = REDIS_HASH_MAX_ZIPLIST_ENTRIES;
     server.hash_max_ziplist_value = REDIS_HASH_MAX_ZIPLIST_VALUE;
     server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
     server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+    server.list_max_ziplist_size = REDIS_LIST_MAX_ZIPLIST_SIZE;
+    server.list_compress_depth = REDIS_LIST_COMPRESS_DEPTH;
     server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
     server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_max_skiplist_entries = REDIS_ZSET_MAX_SKIPLIST_ENTRIES;
     server.hll_sparse_max_bytes = REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES;
     server.shutdown_asap = 0;
     server.repl_ping_slave_period = REDIS_REPL_PING_SLAVE_PERIOD;
@@ -1526,6 +1594,38 @@ void adjustOpenFilesLimit(void) {
     }
 }
 
+/* Create the server.tcp_listeners listening sockets for a single address,
+ * appending them to 'fds'. When more than one listener is configured the
+ * sockets are created with SO_REUSEPORT: the kernel spreads the incoming
+ * connections among their accept queues, so a reconnection storm is split
+ * in more, shorter queues, each drained in batches by acceptTcpHandler().
+ * On error the sockets already created for this address are closed. */
+/* 为一个地址创建tcp-listeners个监听socket */
+static int listenToAddress(int port, char *addr, int ipv6, int *fds, int *count) {
+    int j, fd;
+
+    for (j = 0; j < server.tcp_listeners; j++) {
+        if (server.tcp_listeners > 1) {
+            fd = ipv6 ?
+                anetTcp6ReusePortServer(server.neterr,port,addr,
+                                        server.tcp_backlog) :
+                anetTcpReusePortServer(server.neterr,port,addr,
+                                       server.tcp_backlog);
+        } else {
+            fd = ipv6 ?
+                anetTcp6Server(server.neterr,port,addr,server.tcp_backlog) :
+                anetTcpServer(server.neterr,port,addr,server.tcp_backlog);
+        }
+        if (fd == ANET_ERR) {
+            while(j--) close(fds[--(*count)]);
+            return REDIS_ERR;
+        }
+        anetNonBlock(NULL,fd);
+        fds[(*count)++] = fd;
+    }
+    return REDIS_OK;
+}
+
 /* Initialize a set of file descriptors to listen to the specified 'port'
  * binding the addresses specified in the Redis server configuration.
  *
@@ -1554,40 +1654,24 @@ int listenToPort(int port, int *fds, int *count) {
         if (server.bindaddr[j] == NULL) {
             /* Bind * for both IPv6 and IPv4, we enter here only if
              * server.bindaddr_count == 0. */
-            fds[*count] = anetTcp6Server(server.neterr,port,NULL,
-                server.tcp_backlog);
-            if (fds[*count] != ANET_ERR) {
-                anetNonBlock(NULL,fds[*count]);
-                (*count)++;
-            }
-            fds[*count] = anetTcpServer(server.neterr,port,NULL,
-                server.tcp_backlog);
-            if (fds[*count] != ANET_ERR) {
-                anetNonBlock(NULL,fds[*count]);
-                (*count)++;
-            }
+            int v6 = listenToAddress(port,NULL,1,fds,count);
+            int v4 = listenToAddress(port,NULL,0,fds,count);
+
             /* Exit the loop if we were able to bind * on IPv4 or IPv6,
-             * otherwise fds[*count] will be ANET_ERR and we'll print an
-             * error and return to the caller with an error. */
-            if (*count) break;
-        } else if (strchr(server.bindaddr[j],':')) {
-            /* Bind IPv6 address. */
-            fds[*count] = anetTcp6Server(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        } else {
-            /* Bind IPv4 address. */
-            fds[*count] = anetTcpServer(server.neterr,port,server.bindaddr[j],
-                server.tcp_backlog);
-        }
-        if (fds[*count] == ANET_ERR) {
-            redisLog(REDIS_WARNING,
-                "Creating Server TCP listening socket %s:%d: %s",
-                server.bindaddr[j] ? server.bindaddr[j] : "*",
-                server.port, server.neterr);
-            return REDIS_ERR;
+             * otherwise print an error and return to the caller with
+             * an error. */
+            if (v6 == REDIS_OK || v4 == REDIS_OK) break;
+        } else if (listenToAddress(port,server.bindaddr[j],
+                   strchr(server.bindaddr[j],':') != NULL,
+                   fds,count) == REDIS_OK)
+        {
+            continue;
         }
-        anetNonBlock(NULL,fds[*count]);
-        (*count)++;
+        redisLog(REDIS_WARNING,
+            "Creating Server TCP listening socket %s:%d: %s",
+            server.bindaddr[j] ? server.bindaddr[j] : "*",
+            server.port, server.neterr);
+        return REDIS_ERR;
     }
     return REDIS_OK;
 }
@@ -1600,6 +1684,7 @@ void resetServerStats(void) {
     server.stat_numconnections = 0;
     server.stat_expiredkeys = 0;
     server.stat_evictedkeys = 0;
+    server.stat_evictedclients = 0;
     server.stat_keyspace_misses = 0;
     server.stat_keyspace_hits = 0;
     server.stat_fork_time = 0;
@@ -1608,6 +1693,9 @@ void resetServerStats(void) {
     server.stat_sync_full = 0;
     server.stat_sync_partial_ok = 0;
     server.stat_sync_partial_err = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
+    if (server.el) aeResetStats(server.el);
     memset(server.ops_sec_samples,0,sizeof(server.ops_sec_samples));
     server.ops_sec_idx = 0;
     server.ops_sec_last_sample_time = mstime();
@@ -1629,6 +1717,14 @@ void initServer(void) {
     server.current_client = NULL;
     server.clients = listCreate();
     server.clients_to_close = listCreate();
+    server.reply_buf_pool = NULL;
+    server.reply_buf_pool_len = 0;
+    server.reply_buf_used = 0;
+    for (j = 0; j < REDIS_CLIENT_MEM_BUCKETS; j++)
+        server.clients_mem_buckets[j] = listCreate();
+    server.clients_mem_usage = 0;
+    server.clients_pending_read = listCreate();
+    server.clients_pending_write = listCreate();
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
@@ -1665,8 +1761,13 @@ void initServer(void) {
 
     /* Create the Redis databases, and initialize other internal state. */
     for (j = 0; j < server.dbnum; j++) {
-        server.db[j].dict = dictCreate(&dbDictType,NULL);
-        server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        if (server.keyspace_table == REDIS_KEYSPACE_TABLE_SWISS) {
+            server.db[j].dict = dictCreateSwiss(&dbDictType,NULL);
+            server.db[j].expires = dictCreateSwiss(&keyptrDictType,NULL);
+        } else {
+            server.db[j].dict = dictCreate(&dbDictType,NULL);
+            server.db[j].expires = dictCreate(&keyptrDictType,NULL);
+        }
         server.db[j].blocking_keys = dictCreate(&keylistDictType,NULL);
         server.db[j].ready_keys = dictCreate(&setDictType,NULL);
         server.db[j].watched_keys = dictCreate(&keylistDictType,NULL);
@@ -1744,6 +1845,11 @@ void initServer(void) {
     slowlogInit();
     latencyMonitorInit();
     bioInit();
+    respScanInit();
+    intsetInit();
+    bitKernelsInit();
+    initThreadedIO();
+    initCompletionIO();
 }
 
 /* Populates the Redis Command Table starting from the hard coded list
@@ -2408,6 +2514,20 @@ void bytesToHuman(char *s, unsigned long long n) {
     }
 }
 
+/* Append to 'info' a line with the average and some percentiles of one of
+ * the event loop histograms. */
+/* 输出事件循环直方图的平均值与百分位数 */
+static sds genEventLoopHistogramInfo(sds info, char *name, aeHistogram *h) {
+    return sdscatprintf(info,
+        "eventloop_%s:avg=%.2f,p50=%llu,p99=%llu,p999=%llu,max=%llu\r\n",
+        name,
+        h->count ? (double)h->sum/h->count : 0,
+        aeHistogramPercentile(h,50),
+        aeHistogramPercentile(h,99),
+        aeHistogramPercentile(h,99.9),
+        h->max);
+}
+
 /* Create the string returned by the INFO command. This is decoupled
  * by the INFO command itself as we need to report the same information
  * on memory corruption problems. */
@@ -2455,6 +2575,10 @@ sds genRedisInfoString(char *section) {
             "os:%s %s %s\r\n"
             "arch_bits:%d\r\n"
             "multiplexing_api:%s\r\n"
+            "io_completion:%d\r\n"
+            "protocol_scanner:%s\r\n"
+            "intset_search:%s\r\n"
+            "bitops_kernels:%s\r\n"
             "gcc_version:%d.%d.%d\r\n"
             "process_id:%ld\r\n"
             "run_id:%s\r\n"
@@ -2472,6 +2596,10 @@ sds genRedisInfoString(char *section) {
             name.sysname, name.release, name.machine,
             server.arch_bits,
             aeGetApiName(),
+            server.io_completion,
+            respScanImplName(),
+            intsetImplName(),
+            bitKernelsImplName(),
 #ifdef __GNUC__
             __GNUC__,__GNUC_MINOR__,__GNUC_PATCHLEVEL__,
 #else
@@ -2495,9 +2623,13 @@ sds genRedisInfoString(char *section) {
             "connected_clients:%lu\r\n"
             "client_longest_output_list:%lu\r\n"
             "client_biggest_input_buf:%lu\r\n"
+            "client_reply_buffers:%lu\r\n"
+            "client_reply_buffers_pooled:%lu\r\n"
             "blocked_clients:%d\r\n",
             listLength(server.clients)-listLength(server.slaves),
             lol, bib,
+            server.reply_buf_used,
+            server.reply_buf_pool_len,
             server.bpop_blocked_clients);
     }
 
@@ -2525,6 +2657,8 @@ sds genRedisInfoString(char *section) {
             "used_memory_peak:%zu\r\n"
             "used_memory_peak_human:%s\r\n"
             "used_memory_lua:%lld\r\n"
+            "used_memory_clients:%zu\r\n"
+            "maxmemory_clients:%llu\r\n"
             "mem_fragmentation_ratio:%.2f\r\n"
             "mem_allocator:%s\r\n",
             zmalloc_used,
@@ -2533,6 +2667,8 @@ sds genRedisInfoString(char *section) {
             server.stat_peak_memory,
             peak_hmem,
             ((long long)lua_gc(server.lua,LUA_GCCOUNT,0))*1024LL,
+            server.clients_mem_usage,
+            server.maxmemory_clients,
             zmalloc_get_fragmentation_ratio(server.resident_set_size),
             ZMALLOC_LIB
             );
@@ -2636,8 +2772,11 @@ sds genRedisInfoString(char *section) {
             "sync_full:%lld\r\n"
             "sync_partial_ok:%lld\r\n"
             "sync_partial_err:%lld\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n"
             "expired_keys:%lld\r\n"
             "evicted_keys:%lld\r\n"
+            "evicted_clients:%lld\r\n"
             "keyspace_hits:%lld\r\n"
             "keyspace_misses:%lld\r\n"
             "pubsub_channels:%ld\r\n"
@@ -2650,8 +2789,11 @@ sds genRedisInfoString(char *section) {
             server.stat_sync_full,
             server.stat_sync_partial_ok,
             server.stat_sync_partial_err,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed,
             server.stat_expiredkeys,
             server.stat_evictedkeys,
+            server.stat_evictedclients,
             server.stat_keyspace_hits,
             server.stat_keyspace_misses,
             dictSize(server.pubsub_channels),
@@ -2792,6 +2934,24 @@ sds genRedisInfoString(char *section) {
         (float)c_ru.ru_utime.tv_sec+(float)c_ru.ru_utime.tv_usec/1000000);
     }
 
+    /* Event loop */
+    if (allsections || defsections || !strcasecmp(section,"eventloop")) {
+        aeLoopStats *stats = &server.el->stats;
+
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscatprintf(info,
+            "# Eventloop\r\n"
+            "eventloop_cycles:%lld\r\n",
+            stats->iterations);
+        info = genEventLoopHistogramInfo(info,"poll_usec",&stats->poll);
+        info = genEventLoopHistogramInfo(info,"file_events_usec",&stats->file);
+        info = genEventLoopHistogramInfo(info,"time_events_usec",&stats->time);
+        info = genEventLoopHistogramInfo(info,"before_sleep_usec",
+            &stats->beforesleep);
+        info = genEventLoopHistogramInfo(info,"events_per_cycle",
+            &stats->events);
+    }
+
     /* cmdtime */
     if (allsections || !strcasecmp(section,"commandstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -2894,6 +3054,17 @@ int freeMemoryIfNeeded(void) {
         mem_used -= aofRewriteBufferSize();
     }
 
+    /* With maxmemory-clients the client buffers have their own budget,
+     * enforced by evictClients(): don't evict keys because of them. Only
+     * the memory owned by the clients is counted there, not the values
+     * their replies reference, see getClientMemoryUsage(). */
+    if (server.maxmemory_clients) {
+        if (server.clients_mem_usage > mem_used)
+            mem_used = 0;
+        else
+            mem_used -= server.clients_mem_usage;
+    }
+
     /* Check if we are over the memory limit. */
     if (mem_used <= server.maxmemory) return REDIS_OK;
 
@@ -61,6 +61,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #include "zmalloc.h" /* total memory usage aware version of malloc/free 内存申请管理库 */
 #include "anet.h"    /* Networking the easy way  网络操作库 */
 #include "ziplist.h" /* Compact list data structure  压缩列表 */
+#include "listpack.h" /* Compact list without cascading updates 紧凑列表 */
+#include "quicklist.h" /* Lists are encoded as linked list of ziplists 快速列表 */
+#include "zbtree.h"   /* B+tree for large sorted sets 有序集合B+树 */
+#include "roaring.h"  /* Compressed bitmaps for SETBIT strings 压缩位图 */
+#include "chunkstr.h" /* Segmented strings for large APPEND values 分段字符串 */
 #include "intset.h"  /* Compact integer set structure 整形set结构体 */
 #include "version.h" /* Version macro  版本号文件*/
 #include "util.h"    /* Misc functions useful in many places 同样方法类*/
@@ -155,6 +160,8 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_MAX_HZ            500
 #define REDIS_SERVERPORT        6379    /* TCP port */
 #define REDIS_TCP_BACKLOG       511     /* TCP listen backlog */
+#define REDIS_DEFAULT_TCP_LISTENERS 1   /* Listening sockets per address */
+#define REDIS_TCP_LISTENERS_MAX 16
 #define REDIS_MAXIDLETIME       0       /* default client timeout: infinite */
 #define REDIS_DEFAULT_DBNUM     16
 #define REDIS_CONFIGLINE_MAX    1024
@@ -185,6 +192,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_DEFAULT_CLUSTER_CONFIG_FILE "nodes.conf"
 #define REDIS_DEFAULT_DAEMONIZE 0
 #define REDIS_DEFAULT_UNIX_SOCKET_PERM 0
+#define REDIS_DEFAULT_UNIX_SOCKET_SHMRING 0
 #define REDIS_DEFAULT_TCP_KEEPALIVE 0
 #define REDIS_DEFAULT_LOGFILE ""
 #define REDIS_DEFAULT_SYSLOG_ENABLED 0
@@ -196,6 +204,7 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_DEFAULT_SLAVE_READ_ONLY 1
 #define REDIS_DEFAULT_REPL_DISABLE_TCP_NODELAY 0
 #define REDIS_DEFAULT_MAXMEMORY 0
+#define REDIS_DEFAULT_MAXMEMORY_CLIENTS 0
 #define REDIS_DEFAULT_MAXMEMORY_SAMPLES 3
 #define REDIS_DEFAULT_AOF_FILENAME "appendonly.aof"
 #define REDIS_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
@@ -209,6 +218,10 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_BINDADDR_MAX 16
 #define REDIS_MIN_RESERVED_FDS 32
 #define REDIS_DEFAULT_LATENCY_MONITOR_THRESHOLD 0
+#define REDIS_DEFAULT_IO_THREADS_NUM 1          /* Single threaded by default */
+#define REDIS_DEFAULT_IO_THREADS_DO_READS 0     /* Threads only for writes */
+#define REDIS_DEFAULT_IO_URING_COMPLETION 0     /* Readiness events by default */
+#define REDIS_IO_THREADS_MAX_NUM 128
 
 #define ACTIVE_EXPIRE_CYCLE_LOOKUPS_PER_LOOP 20 /* Loopkups per loop. */
 #define ACTIVE_EXPIRE_CYCLE_FAST_DURATION 1000 /* Microseconds */
@@ -220,6 +233,14 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_MAX_QUERYBUF_LEN  (1024*1024*1024) /* 1GB max query buffer. */
 #define REDIS_IOBUF_LEN         (1024*16)  /* Generic I/O buffer size */
 #define REDIS_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
+#define REDIS_REPLY_ZEROCOPY_BYTES (4*1024) /* Referenced, not copied, replies */
+#define REDIS_REPLY_BUF_POOL_MAX 128 /* Free reply buffers kept for reuse */
+#define REDIS_REPLY_BUF_IDLE_TIME 2 /* Seconds before an idle client releases it */
+
+/* Clients are indexed by memory usage in power of two buckets, the first
+ * one for less than 64k, the last one for 8GB or more. */
+#define REDIS_CLIENT_MEM_BUCKETS 19
+#define REDIS_CLIENT_MEM_BUCKET_MIN_LOG 15
 #define REDIS_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define REDIS_MBULK_BIG_ARG     (1024*32)
 #define REDIS_LONGSTR_SIZE      21          /* Bytes needed for long -> str */
@@ -263,10 +284,16 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_ENCODING_INT 1     /* Encoded as integer */
 #define REDIS_ENCODING_HT 2      /* Encoded as hash table */
 #define REDIS_ENCODING_ZIPMAP 3  /* Encoded as zipmap */
-#define REDIS_ENCODING_LINKEDLIST 4 /* Encoded as regular linked list */
+#define REDIS_ENCODING_LINKEDLIST 4 /* No longer used: old list encoding. */
 #define REDIS_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
 #define REDIS_ENCODING_INTSET 6  /* Encoded as intset */
 #define REDIS_ENCODING_SKIPLIST 7  /* Encoded as skiplist */
+#define REDIS_ENCODING_EMBSTR 8  /* Embedded sds string encoding */
+#define REDIS_ENCODING_QUICKLIST 9 /* Encoded as linked list of ziplists */
+#define REDIS_ENCODING_LISTPACK 10 /* Encoded as listpack */
+#define REDIS_ENCODING_BTREE 11 /* Encoded as B+tree */
+#define REDIS_ENCODING_ROARING 12 /* Encoded as roaring bitmap */
+#define REDIS_ENCODING_CHUNKED 13 /* Encoded as list of fixed size segments */
 
 /* Defines related to the dump file format. To store 32 bits lengths for short
  * keys requires a lot of space, so we check the most significant 2 bits of
@@ -321,6 +348,14 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_PRE_PSYNC (1<<16)   /* Instance don't understand PSYNC. */
 #define REDIS_READONLY (1<<17)    /* Cluster client is in read-only state. */
 #define REDIS_PUBSUB (1<<18)      /* Client is in Pub/Sub mode. */
+#define REDIS_PENDING_READ (1<<19) /* Queued for a read by the I/O threads. */
+#define REDIS_PENDING_WRITE (1<<20) /* Queued for a write by the I/O threads. */
+#define REDIS_PENDING_COMMAND (1<<21) /* An I/O thread parsed a command in
+                                         argv, waiting to be executed. */
+#define REDIS_SHMRING (1<<22) /* Requests and replies go through the shared
+                                 memory rings of c->shm, see SHMRING. */
+#define REDIS_IO_COMPLETION (1<<23) /* Reads and writes are submitted to the
+                                       event loop, see aeIoSubmitRead(). */
 
 /* Client request types */
 #define REDIS_REQ_INLINE 1
@@ -388,9 +423,20 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_HASH_MAX_ZIPLIST_VALUE 64
 #define REDIS_LIST_MAX_ZIPLIST_ENTRIES 512
 #define REDIS_LIST_MAX_ZIPLIST_VALUE 64
+#define REDIS_LIST_MAX_ZIPLIST_SIZE -2
+#define REDIS_LIST_COMPRESS_DEPTH 0
 #define REDIS_SET_MAX_INTSET_ENTRIES 512
 #define REDIS_ZSET_MAX_ZIPLIST_ENTRIES 128
 #define REDIS_ZSET_MAX_ZIPLIST_VALUE 64
+#define REDIS_ZSET_MAX_SKIPLIST_ENTRIES 65536
+
+/* SETBIT turns a raw string into a roaring bitmap instead of growing it by
+ * more than this number of bytes. */
+#define REDIS_BITMAP_MAX_RAW_GROWTH (64*1024)
+
+/* APPEND and SETRANGE turn a string into a chunked string when it gets
+ * longer than this number of bytes. */
+#define REDIS_STRING_CHUNKED_MIN_LEN (1024*1024)
 
 /* HyperLogLog defines */
 #define REDIS_DEFAULT_HLL_SPARSE_MAX_BYTES 3000
@@ -409,6 +455,11 @@ typedef long long mstime_t; /* millisecond time type. */
 #define REDIS_MAXMEMORY_NO_EVICTION 5
 #define REDIS_DEFAULT_MAXMEMORY_POLICY REDIS_MAXMEMORY_VOLATILE_LRU
 
+/* Hash table used for the keyspace and the expires of every DB */
+#define REDIS_KEYSPACE_TABLE_CHAINED 0  /* dictCreate() */
+#define REDIS_KEYSPACE_TABLE_SWISS 1    /* dictCreateSwiss() */
+#define REDIS_DEFAULT_KEYSPACE_TABLE REDIS_KEYSPACE_TABLE_CHAINED
+
 /* Scripting */
 #define REDIS_LUA_TIME_LIMIT 5000 /* milliseconds */
 
@@ -506,6 +557,11 @@ typedef struct redisObject {
     _var.ptr = _ptr; \
 } while(0);
 
+/* True if the object is a string represented by an sds: RAW or EMBSTR.
+ * The sds of an EMBSTR object is allocated with the object and can't be
+ * modified, use dbUnshareStringValue() to get a RAW object first. */
+#define sdsEncodedObject(objptr) (objptr->encoding == REDIS_ENCODING_RAW || objptr->encoding == REDIS_ENCODING_EMBSTR)
+
 typedef struct redisDb {
     dict *dict;                 /* The keyspace for this DB */
     dict *expires;              /* Timeout of keys with a timeout set */
@@ -557,6 +613,16 @@ typedef struct readyList {
 
 /* With multiplexing we need to take per-client state.
  * Clients are taken in a liked list. */
+/* Node of the client reply list: 'used' bytes of protocol in a buffer of
+ * 'size' bytes that following replies fill in place, or, when 'obj' is not
+ * NULL, a reference to a big string value that is sent without copying it
+ * (and then 'size' and 'used' are zero). */
+typedef struct clientReplyBlock {
+    size_t size, used;
+    robj *obj;
+    char buf[];
+} clientReplyBlock;
+
 typedef struct redisClient {
     uint64_t id;            /* Client incremental unique ID. */
     int fd;
@@ -571,8 +637,9 @@ typedef struct redisClient {
     int reqtype;
     int multibulklen;       /* number of multi bulk arguments left to read */
     long bulklen;           /* length of bulk argument in multi bulk request */
-    list *reply;
-    unsigned long reply_bytes; /* Tot bytes of objects in reply list */
+    list *reply;            /* List of clientReplyBlock */
+    unsigned long reply_bytes; /* Tot bytes of blocks in reply list */
+    unsigned long reply_ref_bytes; /* Part of reply_bytes in referenced values */
     int sentlen;            /* Amount of bytes already sent in the current
                                buffer or object being sent. */
     time_t ctime;           /* Client creation time */
@@ -595,10 +662,25 @@ typedef struct redisClient {
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
     sds peerid;             /* Cached peer ID. */
+    sds proto_err;          /* Protocol error to reply, set by the parser. */
+
+    /* Results of the last read/write, possibly done by an I/O thread */
+    int io_nread;           /* Bytes read, 0 on EOF, -1 on error. */
+    int io_nwritten;        /* Bytes written. */
+    int io_sentobjs;        /* Reply list blocks completely written. */
+    int io_errno;           /* errno of the failed read/write, or 0. */
+
+    /* Memory usage as last seen by updateClientMemUsage() */
+    size_t mem_usage;       /* Query and output buffers memory. */
+    int mem_bucket;         /* Index in server.clients_mem_buckets, or -1. */
+    listNode *mem_bucket_node; /* Node of the client in its bucket. */
 
-    /* Response buffer */
+    struct shmRingConn *shm; /* Shared memory transport, if REDIS_SHMRING. */
+
+    /* Response buffer: REDIS_REPLY_CHUNK_BYTES allocated when the first
+     * reply is added, and given back by clientsCron() once idle. */
     int bufpos;
-    char buf[REDIS_REPLY_CHUNK_BYTES];
+    char *buf;
 } redisClient;
 
 struct saveparam {
@@ -638,11 +720,19 @@ typedef struct zskiplist {
     int level;
 } zskiplist;
 
+/* A skiplist encoded sorted set uses 'zsl', and the values of its dict point
+ * to the scores stored in the skiplist nodes. A B+tree encoded one uses
+ * 'zbt', and the scores are stored in the dict entries themselves, as the
+ * elements move inside the tree. zsetDictScore() reads both. */
 typedef struct zset {
     dict *dict;
     zskiplist *zsl;
+    zbtree *zbt;
 } zset;
 
+#define zsetDictScore(zobj,de) ((zobj)->encoding == REDIS_ENCODING_BTREE ? \
+    dictGetDoubleVal(de) : *(double*)dictGetVal(de))
+
 typedef struct clientBufferLimitsConfig {
     unsigned long long hard_limit_bytes;
     unsigned long long soft_limit_bytes;
@@ -696,6 +786,7 @@ struct redisServer {
     unsigned lruclock:REDIS_LRU_BITS; /* Clock for LRU eviction */
     int shutdown_asap;          /* SHUTDOWN needed ASAP */
     int activerehashing;        /* Incremental rehash in serverCron() */
+    int keyspace_table;         /* REDIS_KEYSPACE_TABLE_* */
     char *requirepass;          /* Pass for AUTH command, or NULL */
     char *pidfile;              /* PID file path */
     int arch_bits;              /* 32 or 64 depending on sizeof(long) */
@@ -705,15 +796,30 @@ struct redisServer {
     /* Networking */
     int port;                   /* TCP listening port */
     int tcp_backlog;            /* TCP listen() backlog */
+    int io_threads_num;         /* Number of I/O threads, 1 = no threads */
+    int io_threads_do_reads;    /* Read and parse queries in I/O threads */
+    int io_uring_completion;    /* Completion based client I/O if possible */
+    int io_completion;          /* Completion based client I/O is in use */
+    list *clients_pending_read; /* Clients waiting for a threaded read */
+    list *clients_pending_write; /* Clients waiting for a threaded write */
     char *bindaddr[REDIS_BINDADDR_MAX]; /* Addresses we should bind to */
     int bindaddr_count;         /* Number of addresses in server.bindaddr[] */
     char *unixsocket;           /* UNIX socket path */
     mode_t unixsocketperm;      /* UNIX socket permission */
-    int ipfd[REDIS_BINDADDR_MAX]; /* TCP socket file descriptors */
+    int unixsocket_shmring;     /* Allow SHMRING on the UNIX socket */
+    int tcp_listeners;          /* SO_REUSEPORT listening sockets per address */
+    int ipfd[REDIS_BINDADDR_MAX*REDIS_TCP_LISTENERS_MAX]; /* TCP socket file descriptors */
     int ipfd_count;             /* Used slots in ipfd[] */
     int sofd;                   /* Unix socket file descriptor */
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
+    char *reply_buf_pool;       /* Free client reply buffers, linked by the
+                                   first pointer stored in every buffer. */
+    unsigned long reply_buf_pool_len; /* Buffers in reply_buf_pool. */
+    unsigned long reply_buf_used; /* Buffers currently owned by clients. */
+    list *clients_mem_buckets[REDIS_CLIENT_MEM_BUCKETS]; /* Normal clients
+                                   indexed by memory usage, for eviction. */
+    size_t clients_mem_usage;   /* Memory used by the indexed clients. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     redisClient *current_client; /* Current client, only used on crash report */
     char neterr[ANET_ERR_LEN];   /* Error buffer for anet.c */
@@ -733,6 +839,7 @@ struct redisServer {
     long long stat_numconnections;  /* Number of connections received */
     long long stat_expiredkeys;     /* Number of expired keys */
     long long stat_evictedkeys;     /* Number of evicted keys (maxmemory) */
+    long long stat_evictedclients;  /* Clients evicted (maxmemory-clients) */
     long long stat_keyspace_hits;   /* Number of successful lookups of keys */
     long long stat_keyspace_misses; /* Number of failed lookups of keys */
     size_t stat_peak_memory;        /* Max used memory record */
@@ -742,6 +849,8 @@ struct redisServer {
     long long stat_sync_full;       /* Number of full resyncs with slaves. */
     long long stat_sync_partial_ok; /* Number of accepted PSYNC requests. */
     long long stat_sync_partial_err;/* Number of unaccepted PSYNC requests. */
+    long long stat_io_reads_processed; /* Reads handled by the I/O threads. */
+    long long stat_io_writes_processed; /* Writes handled by the I/O threads. */
     list *slowlog;                  /* SLOWLOG list of commands */
     long long slowlog_entry_id;     /* SLOWLOG current entry ID */
     long long slowlog_log_slower_than; /* SLOWLOG time limit (to get logged) */
@@ -856,6 +965,7 @@ struct redisServer {
     /* Limits */
     unsigned int maxclients;            /* Max number of simultaneous clients */
     unsigned long long maxmemory;   /* Max number of memory bytes to use */
+    unsigned long long maxmemory_clients; /* Max memory of all the clients */
     int maxmemory_policy;           /* Policy for key eviction */
     int maxmemory_samples;          /* Pricision of random sampling */
     /* Blocked clients */
@@ -873,9 +983,13 @@ struct redisServer {
     size_t hash_max_ziplist_value;
     size_t list_max_ziplist_entries;
     size_t list_max_ziplist_value;
+    int list_max_ziplist_size;      /* Fill factor of the quicklist nodes */
+    int list_compress_depth;        /* Quicklist nodes never compressed at
+                                       each end, 0 disables compression */
     size_t set_max_intset_entries;
     size_t zset_max_ziplist_entries;
     size_t zset_max_ziplist_value;
+    size_t zset_max_skiplist_entries; /* Bigger sorted sets use a B+tree */
     size_t hll_sparse_max_bytes;
     time_t unixtime;        /* Unix time sampled every cron cycle. */
     long long mstime;       /* Like 'unixtime' but with milliseconds resolution. */
@@ -955,14 +1069,14 @@ typedef struct {
     unsigned char encoding;
     unsigned char direction; /* Iteration direction */
     unsigned char *zi;
-    listNode *ln;
+    quicklistIter *iter;
 } listTypeIterator;
 
 /* Structure for an entry while iterating over a list. */
 typedef struct {
     listTypeIterator *li;
-    unsigned char *zi;  /* Entry in ziplist */
-    listNode *ln;       /* Entry in linked list */
+    unsigned char *zi;  /* Entry in listpack */
+    quicklistEntry entry; /* Entry in quicklist */
 } listTypeEntry;
 
 /* Structure to hold set iteration abstraction. */
@@ -998,6 +1112,7 @@ extern struct redisServer server;
 extern struct sharedObjectsStruct shared;
 extern dictType setDictType;
 extern dictType zsetDictType;
+extern zbtreeType zsetBtreeType;
 extern dictType dbDictType;
 extern dictType shaScriptObjectDictType;
 extern double R_Zero, R_PosInf, R_NegInf, R_Nan;
@@ -1065,7 +1180,13 @@ void addReplyDouble(redisClient *c, double d);
 void addReplyLongLong(redisClient *c, long long ll);
 void addReplyMultiBulkLen(redisClient *c, long length);
 void copyClientOutputBuffer(redisClient *dst, redisClient *src);
+void releaseClientReplyBuffer(redisClient *c);
 void *dupClientReplyValue(void *o);
+void freeClientReplyValue(void *o);
+size_t getClientMemoryUsage(redisClient *c);
+void updateClientMemUsage(redisClient *c);
+void removeClientFromMemUsageBuckets(redisClient *c);
+int evictClients(void);
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer);
 void formatPeerId(char *peerid, size_t peerid_len, char *ip, int port);
@@ -1083,6 +1204,10 @@ char *getClientTypeName(int class);
 void flushSlavesOutputBuffers(void);
 void disconnectSlaves(void);
 int processEventsWhileBlocked(void);
+void initThreadedIO(void);
+void initCompletionIO(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
 
 #ifdef __GNUC__
 void addReplyErrorFormat(redisClient *c, const char *fmt, ...)
@@ -1134,6 +1259,8 @@ void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
 robj *createObject(int type, void *ptr);
 robj *createStringObject(char *ptr, size_t len);
+robj *createRawStringObject(char *ptr, size_t len);
+robj *createEmbeddedStringObject(char *ptr, size_t len);
 robj *dupStringObject(robj *o);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
 robj *tryObjectEncoding(robj *o);
@@ -1141,13 +1268,17 @@ robj *getDecodedObject(robj *o);
 size_t stringObjectLen(robj *o);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value);
-robj *createListObject(void);
-robj *createZiplistObject(void);
+robj *createQuicklistObject(void);
+robj *createListpackObject(void);
 robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 robj *createZsetObject(void);
-robj *createZsetZiplistObject(void);
+robj *createZsetListpackObject(void);
+robj *createZsetBtreeObject(void);
+robj *createStringRoaringObject(roaringBitmap *rb);
+robj *createStringChunkedObject(chunkString *cs);
+void stringObjectToRaw(robj *o);
 int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *msg);
 int checkType(redisClient *c, robj *o, int type);
 int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg);
@@ -1272,6 +1403,9 @@ robj *setTypeNextObject(setTypeIterator *si);
 int setTypeRandomElement(robj *setobj, robj **objele, int64_t *llele);
 unsigned long setTypeSize(robj *subject);
 void setTypeConvert(robj *subject, int enc);
+int setTypeAllIntsets(robj **sets, unsigned long setnum);
+robj *setTypeCreateFromIntset(intset *is);
+int getIntercardArgsOrReply(redisClient *c, long *numkeys, long *limit);
 
 /* Hash data type */
 void hashTypeConvert(robj *o, int enc);
@@ -1285,10 +1419,10 @@ unsigned long hashTypeLength(robj *o);
 hashTypeIterator *hashTypeInitIterator(robj *subject);
 void hashTypeReleaseIterator(hashTypeIterator *hi);
 int hashTypeNext(hashTypeIterator *hi);
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll);
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll);
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst);
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what);
 robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key);
@@ -1331,6 +1465,7 @@ int dbExists(redisDb *db, robj *key);
 robj *dbRandomKey(redisDb *db);
 int dbDelete(redisDb *db, robj *key);
 robj *dbUnshareStringValue(redisDb *db, robj *key, robj *o);
+robj *dbUnshareChunkedStringValue(redisDb *db, robj *key, robj *o);
 long long emptyDb(void(callback)(void*));
 int selectDb(redisClient *c, int id);
 void signalModifiedKey(redisDb *db, robj *key);
@@ -1347,6 +1482,7 @@ void getKeysFreeResult(int *result);
 int *noPreloadGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags);
 int *renameGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags);
 int *zunionInterGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags);
+int *intercardGetKeys(struct redisCommand *cmd,robj **argv, int argc, int *numkeys, int flags);
 
 /* Sentinel */
 void initSentinelConfig(void);
@@ -1419,6 +1555,7 @@ void spopCommand(redisClient *c);
 void srandmemberCommand(redisClient *c);
 void sinterCommand(redisClient *c);
 void sinterstoreCommand(redisClient *c);
+void sintercardCommand(redisClient *c);
 void sunionCommand(redisClient *c);
 void sunionstoreCommand(redisClient *c);
 void sdiffCommand(redisClient *c);
@@ -1481,6 +1618,7 @@ void hlenCommand(redisClient *c);
 void zremrangebyrankCommand(redisClient *c);
 void zunionstoreCommand(redisClient *c);
 void zinterstoreCommand(redisClient *c);
+void zintercardCommand(redisClient *c);
 void zscanCommand(redisClient *c);
 void hkeysCommand(redisClient *c);
 void hvalsCommand(redisClient *c);
@@ -1503,6 +1641,7 @@ void migrateCommand(redisClient *c);
 void dumpCommand(redisClient *c);
 void objectCommand(redisClient *c);
 void clientCommand(redisClient *c);
+void shmringCommand(redisClient *c);
 void evalCommand(redisClient *c);
 void evalShaCommand(redisClient *c);
 void scriptCommand(redisClient *c);
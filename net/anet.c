@@ -234,6 +234,25 @@ static int anetSetReuseAddr(char *err, int fd) {
     return ANET_OK;
 }
 
+/* Allow several listening sockets to bind the same address and port. The
+ * kernel then spreads the incoming connections among them. */
+/* 设置socket端口重用，多个监听socket可以绑定同一个地址，由内核分发连接 */
+static int anetSetReusePort(char *err, int fd) {
+#ifdef SO_REUSEPORT
+    int yes = 1;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1) {
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+#else
+    ((void) fd);
+    anetSetError(err, "SO_REUSEPORT is not supported on this system");
+    return ANET_ERR;
+#endif
+}
+
 /* anet创建socket连接 */
 static int anetCreateSocket(char *err, int domain) {
     int s;
@@ -423,7 +442,7 @@ static int anetV6Only(char *err, int s) {
     return ANET_OK;
 }
 
-static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog)
+static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backlog, int flags)
 {
     int s, rv;
     char _port[6];  /* strlen("65535") */
@@ -446,6 +465,8 @@ static int _anetTcpServer(char *err, int port, char *bindaddr, int af, int backl
         if (af == AF_INET6 && anetV6Only(err,s) == ANET_ERR) goto error;
         //设置地址重用
         if (anetSetReuseAddr(err,s) == ANET_ERR) goto error;
+        if (flags & ANET_REUSEPORT && anetSetReusePort(err,s) == ANET_ERR)
+            goto error;
         //设置端口监听
         if (anetListen(err,s,p->ai_addr,p->ai_addrlen,backlog) == ANET_ERR) goto error;
         goto end;
@@ -464,12 +485,25 @@ end:
 
 int anetTcpServer(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_NONE);
 }
 
 int anetTcp6Server(char *err, int port, char *bindaddr, int backlog)
 {
-    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog);
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_NONE);
+}
+
+/* Like anetTcpServer() but with SO_REUSEPORT set, so that more sockets
+ * can listen on the same address at the same time. */
+/* 创建设置了SO_REUSEPORT的TCP监听socket */
+int anetTcpReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET, backlog, ANET_REUSEPORT);
+}
+
+int anetTcp6ReusePortServer(char *err, int port, char *bindaddr, int backlog)
+{
+    return _anetTcpServer(err, port, bindaddr, AF_INET6, backlog, ANET_REUSEPORT);
 }
 
 int anetUnixServer(char *err, char *path, mode_t perm, int backlog)
@@ -28,23 +28,46 @@
  */
 
 #include "redis.h"
+#include "respscan.h"
+#include "shmring.h"
 #include <sys/uio.h>
 #include <math.h>
 
-static void setProtocolError(redisClient *c, int pos);
+/* Max iovec entries gathered by a single writev() in writeClientSocket(). */
+#if defined(IOV_MAX) && IOV_MAX < 64
+#define REDIS_WRITE_IOV_MAX IOV_MAX
+#else
+#define REDIS_WRITE_IOV_MAX 64
+#endif
+
+static void setProtocolError(redisClient *c, sds err, int pos);
+static int postponeClientRead(redisClient *c);
+static void readQueryDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res);
+static void sendReplyDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res);
+static int enableClientCompletionIO(redisClient *c);
+
+/* Set while processEventsWhileBlocked() is running. */
+static int processing_events_while_blocked = 0;
 
 /* To evaluate the output buffer size of a client we need to get size of
  * allocated objects, however we can't used zmalloc_size() directly on sds
  * strings because of the trick they use to work (the header is before the
  * returned pointer), so we use this helper function. */
 size_t zmalloc_size_sds(sds s) {
-    return zmalloc_size(s-sizeof(struct sdshdr));
+    return zmalloc_size(sdsAllocPtr(s));
 }
 
 /* ------------ API ---------------------- */
 void *dupClientReplyValue(void *o)	/* 复制value一份 */
+void freeClientReplyValue(void *o) /* 释放回复列表中的一个块 */
 int listMatchObjects(void *a, void *b) /* 比价2个obj是否相等 */
-robj *dupLastObjectIfNeeded(list *reply) /* 返回回复列表中最后一个元素对象 */
+static size_t replyBlockAllocSize(clientReplyBlock *b) /* 返回回复块占用的内存大小，包括引用的对象 */
+static char *replyBlockData(clientReplyBlock *b) /* 返回回复块中待发送的数据 */
+static size_t replyBlockLen(clientReplyBlock *b) /* 返回回复块中待发送数据的长度 */
+static char *replyBufferGet(void) /* 从回收池中获取一个回复buffer，池为空时新申请 */
+static void replyBufferPut(char *buf) /* 将回复buffer放回回收池，池满时直接释放 */
+static void clientReplyBufferAlloc(redisClient *c) /* 确保Client拥有回复buffer */
+void releaseClientReplyBuffer(redisClient *c) /* 将Client的回复buffer交还给回收池 */
 void copyClientOutputBuffer(redisClient *dst, redisClient *src) /* 将源Client的输出buffer复制给目标Client */
 static void acceptCommonHandler(int fd, int flags) /* 网络连接后的调用方法 */
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask)
@@ -56,6 +79,7 @@ int processEventsWhileBlocked(void)
 
 /* ------------- addReply API -----------------   */
 int _addReplyToBuffer(redisClient *c, char *s, size_t len) /* 往客户端缓冲区中添加内容 */
+static void _addReplyReferenceToList(redisClient *c, robj *o) /* 在回复列表中添加一个直接引用对象的块 */
 void _addReplyObjectToList(redisClient *c, robj *o) /* robj添加到reply的列表中 */
 void _addReplySdsToList(redisClient *c, sds s) /* 在回复列表中添加Sds字符串对象 */
 void _addReplyStringToList(redisClient *c, char *s, size_t len) /* 在回复列表中添加字符串对象,参数中已经给定字符的长度 */
@@ -87,13 +111,30 @@ static void freeClientArgv(redisClient *c)
 void freeClient(redisClient *c) /* 释放freeClient，要分为Master和Slave2种情况作不同的处理 */
 void freeClientAsync(redisClient *c)
 void freeClientsInAsyncFreeQueue(void) /* 异步的free客户端 */
+static ssize_t clientWritev(redisClient *c, const struct iovec *iov, int iovcnt) /* 写出回复数据，共享内存连接写入回复环，基于完成通知的连接提交给事件循环 */
+static void writeClientSocket(redisClient *c) /* 把Client的回复数据写入socket，只修改Client自身的状态，I/O线程中也可以调用 */
+static int handleClientWrite(redisClient *c) /* 写socket之后的处理：释放已发送的回复对象，处理错误，安装或删除写事件 */
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) /* 将Client中的reply数据存入文件中 */
 void resetClient(redisClient *c)
+static size_t queryBufReadable(redisClient *c, size_t pos) /* 返回从查询缓冲pos位置开始可以安全读取的字节数 */
 int processInlineBuffer(redisClient *c) /* 处理redis Client的内链的buffer，就是c->querybuf */
-static void setProtocolError(redisClient *c, int pos)
+static void setProtocolError(redisClient *c, sds err, int pos) /* 记录协议错误，由主线程回复 */
+static void replyProtocolError(redisClient *c) /* 回复解析时发现的协议错误，并在回复完成后关闭Client */
 int processMultibulkBuffer(redisClient *c) /* 处理大块的buffer */
+static int parseInputBuffer(redisClient *c) /* 从查询缓冲中解析出一条命令 */
 void processInputBuffer(redisClient *c) /* 处理redisClient的查询buffer */
+static int clientReadLen(redisClient *c) /* 计算下一次读取查询缓冲的字节数 */
+static void readClientSocket(redisClient *c) /* 从socket读取数据到查询缓冲，I/O线程中也可以调用 */
+static int handleClientRead(redisClient *c) /* 读socket之后的处理：错误处理，缓冲区限制检查 */
 void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) /* 从Client获取查询query语句 */
+static int submitClientRead(redisClient *c) /* 基于完成通知的读写：Client始终有一个提交给事件循环的读请求 */
+static void readQueryDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res) /* 基于完成通知的读完成后的回调 */
+static void sendReplyDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res) /* 基于完成通知的写完成后的回调 */
+static int enableClientCompletionIO(redisClient *c) /* 把新连接的Client切换到基于完成通知的读写 */
+void initCompletionIO(void) /* 根据配置和事件循环的能力决定是否启用基于完成通知的读写 */
+void readQueryFromRing(aeEventLoop *el, int fd, void *privdata, int mask) /* 从共享内存的请求环中获取查询语句 */
+void readSocketOfRingClient(aeEventLoop *el, int fd, void *privdata, int mask) /* 共享内存客户端的socket只用于发现连接断开 */
+void shmringCommand(redisClient *c) /* 把unix socket上的连接切换到共享内存传输 */
 void getClientsMaxBuffers(unsigned long *longest_output_list,
                           unsigned long *biggest_input_buffer) /* 获取Client中输入buffer和输出buffer的最大长度值 */
 void formatPeerId(char *peerid, size_t peerid_len, char *ip, int port) /* 格式化ip,port端口号的输出，ip:port */
@@ -110,12 +151,45 @@ int getClientTypeByName(char *name) /* Client中的名字的3种类型，normal,
 char *getClientTypeName(int class)
 int checkClientOutputBufferLimits(redisClient *c) /* 判断Clint的输出缓冲区的已经占用大小是否超过软限制或是硬限制 */
 void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) /* 异步的关闭Client，如果缓冲区中的软限制或是硬限制已经到达的时候，缓冲区超出限制的结果会导致释放不安全， */
-
+size_t getClientMemoryUsage(redisClient *c) /* 获取Client的输入输出缓冲占用的内存 */
+static int clientMemUsageBucket(size_t mem) /* 根据内存大小计算Client所在的桶 */
+void removeClientFromMemUsageBuckets(redisClient *c) /* 将Client从内存索引中移除 */
+void updateClientMemUsage(redisClient *c) /* 更新Client的内存占用以及所在的桶 */
+int evictClients(void) /* 所有Client内存超过maxmemory-clients时，从占用最多的开始关闭Client */
+
+/* ------------- I/O threads API -----------------   */
+void *IOThreadMain(void *myid) /* I/O线程的主循环，等待主线程分配的Client并执行读或写 */
+void initThreadedIO(void) /* 创建I/O线程 */
+static int postponeClientRead(redisClient *c) /* 开启线程读时，把Client加入等待读的列表 */
+static void runThreadedIO(list *clients, int op) /* 把Client分配给I/O线程执行读或写，并等待全部完成 */
+int handleClientsWithPendingReadsUsingThreads(void) /* 用I/O线程读取并解析等待读的Client，然后在主线程中执行命令 */
+int handleClientsWithPendingWritesUsingThreads(void) /* 用I/O线程写出等待写的Client的回复 */
+
+/* Duplicate a block of the reply list: the bytes are copied, while a
+ * referenced object is just referenced once more. */
 /* 复制value一份 */
 void *dupClientReplyValue(void *o) {
-	//增加对此obj的引用计数
-    incrRefCount((robj*)o);
-    return o;
+    clientReplyBlock *old = o, *new;
+
+    new = zmalloc(sizeof(*new)+old->size);
+    new->size = old->size;
+    new->used = old->used;
+    new->obj = old->obj;
+    if (new->obj) {
+        //增加对此obj的引用计数
+        incrRefCount(new->obj);
+    } else {
+        memcpy(new->buf,old->buf,old->used);
+    }
+    return new;
+}
+
+/* 释放回复列表中的一个块 */
+void freeClientReplyValue(void *o) {
+    clientReplyBlock *b = o;
+
+    if (b->obj) decrRefCount(b->obj);
+    zfree(b);
 }
 
 /* 比价2个obj是否相等 */
@@ -153,6 +227,7 @@ redisClient *createClient(int fd) {
     c->fd = fd;
     c->name = NULL;
     c->bufpos = 0;
+    c->buf = NULL;
     c->querybuf = sdsempty();
     c->querybuf_peak = 0;
     c->reqtype = 0;
@@ -163,6 +238,15 @@ redisClient *createClient(int fd) {
     c->bulklen = -1;
     c->sentlen = 0;
     c->flags = 0;
+    c->io_nread = 0;
+    c->io_nwritten = 0;
+    c->io_sentobjs = 0;
+    c->io_errno = 0;
+    c->proto_err = NULL;
+    c->mem_usage = 0;
+    c->mem_bucket = -1;
+    c->mem_bucket_node = NULL;
+    c->shm = NULL;
     c->ctime = c->lastinteraction = server.unixtime;
     c->authenticated = 0;
     c->replstate = REDIS_REPL_NONE;
@@ -172,8 +256,9 @@ redisClient *createClient(int fd) {
     c->slave_listening_port = 0;
     c->reply = listCreate();
     c->reply_bytes = 0;
+    c->reply_ref_bytes = 0;
     c->obuf_soft_limit_reached_time = 0;
-    listSetFreeMethod(c->reply,decrRefCountVoid);
+    listSetFreeMethod(c->reply,freeClientReplyValue);
     listSetDupMethod(c->reply,dupClientReplyValue);
     c->bpop.keys = dictCreate(&setDictType,NULL);
     c->bpop.timeout = 0;
@@ -209,6 +294,37 @@ int prepareClientToWrite(redisClient *c) {
     if ((c->flags & REDIS_MASTER) &&
         !(c->flags & REDIS_MASTER_FORCE_REPLY)) return REDIS_ERR;
     if (c->fd <= 0) return REDIS_ERR; /* Fake client */
+
+    /* Clients using the shared memory transport never get a write handler:
+     * their replies are copied into the ring before sleeping, after the
+     * AOF is written, like the replies of the I/O threads. The same goes
+     * for clients using completion based I/O, their replies are submitted
+     * to the event loop. Slaves and monitors use plain writes instead. */
+    if ((c->flags & REDIS_SHMRING) ||
+        (c->flags & (REDIS_IO_COMPLETION|REDIS_SLAVE)) == REDIS_IO_COMPLETION)
+    {
+        if (!(c->flags & REDIS_PENDING_WRITE)) {
+            c->flags |= REDIS_PENDING_WRITE;
+            listAddNodeHead(server.clients_pending_write,c);
+        }
+        return REDIS_OK;
+    }
+
+    /* With I/O threads enabled normal clients don't get a write handler
+     * right away: they are queued and their replies are written by the
+     * I/O threads in beforeSleep(). The handler is installed only if the
+     * socket can't take the whole reply. */
+    if (server.io_threads_num > 1 &&
+        !processing_events_while_blocked &&
+        !(c->flags & (REDIS_SLAVE|REDIS_MASTER|REDIS_PENDING_WRITE)) &&
+        c->bufpos == 0 && listLength(c->reply) == 0)
+    {
+        c->flags |= REDIS_PENDING_WRITE;
+        listAddNodeHead(server.clients_pending_write,c);
+        return REDIS_OK;
+    }
+    if (c->flags & REDIS_PENDING_WRITE) return REDIS_OK;
+
     if (c->bufpos == 0 && listLength(c->reply) == 0 &&
         (c->replstate == REDIS_REPL_NONE ||
          c->replstate == REDIS_REPL_ONLINE) &&
@@ -218,21 +334,98 @@ int prepareClientToWrite(redisClient *c) {
     return REDIS_OK;
 }
 
-/* Create a duplicate of the last object in the reply list when
- * it is not exclusively owned by the reply list. */
-/* 返回回复列表中最后一个元素对象 */
-robj *dupLastObjectIfNeeded(list *reply) {
-    robj *new, *cur;
-    listNode *ln;
-    redisAssert(listLength(reply) > 0);
-    ln = listLast(reply);
-    cur = listNodeValue(ln);
-    if (cur->refcount > 1) {
-        new = dupStringObject(cur);
-        decrRefCount(cur);
-        listNodeValue(ln) = new;
+/* The reply list is made of clientReplyBlock nodes. A block either holds
+ * 'used' bytes of protocol in its 'size' bytes buffer, so that following
+ * replies are appended in place until it is full, or references a string
+ * value of at least REDIS_REPLY_ZEROCOPY_BYTES that is sent straight from
+ * the keyspace instead of being copied.
+ *
+ * Copy on write is preserved by the refcount: commands modifying a string
+ * in place (APPEND, SETRANGE, SETBIT, ...) go through dbUnshareStringValue()
+ * that stores a new copy of the value when it is referenced elsewhere, so
+ * the referenced object is never touched while the reply is pending.
+ *
+ * c->reply_bytes is the memory used by the blocks, including the values
+ * they reference, and it is updated every time a block is added, grows or
+ * is released. It is what the output buffer limits are checked against.
+ * The referenced values belong to the keyspace, so c->reply_ref_bytes
+ * keeps their part apart for the client memory accounting, see
+ * getClientMemoryUsage(). */
+/* 返回回复块引用的对象占用的内存大小 */
+static size_t replyBlockRefSize(clientReplyBlock *b) {
+    return b->obj ? zmalloc_size_sds(b->obj->ptr) : 0;
+}
+
+/* 返回回复块占用的内存大小，包括引用的对象 */
+static size_t replyBlockAllocSize(clientReplyBlock *b) {
+    return zmalloc_size(b)+replyBlockRefSize(b);
+}
+
+/* 返回回复块中待发送的数据 */
+static char *replyBlockData(clientReplyBlock *b) {
+    return b->obj ? b->obj->ptr : b->buf;
+}
+
+/* 返回回复块中待发送数据的长度 */
+static size_t replyBlockLen(clientReplyBlock *b) {
+    return b->obj ? sdslen(b->obj->ptr) : b->used;
+}
+
+/* -----------------------------------------------------------------------------
+ * Reply buffers pool.
+ *
+ * The REDIS_REPLY_CHUNK_BYTES static reply buffer is not part of the client
+ * structure: it is taken when the first reply is added to an empty client,
+ * and clientsCron() gives it back when the client has been idle with nothing
+ * to send for REDIS_REPLY_BUF_IDLE_TIME seconds. This way many idle clients
+ * (Pub/Sub subscribers, connection pools) don't cost 16k each. Buffers given
+ * back are kept in a free list, up to REDIS_REPLY_BUF_POOL_MAX of them, so
+ * that clients going idle and active again don't hit the allocator.
+ *
+ * Only the main thread takes and releases buffers: the I/O threads just
+ * write what is already in c->buf.
+ * -------------------------------------------------------------------------- */
+
+/* 从回收池中获取一个回复buffer，池为空时新申请 */
+static char *replyBufferGet(void) {
+    char *buf = server.reply_buf_pool;
+
+    if (buf) {
+        server.reply_buf_pool = *(char**)buf;
+        server.reply_buf_pool_len--;
+    } else {
+        buf = zmalloc(REDIS_REPLY_CHUNK_BYTES);
+    }
+    server.reply_buf_used++;
+    return buf;
+}
+
+/* 将回复buffer放回回收池，池满时直接释放 */
+static void replyBufferPut(char *buf) {
+    server.reply_buf_used--;
+    if (server.reply_buf_pool_len >= REDIS_REPLY_BUF_POOL_MAX) {
+        zfree(buf);
+        return;
     }
-    return listNodeValue(ln);
+    *(char**)buf = server.reply_buf_pool;
+    server.reply_buf_pool = buf;
+    server.reply_buf_pool_len++;
+}
+
+/* 确保Client拥有回复buffer */
+static void clientReplyBufferAlloc(redisClient *c) {
+    if (c->buf == NULL) c->buf = replyBufferGet();
+}
+
+/* Give the reply buffer of the client back to the pool. Whatever it still
+ * contains is discarded, so unless the client is being freed the caller
+ * should check that c->bufpos is zero. */
+/* 将Client的回复buffer交还给回收池 */
+void releaseClientReplyBuffer(redisClient *c) {
+    if (c->buf == NULL) return;
+    replyBufferPut(c->buf);
+    c->buf = NULL;
+    c->bufpos = 0;
 }
 
 /* -----------------------------------------------------------------------------
@@ -240,7 +433,7 @@ robj *dupLastObjectIfNeeded(list *reply) {
  * -------------------------------------------------------------------------- */
 /* 往客户端缓冲区中添加内容 */
 int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
-    size_t available = sizeof(c->buf)-c->bufpos;
+    size_t available = REDIS_REPLY_CHUNK_BYTES-c->bufpos;
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return REDIS_OK;
 
@@ -252,107 +445,97 @@ int _addReplyToBuffer(redisClient *c, char *s, size_t len) {
     /* Check that the buffer has enough space available for this string. */
     if (len > available) return REDIS_ERR;
 
+    clientReplyBufferAlloc(c);
     memcpy(c->buf+c->bufpos,s,len);
     c->bufpos+=len;
     return REDIS_OK;
 }
 
-/* robj添加到reply的列表中 */
-void _addReplyObjectToList(redisClient *c, robj *o) {
-    robj *tail;
+/* Append the protocol to the reply list, filling the free space of the last
+ * block first, then allocating a new block of REDIS_REPLY_CHUNK_BYTES (or
+ * exactly of the remaining length when bigger). */
+/* 在回复列表中添加字符串对象,参数中已经给定字符的长度 */
+void _addReplyStringToList(redisClient *c, char *s, size_t len) {
+    clientReplyBlock *tail = NULL;
 
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-    if (listLength(c->reply) == 0) {
-        incrRefCount(o);
-        //在回复列表汇总添加robj内容
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += zmalloc_size_sds(o->ptr);
-    } else {
+    if (listLength(c->reply) > 0)
         tail = listNodeValue(listLast(c->reply));
 
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+sdslen(o->ptr) <= REDIS_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,o->ptr,sdslen(o->ptr));
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-        } else {
-            incrRefCount(o);
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += zmalloc_size_sds(o->ptr);
-        }
+    /* Append to the last block when possible. */
+    if (tail && tail->obj == NULL && tail->size > tail->used) {
+        size_t avail = tail->size-tail->used;
+        size_t copy = avail >= len ? len : avail;
+
+        memcpy(tail->buf+tail->used,s,copy);
+        tail->used += copy;
+        s += copy;
+        len -= copy;
+    }
+    if (len) {
+        /* Create a new block. */
+        size_t size = len < REDIS_REPLY_CHUNK_BYTES ?
+                      REDIS_REPLY_CHUNK_BYTES : len;
+
+        tail = zmalloc(sizeof(*tail)+size);
+        tail->size = size;
+        tail->used = len;
+        tail->obj = NULL;
+        memcpy(tail->buf,s,len);
+        listAddNodeTail(c->reply,tail);
+        c->reply_bytes += zmalloc_size(tail);
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Add a block referencing 'o' to the reply list, taking a new reference.
+ * The object is sent as it is, see the comment on top of
+ * replyBlockAllocSize(). */
+/* 在回复列表中添加一个直接引用对象的块 */
+static void _addReplyReferenceToList(redisClient *c, robj *o) {
+    clientReplyBlock *b;
+
+    if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
+
+    b = zmalloc(sizeof(*b));
+    b->size = b->used = 0;
+    b->obj = o;
+    incrRefCount(o);
+    listAddNodeTail(c->reply,b);
+    c->reply_bytes += replyBlockAllocSize(b);
+    c->reply_ref_bytes += replyBlockRefSize(b);
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* robj添加到reply的列表中 */
+void _addReplyObjectToList(redisClient *c, robj *o) {
+    /* Large values are referenced, everything else is copied. */
+    if (sdslen(o->ptr) >= REDIS_REPLY_ZEROCOPY_BYTES)
+        _addReplyReferenceToList(c,o);
+    else
+        _addReplyStringToList(c,o->ptr,sdslen(o->ptr));
+}
+
 /* This method takes responsibility over the sds. When it is no longer
  * needed it will be free'd, otherwise it ends up in a robj. */
 /* 在回复列表中添加Sds字符串对象 */
 void _addReplySdsToList(redisClient *c, sds s) {
-    robj *tail;
-
     if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
         sdsfree(s);
         return;
     }
 
-    if (listLength(c->reply) == 0) {
-        listAddNodeTail(c->reply,createObject(REDIS_STRING,s));
-        c->reply_bytes += zmalloc_size_sds(s);
-    } else {
-        tail = listNodeValue(listLast(c->reply));
+    /* A big sds is not copied: it becomes the object of a block. */
+    if (sdslen(s) >= REDIS_REPLY_ZEROCOPY_BYTES) {
+        robj *o = createObject(REDIS_STRING,s);
 
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+sdslen(s) <= REDIS_REPLY_CHUNK_BYTES)
-        {
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,sdslen(s));
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-            sdsfree(s);
-        } else {
-            listAddNodeTail(c->reply,createObject(REDIS_STRING,s));
-            c->reply_bytes += zmalloc_size_sds(s);
-        }
-    }
-    asyncCloseClientOnOutputBufferLimitReached(c);
-}
-
-/* 在回复列表中添加字符串对象,参数中已经给定字符的长度 */
-void _addReplyStringToList(redisClient *c, char *s, size_t len) {
-    robj *tail;
-
-    if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
-
-    if (listLength(c->reply) == 0) {
-        robj *o = createStringObject(s,len);
-
-        listAddNodeTail(c->reply,o);
-        c->reply_bytes += zmalloc_size_sds(o->ptr);
+        _addReplyReferenceToList(c,o);
+        decrRefCount(o);
     } else {
-        tail = listNodeValue(listLast(c->reply));
-
-        /* Append to this object when possible. */
-        if (tail->ptr != NULL &&
-            sdslen(tail->ptr)+len <= REDIS_REPLY_CHUNK_BYTES)
-        {
-        	//调整replay中的字节数
-            c->reply_bytes -= zmalloc_size_sds(tail->ptr);
-            tail = dupLastObjectIfNeeded(c->reply);
-            tail->ptr = sdscatlen(tail->ptr,s,len);
-            c->reply_bytes += zmalloc_size_sds(tail->ptr);
-        } else {
-            robj *o = createStringObject(s,len);
-
-            listAddNodeTail(c->reply,o);
-            c->reply_bytes += zmalloc_size_sds(o->ptr);
-        }
+        _addReplyStringToList(c,s,sdslen(s));
+        sdsfree(s);
     }
-    asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
 /* -----------------------------------------------------------------------------
@@ -370,15 +553,20 @@ void addReply(redisClient *c, robj *obj) {
      *
      * If the encoding is RAW and there is room in the static buffer
      * we'll be able to send the object to the client without
-     * messing with its page. */
-    if (obj->encoding == REDIS_ENCODING_RAW) {
-        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != REDIS_OK)
+     * messing with its page.
+     *
+     * Large values are never copied: the reply list references them. */
+    if (sdsEncodedObject(obj)) {
+        if (sdslen(obj->ptr) >= REDIS_REPLY_ZEROCOPY_BYTES ||
+            _addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != REDIS_OK)
             _addReplyObjectToList(c,obj);
     } else if (obj->encoding == REDIS_ENCODING_INT) {
         /* Optimization: if there is room in the static buffer for 32 bytes
          * (more than the max chars a 64 bit integer can take as string) we
          * avoid decoding the object and go for the lower level approach. */
-        if (listLength(c->reply) == 0 && (sizeof(c->buf) - c->bufpos) >= 32) {
+        if (listLength(c->reply) == 0 &&
+            (REDIS_REPLY_CHUNK_BYTES - c->bufpos) >= 32)
+        {
             char buf[32];
             int len;
 
@@ -393,6 +581,23 @@ void addReply(redisClient *c, robj *obj) {
         if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != REDIS_OK)
             _addReplyObjectToList(c,obj);
         decrRefCount(obj);
+    } else if (obj->encoding == REDIS_ENCODING_ROARING) {
+        /* Bitmaps are sent as the string they stand for. */
+        obj = getDecodedObject(obj);
+        addReply(c,obj);
+        decrRefCount(obj);
+    } else if (obj->encoding == REDIS_ENCODING_CHUNKED) {
+        /* Chunked strings are sent segment by segment, without making
+         * them contiguous first. */
+        chunkString *cs = obj->ptr;
+        size_t off, n;
+
+        for (off = 0; off < cs->len; off += n) {
+            char *p = (char*)csSegment(cs,off,&n);
+
+            if (_addReplyToBuffer(c,p,n) != REDIS_OK)
+                _addReplyStringToList(c,p,n);
+        }
     } else {
         redisPanic("Wrong obj->encoding in addReply()");
     }
@@ -466,40 +671,63 @@ void addReplyStatusFormat(redisClient *c, const char *fmt, ...) {
     sdsfree(s);
 }
 
-/* Adds an empty object to the reply list that will contain the multi bulk
- * length, which is not known when this function is called. */
-/* 在reply list 中添加一个空的obj对象 */
+/* Adds an empty block to the reply list that will be replaced by the multi
+ * bulk length, which is not known when this function is called. Its size is
+ * zero so nothing is ever appended to it. */
+/* 在reply list 中添加一个空的块 */
 void *addDeferredMultiBulkLength(redisClient *c) {
+    clientReplyBlock *b;
+
     /* Note that we install the write event here even if the object is not
      * ready to be sent, since we are sure that before returning to the
      * event loop setDeferredMultiBulkLength() will be called. */
     if (prepareClientToWrite(c) != REDIS_OK) return NULL;
-    listAddNodeTail(c->reply,createObject(REDIS_STRING,NULL));
+    b = zmalloc(sizeof(*b));
+    b->size = b->used = 0;
+    b->obj = NULL;
+    listAddNodeTail(c->reply,b);
+    c->reply_bytes += zmalloc_size(b);
     return listLast(c->reply);
 }
 
-/* Populate the length object and try gluing it to the next chunk. */
+/* Write the multi bulk length in place of the empty block: at the end of the
+ * previous block or at the start of the next one when they have room for
+ * it, otherwise in a block of its own. */
 void setDeferredMultiBulkLength(redisClient *c, void *node, long length) {
     listNode *ln = (listNode*)node;
-    robj *len, *next;
+    clientReplyBlock *b, *prev, *next;
+    char lenstr[128];
+    size_t lenlen;
 
     /* Abort when *node is NULL (see addDeferredMultiBulkLength). */
     if (node == NULL) return;
 
-    len = listNodeValue(ln);
-    len->ptr = sdscatprintf(sdsempty(),"*%ld\r\n",length);
-    c->reply_bytes += zmalloc_size_sds(len->ptr);
-    if (ln->next != NULL) {
-        next = listNodeValue(ln->next);
-
-        /* Only glue when the next node is non-NULL (an sds in this case) */
-        if (next->ptr != NULL) {
-            c->reply_bytes -= zmalloc_size_sds(len->ptr);
-            c->reply_bytes -= zmalloc_size_sds(next->ptr);
-            len->ptr = sdscatlen(len->ptr,next->ptr,sdslen(next->ptr));
-            c->reply_bytes += zmalloc_size_sds(len->ptr);
-            listDelNode(c->reply,ln->next);
-        }
+    lenlen = snprintf(lenstr,sizeof(lenstr),"*%ld\r\n",length);
+    b = listNodeValue(ln);
+    prev = ln->prev ? listNodeValue(ln->prev) : NULL;
+    next = ln->next ? listNodeValue(ln->next) : NULL;
+
+    c->reply_bytes -= zmalloc_size(b);
+    if (prev && prev->obj == NULL && prev->size-prev->used >= lenlen) {
+        memcpy(prev->buf+prev->used,lenstr,lenlen);
+        prev->used += lenlen;
+        listDelNode(c->reply,ln);
+    } else if (next && next->obj == NULL &&
+               next->size-next->used >= lenlen)
+    {
+        memmove(next->buf+lenlen,next->buf,next->used);
+        memcpy(next->buf,lenstr,lenlen);
+        next->used += lenlen;
+        listDelNode(c->reply,ln);
+    } else {
+        clientReplyBlock *hdr = zmalloc(sizeof(*hdr)+lenlen);
+
+        hdr->size = hdr->used = lenlen;
+        hdr->obj = NULL;
+        memcpy(hdr->buf,lenstr,lenlen);
+        listNodeValue(ln) = hdr;
+        c->reply_bytes += zmalloc_size(hdr);
+        zfree(b);
     }
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
@@ -566,8 +794,12 @@ void addReplyMultiBulkLen(redisClient *c, long length) {
 void addReplyBulkLen(redisClient *c, robj *obj) {
     size_t len;
 
-    if (obj->encoding == REDIS_ENCODING_RAW) {
+    if (sdsEncodedObject(obj)) {
         len = sdslen(obj->ptr);
+    } else if (obj->encoding == REDIS_ENCODING_ROARING) {
+        len = ((roaringBitmap*)obj->ptr)->len;
+    } else if (obj->encoding == REDIS_ENCODING_CHUNKED) {
+        len = ((chunkString*)obj->ptr)->len;
     } else {
         long n = (long)obj->ptr;
 
@@ -632,12 +864,20 @@ void copyClientOutputBuffer(redisClient *dst, redisClient *src) {
     //reply的复制
     dst->reply = listDup(src->reply);
     //输出buffer的复制
-    memcpy(dst->buf,src->buf,src->bufpos);
+    if (src->bufpos) {
+        clientReplyBufferAlloc(dst);
+        memcpy(dst->buf,src->buf,src->bufpos);
+    }
     //位置，偏移量都需要复制
     dst->bufpos = src->bufpos;
     dst->reply_bytes = src->reply_bytes;
+    dst->reply_ref_bytes = src->reply_ref_bytes;
 }
 
+/* Connections accepted per readable event of a listening socket: enough to
+ * drain a reconnection storm in a few event loop iterations, without
+ * starving the clients that are already connected. With tcp-listeners > 1
+ * the bound applies to each of the SO_REUSEPORT sockets. */
 #define MAX_ACCEPTS_PER_CALL 1000
 /* 网络连接后的调用方法 */
 static void acceptCommonHandler(int fd, int flags) {
@@ -667,6 +907,12 @@ static void acceptCommonHandler(int fd, int flags) {
     }
     server.stat_numconnections++;
     c->flags |= flags;
+    if (server.io_completion && enableClientCompletionIO(c) == REDIS_ERR) {
+        redisLog(REDIS_WARNING,
+            "Error submitting the first read of the new client: %s (fd=%d)",
+            strerror(errno),fd);
+        freeClient(c);
+    }
 }
 
 void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
@@ -799,12 +1045,20 @@ void freeClient(redisClient *c) {
 
     /* Close socket, unregister events, and remove list of replies and
      * accumulated arguments. */
+    if (c->flags & REDIS_SHMRING) {
+        aeDeleteFileEvent(server.el,c->shm->rfd,AE_READABLE);
+        shmRingConnFree(c->shm);
+        c->shm = NULL;
+    }
     if (c->fd != -1) {
+        if (c->flags & REDIS_IO_COMPLETION) aeIoCancel(server.el,c->fd);
         aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
         close(c->fd);
     }
     listRelease(c->reply);
+    releaseClientReplyBuffer(c);
+    removeClientFromMemUsageBuckets(c);
     freeClientArgv(c);
 
     /* Remove from the list of clients */
@@ -822,6 +1076,18 @@ void freeClient(redisClient *c) {
         listDelNode(server.unblocked_clients,ln);
     }
 
+    /* Remove from the lists of clients waiting for the I/O threads. */
+    if (c->flags & REDIS_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+    }
+    if (c->flags & REDIS_PENDING_WRITE) {
+        ln = listSearchKey(server.clients_pending_write,c);
+        redisAssert(ln != NULL);
+        listDelNode(server.clients_pending_write,ln);
+    }
+
     /* Master/slave cleanup Case 1:
      * we lost the connection with a slave. */
     if (c->flags & REDIS_SLAVE) {
@@ -857,6 +1123,7 @@ void freeClient(redisClient *c) {
     zfree(c->argv);
     freeClientMultiState(c);
     sdsfree(c->peerid);
+    sdsfree(c->proto_err);
     zfree(c);
 }
 
@@ -882,52 +1149,126 @@ void freeClientsInAsyncFreeQueue(void) {
     }
 }
 
-/* 将Client中的reply数据存入文件中 */
-void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = privdata;
-    int nwritten = 0, totwritten = 0, objlen;
-    size_t objmem;
-    robj *o;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
-
-    while(c->bufpos > 0 || listLength(c->reply)) {
+/* Write as much of the client output buffers as the socket accepts.
+ *
+ * The static buffer and the blocks of the reply list are gathered in an
+ * iovec array and flushed with a single writev(2), so a pipelined client
+ * or a large multi bulk reply costs one system call per
+ * REDIS_MAX_WRITE_PER_EVENT bytes instead of one per block.
+ *
+ * Blocks of the reply list that were completely transmitted are not
+ * released here, they are only counted in c->io_sentobjs and released later
+ * by handleClientWrite(). This way the function only touches the client
+ * and can be called by the I/O threads: blocks may reference shared objects
+ * whose refcount must only be touched by the main thread.
+ * The bytes written and the errno of a failed write are stored in
+ * c->io_nwritten and c->io_errno. */
+/* writev() the reply to the client socket, or copy it into the reply ring
+ * for clients using the shared memory transport. A full ring is reported
+ * as EAGAIN, exactly like a full socket buffer.
+ *
+ * Clients using completion based I/O submit the write to the event loop,
+ * that takes a copy of the data: it is accounted as written, and errors
+ * are reported later to sendReplyDone(). While a write is in flight we
+ * return EAGAIN, even for a client that became a slave meanwhile, so
+ * that the replies can't be reordered. */
+/* 写出回复数据，共享内存连接写入回复环，基于完成通知的连接提交给事件循环 */
+static ssize_t clientWritev(redisClient *c, const struct iovec *iov, int iovcnt) {
+    ssize_t nwritten;
+
+    if (c->flags & REDIS_IO_COMPLETION) {
+        if (aeIoPending(server.el,c->fd) & AE_IO_WRITE) {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (!(c->flags & REDIS_SLAVE))
+            return aeIoSubmitWritev(server.el,c->fd,iov,iovcnt,
+                                    sendReplyDone,c);
+    }
+    if (!(c->flags & REDIS_SHMRING)) return writev(c->fd,iov,iovcnt);
+    nwritten = shmRingWritev(&c->shm->out,iov,iovcnt);
+    if (nwritten == 0) {
+        errno = EAGAIN;
+        return -1;
+    }
+    shmRingNotifyData(c->shm);
+    return nwritten;
+}
+
+/* 把Client的回复数据写入socket，只修改Client自身的状态，I/O线程中也可以调用 */
+static void writeClientSocket(redisClient *c) {
+    struct iovec iov[REDIS_WRITE_IOV_MAX];
+    int nwritten = 0, totwritten = 0;
+    size_t sentlen = c->sentlen;
+    listNode *ln = listFirst(c->reply);
+
+    c->io_sentobjs = 0;
+    c->io_errno = 0;
+    while(c->bufpos > 0 || ln) {
+        listNode *next = ln;
+        size_t iovbytes = 0, objoff = sentlen, remaining, left;
+        int iovcnt = 0;
+
+        /* Gather the unsent part of the buffer, then the reply blocks,
+         * up to REDIS_MAX_WRITE_PER_EVENT bytes. */
         if (c->bufpos > 0) {
-        	//调用写方法，把数据写入到fd文件句柄所代表的文件
-            nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
-            if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
-
-            /* If the buffer was sent, set bufpos to zero to continue with
-             * the remainder of the reply. */
-            if (c->sentlen == c->bufpos) {
-            	//写操作完毕后，重置buf等值
-                c->bufpos = 0;
-                c->sentlen = 0;
-            }
-        } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = sdslen(o->ptr);
-            objmem = zmalloc_size_sds(o->ptr);
-
-            if (objlen == 0) {
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
+            iov[0].iov_base = c->buf+sentlen;
+            iov[0].iov_len = c->bufpos-sentlen;
+            iovbytes = iov[0].iov_len;
+            iovcnt = 1;
+            objoff = 0;
+        }
+        while(next && iovcnt < REDIS_WRITE_IOV_MAX &&
+              iovbytes < REDIS_MAX_WRITE_PER_EVENT)
+        {
+            clientReplyBlock *b = listNodeValue(next);
+
+            iov[iovcnt].iov_base = replyBlockData(b)+objoff;
+            iov[iovcnt].iov_len = replyBlockLen(b)-objoff;
+            iovbytes += iov[iovcnt].iov_len;
+            iovcnt++;
+            objoff = 0;
+            next = listNextNode(next);
+        }
 
-            nwritten = write(fd, ((char*)o->ptr)+c->sentlen,objlen-c->sentlen);
+        if (iovbytes == 0) {
+            nwritten = 0;
+        } else {
+            //调用writev方法，一次系统调用写出buf以及回复列表中的多个对象
+            nwritten = clientWritev(c,iov,iovcnt);
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
-            totwritten += nwritten;
+        }
+        totwritten += nwritten;
 
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                c->reply_bytes -= objmem;
+        /* Advance the buffer and the reply list by the bytes written. */
+        remaining = nwritten;
+        if (c->bufpos > 0) {
+            left = c->bufpos-sentlen;
+            if (remaining < left) {
+                sentlen += remaining;
+                break;
             }
+            //写操作完毕后，重置buf等值
+            remaining -= left;
+            c->bufpos = 0;
+            sentlen = 0;
         }
+        while(ln) {
+            left = replyBlockLen(listNodeValue(ln))-sentlen;
+            if (remaining < left) {
+                sentlen += remaining;
+                break;
+            }
+            /* If we fully sent the object on head go to the next one */
+            remaining -= left;
+            c->io_sentobjs++;
+            ln = listNextNode(ln);
+            sentlen = 0;
+        }
+
+        /* Partial write: the socket buffer is full. */
+        if ((size_t)nwritten < iovbytes) break;
+
         /* Note that we avoid to send more than REDIS_MAX_WRITE_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
          * other clients as well, even if a very large request comes from
@@ -940,17 +1281,33 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
             (server.maxmemory == 0 ||
              zmalloc_used_memory() < server.maxmemory)) break;
     }
-    if (nwritten == -1) {
-        if (errno == EAGAIN) {
-            nwritten = 0;
-        } else {
-            redisLog(REDIS_VERBOSE,
-                "Error writing to client: %s", strerror(errno));
-            freeClient(c);
-            return;
-        }
+    if (nwritten == -1 && errno != EAGAIN) c->io_errno = errno;
+    c->sentlen = sentlen;
+    c->io_nwritten = totwritten;
+}
+
+/* Second half of a write, always executed by the main thread: release the
+ * reply blocks sent by writeClientSocket(), handle write errors and make
+ * sure the write handler is installed only while there is something left
+ * to send. Returns REDIS_ERR if the client was freed. */
+/* 写socket之后的处理：释放已发送的回复对象，处理错误，安装或删除写事件 */
+static int handleClientWrite(redisClient *c) {
+    while(c->io_sentobjs) {
+        clientReplyBlock *b = listNodeValue(listFirst(c->reply));
+
+        c->reply_bytes -= replyBlockAllocSize(b);
+        c->reply_ref_bytes -= replyBlockRefSize(b);
+        listDelNode(c->reply,listFirst(c->reply));
+        c->io_sentobjs--;
+    }
+    updateClientMemUsage(c);
+    if (c->io_errno) {
+        redisLog(REDIS_VERBOSE,
+            "Error writing to client: %s", strerror(c->io_errno));
+        freeClient(c);
+        return REDIS_ERR;
     }
-    if (totwritten > 0) {
+    if (c->io_nwritten > 0) {
         /* For clients representing masters we don't count sending data
          * as an interaction, since we always send REPLCONF ACK commands
          * that take some time to just fill the socket output buffer.
@@ -962,9 +1319,45 @@ void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         //写完成之后，删除写事件
         aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
 
-        /* Close connection after entire reply has been sent. */
-        if (c->flags & REDIS_CLOSE_AFTER_REPLY) freeClient(c);
+        /* Close connection after entire reply has been sent. If the last
+         * write is still in flight sendReplyDone() will do it. */
+        if ((c->flags & REDIS_CLOSE_AFTER_REPLY) &&
+            !(aeIoPending(server.el,c->fd) & AE_IO_WRITE))
+        {
+            freeClient(c);
+            return REDIS_ERR;
+        }
+    } else if ((c->flags & REDIS_IO_COMPLETION) &&
+               (aeIoPending(server.el,c->fd) & AE_IO_WRITE))
+    {
+        /* sendReplyDone() takes care of the rest once the write in flight
+         * completes. A slave would spin on its write handler meanwhile. */
+        aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    } else if (c->flags & REDIS_SHMRING) {
+        /* If the ring is full the client wakes us up when it consumes the
+         * replies, see readQueryFromRing(). Otherwise we stopped because of
+         * REDIS_MAX_WRITE_PER_EVENT and must come back by ourselves. */
+        if (!shmRingWaitSpace(&c->shm->out)) shmRingWakeSelf(c->shm);
+    } else if (!(aeGetFileEvents(server.el,c->fd) & AE_WRITABLE)) {
+        /* Only possible for replies written by the I/O threads. */
+        if (aeCreateFileEvent(server.el,c->fd,AE_WRITABLE,
+            sendReplyToClient,c) == AE_ERR)
+        {
+            freeClientAsync(c);
+        }
     }
+    return REDIS_OK;
+}
+
+/* 将Client中的reply数据存入文件中 */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    writeClientSocket(c);
+    handleClientWrite(c);
 }
 
 /* resetClient prepare the client to process the next command */
@@ -977,21 +1370,31 @@ void resetClient(redisClient *c) {
     if (!(c->flags & REDIS_MULTI)) c->flags &= (~REDIS_ASKING);
 }
 
+/* Return how many bytes can be read from the query buffer starting at
+ * 'pos', including the unused space and the null terminator of the sds:
+ * respParseLength() uses it to load the length field with a single
+ * unaligned 64 bit read when possible. */
+/* 返回从查询缓冲pos位置开始可以安全读取的字节数 */
+static size_t queryBufReadable(redisClient *c, size_t pos) {
+    return sdslen(c->querybuf)+sdsavail(c->querybuf)+1-pos;
+}
+
 /* 处理redis Client的内链的buffer，就是c->querybuf */
 int processInlineBuffer(redisClient *c) {
     char *newline;
     int argc, j;
     sds *argv, aux;
     size_t querylen;
+    respScanner scan;
 
     /* Search for end of line */
-    newline = strchr(c->querybuf,'\n');
+    respScannerInit(&scan,c->querybuf,sdslen(c->querybuf),'\n');
+    newline = respScannerNext(&scan,0);
 
     /* Nothing to do without a \r\n */
     if (newline == NULL) {
         if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-            addReplyError(c,"Protocol error: too big inline request");
-            setProtocolError(c,0);
+            setProtocolError(c,sdsnew("too big inline request"),0);
         }
         return REDIS_ERR;
     }
@@ -1007,8 +1410,7 @@ int processInlineBuffer(redisClient *c) {
     argv = sdssplitargs(aux,&argc);
     sdsfree(aux);
     if (argv == NULL) {
-        addReplyError(c,"Protocol error: unbalanced quotes in request");
-        setProtocolError(c,0);
+        setProtocolError(c,sdsnew("unbalanced quotes in request"),0);
         return REDIS_ERR;
     }
 
@@ -1039,16 +1441,32 @@ int processInlineBuffer(redisClient *c) {
 }
 
 /* Helper function. Trims query buffer to make the function that processes
- * multi bulk requests idempotent. */
-static void setProtocolError(redisClient *c, int pos) {
+ * multi bulk requests idempotent.
+ *
+ * The parser may run in an I/O thread, so the error is only remembered in
+ * c->proto_err (taking ownership of 'err'): the reply, the log entry and
+ * the REDIS_CLOSE_AFTER_REPLY flag are handled by replyProtocolError() in
+ * the main thread. */
+static void setProtocolError(redisClient *c, sds err, int pos) {
+    sdsfree(c->proto_err);
+    c->proto_err = err;
+    sdsrange(c->querybuf,pos,-1);
+}
+
+/* Reply to a protocol error found by the parser and close the client once
+ * the error is transmitted. */
+/* 回复解析时发现的协议错误，并在回复完成后关闭Client */
+static void replyProtocolError(redisClient *c) {
+    addReplyErrorFormat(c,"Protocol error: %s",c->proto_err);
     if (server.verbosity >= REDIS_VERBOSE) {
         sds client = catClientInfoString(sdsempty(),c);
         redisLog(REDIS_VERBOSE,
             "Protocol error from client: %s", client);
         sdsfree(client);
     }
+    sdsfree(c->proto_err);
+    c->proto_err = NULL;
     c->flags |= REDIS_CLOSE_AFTER_REPLY;
-    sdsrange(c->querybuf,pos,-1);
 }
 
 /* 处理大块的buffer */
@@ -1056,17 +1474,21 @@ int processMultibulkBuffer(redisClient *c) {
     char *newline = NULL;
     int pos = 0, ok;
     long long ll;
+    respScanner scan;
+
+    /* All the line terminators are located by the scanner, that must be
+     * initialized again every time the query buffer changes. */
+    respScannerInit(&scan,c->querybuf,sdslen(c->querybuf),'\r');
 
     if (c->multibulklen == 0) {
         /* The client should have been reset */
         redisAssertWithInfo(c,NULL,c->argc == 0);
 
         /* Multi bulk length cannot be read without a \r\n */
-        newline = strchr(c->querybuf,'\r');
+        newline = respScannerNext(&scan,0);
         if (newline == NULL) {
             if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                addReplyError(c,"Protocol error: too big mbulk count string");
-                setProtocolError(c,0);
+                setProtocolError(c,sdsnew("too big mbulk count string"),0);
             }
             return REDIS_ERR;
         }
@@ -1078,10 +1500,10 @@ int processMultibulkBuffer(redisClient *c) {
         /* We know for sure there is a whole line since newline != NULL,
          * so go ahead and find out the multi bulk length. */
         redisAssertWithInfo(c,NULL,c->querybuf[0] == '*');
-        ok = string2ll(c->querybuf+1,newline-(c->querybuf+1),&ll);
+        ok = respParseLength(c->querybuf+1,newline-(c->querybuf+1),
+                             queryBufReadable(c,1),&ll);
         if (!ok || ll > 1024*1024) {
-            addReplyError(c,"Protocol error: invalid multibulk length");
-            setProtocolError(c,pos);
+            setProtocolError(c,sdsnew("invalid multibulk length"),pos);
             return REDIS_ERR;
         }
 
@@ -1102,13 +1524,12 @@ int processMultibulkBuffer(redisClient *c) {
     while(c->multibulklen) {
         /* Read bulk length if unknown */
         if (c->bulklen == -1) {
-            newline = strchr(c->querybuf+pos,'\r');
+            newline = respScannerNext(&scan,pos);
             if (newline == NULL) {
                 if (sdslen(c->querybuf) > REDIS_INLINE_MAX_SIZE) {
-                    addReplyError(c,
-                        "Protocol error: too big bulk count string");
                     //设置协议错误
-                    setProtocolError(c,0);
+                    setProtocolError(c,
+                        sdsnew("too big bulk count string"),0);
                     return REDIS_ERR;
                 }
                 break;
@@ -1119,17 +1540,16 @@ int processMultibulkBuffer(redisClient *c) {
                 break;
 
             if (c->querybuf[pos] != '$') {
-                addReplyErrorFormat(c,
-                    "Protocol error: expected '$', got '%c'",
-                    c->querybuf[pos]);
-                setProtocolError(c,pos);
+                setProtocolError(c,sdscatprintf(sdsempty(),
+                    "expected '$', got '%c'",c->querybuf[pos]),pos);
                 return REDIS_ERR;
             }
 
-            ok = string2ll(c->querybuf+pos+1,newline-(c->querybuf+pos+1),&ll);
+            ok = respParseLength(c->querybuf+pos+1,
+                                 newline-(c->querybuf+pos+1),
+                                 queryBufReadable(c,pos+1),&ll);
             if (!ok || ll < 0 || ll > 512*1024*1024) {
-                addReplyError(c,"Protocol error: invalid bulk length");
-                setProtocolError(c,pos);
+                setProtocolError(c,sdsnew("invalid bulk length"),pos);
                 return REDIS_ERR;
             }
 
@@ -1148,6 +1568,7 @@ int processMultibulkBuffer(redisClient *c) {
                  * going to contain. */
                 if (qblen < (size_t)ll+2)
                     c->querybuf = sdsMakeRoomFor(c->querybuf,ll+2-qblen);
+                respScannerInit(&scan,c->querybuf,qblen,'\r');
             }
             c->bulklen = ll;
         }
@@ -1170,6 +1591,7 @@ int processMultibulkBuffer(redisClient *c) {
                 /* Assume that if we saw a fat argument we'll see another one
                  * likely... */
                 c->querybuf = sdsMakeRoomFor(c->querybuf,c->bulklen+2);
+                respScannerInit(&scan,c->querybuf,0,'\r');
                 pos = 0;
             } else {
                 c->argv[c->argc++] =
@@ -1191,10 +1613,36 @@ int processMultibulkBuffer(redisClient *c) {
     return REDIS_ERR;
 }
 
+/* Parse the next command of the query buffer into c->argv. Returns
+ * REDIS_OK if a whole command (possibly with zero arguments) was parsed.
+ * Only touches the client, so the I/O threads can call it as well. */
+/* 从查询缓冲中解析出一条命令 */
+static int parseInputBuffer(redisClient *c) {
+    /* Determine request type when unknown. */
+    if (!c->reqtype) {
+        if (c->querybuf[0] == '*') {
+            c->reqtype = REDIS_REQ_MULTIBULK;
+        } else {
+            c->reqtype = REDIS_REQ_INLINE;
+        }
+    }
+
+	//根据Request请求的Type的不同，调度不同的处理方法
+    if (c->reqtype == REDIS_REQ_INLINE) {
+        return processInlineBuffer(c);
+    } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
+        return processMultibulkBuffer(c);
+    } else {
+        redisPanic("Unknown request type");
+        return REDIS_ERR;
+    }
+}
+
 /* 处理redisClient的查询buffer */
 void processInputBuffer(redisClient *c) {
-    /* Keep processing while there is something in the input buffer */
-    while(sdslen(c->querybuf)) {
+    /* Keep processing while there is something in the input buffer, or a
+     * command already parsed by an I/O thread. */
+    while(sdslen(c->querybuf) || c->flags & REDIS_PENDING_COMMAND) {
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & REDIS_BLOCKED) return;
 
@@ -1203,22 +1651,11 @@ void processInputBuffer(redisClient *c) {
          * this flag has been set (i.e. don't process more commands). */
         if (c->flags & REDIS_CLOSE_AFTER_REPLY) return;
 
-        /* Determine request type when unknown. */
-        if (!c->reqtype) {
-            if (c->querybuf[0] == '*') {
-                c->reqtype = REDIS_REQ_MULTIBULK;
-            } else {
-                c->reqtype = REDIS_REQ_INLINE;
-            }
-        }
-		
-		//根据Request请求的Type的不同，调度不同的处理方法
-        if (c->reqtype == REDIS_REQ_INLINE) {
-            if (processInlineBuffer(c) != REDIS_OK) break;
-        } else if (c->reqtype == REDIS_REQ_MULTIBULK) {
-            if (processMultibulkBuffer(c) != REDIS_OK) break;
-        } else {
-            redisPanic("Unknown request type");
+        if (c->flags & REDIS_PENDING_COMMAND) {
+            c->flags &= ~REDIS_PENDING_COMMAND;
+        } else if (parseInputBuffer(c) != REDIS_OK) {
+            if (c->proto_err) replyProtocolError(c);
+            break;
         }
 
         /* Multibulk processing could see a <= 0 length. */
@@ -1232,16 +1669,13 @@ void processInputBuffer(redisClient *c) {
     }
 }
 
-/* 从Client获取查询query语句 */
-void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
-    redisClient *c = (redisClient*) privdata;
-    int nread, readlen;
-    size_t qblen;
-    REDIS_NOTUSED(el);
-    REDIS_NOTUSED(mask);
+/* Return how many bytes to append to the query buffer with the next read:
+ * at most REDIS_IOBUF_LEN, so that handleClientRead() can enforce the
+ * query buffer limit after every read. */
+/* 计算下一次读取查询缓冲的字节数 */
+static int clientReadLen(redisClient *c) {
+    int readlen = REDIS_IOBUF_LEN;
 
-    server.current_client = c;
-    readlen = REDIS_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
      * buffer contains exactly the SDS string representing the object, even
@@ -1255,33 +1689,51 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 
         if (remaining < readlen) readlen = remaining;
     }
+    return readlen;
+}
+
+/* Read from the client socket appending to the query buffer. The number
+ * of bytes read (0 on EOF, -1 on error) is stored in c->io_nread and the
+ * errno in c->io_errno: like writeClientSocket() this only touches the
+ * client so it can run in the I/O threads. */
+/* 从socket读取数据到查询缓冲，I/O线程中也可以调用 */
+static void readClientSocket(redisClient *c) {
+    int nread, readlen = clientReadLen(c);
+    size_t qblen;
 
     qblen = sdslen(c->querybuf);
     if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
     c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
     //从fd的文件描述符中读取查询buf到c->querybuf
-    nread = read(fd, c->querybuf+qblen, readlen);
+    nread = read(c->fd, c->querybuf+qblen, readlen);
+    c->io_errno = (nread == -1) ? errno : 0;
+    if (nread > 0) sdsIncrLen(c->querybuf,nread);
+    c->io_nread = nread;
+}
+
+/* Second half of a read, executed by the main thread. Returns REDIS_OK if
+ * there is new data to process, REDIS_ERR if there is nothing to do or the
+ * client was freed. */
+/* 读socket之后的处理：错误处理，缓冲区限制检查 */
+static int handleClientRead(redisClient *c) {
+    int nread = c->io_nread;
+
     if (nread == -1) {
-        if (errno == EAGAIN) {
-            nread = 0;
+        if (c->io_errno == EAGAIN) {
+            return REDIS_ERR;
         } else {
-            redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(errno));
+            redisLog(REDIS_VERBOSE, "Reading from client: %s",
+                strerror(c->io_errno));
             freeClient(c);
-            return;
+            return REDIS_ERR;
         }
     } else if (nread == 0) {
         redisLog(REDIS_VERBOSE, "Client closed connection");
         freeClient(c);
-        return;
-    }
-    if (nread) {
-        sdsIncrLen(c->querybuf,nread);
-        c->lastinteraction = server.unixtime;
-        if (c->flags & REDIS_MASTER) c->reploff += nread;
-    } else {
-        server.current_client = NULL;
-        return;
+        return REDIS_ERR;
     }
+    c->lastinteraction = server.unixtime;
+    if (c->flags & REDIS_MASTER) c->reploff += nread;
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1290,10 +1742,282 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         sdsfree(ci);
         sdsfree(bytes);
         freeClient(c);
+        return REDIS_ERR;
+    }
+    updateClientMemUsage(c);
+    return REDIS_OK;
+}
+
+/* 从Client获取查询query语句 */
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    /* With threaded reads the client is queued, the read is performed by
+     * handleClientsWithPendingReadsUsingThreads() before sleeping. */
+    if (postponeClientRead(c)) return;
+
+    server.current_client = c;
+    readClientSocket(c);
+    if (handleClientRead(c) == REDIS_OK) processInputBuffer(c);
+    server.current_client = NULL;
+}
+
+/* Completion based I/O: instead of waiting for the socket to be readable and
+ * then calling read(2), clients accepted with io-uring-completion enabled
+ * always have a read submitted to the event loop, and their replies are
+ * submitted as writes, see clientWritev(). With io_uring this saves the
+ * system calls of the reads and writes, everything is submitted and reaped
+ * with the single io_uring_enter() of every event loop iteration. */
+/* 基于完成通知的读写：Client始终有一个提交给事件循环的读请求 */
+static int submitClientRead(redisClient *c) {
+    return aeIoSubmitRead(server.el,c->fd,REDIS_IOBUF_LEN,readQueryDone,c);
+}
+
+/* Called when the read submitted by submitClientRead() completes: 'res' is
+ * the number of bytes in 'buf', 0 on EOF or -errno. The next read is
+ * submitted before processing the data, so it's already in flight while
+ * we execute the commands. */
+/* 基于完成通知的读完成后的回调 */
+static void readQueryDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res) {
+    redisClient *c = (redisClient*) privdata;
+    size_t qblen;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+
+    if (res == -EAGAIN || res == -EINTR) {
+        if (submitClientRead(c) == REDIS_OK) return;
+        res = -errno;
+    }
+    server.current_client = c;
+    if (res > 0) {
+        qblen = sdslen(c->querybuf);
+        if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+        c->querybuf = sdscatlen(c->querybuf,buf,res);
+        c->io_nread = res;
+        c->io_errno = 0;
+        if (submitClientRead(c) == AE_ERR) {
+            redisLog(REDIS_VERBOSE, "Submitting a client read: %s",
+                strerror(errno));
+            freeClient(c);
+            return;
+        }
+    } else {
+        c->io_nread = res == 0 ? 0 : -1;
+        c->io_errno = -res;
+    }
+    if (handleClientRead(c) == REDIS_OK) processInputBuffer(c);
+    server.current_client = NULL;
+}
+
+/* Called when a write submitted by clientWritev() completes: the event loop
+ * already retried short writes, so 'res' is either the whole length or
+ * -errno. */
+/* 基于完成通知的写完成后的回调 */
+static void sendReplyDone(aeEventLoop *el, int fd, void *privdata, char *buf, int res) {
+    redisClient *c = (redisClient*) privdata;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(buf);
+
+    if (res < 0) {
+        redisLog(REDIS_VERBOSE,
+            "Error writing to client: %s", strerror(-res));
+        freeClient(c);
+        return;
+    }
+    if (c->bufpos || listLength(c->reply)) {
+        if (!(c->flags & REDIS_SLAVE)) {
+            prepareClientToWrite(c);
+        } else if ((c->replstate == REDIS_REPL_NONE ||
+                    c->replstate == REDIS_REPL_ONLINE) &&
+                   aeCreateFileEvent(server.el,c->fd,AE_WRITABLE,
+                       sendReplyToClient,c) == AE_ERR)
+        {
+            /* Became a monitor meanwhile: plain writes from now on. */
+            freeClientAsync(c);
+        }
+    } else if (c->flags & REDIS_CLOSE_AFTER_REPLY) {
+        freeClient(c);
+    }
+}
+
+/* Switch a client just accepted to completion based I/O. */
+/* 把新连接的Client切换到基于完成通知的读写 */
+static int enableClientCompletionIO(redisClient *c) {
+    /* createClient() armed a read handler: the poll is cancelled in the
+     * same submission batch, without any additional system call. */
+    aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+    c->flags |= REDIS_IO_COMPLETION;
+    return submitClientRead(c) == AE_OK ? REDIS_OK : REDIS_ERR;
+}
+
+/* Enable completion based I/O if configured and supported. It is not used
+ * together with the I/O threads, that already move the system calls away
+ * from the main thread. */
+/* 根据配置和事件循环的能力决定是否启用基于完成通知的读写 */
+void initCompletionIO(void) {
+    server.io_completion = 0;
+    if (!server.io_uring_completion) return;
+    if (server.io_threads_num > 1) {
+        redisLog(REDIS_WARNING,
+            "io-uring-completion is ignored when io-threads is greater than 1.");
+    } else if (!aeIoSupported(server.el)) {
+        redisLog(REDIS_WARNING,
+            "io-uring-completion is not supported by the %s event loop on this system, using readiness notifications.",
+            aeGetApiName());
+    } else {
+        server.io_completion = 1;
+    }
+}
+
+/* Read handler of the eventfd of a client using the shared memory transport.
+ * The client signals it when it writes requests while we sleep, or when it
+ * consumed the replies of a ring we found full. Like a socket read, at most
+ * clientReadLen() bytes are moved to the query buffer per call, and if the
+ * ring is not empty yet we wake ourselves up to come back in the next
+ * iteration of the event loop. The counters of the ring are checked by
+ * shmRingRead(): a client that corrupts them gets a read error and is
+ * disconnected. */
+/* 从共享内存的请求环中获取查询语句 */
+void readQueryFromRing(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    shmRingConn *shm = c->shm;
+    int readlen = clientReadLen(c);
+    size_t qblen;
+    ssize_t nread;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(fd);
+    REDIS_NOTUSED(mask);
+
+    shmRingClearWakeup(shm);
+    if (shmRingPeerClosed(shm)) {
+        redisLog(REDIS_VERBOSE, "Client closed connection");
+        freeClient(c);
         return;
     }
-    processInputBuffer(c);
+
+    server.current_client = c;
+    qblen = sdslen(c->querybuf);
+    if (c->querybuf_peak < qblen) c->querybuf_peak = qblen;
+    c->querybuf = sdsMakeRoomFor(c->querybuf,readlen);
+    nread = shmRingRead(&shm->in,c->querybuf+qblen,readlen);
+    if (nread != 0) {
+        c->io_nread = nread;
+        c->io_errno = (nread == -1) ? errno : 0;
+        if (nread > 0) {
+            sdsIncrLen(c->querybuf,nread);
+            shmRingNotifySpace(shm);
+        }
+        if (handleClientRead(c) == REDIS_ERR) return; /* Client freed. */
+        processInputBuffer(c);
+    }
     server.current_client = NULL;
+
+    /* Replies stuck on a full ring can be written again. */
+    if (c->bufpos || listLength(c->reply)) prepareClientToWrite(c);
+
+    /* Go to sleep only if the ring is still empty. */
+    if (!shmRingWaitData(&shm->in)) shmRingWakeSelf(shm);
+}
+
+/* Read handler of the unix socket of a client that moved to the shared
+ * memory transport. Nothing is expected on the socket anymore: EOF or an
+ * error means the client went away, and data is a protocol violation. */
+/* 共享内存客户端的socket只用于发现连接断开 */
+void readSocketOfRingClient(aeEventLoop *el, int fd, void *privdata, int mask) {
+    redisClient *c = (redisClient*) privdata;
+    char buf[1];
+    ssize_t nread;
+    REDIS_NOTUSED(el);
+    REDIS_NOTUSED(mask);
+
+    nread = read(fd,buf,sizeof(buf));
+    if (nread == -1 && errno == EAGAIN) return;
+    if (nread == 0) {
+        redisLog(REDIS_VERBOSE, "Client closed connection");
+    } else if (nread == -1) {
+        redisLog(REDIS_VERBOSE, "Reading from client: %s",strerror(errno));
+    } else {
+        redisLog(REDIS_VERBOSE, "Client sent data on the socket after SHMRING");
+    }
+    freeClient(c);
+}
+
+/* SHMRING <size>
+ *
+ * Move the connection of a client on the unix socket to shared memory: the
+ * +OK reply carries the memfd of the two rings and their eventfds, and from
+ * now on requests and replies only go through the rings, see shmring.c. The
+ * socket is only watched to notice when the client goes away. The client
+ * must not pipeline anything after this command. */
+/* 把unix socket上的连接切换到共享内存传输 */
+void shmringCommand(redisClient *c) {
+    shmRingConn *shm;
+    long long size;
+    char err[256];
+    int fds[3];
+
+    if (!server.unixsocket_shmring) {
+        addReplyError(c,"SHMRING is disabled, see the unixsocket-shmring option");
+        return;
+    }
+    if (!(c->flags & REDIS_UNIX_SOCKET)) {
+        addReplyError(c,"SHMRING is only available on the unix socket");
+        return;
+    }
+    if (c->flags & (REDIS_SHMRING|REDIS_MULTI|REDIS_SLAVE|REDIS_MASTER)) {
+        addReplyError(c,"SHMRING is not allowed in this context");
+        return;
+    }
+    if (c->bufpos || listLength(c->reply)) {
+        addReplyError(c,"SHMRING requires no pending replies");
+        return;
+    }
+    if (getLongLongFromObjectOrReply(c,c->argv[1],&size,NULL) != REDIS_OK)
+        return;
+    if (size < 0 || (size_t)size != shmRingRoundSize(size)) {
+        addReplyErrorFormat(c,"size must be a power of two between %d and %d",
+            SHMRING_MIN_SIZE, SHMRING_MAX_SIZE);
+        return;
+    }
+
+    if ((shm = shmRingServerCreate(size,fds,err)) == NULL) {
+        addReplyErrorFormat(c,"SHMRING failed: %s",err);
+        return;
+    }
+
+    /* The reply is sent here, bypassing the output buffers, since the
+     * descriptors must travel with it. */
+    if (shmRingSendFds(c->fd,"+OK\r\n",5,fds,3) == -1) {
+        redisLog(REDIS_VERBOSE,"Error sending the SHMRING descriptors: %s",
+            strerror(errno));
+        close(fds[0]);
+        shmRingConnFree(shm);
+        freeClientAsync(c);
+        return;
+    }
+    close(fds[0]);
+    if (aeCreateFileEvent(server.el,shm->rfd,AE_READABLE,
+        readQueryFromRing,c) == AE_ERR)
+    {
+        shmRingConnFree(shm);
+        freeClientAsync(c);
+        return;
+    }
+    c->shm = shm;
+    c->flags |= REDIS_SHMRING;
+
+    /* Requests must not be read from the socket anymore. */
+    aeDeleteFileEvent(server.el,c->fd,AE_READABLE);
+    if (aeCreateFileEvent(server.el,c->fd,AE_READABLE,
+        readSocketOfRingClient,c) == AE_ERR)
+    {
+        freeClientAsync(c);
+        return;
+    }
 }
 
 /* 获取Client中输入buffer和输出buffer的最大长度值 */
@@ -1378,7 +2102,7 @@ char *getClientPeerId(redisClient *c) {
 /* 格式化的输出客户端的属性信息，直接返回一个拼接好的字符串 */
 sds catClientInfoString(sds s, redisClient *client) {
     char flags[16], events[3], *p;
-    int emask;
+    int emask, iomask;
 
     p = flags;
     if (client->flags & REDIS_SLAVE) {
@@ -1395,18 +2119,22 @@ sds catClientInfoString(sds s, redisClient *client) {
     if (client->flags & REDIS_UNBLOCKED) *p++ = 'u';
     if (client->flags & REDIS_CLOSE_ASAP) *p++ = 'A';
     if (client->flags & REDIS_UNIX_SOCKET) *p++ = 'U';
+    if (client->flags & REDIS_SHMRING) *p++ = 'R';
+    if (client->flags & REDIS_IO_COMPLETION) *p++ = 'I';
     if (p == flags) *p++ = 'N';
     *p++ = '\0';
 
     emask = client->fd == -1 ? 0 : aeGetFileEvents(server.el,client->fd);
+    /* Reads and writes in flight count as interest in the events. */
+    iomask = aeIoPending(server.el,client->fd);
     p = events;
-    if (emask & AE_READABLE) *p++ = 'r';
-    if (emask & AE_WRITABLE) *p++ = 'w';
+    if ((emask & AE_READABLE) || (iomask & AE_IO_READ)) *p++ = 'r';
+    if ((emask & AE_WRITABLE) || (iomask & AE_IO_WRITE)) *p++ = 'w';
     *p = '\0';
     
     //最后格式化输出结果
     return sdscatfmt(s,
-        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U oll=%U omem=%U events=%s cmd=%s",
+        "id=%U addr=%s fd=%i name=%s age=%I idle=%I flags=%s db=%i sub=%i psub=%i multi=%i qbuf=%U qbuf-free=%U obl=%U obs=%U oll=%U omem=%U events=%s cmd=%s",
         (unsigned long long) client->id,
         getClientPeerId(client),
         client->fd,
@@ -1421,6 +2149,7 @@ sds catClientInfoString(sds s, redisClient *client) {
         (unsigned long long) sdslen(client->querybuf),
         (unsigned long long) sdsavail(client->querybuf),
         (unsigned long long) client->bufpos,
+        (unsigned long long) (client->buf ? REDIS_REPLY_CHUNK_BYTES : 0),
         (unsigned long long) listLength(client->reply),
         (unsigned long long) getClientOutputBufferMemoryUsage(client),
         events,
@@ -1655,9 +2384,7 @@ void rewriteClientCommandArgument(redisClient *c, int i, robj *newval) {
  * enforcing the client output length limits. */
 /* 获取Client中已经用去的输出buffer的大小 */
 unsigned long getClientOutputBufferMemoryUsage(redisClient *c) {
-    unsigned long list_item_size = sizeof(listNode)+sizeof(robj);
-
-    return c->reply_bytes + (list_item_size*listLength(c->reply));
+    return c->reply_bytes + (sizeof(listNode)*listLength(c->reply));
 }
 
 /* Get the class of a client, used in order to enforce limits to different
@@ -1750,6 +2477,7 @@ int checkClientOutputBufferLimits(redisClient *c) {
 /* 异步的关闭Client，如果缓冲区中的软限制或是硬限制已经到达的时候，缓冲区超出限制的结果会导致释放不安全， */
 void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) {
     redisAssert(c->reply_bytes < ULONG_MAX-(1024*64));
+    updateClientMemUsage(c);
     if (c->reply_bytes == 0 || c->flags & REDIS_CLOSE_ASAP) return;
     if (checkClientOutputBufferLimits(c)) {
         sds client = catClientInfoString(sdsempty(),c);
@@ -1760,6 +2488,119 @@ void asyncCloseClientOnOutputBufferLimitReached(redisClient *c) {
     }
 }
 
+/* -----------------------------------------------------------------------------
+ * Client memory eviction.
+ *
+ * The output buffer limits are per client, so many clients each under the
+ * limit can still use a lot of memory. With maxmemory-clients set the query
+ * and output buffers of all the normal and Pub/Sub clients share a global
+ * budget: when it is exceeded evictClients() disconnects the clients using
+ * more memory first, and freeMemoryIfNeeded() no longer counts this memory,
+ * so that keys are not evicted because of client buffers.
+ *
+ * To find the biggest clients without scanning server.clients they are kept
+ * in REDIS_CLIENT_MEM_BUCKETS lists, one for every power of two of memory
+ * usage. updateClientMemUsage() moves a client to the right bucket every
+ * time its buffers change: after a read, when replies are queued and after
+ * a write. Masters and slaves are never indexed nor evicted.
+ * -------------------------------------------------------------------------- */
+
+/* Memory owned by the client: the client structure and its buffers. The
+ * values referenced by the reply list belong to the keyspace and are shared
+ * by every client reading them, so they are not counted: otherwise keys
+ * would be hidden from maxmemory, and the readers of big values evicted. */
+/* 获取Client自身占用的内存，不包括回复中引用的对象 */
+size_t getClientMemoryUsage(redisClient *c) {
+    size_t mem = sizeof(redisClient);
+
+    mem += sdsAllocSize(c->querybuf);
+    mem += getClientOutputBufferMemoryUsage(c)-c->reply_ref_bytes;
+    if (c->buf) mem += REDIS_REPLY_CHUNK_BYTES;
+    return mem;
+}
+
+/* 根据内存大小计算Client所在的桶 */
+static int clientMemUsageBucket(size_t mem) {
+    int log = 63-__builtin_clzll((unsigned long long)mem|1);
+
+    if (log <= REDIS_CLIENT_MEM_BUCKET_MIN_LOG) return 0;
+    log -= REDIS_CLIENT_MEM_BUCKET_MIN_LOG;
+    if (log >= REDIS_CLIENT_MEM_BUCKETS) return REDIS_CLIENT_MEM_BUCKETS-1;
+    return log;
+}
+
+/* 将Client从内存索引中移除 */
+void removeClientFromMemUsageBuckets(redisClient *c) {
+    if (c->mem_bucket == -1) return;
+    listDelNode(server.clients_mem_buckets[c->mem_bucket],c->mem_bucket_node);
+    server.clients_mem_usage -= c->mem_usage;
+    c->mem_bucket = -1;
+    c->mem_bucket_node = NULL;
+    c->mem_usage = 0;
+}
+
+/* Refresh the memory usage of the client and its position in the index.
+ * This is O(1) and only called by the main thread. */
+/* 更新Client的内存占用以及所在的桶 */
+void updateClientMemUsage(redisClient *c) {
+    size_t mem;
+    int bucket;
+
+    /* Only normal and Pub/Sub clients can be evicted. */
+    if (c->fd == -1 || c->flags & (REDIS_SLAVE|REDIS_MASTER)) {
+        removeClientFromMemUsageBuckets(c);
+        return;
+    }
+
+    mem = getClientMemoryUsage(c);
+    bucket = clientMemUsageBucket(mem);
+    if (bucket != c->mem_bucket) {
+        list *l = server.clients_mem_buckets[bucket];
+
+        removeClientFromMemUsageBuckets(c);
+        listAddNodeTail(l,c);
+        c->mem_bucket = bucket;
+        c->mem_bucket_node = listLast(l);
+    }
+    server.clients_mem_usage -= c->mem_usage;
+    server.clients_mem_usage += mem;
+    c->mem_usage = mem;
+}
+
+/* Disconnect clients, starting from the bucket of the biggest ones, until
+ * the memory of the clients is back under maxmemory-clients. Must not be
+ * called while executing a command. Returns the number of clients evicted. */
+/* 所有Client内存超过maxmemory-clients时，从占用最多的开始关闭Client */
+int evictClients(void) {
+    int j, evicted = 0;
+
+    if (server.maxmemory_clients == 0) return 0;
+    for (j = REDIS_CLIENT_MEM_BUCKETS-1; j >= 0; j--) {
+        listNode *ln = listFirst(server.clients_mem_buckets[j]);
+
+        while (ln && server.clients_mem_usage > server.maxmemory_clients) {
+            redisClient *c = listNodeValue(ln);
+
+            ln = listNextNode(ln);
+            /* Clients already scheduled to be closed free their memory
+             * soon anyway. */
+            if (c->flags & REDIS_CLOSE_ASAP || c == server.current_client)
+                continue;
+            if (server.verbosity <= REDIS_VERBOSE) {
+                sds client = catClientInfoString(sdsempty(),c);
+                redisLog(REDIS_VERBOSE,
+                    "Evicting client for maxmemory-clients: %s", client);
+                sdsfree(client);
+            }
+            freeClient(c);
+            server.stat_evictedclients++;
+            evicted++;
+        }
+        if (server.clients_mem_usage <= server.maxmemory_clients) break;
+    }
+    return evicted;
+}
+
 /* Helper function used by freeMemoryIfNeeded() in order to flush slave
  * output buffers without returning control to the event loop. */
 /* 从方法将会在freeMemoryIfNeeded()，释放内存空间函数，将存在内存中数据操作结果刷新到磁盘中 */
@@ -1798,10 +2639,258 @@ void flushSlavesOutputBuffers(void) {
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* beforeSleep() is not called here, so clients must be served directly
+     * instead of being queued for the I/O threads. */
+    processing_events_while_blocked = 1;
     while (iterations--) {
         int events = aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
         if (!events) break;
         count += events;
     }
+    processing_events_while_blocked = 0;
+
+    /* Clients using SHMRING are always queued, serve them now. */
+    if (listLength(server.clients_pending_write))
+        handleClientsWithPendingWritesUsingThreads();
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* When io-threads is greater than one, the read(2)/write(2) calls and the
+ * parsing of the query buffer of normal clients are performed by a pool of
+ * I/O threads, while commands are still executed by the main thread only.
+ *
+ * readQueryFromClient() and prepareClientToWrite() just queue the clients
+ * into server.clients_pending_read and server.clients_pending_write. Before
+ * sleeping the main thread splits each list among the threads (taking one
+ * share itself), waits for all of them to finish and then, alone, executes
+ * the parsed commands and finalizes the writes. The main thread and the
+ * I/O threads never run at the same time on the same client, so no client
+ * level locking is needed: the I/O threads only call the functions that
+ * don't touch global state (readClientSocket(), parseInputBuffer(),
+ * writeClientSocket()). */
+
+#define IO_THREADS_OP_READ 0
+#define IO_THREADS_OP_WRITE 1
+/* Below this number of clients per thread the main thread does the work
+ * alone: waking up the threads would cost more than it saves. */
+#define IO_THREADS_MIN_CLIENTS_PER_THREAD 2
+/* Iterations an idle I/O thread busy waits for new work before blocking
+ * on its condition variable. */
+#define IO_THREADS_SPIN_LOOPS 1000000
+
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+static pthread_cond_t io_threads_cond[REDIS_IO_THREADS_MAX_NUM];
+static list *io_threads_list[REDIS_IO_THREADS_MAX_NUM]; /* 每个线程分配到的Client */
+static unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM]; /* 每个线程未完成的Client数量 */
+static int io_threads_op; /* 当前是读操作还是写操作 */
+
+#if defined(__ATOMIC_RELAXED)
+#define getIOPendingCount(i) __atomic_load_n(&io_threads_pending[i],__ATOMIC_ACQUIRE)
+#define setIOPendingCount(i,v) __atomic_store_n(&io_threads_pending[i],(v),__ATOMIC_RELEASE)
+#else
+#define getIOPendingCount(i) __sync_add_and_fetch(&io_threads_pending[i],0)
+#define setIOPendingCount(i,v) do { \
+    __sync_synchronize(); \
+    io_threads_pending[i] = (v); \
+    __sync_synchronize(); \
+} while(0)
+#endif
+
+/* Perform the current I/O operation against a client. */
+/* 在线程中对Client执行读或写 */
+static void ioThreadsHandleClient(redisClient *c) {
+    if (io_threads_op == IO_THREADS_OP_WRITE) {
+        writeClientSocket(c);
+    } else {
+        readClientSocket(c);
+        /* Parse the first command, it's up to the main thread to execute
+         * it and to parse the rest of the buffer, if any. */
+        if (c->io_nread > 0 &&
+            !(c->flags & REDIS_CLOSE_AFTER_REPLY) &&
+            sdslen(c->querybuf) <= server.client_max_querybuf_len &&
+            parseInputBuffer(c) == REDIS_OK)
+        {
+            c->flags |= REDIS_PENDING_COMMAND;
+        }
+    }
+}
+
+/* I/O线程的主循环，等待主线程分配的Client并执行读或写 */
+void *IOThreadMain(void *myid) {
+    long id = (unsigned long) myid;
+    sigset_t sigset;
+    listIter li;
+    listNode *ln;
+    int j;
+
+    /* Like the bio threads, leave SIGALRM to the main thread. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        redisLog(REDIS_WARNING,
+            "Warning: can't mask SIGALRM in I/O thread: %s", strerror(errno));
+
+    while(1) {
+        /* Spin for a while, new work usually comes at the next event loop
+         * iteration, then go to sleep until the main thread signals us. */
+        for (j = 0; j < IO_THREADS_SPIN_LOOPS; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            while (getIOPendingCount(id) == 0)
+                pthread_cond_wait(&io_threads_cond[id],&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+        }
+
+        listRewind(io_threads_list[id],&li);
+        while((ln = listNext(&li))) ioThreadsHandleClient(listNodeValue(ln));
+        while(listLength(io_threads_list[id]))
+            listDelNode(io_threads_list[id],listFirst(io_threads_list[id]));
+        setIOPendingCount(id,0);
+    }
+    return NULL;
+}
+
+/* Initialize the data structures needed for threaded I/O and spawn the
+ * threads. Thread 0 is the main thread itself. */
+/* 创建I/O线程 */
+void initThreadedIO(void) {
+    pthread_t tid;
+    int j;
+
+    for (j = 0; j < server.io_threads_num; j++) {
+        io_threads_list[j] = listCreate();
+        io_threads_pending[j] = 0;
+        if (j == 0) continue;
+
+        pthread_mutex_init(&io_threads_mutex[j],NULL);
+        pthread_cond_init(&io_threads_cond[j],NULL);
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)j) != 0) {
+            redisLog(REDIS_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+        io_threads[j] = tid;
+    }
+}
+
+/* Queue the client for a threaded read if threaded reads are enabled and
+ * the client can be served by the I/O threads. Masters and slaves are
+ * always served by the main thread, as are clients that are blocked or
+ * reading while we process events during a long blocking operation. */
+/* 开启线程读时，把Client加入等待读的列表 */
+static int postponeClientRead(redisClient *c) {
+    if (server.io_threads_num > 1 &&
+        server.io_threads_do_reads &&
+        !processing_events_while_blocked &&
+        !(c->flags & (REDIS_MASTER|REDIS_SLAVE|REDIS_BLOCKED|
+                      REDIS_PENDING_READ)))
+    {
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    }
+    return 0;
+}
+
+/* Distribute the clients among the I/O threads round robin, perform 'op'
+ * on the main thread share and wait for the other threads to finish. */
+/* 把Client分配给I/O线程执行读或写，并等待全部完成 */
+static void runThreadedIO(list *clients, int op) {
+    int threads = server.io_threads_num;
+    unsigned long pending;
+    listIter li;
+    listNode *ln;
+    int j, item_id = 0;
+
+    /* Not enough work to be worth the synchronization cost. */
+    if (listLength(clients) < (unsigned long)
+        (threads*IO_THREADS_MIN_CLIENTS_PER_THREAD)) threads = 1;
+
+    io_threads_op = op;
+    listRewind(clients,&li);
+    while((ln = listNext(&li))) {
+        int target_id = item_id % threads;
+        listAddNodeTail(io_threads_list[target_id],listNodeValue(ln));
+        item_id++;
+    }
+
+    /* Wake up the threads, then do our own share. */
+    for (j = 1; j < threads; j++) {
+        pthread_mutex_lock(&io_threads_mutex[j]);
+        setIOPendingCount(j,listLength(io_threads_list[j]));
+        pthread_cond_signal(&io_threads_cond[j]);
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    }
+    listRewind(io_threads_list[0],&li);
+    while((ln = listNext(&li))) ioThreadsHandleClient(listNodeValue(ln));
+    while(listLength(io_threads_list[0]))
+        listDelNode(io_threads_list[0],listFirst(io_threads_list[0]));
+
+    while(1) {
+        pending = 0;
+        for (j = 1; j < threads; j++) pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+}
+
+/* Read and parse the queries of the clients queued by readQueryFromClient()
+ * using the I/O threads, then execute the commands in the main thread.
+ * Called by beforeSleep(), returns the number of clients processed. */
+/* 用I/O线程读取并解析等待读的Client，然后在主线程中执行命令 */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    int processed = listLength(server.clients_pending_read);
+    listNode *ln;
+    redisClient *c;
+
+    if (processed == 0) return 0;
+    runThreadedIO(server.clients_pending_read,IO_THREADS_OP_READ);
+
+    /* Executing a command may free other clients of the list (think of
+     * CLIENT KILL), so always pop from the head. */
+    while(listLength(server.clients_pending_read)) {
+        ln = listFirst(server.clients_pending_read);
+        c = listNodeValue(ln);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~REDIS_PENDING_READ;
+
+        server.current_client = c;
+        if (handleClientRead(c) == REDIS_OK) {
+            if (c->proto_err) replyProtocolError(c);
+            processInputBuffer(c);
+        }
+        server.current_client = NULL;
+    }
+    server.stat_io_reads_processed += processed;
+    return processed;
+}
+
+/* Write the replies of the clients queued by prepareClientToWrite() using
+ * the I/O threads. Clients whose reply doesn't fit the socket buffer get a
+ * regular write handler. Called by beforeSleep(), returns the number of
+ * clients processed. */
+/* 用I/O线程写出等待写的Client的回复 */
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    listNode *ln;
+    redisClient *c;
+
+    if (processed == 0) return 0;
+    runThreadedIO(server.clients_pending_write,IO_THREADS_OP_WRITE);
+
+    while(listLength(server.clients_pending_write)) {
+        ln = listFirst(server.clients_pending_write);
+        c = listNodeValue(ln);
+        listDelNode(server.clients_pending_write,ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        handleClientWrite(c);
+    }
+    server.stat_io_writes_processed += processed;
+    return processed;
+}
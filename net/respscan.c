@@ -0,0 +1,398 @@
+/* respscan.c -- Vectorized scanning of the Redis protocol
+ * 协议解析中换行符的向量化查找以及长度字段的快速解析
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The request parser used to look for every "\r\n" with strchr() and to
+ * convert every "*<count>" and "$<len>" with string2ll(), one argument at a
+ * time. With pipelines of small commands this is a big part of the main
+ * thread CPU time.
+ *
+ * Here the parser gets a scanner instead: when it needs a line terminator
+ * the scanner compares a whole window of the buffer (RESP_SCAN_WINDOW bytes)
+ * against the terminator 16 or 32 bytes at a time with SSE2 or AVX2, and
+ * remembers the offsets of all the matches. The following lines of the same
+ * window are then returned without looking at the buffer again. Bytes the
+ * parser already skipped (bulk payloads) are never scanned.
+ *
+ * The implementation is selected at startup by respScanInit() according to
+ * the CPU features. Without SSE2/AVX2, or when respScanInit() is never called,
+ * respScannerNext() calls memchr() once per line exactly like the original
+ * loop did: the windows only pay off when the comparison is done inline.
+ *
+ * Lengths of up to 8 digits, that is, almost all of them, are converted by
+ * respParseLength() with a few 64 bit operations instead of a loop. */
+
+#include "fmacros.h"
+#include <string.h>
+#include "config.h"
+#include "util.h"
+#include "respscan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_RESP_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+/* Scan the buffer from s->scanned to 'end' (excluded), appending the offsets
+ * of the terminators to s->offsets. When the array gets full s->scanned is
+ * set to the offset of the first terminator that was not stored, otherwise
+ * to 'end'. */
+typedef void respScanProc(respScanner *s, size_t end);
+
+/* 标量实现，使用memchr查找结束符 */
+static void respScanScalar(respScanner *s, size_t end) {
+    const char *p = s->buf+s->scanned, *e = s->buf+end;
+
+    while (p < e && (p = memchr(p,s->term,e-p)) != NULL) {
+        if (s->count == RESP_SCAN_MAX_TERM) {
+            s->scanned = p-s->buf;
+            return;
+        }
+        s->offsets[s->count++] = p-s->buf;
+        p++;
+    }
+    s->scanned = end;
+}
+
+#ifdef HAVE_RESP_SCAN_X86
+/* Store the terminators found in a block starting at offset 'off', given as
+ * a bitmap with one bit per byte. Returns 0 if the offsets array got full. */
+/* 将一个块中找到的结束符位置保存到扫描器中 */
+static inline int respScanRecord(respScanner *s, size_t off, uint32_t mask) {
+    while (mask) {
+        size_t pos = off+__builtin_ctz(mask);
+
+        if (s->count == RESP_SCAN_MAX_TERM) {
+            s->scanned = pos;
+            return 0;
+        }
+        s->offsets[s->count++] = pos;
+        mask &= mask-1;
+    }
+    return 1;
+}
+
+/* 使用SSE2指令每次比较16个字节 */
+__attribute__((target("sse2")))
+static void respScanSSE2(respScanner *s, size_t end) {
+    const __m128i term = _mm_set1_epi8(s->term);
+    size_t off = s->scanned;
+
+    while (off+16 <= end) {
+        __m128i block = _mm_loadu_si128((const __m128i*)(s->buf+off));
+        uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block,term));
+
+        if (!respScanRecord(s,off,mask)) return;
+        off += 16;
+    }
+    s->scanned = off;
+    respScanScalar(s,end);
+}
+
+/* 使用AVX2指令每次比较32个字节 */
+__attribute__((target("avx2")))
+static void respScanAVX2(respScanner *s, size_t end) {
+    const __m256i term = _mm256_set1_epi8(s->term);
+    size_t off = s->scanned;
+
+    while (off+32 <= end) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)(s->buf+off));
+        uint32_t mask = (uint32_t)
+            _mm256_movemask_epi8(_mm256_cmpeq_epi8(block,term));
+
+        if (!respScanRecord(s,off,mask)) return;
+        off += 32;
+    }
+    s->scanned = off;
+    respScanSSE2(s,end);
+}
+#endif
+
+static respScanProc *respScanBlock = respScanScalar;
+static const char *respScanName = "scalar";
+
+/* Select the fastest implementation supported by this CPU. Must be called
+ * before any other thread uses the scanner. */
+/* 根据CPU支持的指令集选择扫描实现 */
+void respScanInit(void) {
+#ifdef HAVE_RESP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        respScanBlock = respScanAVX2;
+        respScanName = "avx2";
+        return;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        respScanBlock = respScanSSE2;
+        respScanName = "sse2";
+        return;
+    }
+#endif
+    respScanBlock = respScanScalar;
+    respScanName = "scalar";
+}
+
+/* 返回当前使用的扫描实现的名称 */
+const char *respScanImplName(void) {
+    return respScanName;
+}
+
+/* 初始化一个扫描器 */
+void respScannerInit(respScanner *s, const char *buf, size_t len, char term) {
+    s->buf = buf;
+    s->len = len;
+    s->scanned = 0;
+    s->term = term;
+    s->count = 0;
+    s->next = 0;
+}
+
+/* Return a pointer to the first terminator at offset 'from' or after it,
+ * or NULL if there is none in the buffer. Offsets must be requested in
+ * ascending order. */
+/* 返回from位置及之后的第一个结束符 */
+char *respScannerNext(respScanner *s, size_t from) {
+    /* Without SIMD recording the offsets of a window costs more than it
+     * saves: just look for the next terminator like the old strchr() loop
+     * did, with the libc memchr() that is already vectorized. */
+    if (respScanBlock == respScanScalar)
+        return from < s->len ?
+            memchr(s->buf+from,s->term,s->len-from) : NULL;
+
+    while(1) {
+        size_t end;
+
+        while (s->next < s->count) {
+            if (s->offsets[s->next] >= from)
+                return (char*)s->buf+s->offsets[s->next];
+            s->next++;
+        }
+
+        /* What is before 'from' will never be requested: don't scan it. */
+        if (s->scanned < from) s->scanned = from;
+        if (s->scanned >= s->len) return NULL;
+
+        end = s->scanned+RESP_SCAN_WINDOW;
+        if (end > s->len) end = s->len;
+        s->count = s->next = 0;
+        respScanBlock(s,end);
+    }
+}
+
+/* Convert the multi bulk count or bulk length 'p' of 'len' bytes, with the
+ * same semantic of string2ll(). 'avail' is the number of bytes that can be
+ * read starting at 'p' (at least 'len').
+ *
+ * Up to 8 digits without sign, that is, almost every length, are loaded as
+ * a single little endian 64 bit word, shifted so that the digits are right
+ * aligned and padded on the left with '0', then validated and converted with
+ * a few 64 bit operations instead of a loop. Anything else goes to
+ * string2ll(). */
+/* 快速解析协议中的长度字段 */
+int respParseLength(const char *p, size_t len, size_t avail, long long *value) {
+#if (BYTE_ORDER == LITTLE_ENDIAN)
+    if (avail >= 8 && len >= 1 && len <= 8 && (p[0] != '0' || len == 1)) {
+        uint64_t v;
+
+        memcpy(&v,p,8);
+        if (len < 8) {
+            v <<= (8-len)*8;
+            v |= 0x3030303030303030ULL >> (len*8);
+        }
+        /* All the bytes must be 0x30-0x39: high nibble 3, and adding 6 to
+         * the low nibble must not carry into the high one. */
+        if ((v & 0xF0F0F0F0F0F0F0F0ULL) == 0x3030303030303030ULL &&
+            ((v+0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ==
+             0x3030303030303030ULL)
+        {
+            v -= 0x3030303030303030ULL;
+            /* Combine adjacent digits, then pairs, then quads. */
+            v = ((v*10)+(v>>8)) & 0x00FF00FF00FF00FFULL;
+            v = ((v*100)+(v>>16)) & 0x0000FFFF0000FFFFULL;
+            v = ((v*10000)+(v>>32)) & 0x00000000FFFFFFFFULL;
+            if (value) *value = (long long)v;
+            return 1;
+        }
+        /* Not only digits: let string2ll() decide. */
+    }
+#endif
+    return string2ll(p,len,value);
+}
+
+#ifdef RESPSCAN_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <sys/time.h>
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* Check that the scanner returns exactly what memchr() finds, jumping ahead
+ * at random like the parser does when it skips bulk payloads. */
+static void testScanner(const char *name) {
+    char buf[4096];
+    int j, i;
+
+    for (j = 0; j < 20000; j++) {
+        size_t len = rand() % sizeof(buf), from = 0;
+        respScanner s;
+        char *p;
+
+        for (i = 0; i < (int)len; i++)
+            buf[i] = (rand() % 8 == 0) ? '\r' : 'a'+rand()%26;
+        respScannerInit(&s,buf,len,'\r');
+        while(1) {
+            char *expected = len > from ? memchr(buf+from,'\r',len-from) : NULL;
+
+            p = respScannerNext(&s,from);
+            assert(p == expected);
+            if (p == NULL) break;
+            from = (p-buf)+1+(rand()%4 == 0 ? rand()%64 : 0);
+        }
+    }
+    printf("scanner (%s): ok\n", name);
+}
+
+static void testParseLength(void) {
+    char buf[32];
+    long long a, b;
+    int j, oka, okb;
+    const char *cases[] = {"0","1","9","10","99999999","12345678","123456789",
+        "-1","-0","01","00","","1a","a1","1:","1/","+1"," 1",
+        "9223372036854775807","9223372036854775808",NULL};
+
+    for (j = 0; cases[j]; j++) {
+        memset(buf,0,sizeof(buf));
+        strcpy(buf,cases[j]);
+        a = b = 0;
+        oka = respParseLength(buf,strlen(buf),sizeof(buf),&a);
+        okb = string2ll(cases[j],strlen(cases[j]),&b);
+        assert(oka == okb && (!oka || a == b));
+    }
+    for (j = 0; j < 1000000; j++) {
+        int len = 1+rand()%10, i;
+
+        for (i = 0; i < len; i++)
+            buf[i] = (rand()%20 == 0) ? rand()%256 : '0'+rand()%10;
+        a = b = 0;
+        oka = respParseLength(buf,len,sizeof(buf),&a);
+        okb = string2ll(buf,len,&b);
+        assert(oka == okb && (!oka || a == b));
+    }
+    printf("respParseLength: ok\n");
+}
+
+/* Time the scanner against strchr() on a pipeline of small SET commands. */
+static void benchScanner(const char *name) {
+    const char *cmd = "*3\r\n$3\r\nSET\r\n$16\r\nkey:000000000001\r\n"
+                      "$8\r\nvalue123\r\n";
+    size_t cmdlen = strlen(cmd), len = 0, found = 0;
+    char *buf = malloc(cmdlen*1000+1);
+    long long start;
+    int j, i;
+
+    for (j = 0; j < 1000; j++) {
+        memcpy(buf+len,cmd,cmdlen);
+        len += cmdlen;
+    }
+    buf[len] = '\0';
+
+    start = ustime();
+    for (j = 0; j < 2000; j++) {
+        respScanner s;
+        size_t from = 0;
+        char *p;
+
+        respScannerInit(&s,buf,len,'\r');
+        while ((p = respScannerNext(&s,from)) != NULL) {
+            from = (p-buf)+2;
+            found++;
+        }
+    }
+    printf("scanner (%s): %lld usec\n", name, ustime()-start);
+
+    start = ustime();
+    for (j = 0; j < 2000; j++) {
+        char *p = buf;
+
+        while ((p = strchr(p,'\r')) != NULL) {
+            p += 2;
+            found--;
+        }
+    }
+    printf("strchr: %lld usec\n", ustime()-start);
+    assert(found == 0);
+
+    start = ustime();
+    for (i = 0, j = 0; j < 10000000; j++) {
+        long long v;
+        respParseLength("16\r\n\0\0\0\0",2,8,&v);
+        i += v;
+    }
+    printf("respParseLength: %lld usec\n", ustime()-start);
+    start = ustime();
+    for (j = 0; j < 10000000; j++) {
+        long long v;
+        string2ll("16\r\n\0\0\0\0",2,&v);
+        i -= v;
+    }
+    printf("string2ll: %lld usec\n", ustime()-start);
+    assert(i == 0);
+    free(buf);
+}
+
+int main(void) {
+    testScanner("scalar");
+    benchScanner("scalar");
+#ifdef HAVE_RESP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        respScanBlock = respScanSSE2;
+        testScanner("sse2");
+        benchScanner("sse2");
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        respScanBlock = respScanAVX2;
+        testScanner("avx2");
+        benchScanner("avx2");
+    }
+#endif
+    respScanInit();
+    printf("selected: %s\n", respScanImplName());
+    testParseLength();
+    return 0;
+}
+#endif
@@ -0,0 +1,64 @@
+/* respscan.h -- Vectorized scanning of the Redis protocol
+ * 协议解析中换行符的向量化查找以及长度字段的快速解析
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RESPSCAN_H
+#define __RESPSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Max number of terminator offsets a scanner remembers, and number of bytes
+ * scanned ahead of the parser every time the scanner runs out of them. */
+#define RESP_SCAN_MAX_TERM 64
+#define RESP_SCAN_WINDOW 256
+
+/* A scanner finds all the occurrences of 'term' in a window of the buffer
+ * with a single vectorized pass, so that the parser can then consume the
+ * lines without searching again. It only references the buffer, so it must
+ * be initialized again every time the buffer is modified or reallocated. */
+/* 换行符扫描器，一次扫描记录窗口中所有的结束符的位置 */
+typedef struct respScanner {
+    const char *buf;        /* Buffer being parsed. */
+    size_t len;             /* Length of the buffer. */
+    size_t scanned;         /* Bytes before this offset were already scanned. */
+    char term;              /* Line terminator we look for. */
+    unsigned int count;     /* Number of offsets in 'offsets'. */
+    unsigned int next;      /* First offset not yet consumed. */
+    uint32_t offsets[RESP_SCAN_MAX_TERM]; /* Terminators found, ascending. */
+} respScanner;
+
+void respScanInit(void); /* 根据CPU支持的指令集选择扫描实现 */
+const char *respScanImplName(void); /* 返回当前使用的扫描实现的名称 */
+void respScannerInit(respScanner *s, const char *buf, size_t len, char term); /* 初始化一个扫描器 */
+char *respScannerNext(respScanner *s, size_t from); /* 返回from位置及之后的第一个结束符 */
+int respParseLength(const char *p, size_t len, size_t avail, long long *value); /* 快速解析协议中的长度字段 */
+
+#endif
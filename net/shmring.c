@@ -0,0 +1,557 @@
+/* shmring.c -- Shared memory transport for clients on the same host
+ * 同一台机器上的客户端通过共享内存环形缓冲区与服务端通信
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A client connected via the unix socket can ask the server, with the
+ * SHMRING command, to move the rest of the conversation to shared memory.
+ * The server creates a memfd holding two single producer / single consumer
+ * rings (requests and replies) and two eventfds, and passes the three file
+ * descriptors back with SCM_RIGHTS together with the +OK reply. The socket
+ * stays open and is only used to detect that the client went away.
+ *
+ * Data moves with one memcpy on each side and no system call. The eventfds
+ * are only written when the other side announced it is going to sleep,
+ * setting consumer_waiting (waiting for data) or producer_waiting (waiting
+ * for space) in the shared control block and checking the ring once again
+ * before blocking, so that a busy pipeline runs without any wakeup at all.
+ *
+ * This file does not depend on the rest of the server so that clients such
+ * as redis-benchmark can use it as well. */
+
+#include "fmacros.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include "config.h"
+#include "shmring.h"
+
+#ifdef HAVE_SHMRING
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#ifndef __NR_memfd_create
+#undef HAVE_SHMRING /* Kernel headers older than 3.17. */
+#endif
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#endif
+
+/* Timeout of the handshake performed by shmRingClientConnect(). */
+#define SHMRING_HANDSHAKE_TIMEOUT 5000
+
+/* 设置错误信息 */
+static void shmRingSetError(char *err, const char *fmt, const char *msg) {
+    if (err) snprintf(err,256,fmt,msg);
+}
+
+/* Return the ring size to use for a requested size: the next power of two,
+ * clamped to SHMRING_MIN_SIZE .. SHMRING_MAX_SIZE. */
+/* 将请求的大小调整为合法的2的幂次 */
+size_t shmRingRoundSize(long long size) {
+    size_t s = SHMRING_MIN_SIZE;
+
+    while ((long long)s < size && s < SHMRING_MAX_SIZE) s <<= 1;
+    return s;
+}
+
+/* 根据映射初始化连接两端的环 */
+static void shmRingSetup(shmRingConn *conn, int server) {
+    shmRingHdr *hdr = conn->hdr;
+    char *data = (char*)conn->map+SHMRING_HDR_SIZE;
+    shmRing req, rep;
+
+    req.ctl = &hdr->req;
+    req.data = data;
+    req.size = hdr->size;
+    req.head = req.tail = 0;
+    rep.ctl = &hdr->rep;
+    rep.data = data+hdr->size;
+    rep.size = hdr->size;
+    rep.head = rep.tail = 0;
+    conn->in = server ? req : rep;
+    conn->out = server ? rep : req;
+}
+
+#ifdef HAVE_SHMRING
+
+/* Create the shared memory and the two eventfds of a new connection on the
+ * server side. On success fds[0..2] are set to the memfd, the eventfd the
+ * client waits on and the eventfd the client writes to: they must be sent
+ * to the client, after which fds[0] can be closed by the caller. The other
+ * two are owned by the returned connection. */
+/* 服务端创建共享内存及eventfd */
+shmRingConn *shmRingServerCreate(size_t size, int *fds, char *err) {
+    shmRingConn *conn;
+    int memfd, cfd = -1, sfd = -1;
+    size_t maplen = SHMRING_HDR_SIZE+size*2;
+    void *map;
+
+    memfd = syscall(__NR_memfd_create,"redis-shmring",MFD_CLOEXEC);
+    if (memfd == -1) {
+        shmRingSetError(err,"memfd_create: %s",strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(memfd,maplen) == -1) {
+        shmRingSetError(err,"ftruncate: %s",strerror(errno));
+        goto error;
+    }
+    map = mmap(NULL,maplen,PROT_READ|PROT_WRITE,MAP_SHARED,memfd,0);
+    if (map == MAP_FAILED) {
+        shmRingSetError(err,"mmap: %s",strerror(errno));
+        goto error;
+    }
+    cfd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    sfd = eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if (cfd == -1 || sfd == -1) {
+        shmRingSetError(err,"eventfd: %s",strerror(errno));
+        munmap(map,maplen);
+        goto error;
+    }
+
+    /* The memfd is zero filled, only the header needs to be set. Both
+     * consumers start asleep, so that the first write wakes them up. */
+    conn = malloc(sizeof(*conn));
+    conn->map = map;
+    conn->maplen = maplen;
+    conn->hdr = map;
+    conn->hdr->magic = SHMRING_MAGIC;
+    conn->hdr->size = size;
+    conn->hdr->req.consumer_waiting = 1;
+    conn->hdr->rep.consumer_waiting = 1;
+    conn->rfd = sfd;
+    conn->wfd = cfd;
+    shmRingSetup(conn,1);
+    fds[0] = memfd;
+    fds[1] = cfd;
+    fds[2] = sfd;
+    return conn;
+
+error:
+    close(memfd);
+    if (cfd != -1) close(cfd);
+    if (sfd != -1) close(sfd);
+    return NULL;
+}
+
+/* Send 'buf' on the socket together with the file descriptors in 'fds'.
+ * The socket may be non blocking: the message is small enough to always
+ * fit in the socket buffer of a client that is waiting for it. */
+/* 通过SCM_RIGHTS发送文件描述符 */
+int shmRingSendFds(int sockfd, const char *buf, size_t len, int *fds, int nfds) {
+    struct msghdr msg;
+    struct iovec iov;
+    union {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int)*3)];
+    } cbuf;
+    struct cmsghdr *cmsg;
+
+    if (nfds > 3) return -1;
+    memset(&msg,0,sizeof(msg));
+    memset(&cbuf,0,sizeof(cbuf));
+    iov.iov_base = (void*)buf;
+    iov.iov_len = len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf.buf;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int)*nfds);
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int)*nfds);
+    memcpy(CMSG_DATA(cmsg),fds,sizeof(int)*nfds);
+    return sendmsg(sockfd,&msg,0) == (ssize_t)len ? 0 : -1;
+}
+
+/* Wait until the socket is ready for 'events', up to the handshake timeout. */
+/* 握手期间等待socket可读或可写 */
+static int shmRingPoll(int sockfd, short events) {
+    struct pollfd pfd;
+
+    pfd.fd = sockfd;
+    pfd.events = events;
+    return poll(&pfd,1,SHMRING_HANDSHAKE_TIMEOUT) == 1 ? 0 : -1;
+}
+
+/* Client side of the handshake: send SHMRING <size> on the unix socket
+ * 'sockfd', that must have no other request in flight, wait for the reply
+ * and map the shared memory it carries. On error NULL is returned and 'err'
+ * (at least 256 bytes) is set. */
+/* 客户端通过unix socket协商共享内存连接 */
+shmRingConn *shmRingClientConnect(int sockfd, size_t size, char *err) {
+    char cmd[64], sizestr[32], reply[256];
+    size_t cmdlen, sent = 0, got = 0;
+    int fds[3], nfds = 0, j;
+    shmRingConn *conn;
+    void *map;
+
+    snprintf(sizestr,sizeof(sizestr),"%zu",size);
+    cmdlen = snprintf(cmd,sizeof(cmd),"*2\r\n$7\r\nSHMRING\r\n$%zu\r\n%s\r\n",
+        strlen(sizestr),sizestr);
+    while (sent < cmdlen) {
+        ssize_t n = write(sockfd,cmd+sent,cmdlen-sent);
+        if (n == -1 && errno == EAGAIN && shmRingPoll(sockfd,POLLOUT) == 0)
+            continue;
+        if (n <= 0) {
+            shmRingSetError(err,"handshake write: %s",
+                n == 0 ? "connection closed" : strerror(errno));
+            return NULL;
+        }
+        sent += n;
+    }
+
+    /* Read the reply line, collecting the descriptors attached to it. */
+    while (got == 0 || memchr(reply,'\n',got) == NULL) {
+        struct msghdr msg;
+        struct iovec iov;
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(int)*3)];
+        } cbuf;
+        struct cmsghdr *cmsg;
+        ssize_t n;
+
+        if (got == sizeof(reply)-1) {
+            shmRingSetError(err,"handshake: %s","reply too long");
+            goto error;
+        }
+        memset(&msg,0,sizeof(msg));
+        iov.iov_base = reply+got;
+        iov.iov_len = sizeof(reply)-1-got;
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = cbuf.buf;
+        msg.msg_controllen = sizeof(cbuf.buf);
+        n = recvmsg(sockfd,&msg,MSG_CMSG_CLOEXEC);
+        if (n == -1 && errno == EAGAIN && shmRingPoll(sockfd,POLLIN) == 0)
+            continue;
+        if (n <= 0) {
+            shmRingSetError(err,"handshake read: %s",
+                n == 0 ? "connection closed" : strerror(errno));
+            goto error;
+        }
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg,cmsg)) {
+            int count;
+
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_RIGHTS) continue;
+            count = (cmsg->cmsg_len-CMSG_LEN(0))/sizeof(int);
+            for (j = 0; j < count; j++) {
+                int fd;
+
+                memcpy(&fd,CMSG_DATA(cmsg)+j*sizeof(int),sizeof(int));
+                if (nfds < 3) fds[nfds++] = fd; else close(fd);
+            }
+        }
+        got += n;
+    }
+    reply[got] = '\0';
+    if (reply[0] != '+') {
+        reply[strcspn(reply,"\r\n")] = '\0';
+        shmRingSetError(err,"%s",reply[0] == '-' ? reply+1 : reply);
+        goto error;
+    }
+    if (nfds != 3) {
+        shmRingSetError(err,"handshake: %s","missing file descriptors");
+        goto error;
+    }
+
+    map = mmap(NULL,SHMRING_HDR_SIZE+size*2,PROT_READ|PROT_WRITE,MAP_SHARED,
+        fds[0],0);
+    if (map == MAP_FAILED) {
+        shmRingSetError(err,"mmap: %s",strerror(errno));
+        goto error;
+    }
+    if (((shmRingHdr*)map)->magic != SHMRING_MAGIC ||
+        ((shmRingHdr*)map)->size != size)
+    {
+        munmap(map,SHMRING_HDR_SIZE+size*2);
+        shmRingSetError(err,"handshake: %s","bad shared memory header");
+        goto error;
+    }
+    close(fds[0]);
+    conn = malloc(sizeof(*conn));
+    conn->map = map;
+    conn->maplen = SHMRING_HDR_SIZE+size*2;
+    conn->hdr = map;
+    conn->rfd = fds[1];
+    conn->wfd = fds[2];
+    shmRingSetup(conn,0);
+    return conn;
+
+error:
+    for (j = 0; j < nfds; j++) close(fds[j]);
+    return NULL;
+}
+
+/* Mark the connection as closed for the peer, wake it up so that it can
+ * notice, and release our side. */
+/* 关闭连接并释放映射 */
+void shmRingConnFree(shmRingConn *conn) {
+    uint64_t one = 1;
+
+    __atomic_store_n(&conn->hdr->closed,1,__ATOMIC_SEQ_CST);
+    if (write(conn->wfd,&one,sizeof(one)) == -1) {
+        /* Nothing to do, the peer also watches the socket. */
+    }
+    munmap(conn->map,conn->maplen);
+    close(conn->rfd);
+    close(conn->wfd);
+    free(conn);
+}
+
+#else /* !HAVE_SHMRING */
+
+shmRingConn *shmRingServerCreate(size_t size, int *fds, char *err) {
+    ((void)size); ((void)fds);
+    shmRingSetError(err,"%s","shared memory transport not supported");
+    return NULL;
+}
+
+int shmRingSendFds(int sockfd, const char *buf, size_t len, int *fds, int nfds) {
+    ((void)sockfd); ((void)buf); ((void)len); ((void)fds); ((void)nfds);
+    return -1;
+}
+
+shmRingConn *shmRingClientConnect(int sockfd, size_t size, char *err) {
+    ((void)sockfd); ((void)size);
+    shmRingSetError(err,"%s","shared memory transport not supported");
+    return NULL;
+}
+
+void shmRingConnFree(shmRingConn *conn) {
+    ((void)conn);
+}
+
+#endif /* HAVE_SHMRING */
+
+/* Bytes available to the consumer, or -1 if the head published by the
+ * producer is not within 'size' bytes after our tail. Only the consumer may
+ * call it. */
+/* 环中待读取的字节数，对端破坏了环时返回-1 */
+ssize_t shmRingUsed(shmRing *r) {
+    uint64_t used = __atomic_load_n(&r->ctl->head,__ATOMIC_ACQUIRE)-r->tail;
+
+    return used > r->size ? -1 : (ssize_t)used;
+}
+
+/* Free space for the producer, or -1 if the tail published by the consumer
+ * is not within 'size' bytes before our head. Only the producer may call
+ * it. */
+/* 环中可写入的字节数，对端破坏了环时返回-1 */
+ssize_t shmRingAvail(shmRing *r) {
+    uint64_t used = r->head-__atomic_load_n(&r->ctl->tail,__ATOMIC_ACQUIRE);
+
+    return used > r->size ? -1 : (ssize_t)(r->size-used);
+}
+
+/* Copy up to 'len' bytes into the ring and publish them. Returns the number
+ * of bytes written, zero if the ring is full, or -1 with errno set to EPROTO
+ * if the peer corrupted the ring. Only the producer may call it. */
+/* 写入数据，返回实际写入的字节数 */
+ssize_t shmRingWrite(shmRing *r, const char *buf, size_t len) {
+    uint64_t head = r->head;
+    ssize_t avail = shmRingAvail(r);
+    size_t off, first;
+
+    if (avail == -1) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (len > (size_t)avail) len = avail;
+    if (len == 0) return 0;
+    off = head & (r->size-1);
+    first = r->size-off;
+    if (first >= len) {
+        memcpy(r->data+off,buf,len);
+    } else {
+        memcpy(r->data+off,buf,first);
+        memcpy(r->data,buf+first,len-first);
+    }
+    r->head = head+len;
+    __atomic_store_n(&r->ctl->head,r->head,__ATOMIC_RELEASE);
+    return len;
+}
+
+/* Like shmRingWrite() but gathering the data from 'iov'. The bytes are
+ * published once, after all the vectors that fit were copied. */
+/* 聚集写入 */
+ssize_t shmRingWritev(shmRing *r, const struct iovec *iov, int iovcnt) {
+    uint64_t head = r->head;
+    ssize_t ret = shmRingAvail(r);
+    size_t avail, written = 0;
+    int j;
+
+    if (ret == -1) {
+        errno = EPROTO;
+        return -1;
+    }
+    avail = ret;
+    for (j = 0; j < iovcnt && avail; j++) {
+        size_t len = iov[j].iov_len, off, first;
+        const char *buf = iov[j].iov_base;
+
+        if (len > avail) len = avail;
+        off = (head+written) & (r->size-1);
+        first = r->size-off;
+        if (first >= len) {
+            memcpy(r->data+off,buf,len);
+        } else {
+            memcpy(r->data+off,buf,first);
+            memcpy(r->data,buf+first,len-first);
+        }
+        written += len;
+        avail -= len;
+    }
+    if (written) {
+        r->head = head+written;
+        __atomic_store_n(&r->ctl->head,r->head,__ATOMIC_RELEASE);
+    }
+    return written;
+}
+
+/* Copy up to 'len' bytes out of the ring and release the space. Returns the
+ * number of bytes read, zero if the ring is empty, or -1 with errno set to
+ * EPROTO if the peer corrupted the ring. Only the consumer may call it. */
+/* 读取数据，返回实际读取的字节数 */
+ssize_t shmRingRead(shmRing *r, char *buf, size_t len) {
+    uint64_t tail = r->tail;
+    ssize_t used = shmRingUsed(r);
+    size_t off, first;
+
+    if (used == -1) {
+        errno = EPROTO;
+        return -1;
+    }
+    if (len > (size_t)used) len = used;
+    if (len == 0) return 0;
+    off = tail & (r->size-1);
+    first = r->size-off;
+    if (first >= len) {
+        memcpy(buf,r->data+off,len);
+    } else {
+        memcpy(buf,r->data+off,first);
+        memcpy(buf+first,r->data,len-first);
+    }
+    r->tail = tail+len;
+    __atomic_store_n(&r->ctl->tail,r->tail,__ATOMIC_RELEASE);
+    return len;
+}
+
+/* The producer found the ring full and is going to wait for the eventfd.
+ * Returns 1 if it can sleep, 0 if space was released in the meantime and it
+ * should write again instead. A corrupted ring also returns 0, so that the
+ * next write reports the error. */
+/* 生产者准备休眠等待空间 */
+int shmRingWaitSpace(shmRing *r) {
+    __atomic_store_n(&r->ctl->producer_waiting,1,__ATOMIC_SEQ_CST);
+    if (shmRingAvail(r) != 0) {
+        __atomic_store_n(&r->ctl->producer_waiting,0,__ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+/* The consumer drained the ring and is going to wait for the eventfd.
+ * Returns 1 if it can sleep, 0 if new data arrived in the meantime or the
+ * ring is corrupted, so that the next read reports it. */
+/* 消费者准备休眠等待数据 */
+int shmRingWaitData(shmRing *r) {
+    __atomic_store_n(&r->ctl->consumer_waiting,1,__ATOMIC_SEQ_CST);
+    if (shmRingUsed(r) != 0) {
+        __atomic_store_n(&r->ctl->consumer_waiting,0,__ATOMIC_SEQ_CST);
+        return 0;
+    }
+    return 1;
+}
+
+/* Wake up the peer if it is sleeping on the ring we just wrote. */
+/* 生产者写入后按需唤醒对端 */
+void shmRingNotifyData(shmRingConn *conn) {
+    uint32_t *w = (uint32_t*)&conn->out.ctl->consumer_waiting;
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(w,__ATOMIC_RELAXED) &&
+        __atomic_exchange_n(w,0,__ATOMIC_SEQ_CST))
+    {
+        if (write(conn->wfd,&one,sizeof(one)) == -1) {
+            /* The counter can't overflow in practice: nothing to do. */
+        }
+    }
+}
+
+/* Wake up the peer if it is waiting for space in the ring we just read. */
+/* 消费者读取后按需唤醒对端 */
+void shmRingNotifySpace(shmRingConn *conn) {
+    uint32_t *w = (uint32_t*)&conn->in.ctl->producer_waiting;
+    uint64_t one = 1;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(w,__ATOMIC_RELAXED) &&
+        __atomic_exchange_n(w,0,__ATOMIC_SEQ_CST))
+    {
+        if (write(conn->wfd,&one,sizeof(one)) == -1) {
+            /* The counter can't overflow in practice: nothing to do. */
+        }
+    }
+}
+
+/* Make our own 'rfd' readable, so that the event loop calls us again even
+ * if the peer has no reason to wake us up. */
+/* 唤醒自己，让事件循环再次处理这个连接 */
+void shmRingWakeSelf(shmRingConn *conn) {
+    uint64_t one = 1;
+
+    if (write(conn->rfd,&one,sizeof(one)) == -1) {
+        /* The counter can't overflow in practice: nothing to do. */
+    }
+}
+
+/* Consume the pending wakeups of 'rfd', to call when it becomes readable. */
+/* 清除eventfd上的唤醒计数 */
+void shmRingClearWakeup(shmRingConn *conn) {
+    uint64_t count;
+
+    if (read(conn->rfd,&count,sizeof(count)) == -1) {
+        /* EAGAIN: spurious wakeup. */
+    }
+}
+
+/* Return non zero if the peer closed the connection. */
+/* 对端是否已经关闭 */
+int shmRingPeerClosed(shmRingConn *conn) {
+    return __atomic_load_n(&conn->hdr->closed,__ATOMIC_ACQUIRE) != 0;
+}
@@ -0,0 +1,121 @@
+/* shmring.h -- Shared memory transport for clients on the same host
+ * 同一台机器上的客户端通过共享内存环形缓冲区与服务端通信
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SHMRING_H
+#define __SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Limits of the data area of every ring, in bytes. The size requested by a
+ * client is rounded up to a power of two inside this range. */
+#define SHMRING_MIN_SIZE (64*1024)
+#define SHMRING_MAX_SIZE (64*1024*1024)
+#define SHMRING_DEFAULT_SIZE (1024*1024)
+#define SHMRING_MAGIC 0x474e4952 /* "RING" */
+
+/* Control block of a single producer / single consumer ring. 'head' is only
+ * written by the producer and 'tail' only by the consumer, and they live in
+ * different cache lines so that the two sides do not fight for them. The
+ * two counters are never wrapped: used bytes are head-tail.
+ *
+ * The peer can write anything here, so each side keeps the counter it owns
+ * in its private shmRing and only trusts that copy: the counter of the peer
+ * is checked against it at every access. */
+/* 单生产者单消费者环形缓冲区的控制结构 */
+typedef struct shmRingCtl {
+    volatile uint64_t head;             /* Written by the producer. */
+    char pad1[56];
+    volatile uint64_t tail;             /* Written by the consumer. */
+    char pad2[56];
+    volatile uint32_t consumer_waiting; /* Consumer sleeps, wake it on data. */
+    volatile uint32_t producer_waiting; /* Producer sleeps, wake it on space. */
+    char pad3[56];
+} shmRingCtl;
+
+/* Header at the start of the shared mapping. The data areas of the request
+ * ring and of the reply ring follow at SHMRING_HDR_SIZE. */
+/* 共享内存头部 */
+typedef struct shmRingHdr {
+    uint32_t magic;
+    volatile uint32_t closed;   /* Set by the side that goes away. */
+    uint64_t size;              /* Size of the data area of every ring. */
+    char pad[48];
+    shmRingCtl req;             /* Client -> server. */
+    shmRingCtl rep;             /* Server -> client. */
+} shmRingHdr;
+
+#define SHMRING_HDR_SIZE 4096
+
+/* 进程中对某个环形缓冲区的引用 */
+typedef struct shmRing {
+    shmRingCtl *ctl;
+    char *data;
+    uint64_t size;              /* Power of two. */
+    uint64_t head;              /* Our copy of ctl->head, if we produce. */
+    uint64_t tail;              /* Our copy of ctl->tail, if we consume. */
+} shmRing;
+
+/* One side of a connection: the mapping, the ring it reads, the ring it
+ * writes, and two eventfds. 'rfd' becomes readable when the peer wants our
+ * attention (new data or free space), writing 'wfd' wakes up the peer. */
+/* 一个共享内存连接的一端 */
+typedef struct shmRingConn {
+    void *map;
+    size_t maplen;
+    shmRingHdr *hdr;
+    shmRing in;                 /* Ring we consume. */
+    shmRing out;                /* Ring we produce. */
+    int rfd;
+    int wfd;
+} shmRingConn;
+
+size_t shmRingRoundSize(long long size); /* 将请求的大小调整为合法的2的幂次 */
+shmRingConn *shmRingServerCreate(size_t size, int *fds, char *err); /* 服务端创建共享内存及eventfd */
+shmRingConn *shmRingClientConnect(int sockfd, size_t size, char *err); /* 客户端通过unix socket协商共享内存连接 */
+void shmRingConnFree(shmRingConn *conn); /* 关闭连接并释放映射 */
+int shmRingSendFds(int sockfd, const char *buf, size_t len, int *fds, int nfds); /* 通过SCM_RIGHTS发送文件描述符 */
+ssize_t shmRingUsed(shmRing *r); /* 环中待读取的字节数，对端破坏了环时返回-1 */
+ssize_t shmRingAvail(shmRing *r); /* 环中可写入的字节数，对端破坏了环时返回-1 */
+ssize_t shmRingWrite(shmRing *r, const char *buf, size_t len); /* 写入数据，返回实际写入的字节数 */
+ssize_t shmRingWritev(shmRing *r, const struct iovec *iov, int iovcnt); /* 聚集写入 */
+ssize_t shmRingRead(shmRing *r, char *buf, size_t len); /* 读取数据，返回实际读取的字节数 */
+int shmRingWaitSpace(shmRing *r); /* 生产者准备休眠等待空间 */
+int shmRingWaitData(shmRing *r); /* 消费者准备休眠等待数据 */
+void shmRingNotifyData(shmRingConn *conn); /* 生产者写入后按需唤醒对端 */
+void shmRingNotifySpace(shmRingConn *conn); /* 消费者读取后按需唤醒对端 */
+void shmRingWakeSelf(shmRingConn *conn); /* 唤醒自己，让事件循环再次处理这个连接 */
+void shmRingClearWakeup(shmRingConn *conn); /* 清除eventfd上的唤醒计数 */
+int shmRingPeerClosed(shmRingConn *conn); /* 对端是否已经关闭 */
+
+#endif
@@ -0,0 +1,272 @@
+/* chunkstr.c - Strings stored as a list of fixed size segments
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* APPEND and SETRANGE grow a raw string with sdsMakeRoomFor(), and past a
+ * few megabytes every reallocation may copy the whole string. Strings that
+ * are used as append only logs pay this again and again.
+ *
+ * A chunked string is instead an array of pointers to segments of
+ * CS_SEGMENT_SIZE bytes. Appending only touches the last segment (and
+ * allocates a new one when it is full), writing or reading a range only
+ * touches the segments it overlaps, and the segment of an offset is found
+ * with a division, so no operation depends on the length of the string.
+ * Only the array of pointers is reallocated as the string grows, and it is
+ * 1/8192 of the size of the string.
+ *
+ * 分段字符串由固定大小的段组成，追加和读写一个范围时只访问相关的段，
+ * 字符串变长时不需要复制已有的数据。
+ *
+ * Segments that were never written are NULL and read as zeros, so SETRANGE
+ * at a large offset does not allocate the zero bytes before it. */
+
+#include <string.h>
+#include "zmalloc.h"
+#include "chunkstr.h"
+#include "redisassert.h"
+
+/* What NULL segments read as. */
+static const unsigned char csZeroSegment[CS_SEGMENT_SIZE];
+
+/* 创建空的分段字符串 */
+chunkString *csNew(void) {
+    chunkString *cs = zmalloc(sizeof(*cs));
+
+    cs->len = 0;
+    cs->count = 0;
+    cs->cap = 0;
+    cs->seg = NULL;
+    return cs;
+}
+
+/* 释放分段字符串 */
+void csFree(chunkString *cs) {
+    size_t j;
+
+    for (j = 0; j < cs->count; j++) zfree(cs->seg[j]);
+    zfree(cs->seg);
+    zfree(cs);
+}
+
+/* 复制分段字符串 */
+chunkString *csDup(chunkString *cs) {
+    chunkString *copy = csNew();
+    size_t j;
+
+    copy->len = cs->len;
+    copy->count = copy->cap = cs->count;
+    if (cs->count) copy->seg = zmalloc(sizeof(unsigned char*)*cs->count);
+    for (j = 0; j < cs->count; j++) {
+        if (cs->seg[j] == NULL) {
+            copy->seg[j] = NULL;
+        } else {
+            copy->seg[j] = zmalloc(CS_SEGMENT_SIZE);
+            memcpy(copy->seg[j],cs->seg[j],CS_SEGMENT_SIZE);
+        }
+    }
+    return copy;
+}
+
+/* Extend the string to 'len' bytes if it is shorter. The new segments are
+ * NULL, that is, the new bytes are zeros. */
+/* 将字符串扩展到len个字节，新增的段为NULL */
+static void csGrow(chunkString *cs, size_t len) {
+    size_t count = (len+CS_SEGMENT_SIZE-1)/CS_SEGMENT_SIZE;
+
+    if (len <= cs->len) return;
+    if (count > cs->cap) {
+        size_t cap = cs->cap ? cs->cap*2 : 16;
+
+        if (cap < count) cap = count;
+        cs->seg = zrealloc(cs->seg,sizeof(unsigned char*)*cap);
+        cs->cap = cap;
+    }
+    while (cs->count < count) cs->seg[cs->count++] = NULL;
+    cs->len = len;
+}
+
+/* 根据len个字节的字符串创建分段字符串 */
+chunkString *csFromBuffer(const void *p, size_t len) {
+    chunkString *cs = csNew();
+
+    csAppend(cs,p,len);
+    return cs;
+}
+
+/* 在末尾追加len个字节 */
+void csAppend(chunkString *cs, const void *p, size_t len) {
+    csSetRange(cs,cs->len,p,len);
+}
+
+/* Overwrite 'len' bytes starting at 'offset' with the ones at 'p'. If the
+ * string is shorter than offset+len it is extended, padding it with zeros
+ * up to 'offset'. */
+/* 从offset开始覆盖len个字节，需要时用0补齐 */
+void csSetRange(chunkString *cs, size_t offset, const void *p, size_t len) {
+    const unsigned char *src = p;
+
+    if (len == 0) return;
+    csGrow(cs,offset+len);
+    while (len) {
+        size_t j = offset/CS_SEGMENT_SIZE, off = offset%CS_SEGMENT_SIZE;
+        size_t n = CS_SEGMENT_SIZE-off;
+
+        if (n > len) n = len;
+        if (cs->seg[j] == NULL) cs->seg[j] = zcalloc(CS_SEGMENT_SIZE);
+        memcpy(cs->seg[j]+off,src,n);
+        offset += n;
+        src += n;
+        len -= n;
+    }
+}
+
+/* Return a pointer to the byte at 'offset', that must be inside the string,
+ * and set '*len' to the number of bytes that can be read from it: up to the
+ * end of the segment or of the string. */
+/* 返回offset处的字节，len中保存同一个段中之后连续的字节数 */
+const unsigned char *csSegment(chunkString *cs, size_t offset, size_t *len) {
+    size_t j = offset/CS_SEGMENT_SIZE, off = offset%CS_SEGMENT_SIZE;
+    size_t n = CS_SEGMENT_SIZE-off;
+
+    assert(offset < cs->len);
+    if (n > cs->len-offset) n = cs->len-offset;
+    *len = n;
+    return (cs->seg[j] ? cs->seg[j] : csZeroSegment)+off;
+}
+
+/* Copy to 'buf' the 'len' bytes starting at 'start', that must all be
+ * inside the string. */
+/* 将从start开始的len个字节复制到buf中 */
+void csGetRange(chunkString *cs, size_t start, size_t len, void *buf) {
+    unsigned char *dst = buf;
+
+    assert(start+len <= cs->len);
+    while (len) {
+        size_t n;
+        const unsigned char *p = csSegment(cs,start,&n);
+
+        if (n > len) n = len;
+        memcpy(dst,p,n);
+        dst += n;
+        start += n;
+        len -= n;
+    }
+}
+
+#ifdef CHUNKSTR_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+/* The reference model is a flat buffer. */
+#define MODEL_BYTES (8*CS_SEGMENT_SIZE)
+
+/* Check that the string is the first 'len' bytes of 'm', and that the
+ * bytes of the last segment after the end are zeros. Returns 1 if so. */
+static int checkString(chunkString *cs, unsigned char *m, size_t len) {
+    unsigned char *buf;
+    size_t j;
+    int ok;
+
+    if (cs->len != len ||
+        cs->count != (len+CS_SEGMENT_SIZE-1)/CS_SEGMENT_SIZE) return 0;
+    buf = malloc(len+1);
+    csGetRange(cs,0,len,buf);
+    ok = memcmp(buf,m,len) == 0;
+    free(buf);
+    if (len % CS_SEGMENT_SIZE && cs->seg[cs->count-1]) {
+        unsigned char *last = cs->seg[cs->count-1];
+        for (j = len % CS_SEGMENT_SIZE; j < CS_SEGMENT_SIZE; j++)
+            if (last[j] != 0) ok = 0;
+    }
+    return ok;
+}
+
+int main(void) {
+    unsigned char *m = calloc(MODEL_BYTES,1), *data = malloc(MODEL_BYTES);
+    chunkString *cs = csNew(), *copy;
+    size_t len = 0, j;
+    int iter, ok = 1;
+
+    for (j = 0; j < MODEL_BYTES; j++) data[j] = rand();
+
+    /* APPEND and SETRANGE of random sizes, some of them far from the end. */
+    for (iter = 0; iter < 20000; iter++) {
+        size_t n = rand() % ((iter % 10 == 0) ? 3*CS_SEGMENT_SIZE/2 : 100);
+        size_t offset;
+
+        if (rand() % 2) {
+            offset = len;
+        } else {
+            offset = rand() % (len + CS_SEGMENT_SIZE*2 + 1);
+        }
+        if (offset+n > MODEL_BYTES) {
+            csFree(cs);
+            cs = csNew();
+            memset(m,0,MODEL_BYTES);
+            len = 0;
+            continue;
+        }
+        if (offset == len) csAppend(cs,data+iter%1000,n);
+        else csSetRange(cs,offset,data+iter%1000,n);
+        memcpy(m+offset,data+iter%1000,n);
+        if (n && offset+n > len) len = offset+n;
+
+        /* A random range, read both ways. */
+        if (len) {
+            size_t s = rand() % len, l = rand() % (len-s+1), avail;
+            unsigned char *buf = malloc(l+1);
+            const unsigned char *p = csSegment(cs,s,&avail);
+
+            csGetRange(cs,s,l,buf);
+            if (memcmp(buf,m+s,l) != 0 || avail == 0 || avail > len-s ||
+                memcmp(p,m+s,avail) != 0) ok = 0;
+            free(buf);
+        }
+        if (iter % 1000 == 0 && !checkString(cs,m,len)) ok = 0;
+    }
+    test_cond("APPEND and SETRANGE of random sizes",
+        ok && checkString(cs,m,len));
+
+    copy = csDup(cs);
+    test_cond("Copy of a string", checkString(copy,m,len));
+    csFree(copy);
+    csFree(cs);
+
+    copy = csFromBuffer(data,MODEL_BYTES-7);
+    test_cond("String created from a buffer",
+        checkString(copy,data,MODEL_BYTES-7));
+    csFree(copy);
+
+    free(m);
+    free(data);
+    test_report();
+    return 0;
+}
+#endif
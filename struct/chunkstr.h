@@ -0,0 +1,60 @@
+/* chunkstr.h - Strings stored as a list of fixed size segments
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CHUNKSTR_H
+#define __CHUNKSTR_H
+
+#include <stddef.h>
+
+/* Bytes of every segment. */
+#define CS_SEGMENT_SIZE (64*1024)
+
+/* Segment i holds the bytes i*CS_SEGMENT_SIZE to (i+1)*CS_SEGMENT_SIZE-1 of
+ * the string, so the segment of any offset is found with a division. A NULL
+ * segment stands for CS_SEGMENT_SIZE zero bytes. The bytes of the last
+ * segment after 'len' are always zero. */
+/* 分段字符串，每个段的大小固定，为NULL的段全部为0 */
+typedef struct chunkString {
+    size_t len;             /* Length of the string. */
+    size_t count;           /* Number of segments, enough to hold 'len'. */
+    size_t cap;             /* Number of allocated slots of 'seg'. */
+    unsigned char **seg;    /* Segments. */
+} chunkString;
+
+chunkString *csNew(void);   //创建空的分段字符串
+void csFree(chunkString *cs);   //释放分段字符串
+chunkString *csDup(chunkString *cs);    //复制分段字符串
+chunkString *csFromBuffer(const void *p, size_t len);   //根据len个字节的字符串创建分段字符串
+void csAppend(chunkString *cs, const void *p, size_t len);  //在末尾追加len个字节
+void csSetRange(chunkString *cs, size_t offset, const void *p, size_t len);    //从offset开始覆盖len个字节，需要时用0补齐
+void csGetRange(chunkString *cs, size_t start, size_t len, void *buf);  //将从start开始的len个字节复制到buf中
+const unsigned char *csSegment(chunkString *cs, size_t offset, size_t *len);   //返回offset处的字节，len中保存同一个段中之后连续的字节数
+
+#endif
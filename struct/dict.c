@@ -47,6 +47,10 @@
 #include "zmalloc.h"
 #include "redisassert.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /* Using dictEnableResize() / dictDisableResize() we make possible to
  * enable/disable resizing of the hash table as needed. This is very important
  * for Redis, as we use copy-on-write and don't want to move too much memory
@@ -66,6 +70,16 @@ static int _dictExpandIfNeeded(dict *ht);    //字典是否需要扩展
 static unsigned long _dictNextPower(unsigned long size);
 static int _dictKeyIndex(dict *ht, const void *key);
 static int _dictInit(dict *ht, dictType *type, void *privDataPtr);  //字典初始化方法
+static int _dictSwissExpand(dict *d, unsigned long size);  //开放寻址哈希表的扩增
+static void _dictSwissGrowTarget(dict *d);  //重定位时重建ht[1]
+static int _dictSwissRehash(dict *d, int n);  //开放寻址哈希表的重定位
+static dictEntry *_dictSwissAddRaw(dict *d, void *key);  //开放寻址哈希表中添加key
+static dictEntry *_dictSwissFind(dict *d, const void *key);  //开放寻址哈希表中查找key
+static int _dictSwissDelete(dict *d, const void *key, int nofree);  //开放寻址哈希表中删除key
+static void _dictSwissClear(dict *d, dictht *ht, void(callback)(void *));  //清空开放寻址哈希表
+static dictEntry *_dictSwissNext(dictIterator *iter);  //开放寻址哈希表的迭代
+static dictEntry *_dictSwissGetRandomKey(dict *d);  //开放寻址哈希表中随机获取
+static unsigned long _dictSwissScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);  //开放寻址哈希表的扫描
 
 /* -------------------------- hash functions -------------------------------- */
 /* 哈希索引计算的方法 */
@@ -177,6 +191,9 @@ static void _dictReset(dictht *ht)
     ht->size = 0;
     ht->sizemask = 0;
     ht->used = 0;
+    ht->ctrl = NULL;
+    ht->slots = NULL;
+    ht->deleted = 0;
 }
 
 /* Create a new hash table */
@@ -191,6 +208,19 @@ dict *dictCreate(dictType *type,
     return d;
 }
 
+/* Create a dictionary using open addressing tables instead of chaining.
+ * The API is the same, but entries are stored in place, see the comment
+ * on top of the open addressing section below. */
+/* 创建使用开放寻址哈希表的dict */
+dict *dictCreateSwiss(dictType *type,
+        void *privDataPtr)
+{
+    dict *d = dictCreate(type,privDataPtr);
+
+    d->swiss = 1;
+    return d;
+}
+
 /* Initialize the hash table */
 /* 初始化dict类中的type，ht等变量 */
 int _dictInit(dict *d, dictType *type,
@@ -206,6 +236,8 @@ int _dictInit(dict *d, dictType *type,
     d->rehashidx = -1;
     //当前使用中的迭代器为0
     d->iterators = 0;
+    d->swiss = 0;
+    d->rebuilds = 0;
     
     //返回DICT_OK，代表初始化成功
     return DICT_OK;
@@ -238,6 +270,8 @@ int dictExpand(dict *d, unsigned long size)
     //获取调整值，以2的幂次向上取
     unsigned long realsize = _dictNextPower(size);
 
+    if (d->swiss) return _dictSwissExpand(d,size);
+
     /* the size is invalid if it is smaller than the number of
      * elements already inside the hash table */
      //再次判断数量符合不符合
@@ -246,6 +280,7 @@ int dictExpand(dict *d, unsigned long size)
 
     /* Allocate the new hash table and initialize all pointers to NULL */
     //初始化大小
+    _dictReset(&n);
     n.size = realsize;
     n.sizemask = realsize-1;
     //为表格申请realsize个字典集的大小
@@ -274,6 +309,7 @@ int dictExpand(dict *d, unsigned long size)
  * 如果返回1说明旧的表中还存在key迁移到新表中，0代表没有 */
 int dictRehash(dict *d, int n) {
     if (!dictIsRehashing(d)) return 0;
+    if (d->swiss) return _dictSwissRehash(d,n);
 	
 	/* 根据参数分n步多次循环操作 */
     while(n--) {
@@ -382,6 +418,7 @@ dictEntry *dictAddRaw(dict *d, void *key)
     dictEntry *entry;
     dictht *ht;
 
+    if (d->swiss) return _dictSwissAddRaw(d,key);
     if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
@@ -423,8 +460,8 @@ int dictReplace(dict *d, void *key, void *val)
      * as the previous one. In this context, think to reference counting,
      * you want to increment (set), and then decrement (free), and not the
      * reverse. */
-    //赋值方法
-    auxentry = *entry;
+    //赋值方法，只复制val，开放寻址哈希表中的字典集比dictEntry要小
+    auxentry.v = entry->v;
     dictSetVal(d, entry, val);
     dictFreeVal(d, &auxentry);
     return 0;
@@ -452,6 +489,7 @@ static int dictGenericDelete(dict *d, const void *key, int nofree)
     int table;
 
     if (d->ht[0].size == 0) return DICT_ERR; /* d->ht[0].table is NULL */
+    if (d->swiss) return _dictSwissDelete(d,key,nofree);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     //计算key对应的哈希索引
     h = dictHashKey(d, key);
@@ -500,6 +538,11 @@ int dictDeleteNoFree(dict *ht, const void *key) {
 int _dictClear(dict *d, dictht *ht, void(callback)(void *)) {
     unsigned long i;
 
+    if (d->swiss) {
+        _dictSwissClear(d,ht,callback);
+        return DICT_OK;
+    }
+
     /* Free all the elements */
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
@@ -541,6 +584,7 @@ dictEntry *dictFind(dict *d, const void *key)
     unsigned int h, idx, table;
 
     if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
+    if (d->swiss) return _dictSwissFind(d,key);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     h = dictHashKey(d, key);
     for (table = 0; table <= 1; table++) {
@@ -576,10 +620,10 @@ long long dictFingerprint(dict *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = (long) d->ht[0].table ^ (long) d->ht[0].slots;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = (long) d->ht[1].table ^ (long) d->ht[1].slots;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -629,6 +673,7 @@ dictIterator *dictGetSafeIterator(dict *d) {
 /* 迭代器获取下一个集合点 */
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (iter->d->swiss) return _dictSwissNext(iter);
     while (1) {
         if (iter->entry == NULL) {
             dictht *ht = &iter->d->ht[iter->table];
@@ -688,6 +733,7 @@ dictEntry *dictGetRandomKey(dict *d)
     int listlen, listele;
 
     if (dictSize(d) == 0) return NULL;
+    if (d->swiss) return _dictSwissGetRandomKey(d);
     if (dictIsRehashing(d)) _dictRehashStep(d);
     if (dictIsRehashing(d)) {
         do {
@@ -827,6 +873,7 @@ unsigned long dictScan(dict *d,
     unsigned long m0, m1;
 
     if (dictSize(d) == 0) return 0;
+    if (d->swiss) return _dictSwissScan(d,v,fn,privdata);
 
     if (!dictIsRehashing(d)) {
         t0 = &(d->ht[0]);
@@ -959,6 +1006,464 @@ static int _dictKeyIndex(dict *d, const void *key)
     return idx;
 }
 
+/* ------------------------ open addressing tables -------------------------- */
+
+/* With chaining every key costs a dictEntry allocation, and every entry
+ * visited by a lookup is a pointer to follow, that is a likely cache miss.
+ * Dictionaries created with dictCreateSwiss() use open addressing tables in
+ * the style of the "Swiss tables" instead: the entries (dictSlot) are stored
+ * in place, and every slot has a control byte holding the lower 7 bits of
+ * the hash of its key (H2), or DICT_CTRL_EMPTY / DICT_CTRL_DELETED.
+ *
+ * Slots are organized in groups of DICT_GROUP_SIZE. The upper bits of the
+ * hash (H1) select the home group of a key: if it is full the key goes in
+ * the following groups of a triangular probe sequence, that visits all the
+ * groups since their number is a power of two. A lookup compares the control
+ * bytes of a whole group with H2 using a couple of SSE2 instructions and
+ * only looks at the keys that match, so a miss almost never touches a key.
+ * The probe stops at the first group with an empty slot.
+ *
+ * A deleted slot becomes empty again only if its group already has empty
+ * slots, since then no probe sequence goes past it, otherwise it is marked
+ * as deleted so that lookups keep probing. Tables are kept at most 7/8 full,
+ * deleted slots included, or 15/16 when resizing is disabled, so that the
+ * table is not copied while a child is saving unless it is really needed.
+ *
+ * Everything else works as with chained tables: incremental rehashing moves
+ * a group of ht[0] per step into ht[1], safe iterators stop rehashing, and
+ * dictScan() uses the same reverse binary cursor, applied to home groups
+ * instead of buckets. */
+
+#define DICT_H1(h) ((h) >> 7)
+#define DICT_H2(h) ((h) & 0x7f)
+
+/* Return a bitmask of the slots of a group whose control byte is 'c'. */
+/* 返回分组中控制字节等于c的槽位掩码 */
+static inline unsigned int _dictGroupMatch(const unsigned char *ctrl, unsigned char c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group,_mm_set1_epi8((char)c)));
+#else
+    unsigned int mask = 0, j;
+
+    for (j = 0; j < DICT_GROUP_SIZE; j++)
+        if (ctrl[j] == c) mask |= 1U<<j;
+    return mask;
+#endif
+}
+
+/* Return a bitmask of the slots of a group that are empty or deleted: both
+ * have the most significant bit set, unlike H2. */
+/* 返回分组中空闲或已删除的槽位掩码 */
+static inline unsigned int _dictGroupMatchFree(const unsigned char *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+#else
+    unsigned int mask = 0, j;
+
+    for (j = 0; j < DICT_GROUP_SIZE; j++)
+        if (ctrl[j] & 0x80) mask |= 1U<<j;
+    return mask;
+#endif
+}
+
+/* Max number of used or deleted slots in a table of 'size' slots. */
+/* 表格中最多可以被占用的槽位数 */
+static unsigned long _dictSwissCapacity(unsigned long size) {
+    return size - (dict_can_resize ? size/8 : size/16);
+}
+
+/* Look for 'key', of hash 'h', in the table. Returns its slot or NULL. */
+/* 在表格中查找key所在的槽位 */
+static dictSlot *_dictSwissLookup(dict *d, dictht *ht, const void *key, unsigned int h) {
+    unsigned long gm = ht->sizemask/DICT_GROUP_SIZE, g = DICT_H1(h) & gm, i = 0;
+
+    while(1) {
+        const unsigned char *ctrl = ht->ctrl+g*DICT_GROUP_SIZE;
+        unsigned int mask = _dictGroupMatch(ctrl,DICT_H2(h));
+
+        while(mask) {
+            dictSlot *s = ht->slots+g*DICT_GROUP_SIZE+__builtin_ctz(mask);
+
+            if (dictCompareKeys(d, key, s->key)) return s;
+            mask &= mask-1;
+        }
+        if (_dictGroupMatch(ctrl,DICT_CTRL_EMPTY) || i == gm) return NULL;
+        g = (g+(++i)) & gm;
+    }
+}
+
+/* Take the first free slot of the probe sequence of the hash 'h' for a new
+ * key, that must not be already in the table, and return it. The caller is
+ * responsible of setting the key and the value. */
+/* 为新的key占用探测序列中第一个空闲的槽位 */
+static dictSlot *_dictSwissClaimSlot(dictht *ht, unsigned int h) {
+    unsigned long gm = ht->sizemask/DICT_GROUP_SIZE, g = DICT_H1(h) & gm, i = 0;
+    unsigned long idx;
+    unsigned int mask;
+
+    while((mask = _dictGroupMatchFree(ht->ctrl+g*DICT_GROUP_SIZE)) == 0)
+        g = (g+(++i)) & gm;
+    idx = g*DICT_GROUP_SIZE+__builtin_ctz(mask);
+    if (ht->ctrl[idx] == DICT_CTRL_DELETED) ht->deleted--;
+    ht->ctrl[idx] = DICT_H2(h);
+    ht->used++;
+    return ht->slots+idx;
+}
+
+/* Number of slots of a table able to hold 'size' keys. */
+/* 可以容纳size个key的表格的槽位数 */
+static unsigned long _dictSwissTableSize(unsigned long size) {
+    unsigned long realsize = DICT_GROUP_SIZE;
+
+    while(realsize-realsize/8 < size && realsize < LONG_MAX/2) realsize *= 2;
+    return realsize;
+}
+
+/* Initialize 'n' as an empty table of 'realsize' slots. */
+/* 创建一个有realsize个槽位的空表格 */
+static void _dictSwissInitTable(dictht *n, unsigned long realsize) {
+    /* Slots and control bytes share the same allocation. */
+    _dictReset(n);
+    n->size = realsize;
+    n->sizemask = realsize-1;
+    n->slots = zmalloc(realsize*(sizeof(dictSlot)+1));
+    n->ctrl = (unsigned char*)(n->slots+realsize);
+    memset(n->ctrl,DICT_CTRL_EMPTY,realsize);
+}
+
+/* Create a table able to hold 'size' keys. Like dictExpand(), that calls
+ * it for open addressing dicts. */
+/* 开放寻址哈希表的扩增 */
+static int _dictSwissExpand(dict *d, unsigned long size) {
+    unsigned long realsize;
+    dictht n;
+
+    if (dictIsRehashing(d) || d->ht[0].used > size)
+        return DICT_ERR;
+    realsize = _dictSwissTableSize(size);
+
+    /* Nothing to gain rehashing into a table of the same size, unless we
+     * want to get rid of the deleted slots. */
+    if (realsize == d->ht[0].size && d->ht[0].deleted == 0)
+        return DICT_ERR;
+
+    _dictSwissInitTable(&n,realsize);
+    if (d->ht[0].slots == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
+
+/* Replace ht[1] with a table sized for twice the keys of both tables, and
+ * without deleted slots, while rehashing. This is the only way to make room
+ * when safe iterators are stopping the rehashing: ht[0] is left alone, and
+ * safe iterators walking ht[1] notice that it was replaced thanks to
+ * d->rebuilds, see _dictSwissNext(). */
+/* 正在重定位时重建ht[1]，使其有足够的空间 */
+static void _dictSwissGrowTarget(dict *d) {
+    dictht *t1 = &d->ht[1], n;
+    unsigned long i;
+
+    _dictSwissInitTable(&n,_dictSwissTableSize((d->ht[0].used+t1->used)*2));
+    for (i = 0; i < t1->size; i++) {
+        dictSlot *s = t1->slots+i;
+
+        if (t1->ctrl[i] & DICT_CTRL_EMPTY) continue; /* Empty or deleted. */
+        *_dictSwissClaimSlot(&n,dictHashKey(d, s->key)) = *s;
+    }
+    zfree(t1->slots);
+    *t1 = n;
+    d->rebuilds++;
+}
+
+/* Make sure there is room for one more key. */
+/* 判断开放寻址哈希表是否需要扩容 */
+static int _dictSwissExpandIfNeeded(dict *d) {
+    dictht *ht;
+
+    /* New keys go to ht[1], that has room for twice the keys of ht[0]: it
+     * can only get full if safe iterators stop the rehashing for a long
+     * time. Then the rehashing is completed if possible, otherwise ht[1]
+     * is replaced with a bigger table. */
+    if (dictIsRehashing(d)) {
+        ht = &d->ht[1];
+        if (ht->used+ht->deleted+d->ht[0].used < _dictSwissCapacity(ht->size))
+            return DICT_OK;
+        if (d->iterators) {
+            _dictSwissGrowTarget(d);
+            return DICT_OK;
+        }
+        while(dictRehash(d,100));
+    }
+
+    if (d->ht[0].size == 0) return dictExpand(d, DICT_HT_INITIAL_SIZE);
+    ht = &d->ht[0];
+    if (ht->used+ht->deleted < _dictSwissCapacity(ht->size)) return DICT_OK;
+
+    /* If most of the slots are deleted this is a rehash to a table of the
+     * same size, or smaller, just to clean them up. */
+    return dictExpand(d, ht->used*2);
+}
+
+/* Move N groups of slots from ht[0] to ht[1], see dictRehash(). Here
+ * rehashidx is the index of a group of ht[0]. */
+/* 开放寻址哈希表的重定位，每一步迁移旧表中的一个分组 */
+static int _dictSwissRehash(dict *d, int n) {
+    dictht *t0 = &d->ht[0], *t1 = &d->ht[1];
+
+    while(n--) {
+        unsigned long base;
+        unsigned int mask;
+
+        /* Check if we already rehashed the whole table... */
+        if (t0->used == 0) {
+            zfree(t0->slots);
+            *t0 = *t1;
+            _dictReset(t1);
+            d->rehashidx = -1;
+            return 0;
+        }
+
+        assert(t0->size > (unsigned long)d->rehashidx*DICT_GROUP_SIZE);
+        while((mask = ~_dictGroupMatchFree(t0->ctrl+
+               d->rehashidx*DICT_GROUP_SIZE) & 0xffff) == 0) d->rehashidx++;
+
+        /* Moved slots are marked as deleted, not as empty, so that the keys
+         * still in ht[0] can be found. */
+        base = d->rehashidx*DICT_GROUP_SIZE;
+        while(mask) {
+            unsigned long idx = base+__builtin_ctz(mask);
+            dictSlot *s = t0->slots+idx;
+
+            *_dictSwissClaimSlot(t1,dictHashKey(d, s->key)) = *s;
+            t0->ctrl[idx] = DICT_CTRL_DELETED;
+            t0->deleted++;
+            t0->used--;
+            mask &= mask-1;
+        }
+        d->rehashidx++;
+    }
+    return 1;
+}
+
+/* dictAddRaw() for open addressing dicts. */
+/* 开放寻址哈希表中添加key */
+static dictEntry *_dictSwissAddRaw(dict *d, void *key) {
+    unsigned int h;
+    dictSlot *s;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (_dictSwissExpandIfNeeded(d) == DICT_ERR) return NULL;
+
+    h = dictHashKey(d, key);
+    if (_dictSwissLookup(d,&d->ht[0],key,h) ||
+        (dictIsRehashing(d) && _dictSwissLookup(d,&d->ht[1],key,h)))
+        return NULL;
+    s = _dictSwissClaimSlot(dictIsRehashing(d) ? &d->ht[1] : &d->ht[0],h);
+    dictSetKey(d, s, key);
+    return (dictEntry*)s;
+}
+
+/* dictFind() for open addressing dicts. */
+/* 开放寻址哈希表中查找key */
+static dictEntry *_dictSwissFind(dict *d, const void *key) {
+    unsigned int h;
+    dictSlot *s;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    s = _dictSwissLookup(d,&d->ht[0],key,h);
+    if (s == NULL && dictIsRehashing(d))
+        s = _dictSwissLookup(d,&d->ht[1],key,h);
+    return (dictEntry*)s;
+}
+
+/* dictDelete() and dictDeleteNoFree() for open addressing dicts. */
+/* 开放寻址哈希表中删除key */
+static int _dictSwissDelete(dict *d, const void *key, int nofree) {
+    unsigned int h;
+    int table;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+        dictSlot *s = _dictSwissLookup(d,ht,key,h);
+
+        if (s) {
+            unsigned long idx = s-ht->slots;
+            unsigned char *group = ht->ctrl+(idx & ~(unsigned long)(DICT_GROUP_SIZE-1));
+
+            if (!nofree) {
+                dictFreeKey(d, s);
+                dictFreeVal(d, s);
+            }
+            if (_dictGroupMatch(group,DICT_CTRL_EMPTY)) {
+                ht->ctrl[idx] = DICT_CTRL_EMPTY;
+            } else {
+                ht->ctrl[idx] = DICT_CTRL_DELETED;
+                ht->deleted++;
+            }
+            ht->used--;
+            return DICT_OK;
+        }
+        if (!dictIsRehashing(d)) break;
+    }
+    return DICT_ERR; /* not found */
+}
+
+/* _dictClear() for open addressing dicts. */
+/* 清空开放寻址哈希表 */
+static void _dictSwissClear(dict *d, dictht *ht, void(callback)(void *)) {
+    unsigned long i;
+
+    for (i = 0; i < ht->size && ht->used > 0; i++) {
+        dictSlot *s = ht->slots+i;
+
+        if (callback && (i & 65535) == 0) callback(d->privdata);
+        if (ht->ctrl[i] & DICT_CTRL_EMPTY) continue; /* Empty or deleted. */
+        dictFreeKey(d, s);
+        dictFreeVal(d, s);
+        ht->used--;
+    }
+    zfree(ht->slots);
+    _dictReset(ht);
+}
+
+/* dictNext() for open addressing dicts: iter->index is a slot index. Keys
+ * deleted while iterating don't move the other ones, so there is no need
+ * to remember the next entry. If keys are added with a safe iterator ht[1]
+ * may be replaced by a bigger table (see _dictSwissGrowTarget()): then the
+ * walk of ht[1] starts again, so its keys may be returned twice, but never
+ * skipped. Safe iterators have no fingerprint, so it is used to remember
+ * d->rebuilds while walking ht[1]. */
+/* 开放寻址哈希表的迭代 */
+static dictEntry *_dictSwissNext(dictIterator *iter) {
+    dict *d = iter->d;
+
+    if (iter->index == -1 && iter->table == 0) {
+        if (iter->safe)
+            d->iterators++;
+        else
+            iter->fingerprint = dictFingerprint(d);
+    }
+    while(1) {
+        dictht *ht = &d->ht[iter->table];
+
+        if (iter->table == 1 && iter->safe &&
+            iter->fingerprint != (long long)d->rebuilds)
+        {
+            iter->fingerprint = d->rebuilds;
+            iter->index = -1;
+        }
+        iter->index++;
+        if (iter->index >= (long) ht->size) {
+            if (dictIsRehashing(d) && iter->table == 0) {
+                iter->table++;
+                iter->index = -1;
+                if (iter->safe) iter->fingerprint = d->rebuilds;
+                continue;
+            }
+            return NULL;
+        }
+        if (!(ht->ctrl[iter->index] & DICT_CTRL_EMPTY))
+            return (dictEntry*)(ht->slots+iter->index);
+    }
+}
+
+/* dictGetRandomKey() for open addressing dicts: slots are picked at random
+ * until a used one is found. Tables are never less than 10% full in Redis,
+ * see htNeedsResize(). */
+/* 开放寻址哈希表中随机获取一个字典集 */
+static dictEntry *_dictSwissGetRandomKey(dict *d) {
+    unsigned long idx;
+    dictht *ht;
+
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    do {
+        idx = random() % (d->ht[0].size+d->ht[1].size);
+        ht = &d->ht[0];
+        if (idx >= ht->size) {
+            idx -= ht->size;
+            ht = &d->ht[1];
+        }
+    } while(ht->ctrl[idx] & DICT_CTRL_EMPTY);
+    return (dictEntry*)(ht->slots+idx);
+}
+
+/* Emit the keys whose home group is 'g'. They are all in the probe sequence
+ * of 'g', before the first group with an empty slot, exactly where a lookup
+ * would look for them. */
+/* 扫描以g为起始分组的所有key */
+static void _dictSwissScanGroup(dict *d, dictht *ht, unsigned long g,
+                                dictScanFunction *fn, void *privdata)
+{
+    unsigned long gm = ht->sizemask/DICT_GROUP_SIZE, idx = g, i = 0;
+
+    while(1) {
+        const unsigned char *ctrl = ht->ctrl+idx*DICT_GROUP_SIZE;
+        unsigned int mask = ~_dictGroupMatchFree(ctrl) & 0xffff;
+
+        while(mask) {
+            dictSlot *s = ht->slots+idx*DICT_GROUP_SIZE+__builtin_ctz(mask);
+
+            if ((DICT_H1(dictHashKey(d, s->key)) & gm) == g)
+                fn(privdata, (dictEntry*)s);
+            mask &= mask-1;
+        }
+        if (_dictGroupMatch(ctrl,DICT_CTRL_EMPTY) || i == gm) break;
+        idx = (idx+(++i)) & gm;
+    }
+}
+
+/* dictScan() for open addressing dicts. The cursor is the same, but the
+ * position of a key in the table depends on the other keys, so instead of
+ * the keys stored in the bucket at the cursor we emit the keys whose home
+ * group is the cursor: growing or shrinking the table maps home groups the
+ * same way it maps buckets. */
+/* 开放寻址哈希表的扫描 */
+static unsigned long _dictSwissScan(dict *d,
+                                    unsigned long v,
+                                    dictScanFunction *fn,
+                                    void *privdata)
+{
+    dictht *t0, *t1;
+    unsigned long m0, m1;
+
+    t0 = &d->ht[0];
+    if (!dictIsRehashing(d)) {
+        m0 = t0->sizemask/DICT_GROUP_SIZE;
+        _dictSwissScanGroup(d,t0,v & m0,fn,privdata);
+    } else {
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask/DICT_GROUP_SIZE;
+        m1 = t1->sizemask/DICT_GROUP_SIZE;
+
+        _dictSwissScanGroup(d,t0,v & m0,fn,privdata);
+        do {
+            _dictSwissScanGroup(d,t1,v & m1,fn,privdata);
+            v = (((v | m0) + 1) & ~m0) | (v & m0);
+        } while (v & (m0 ^ m1));
+    }
+
+    v |= ~m0;
+    v = rev(v);
+    v++;
+    v = rev(v);
+    return v;
+}
+
 /* 清空整个字典，即清空里面的2张哈希表 */
 void dictEmpty(dict *d, void(callback)(void*)) {
     _dictClear(d,&d->ht[0],callback);
@@ -1102,3 +1607,241 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringDestructor,         /* val destructor */
 };
 #endif
+
+#ifdef DICT_TEST_MAIN
+#include "testhelp.h"
+
+/* Keys are the integers 1..N stored in the pointers themselves. The values
+ * are the key plus one, so that slots with the wrong value are noticed. */
+#define KEY(k) ((void*)(unsigned long)(k))
+#define VAL(k) ((void*)((unsigned long)(k)+1))
+
+static long freed_keys;
+
+static unsigned int testHash(const void *key) {
+    return dictIntHashFunction((unsigned long)key);
+}
+
+static int testCompare(void *privdata, const void *key1, const void *key2) {
+    DICT_NOTUSED(privdata);
+    return key1 == key2;
+}
+
+static void testKeyDestructor(void *privdata, void *key) {
+    DICT_NOTUSED(privdata);
+    DICT_NOTUSED(key);
+    freed_keys++;
+}
+
+static dictType testType = {
+    testHash,                   /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    testCompare,                /* key compare */
+    testKeyDestructor,          /* key destructor */
+    NULL                        /* val destructor */
+};
+
+/* The model: present[k] is set if the key k is in the dict. The helpers
+ * below clear 'model_ok' when the dict does not agree with it. */
+#define MAXKEY 100000
+static unsigned char present[MAXKEY+1];
+static unsigned char seen[MAXKEY+1];
+static int model_ok = 1;
+
+/* Returns 1 if the dict holds exactly the keys of the model. */
+static int checkDict(dict *d) {
+    unsigned long k, count = 0;
+
+    for (k = 1; k <= MAXKEY; k++) {
+        dictEntry *de = dictFind(d,KEY(k));
+
+        if (present[k]) {
+            if (de == NULL || dictGetKey(de) != KEY(k) ||
+                dictGetVal(de) != VAL(k)) return 0;
+            count++;
+        } else if (de != NULL) {
+            return 0;
+        }
+    }
+    return dictSize(d) == count;
+}
+
+static void addKey(dict *d, unsigned long k) {
+    if (dictAdd(d,KEY(k),VAL(k)) != DICT_OK) model_ok = 0;
+    present[k] = 1;
+}
+
+static void delKey(dict *d, unsigned long k) {
+    long freed = freed_keys;
+
+    if (dictDelete(d,KEY(k)) != DICT_OK || freed_keys != freed+1)
+        model_ok = 0;
+    present[k] = 0;
+}
+
+static void scanCallback(void *privdata, const dictEntry *de) {
+    unsigned long k = (unsigned long)dictGetKey(de);
+
+    DICT_NOTUSED(privdata);
+    if (k < 1 || k > MAXKEY || dictGetVal(de) != VAL(k)) {
+        model_ok = 0;
+        return;
+    }
+    seen[k] = 1;
+}
+
+/* Returns 1 if the keys from 'first' to 'last' were all seen. */
+static int allSeen(unsigned long first, unsigned long last) {
+    while(first <= last)
+        if (!seen[first++]) return 0;
+    return 1;
+}
+
+/* Index of the first used slot of 'ht' at 'idx' or after it. */
+static unsigned long firstUsedSlot(dictht *ht, unsigned long idx) {
+    while(ht->ctrl[idx] & DICT_CTRL_EMPTY) idx++;
+    return idx;
+}
+
+/* Start a rehashing of 'd' by adding keys from 'next' on. Returns the
+ * first key not added. */
+static unsigned long startRehashing(dict *d, unsigned long next) {
+    while(!dictIsRehashing(d)) addKey(d,next++);
+    return next;
+}
+
+int main(void) {
+    unsigned long j, k, next;
+    dictIterator *iter;
+    dictEntry *de;
+    dict *d;
+
+    /* Insert, delete, and churn on a small set of keys: the deleted slots
+     * must be reused or cleaned up by rehashing to a table of the same size,
+     * instead of growing the table forever. */
+    d = dictCreateSwiss(&testType,NULL);
+    for (k = 1; k <= 20000; k++) addKey(d,k);
+    test_cond("dictAdd() of new keys and of an existing one",
+        model_ok && dictAdd(d,KEY(1),VAL(1)) == DICT_ERR && checkDict(d));
+    for (k = 1; k <= 20000; k += 2) delKey(d,k);
+    test_cond("dictDelete() of present keys and of a missing one",
+        model_ok && dictDelete(d,KEY(1)) == DICT_ERR && checkDict(d));
+    while(dictIsRehashing(d)) dictRehash(d,100);
+    test_cond("Deleted slots are left as tombstones",
+        d->ht[0].deleted > 0);
+    for (j = 0; j < 500000; j++) {
+        k = 20001+rand()%1000;
+        if (present[k]) delKey(d,k); else addKey(d,k);
+    }
+    test_cond("Churn on a small set of keys does not grow the table",
+        model_ok && dictSlots(d) <= 65536 && checkDict(d));
+    dictRelease(d);
+    memset(present,0,sizeof(present));
+
+    /* Add many keys with a safe iterator alive, both while it is walking
+     * ht[0] and ht[1]: the rehashing is stopped, so ht[1] gets full and must
+     * be replaced. Every key present for the whole iteration must be
+     * returned, and nothing else. */
+    for (j = 0; j < 2; j++) {
+        unsigned long first;
+
+        d = dictCreateSwiss(&testType,NULL);
+        next = startRehashing(d,1);
+        first = next;
+        memset(seen,0,sizeof(seen));
+        iter = dictGetSafeIterator(d);
+        de = dictNext(iter);
+        if (j == 1) {
+            while(iter->table == 0) {
+                seen[(unsigned long)dictGetKey(de)] = 1;
+                de = dictNext(iter);
+            }
+        }
+        /* The slot is only valid until the next call. */
+        seen[(unsigned long)dictGetKey(de)] = 1;
+        for (k = 0; k < 50000; k++) addKey(d,next++);
+        test_cond(j == 0 ?
+            "ht[1] is replaced when a safe iterator walks ht[0]" :
+            "ht[1] is replaced when a safe iterator walks ht[1]",
+            model_ok && dictIsRehashing(d) && d->rebuilds > 0);
+        de = dictNext(iter);
+        while(de) {
+            k = (unsigned long)dictGetKey(de);
+            if (!present[k]) model_ok = 0;
+            seen[k] = 1;
+            /* Deleting the current key is allowed with safe iterators. */
+            if (k % 3 == 0) delKey(d,k);
+            de = dictNext(iter);
+        }
+        dictReleaseIterator(iter);
+        test_cond("The safe iterator returns every key present all along",
+            model_ok && allSeen(1,first-1) && checkDict(d));
+        while(dictRehash(d,100));
+        test_cond("The rehashing completes after the iteration",
+            !dictIsRehashing(d) && d->ht[0].used == dictSize(d) &&
+            checkDict(d));
+        dictRelease(d);
+        memset(present,0,sizeof(present));
+    }
+
+    /* Every key present from the start to the end of a dictScan() cycle is
+     * returned, while the table grows, rehashes and shrinks. */
+    d = dictCreateSwiss(&testType,NULL);
+    for (k = 1; k <= 5000; k++) addKey(d,k);
+    next = 5001;
+    for (j = 0; j < 4; j++) {
+        unsigned long cursor = 0;
+
+        memset(seen,0,sizeof(seen));
+        do {
+            cursor = dictScan(d,cursor,scanCallback,NULL);
+            /* Keys 1..5000 are never touched; the others come and go. */
+            if (j % 2 == 0) {
+                for (k = 0; k < 50 && next < MAXKEY; k++) addKey(d,next++);
+            } else {
+                for (k = 0; k < 50 && next > 5001; k++) delKey(d,--next);
+                dictResize(d);
+            }
+            if (dictIsRehashing(d) && rand() % 2) dictRehash(d,1);
+        } while(cursor != 0);
+        if (!allSeen(1,5000)) model_ok = 0;
+    }
+    test_cond("dictScan() returns every key present all along",
+        model_ok && checkDict(d));
+    dictRelease(d);
+    memset(present,0,sizeof(present));
+
+    /* A slot returned by dictFind() is only valid until the next call: the
+     * rehashing step of that call can move it to ht[1]. */
+    d = dictCreateSwiss(&testType,NULL);
+    next = 1;
+    while(d->ht[0].size < 1024) {
+        next = startRehashing(d,next);
+        while(dictRehash(d,100));
+    }
+    next = startRehashing(d,next);
+
+    /* The next rehashing step moves the first group of ht[0] that is not
+     * empty: take a key of the following one, that the step of its own
+     * dictFind() does not move, but the step of the next call does. */
+    j = firstUsedSlot(&d->ht[0],d->rehashidx*DICT_GROUP_SIZE);
+    j = firstUsedSlot(&d->ht[0],(j|(DICT_GROUP_SIZE-1))+1);
+    k = (unsigned long)d->ht[0].slots[j].key;
+    de = dictFind(d,KEY(k));
+    test_cond("dictFind() does not move the slot it returns",
+        (dictSlot*)de == d->ht[0].slots+j &&
+        d->ht[0].ctrl[j] != DICT_CTRL_DELETED);
+    test_cond("The rehashing step of the next call moves it",
+        dictFind(d,KEY(next)) == NULL &&
+        d->ht[0].ctrl[j] == DICT_CTRL_DELETED);
+    de = dictFind(d,KEY(k));
+    test_cond("The moved key is found in ht[1]",
+        de != NULL && (dictSlot*)de != d->ht[0].slots+j &&
+        dictGetKey(de) == KEY(k) && dictGetVal(de) == VAL(k) &&
+        model_ok && checkDict(d));
+    dictRelease(d);
+    test_report();
+    return 0;
+}
+#endif
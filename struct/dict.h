@@ -62,6 +62,22 @@ typedef struct dictEntry {
     struct dictEntry *next;
 } dictEntry;
 
+/* Entry of an open addressing table (see dictCreateSwiss()): a dictEntry
+ * without the 'next' pointer, stored in place in the table. The API returns
+ * pointers to slots as dictEntry pointers, so 'next' must never be accessed
+ * outside dict.c. Slots move when the table is rehashed: a pointer returned
+ * by the API is only valid until the next call against the same dict. */
+/* 开放寻址哈希表中的字典集，直接存放在表格中，没有next指针 */
+typedef struct dictSlot {
+    void *key;
+    union {
+        void *val;
+        uint64_t u64;
+        int64_t s64;
+        double d;
+    } v;
+} dictSlot;
+
 /* 字典类型 */
 typedef struct dictType {
 	//哈希计算方法，返回整形变量
@@ -89,6 +105,10 @@ typedef struct dictht {
     unsigned long sizemask;
     //正在被使用的数量
     unsigned long used;
+    /* Open addressing tables only: 'size' is the number of slots. */
+    unsigned char *ctrl;    /* Control byte of every slot */
+    dictSlot *slots;        /* Entries, stored in place */
+    unsigned long deleted;  /* Slots marked as deleted (tombstones) */
 } dictht;
 
 /* 字典主操作类 */
@@ -103,6 +123,10 @@ typedef struct dict {
     long rehashidx; /* rehashing not in progress if rehashidx == -1 */
     //当前迭代器数量
     int iterators; /* number of iterators currently running */
+    //是否使用开放寻址的哈希表
+    int swiss; /* open addressing tables, see dictCreateSwiss() */
+    //重定位过程中ht[1]被重建的次数
+    unsigned long rebuilds; /* ht[1] replaced while rehashing */
 } dict;
 
 /* If safe is set to 1 this is a safe iterator, that means, you can call
@@ -132,6 +156,14 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 /* 初始化哈希表的数目 */
 #define DICT_HT_INITIAL_SIZE     4
 
+/* Open addressing tables are made of groups of slots, probed together.
+ * The control byte of a slot is DICT_CTRL_EMPTY, DICT_CTRL_DELETED, or the
+ * lower 7 bits of the hash of the key it stores. */
+/* 开放寻址哈希表的分组大小以及控制字节的取值 */
+#define DICT_GROUP_SIZE 16
+#define DICT_CTRL_EMPTY 0x80
+#define DICT_CTRL_DELETED 0xfe
+
 /* ------------------------------- Macros ------------------------------------*/
 /* 字典释放val函数时候调用，如果dict中的dictType定义了这个函数指针， */
 #define dictFreeVal(d, entry) \
@@ -189,6 +221,7 @@ typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
 
 /* API */
 dict *dictCreate(dictType *type, void *privDataPtr);   //创建dict字典总类
+dict *dictCreateSwiss(dictType *type, void *privDataPtr);   //创建使用开放寻址哈希表的dict
 int dictExpand(dict *d, unsigned long size);    //字典扩增方法
 int dictAdd(dict *d, void *key, void *val);    //字典根据key, val添加一个字典集
 dictEntry *dictAddRaw(dict *d, void *key);     //字典添加一个只有key值的dicEntry
@@ -0,0 +1,854 @@
+/*
+ * Copyright (c) 2009-2012, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* An intset is a sorted array of integers without duplicates, all stored
+ * with the same width: 16, 32 or 64 bits, the smallest one able to represent
+ * every element. Adding an element that does not fit upgrades the whole set
+ * to the larger encoding; sets are never downgraded. The header and the
+ * elements are stored in little endian order, so the blob can be saved in
+ * RDB files as it is.
+ *
+ * 整数集合是一个有序且不重复的整数数组，所有元素采用相同的宽度存放，添加
+ * 放不下的元素时整个集合升级到更大的编码。
+ *
+ * Lookups use a binary search that stops when the range is down to
+ * INTSET_LINEAR_SEARCH elements. The remaining window is then scanned with
+ * SSE4.2 or AVX2, comparing 2 to 16 elements with the searched value at a
+ * time, counting the elements that are smaller: since the array is sorted
+ * that count is the position of the value. The implementation is selected
+ * at startup by intsetInit(), the scalar one is used when it is never
+ * called.
+ *
+ * intsetIntersect(), intsetUnion() and intsetDifference() build a new set
+ * from two sets by merging them. When one set is much smaller than the other
+ * the intersection and the difference gallop over the larger one, skipping
+ * runs of elements with an exponential search followed by the vectorized
+ * lookup, so that the cost depends on the size of the smaller set. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "intset.h"
+#include "zmalloc.h"
+#include "endianconv.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_INTSET_SEARCH_X86 1
+#include <immintrin.h>
+#endif
+
+/* Note that these encodings are ordered, so:
+ * INTSET_ENC_INT16 < INTSET_ENC_INT32 < INTSET_ENC_INT64. */
+/* 整数的3种编码，即每个整数占用的字节数 */
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+/* Number of elements below which the binary search hands over to the
+ * vectorized scan. */
+#define INTSET_LINEAR_SEARCH 32
+
+/* Size ratio above which the set operations gallop over the larger set
+ * instead of merging. */
+#define INTSET_GALLOP_RATIO 16
+
+/* Return the number of elements smaller than 'value' at positions
+ * [from,to) of the set, given its encoding. The value must be representable
+ * with that encoding. The vectorized versions read the elements as they are
+ * in memory, that is only correct on little endian CPUs: they are only
+ * built for x86. */
+typedef uint32_t intsetRankProc(const intset *is, uint8_t enc,
+                                uint32_t from, uint32_t to, int64_t value);
+
+/* Return the required encoding for the provided value. */
+/* 返回存放value所需要的编码 */
+static uint8_t _intsetValueEncoding(int64_t v) {
+    if (v < INT32_MIN || v > INT32_MAX)
+        return INTSET_ENC_INT64;
+    else if (v < INT16_MIN || v > INT16_MAX)
+        return INTSET_ENC_INT32;
+    else
+        return INTSET_ENC_INT16;
+}
+
+/* Return the value at pos, given an encoding. */
+/* 按照给定的编码获取pos位置上的值 */
+static inline int64_t _intsetGetEncoded(const intset *is, int pos, uint8_t enc) {
+    int64_t v64;
+    int32_t v32;
+    int16_t v16;
+
+    if (enc == INTSET_ENC_INT64) {
+        memcpy(&v64,((int64_t*)is->contents)+pos,sizeof(v64));
+        memrev64ifbe(&v64);
+        return v64;
+    } else if (enc == INTSET_ENC_INT32) {
+        memcpy(&v32,((int32_t*)is->contents)+pos,sizeof(v32));
+        memrev32ifbe(&v32);
+        return v32;
+    } else {
+        memcpy(&v16,((int16_t*)is->contents)+pos,sizeof(v16));
+        memrev16ifbe(&v16);
+        return v16;
+    }
+}
+
+/* Return the value at pos, using the configured encoding. */
+/* 按照集合的编码获取pos位置上的值 */
+static int64_t _intsetGet(intset *is, int pos) {
+    return _intsetGetEncoded(is,pos,intrev32ifbe(is->encoding));
+}
+
+/* Set the value at pos, using the configured encoding. */
+/* 按照集合的编码设置pos位置上的值 */
+static void _intsetSet(intset *is, int pos, int64_t value) {
+    uint32_t encoding = intrev32ifbe(is->encoding);
+
+    if (encoding == INTSET_ENC_INT64) {
+        ((int64_t*)is->contents)[pos] = value;
+        memrev64ifbe(((int64_t*)is->contents)+pos);
+    } else if (encoding == INTSET_ENC_INT32) {
+        ((int32_t*)is->contents)[pos] = value;
+        memrev32ifbe(((int32_t*)is->contents)+pos);
+    } else {
+        ((int16_t*)is->contents)[pos] = value;
+        memrev16ifbe(((int16_t*)is->contents)+pos);
+    }
+}
+
+/* 标量实现，从from开始逐个比较 */
+static uint32_t intsetRankScalar(const intset *is, uint8_t enc,
+                                 uint32_t from, uint32_t to, int64_t value)
+{
+    uint32_t i;
+
+    for (i = from; i < to; i++)
+        if (_intsetGetEncoded(is,i,enc) >= value) break;
+    return i-from;
+}
+
+#ifdef HAVE_INTSET_SEARCH_X86
+/* 使用SSE4.2指令每次比较16个字节 */
+__attribute__((target("sse4.2")))
+static uint32_t intsetRankSSE42(const intset *is, uint8_t enc,
+                                uint32_t from, uint32_t to, int64_t value)
+{
+    uint32_t i = from, count = 0;
+
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *p = (const int16_t*)is->contents;
+        const __m128i v = _mm_set1_epi16((int16_t)value);
+
+        /* Two mask bits per element. */
+        for (; i+8 <= to; i += 8) {
+            __m128i e = _mm_loadu_si128((const __m128i*)(p+i));
+            count += __builtin_popcount(
+                _mm_movemask_epi8(_mm_cmpgt_epi16(v,e)))/2;
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *p = (const int32_t*)is->contents;
+        const __m128i v = _mm_set1_epi32((int32_t)value);
+
+        for (; i+4 <= to; i += 4) {
+            __m128i e = _mm_loadu_si128((const __m128i*)(p+i));
+            count += __builtin_popcount(
+                _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(v,e))));
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    } else {
+        const int64_t *p = (const int64_t*)is->contents;
+        const __m128i v = _mm_set1_epi64x(value);
+
+        for (; i+2 <= to; i += 2) {
+            __m128i e = _mm_loadu_si128((const __m128i*)(p+i));
+            count += __builtin_popcount(
+                _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(v,e))));
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    }
+    return count;
+}
+
+/* 使用AVX2指令每次比较32个字节 */
+__attribute__((target("avx2")))
+static uint32_t intsetRankAVX2(const intset *is, uint8_t enc,
+                               uint32_t from, uint32_t to, int64_t value)
+{
+    uint32_t i = from, count = 0;
+
+    if (enc == INTSET_ENC_INT16) {
+        const int16_t *p = (const int16_t*)is->contents;
+        const __m256i v = _mm256_set1_epi16((int16_t)value);
+
+        for (; i+16 <= to; i += 16) {
+            __m256i e = _mm256_loadu_si256((const __m256i*)(p+i));
+            count += __builtin_popcount((uint32_t)
+                _mm256_movemask_epi8(_mm256_cmpgt_epi16(v,e)))/2;
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    } else if (enc == INTSET_ENC_INT32) {
+        const int32_t *p = (const int32_t*)is->contents;
+        const __m256i v = _mm256_set1_epi32((int32_t)value);
+
+        for (; i+8 <= to; i += 8) {
+            __m256i e = _mm256_loadu_si256((const __m256i*)(p+i));
+            count += __builtin_popcount(_mm256_movemask_ps(
+                _mm256_castsi256_ps(_mm256_cmpgt_epi32(v,e))));
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    } else {
+        const int64_t *p = (const int64_t*)is->contents;
+        const __m256i v = _mm256_set1_epi64x(value);
+
+        for (; i+4 <= to; i += 4) {
+            __m256i e = _mm256_loadu_si256((const __m256i*)(p+i));
+            count += __builtin_popcount(_mm256_movemask_pd(
+                _mm256_castsi256_pd(_mm256_cmpgt_epi64(v,e))));
+        }
+        for (; i < to && p[i] < value; i++) count++;
+    }
+    return count;
+}
+#endif
+
+static intsetRankProc *intsetRank = intsetRankScalar;
+static const char *intsetRankName = "scalar";
+
+/* Select the fastest implementation supported by this CPU. Must be called
+ * before any other thread uses intsets. */
+/* 根据CPU支持的指令集选择查找实现 */
+void intsetInit(void) {
+#ifdef HAVE_INTSET_SEARCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        intsetRank = intsetRankAVX2;
+        intsetRankName = "avx2";
+        return;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        intsetRank = intsetRankSSE42;
+        intsetRankName = "sse4.2";
+        return;
+    }
+#endif
+    intsetRank = intsetRankScalar;
+    intsetRankName = "scalar";
+}
+
+/* 返回当前使用的查找实现的名称 */
+const char *intsetImplName(void) {
+    return intsetRankName;
+}
+
+/* Return the position of the first element >= value among the elements at
+ * positions [from,to), or 'to' if there is none. */
+/* 返回[from,to)范围内第一个不小于value的元素的位置 */
+static uint32_t _intsetLowerBound(intset *is, uint32_t from, uint32_t to, int64_t value) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+
+    /* A value that does not fit the encoding is smaller or greater than
+     * all the elements. */
+    if (_intsetValueEncoding(value) > enc) return value > 0 ? to : from;
+
+    while (to-from > INTSET_LINEAR_SEARCH) {
+        uint32_t mid = from+(to-from)/2;
+
+        if (_intsetGetEncoded(is,mid,enc) < value)
+            from = mid+1;
+        else
+            to = mid;
+    }
+    return from+intsetRank(is,enc,from,to,value);
+}
+
+/* Like _intsetLowerBound() from position 'from' to the end of the set, but
+ * first find the range to search with an exponential search, so that the
+ * cost depends on the distance from 'from' and not on the size of the set. */
+/* 从from开始按指数步长跳跃，再在找到的范围内查找第一个不小于value的元素 */
+static uint32_t _intsetGallop(intset *is, uint32_t from, int64_t value) {
+    uint8_t enc = intrev32ifbe(is->encoding);
+    uint32_t len = intrev32ifbe(is->length), step = 1, hi;
+
+    if (from >= len || _intsetGetEncoded(is,from,enc) >= value) return from;
+
+    /* Here the element at 'from' is always smaller than value. */
+    while (from+step < len && _intsetGetEncoded(is,from+step,enc) < value) {
+        from += step;
+        step <<= 1;
+    }
+    hi = (from+step < len) ? from+step+1 : len;
+    return _intsetLowerBound(is,from+1,hi,value);
+}
+
+/* Create an empty intset. */
+/* 创建新的整数集合，默认编码为16位 */
+intset *intsetNew(void) {
+    intset *is = zmalloc(sizeof(intset));
+    is->encoding = intrev32ifbe(INTSET_ENC_INT16);
+    is->length = 0;
+    return is;
+}
+
+/* Resize the intset */
+/* 调整整数集合的大小，使其能放下len个元素 */
+static intset *intsetResize(intset *is, uint32_t len) {
+    uint32_t size = len*intrev32ifbe(is->encoding);
+    is = zrealloc(is,sizeof(intset)+size);
+    return is;
+}
+
+/* Search for the position of "value". Return 1 when the value was found and
+ * sets "pos" to the position of the value within the intset. Return 0 when
+ * the value is not present in the intset and sets "pos" to the position
+ * where "value" can be inserted. */
+/* 查找value的位置，找到返回1，否则返回0并将pos设置为可以插入的位置 */
+static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+    uint32_t len = intrev32ifbe(is->length), p;
+
+    /* The value can never be found when the set is empty */
+    if (len == 0) {
+        if (pos) *pos = 0;
+        return 0;
+    } else {
+        /* Check for the case where we know we cannot find the value,
+         * but do know the insert position. */
+        if (value > _intsetGet(is,len-1)) {
+            if (pos) *pos = len;
+            return 0;
+        } else if (value < _intsetGet(is,0)) {
+            if (pos) *pos = 0;
+            return 0;
+        }
+    }
+
+    p = _intsetLowerBound(is,0,len,value);
+    if (pos) *pos = p;
+    return p < len && _intsetGet(is,p) == value;
+}
+
+/* Upgrades the intset to a larger encoding and inserts the given integer. */
+/* 升级整数集合的编码并插入value，value要么比所有元素都小，要么都大 */
+static intset *intsetUpgradeAndAdd(intset *is, int64_t value) {
+    uint8_t curenc = intrev32ifbe(is->encoding);
+    uint8_t newenc = _intsetValueEncoding(value);
+    int length = intrev32ifbe(is->length);
+    int prepend = value < 0 ? 1 : 0;
+
+    /* First set new encoding and resize */
+    is->encoding = intrev32ifbe(newenc);
+    is = intsetResize(is,intrev32ifbe(is->length)+1);
+
+    /* Upgrade back-to-front so we don't overwrite values.
+     * Note that the "prepend" variable is used to make sure we have an empty
+     * space at either the beginning or the end of the intset. */
+    while(length--)
+        _intsetSet(is,length+prepend,_intsetGetEncoded(is,length,curenc));
+
+    /* Set the value at the beginning or the end. */
+    if (prepend)
+        _intsetSet(is,0,value);
+    else
+        _intsetSet(is,intrev32ifbe(is->length),value);
+    is->length = intrev32ifbe(intrev32ifbe(is->length)+1);
+    return is;
+}
+
+/* 将from位置开始的所有元素移动到to位置 */
+static void intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
+    void *src, *dst;
+    uint32_t bytes = intrev32ifbe(is->length)-from;
+    uint32_t encoding = intrev32ifbe(is->encoding);
+
+    if (encoding == INTSET_ENC_INT64) {
+        src = (int64_t*)is->contents+from;
+        dst = (int64_t*)is->contents+to;
+        bytes *= sizeof(int64_t);
+    } else if (encoding == INTSET_ENC_INT32) {
+        src = (int32_t*)is->contents+from;
+        dst = (int32_t*)is->contents+to;
+        bytes *= sizeof(int32_t);
+    } else {
+        src = (int16_t*)is->contents+from;
+        dst = (int16_t*)is->contents+to;
+        bytes *= sizeof(int16_t);
+    }
+    memmove(dst,src,bytes);
+}
+
+/* Insert an integer in the intset */
+/* 添加整数，必要时升级编码 */
+intset *intsetAdd(intset *is, int64_t value, uint8_t *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+    if (success) *success = 1;
+
+    /* Upgrade encoding if necessary. If we need to upgrade, we know that
+     * this value should be either appended (if > 0) or prepended (if < 0),
+     * because it lies outside the range of existing values. */
+    if (valenc > intrev32ifbe(is->encoding)) {
+        /* This always succeeds, so we don't need to curry *success. */
+        return intsetUpgradeAndAdd(is,value);
+    } else {
+        /* Abort if the value is already present in the set.
+         * This call will populate "pos" with the right position to insert
+         * the value when it cannot be found. */
+        if (intsetSearch(is,value,&pos)) {
+            if (success) *success = 0;
+            return is;
+        }
+
+        is = intsetResize(is,intrev32ifbe(is->length)+1);
+        if (pos < intrev32ifbe(is->length)) intsetMoveTail(is,pos,pos+1);
+    }
+
+    _intsetSet(is,pos,value);
+    is->length = intrev32ifbe(intrev32ifbe(is->length)+1);
+    return is;
+}
+
+/* Delete integer from intset */
+/* 删除整数 */
+intset *intsetRemove(intset *is, int64_t value, int *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+    if (success) *success = 0;
+
+    if (valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,&pos)) {
+        uint32_t len = intrev32ifbe(is->length);
+
+        /* We know we can delete */
+        if (success) *success = 1;
+
+        /* Overwrite value with tail and update length */
+        if (pos < (len-1)) intsetMoveTail(is,pos+1,pos);
+        is = intsetResize(is,len-1);
+        is->length = intrev32ifbe(len-1);
+    }
+    return is;
+}
+
+/* Determine whether a value belongs to this set */
+/* 查找整数是否存在 */
+uint8_t intsetFind(intset *is, int64_t value) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    return valenc <= intrev32ifbe(is->encoding) && intsetSearch(is,value,NULL);
+}
+
+/* Return random member */
+/* 随机返回一个整数 */
+int64_t intsetRandom(intset *is) {
+    return _intsetGet(is,rand()%intrev32ifbe(is->length));
+}
+
+/* Sets the value to the value at the given position. When this position is
+ * out of range the function returns 0, when in range it returns 1. */
+/* 获取pos位置上的整数，pos越界返回0 */
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value) {
+    if (pos < intrev32ifbe(is->length)) {
+        *value = _intsetGet(is,pos);
+        return 1;
+    }
+    return 0;
+}
+
+/* Return intset length */
+/* 返回整数的个数 */
+uint32_t intsetLen(intset *is) {
+    return intrev32ifbe(is->length);
+}
+
+/* Return intset blob size in bytes. */
+/* 返回整数集合占用的字节数 */
+size_t intsetBlobLen(intset *is) {
+    return sizeof(intset)+intrev32ifbe(is->length)*intrev32ifbe(is->encoding);
+}
+
+/* Create an empty intset with the given encoding and room for 'len'
+ * elements, used to build the results of the set operations. */
+/* 创建指定编码并预留len个元素空间的整数集合 */
+static intset *intsetNewSized(uint8_t enc, uint32_t len) {
+    intset *is = zmalloc(sizeof(intset)+(size_t)len*enc);
+    is->encoding = intrev32ifbe(enc);
+    is->length = 0;
+    return is;
+}
+
+/* Set the length of a set built with intsetNewSized() and release the
+ * memory that was not used. */
+/* 设置结果集合的长度并释放多余的空间 */
+static intset *intsetSetLength(intset *is, uint32_t len) {
+    is->length = intrev32ifbe(len);
+    return intsetResize(is,len);
+}
+
+/* Return a new intset with the elements that are both in 'a' and 'b'. The
+ * result uses the smaller of the two encodings, since every element of the
+ * intersection fits in both. */
+/* 求交集，返回新的整数集合 */
+intset *intsetIntersect(intset *a, intset *b) {
+    uint32_t la, lb, i, j = 0, n = 0;
+    uint8_t ea, eb;
+    int gallop;
+    intset *r;
+
+    /* Iterate the smaller set. */
+    if (intsetLen(a) > intsetLen(b)) {
+        intset *t = a;
+        a = b;
+        b = t;
+    }
+    la = intsetLen(a);
+    lb = intsetLen(b);
+    ea = intrev32ifbe(a->encoding);
+    eb = intrev32ifbe(b->encoding);
+    r = intsetNewSized(ea < eb ? ea : eb,la);
+    gallop = la && lb/la >= INTSET_GALLOP_RATIO;
+
+    for (i = 0; i < la && j < lb; i++) {
+        int64_t v = _intsetGetEncoded(a,i,ea);
+
+        if (gallop) {
+            j = _intsetGallop(b,j,v);
+        } else {
+            while (j < lb && _intsetGetEncoded(b,j,eb) < v) j++;
+        }
+        if (j == lb) break;
+        if (_intsetGetEncoded(b,j,eb) == v) {
+            _intsetSet(r,n++,v);
+            j++;
+        }
+    }
+    return intsetSetLength(r,n);
+}
+
+/* Return a new intset with the elements that are in 'a' or in 'b'. */
+/* 求并集，返回新的整数集合 */
+intset *intsetUnion(intset *a, intset *b) {
+    uint32_t la = intsetLen(a), lb = intsetLen(b), i = 0, j = 0, n = 0;
+    uint8_t ea = intrev32ifbe(a->encoding), eb = intrev32ifbe(b->encoding);
+    intset *r = intsetNewSized(ea > eb ? ea : eb,la+lb);
+
+    while (i < la && j < lb) {
+        int64_t va = _intsetGetEncoded(a,i,ea);
+        int64_t vb = _intsetGetEncoded(b,j,eb);
+
+        if (va <= vb) {
+            _intsetSet(r,n++,va);
+            i++;
+            if (va == vb) j++;
+        } else {
+            _intsetSet(r,n++,vb);
+            j++;
+        }
+    }
+    for (; i < la; i++) _intsetSet(r,n++,_intsetGetEncoded(a,i,ea));
+    for (; j < lb; j++) _intsetSet(r,n++,_intsetGetEncoded(b,j,eb));
+    return intsetSetLength(r,n);
+}
+
+/* Return a new intset with the elements of 'a' that are not in 'b'. */
+/* 求差集a-b，返回新的整数集合 */
+intset *intsetDifference(intset *a, intset *b) {
+    uint32_t la = intsetLen(a), lb = intsetLen(b), i, j = 0, n = 0;
+    uint8_t ea = intrev32ifbe(a->encoding), eb = intrev32ifbe(b->encoding);
+    int gallop = la && lb/la >= INTSET_GALLOP_RATIO;
+    intset *r = intsetNewSized(ea,la);
+
+    for (i = 0; i < la; i++) {
+        int64_t v = _intsetGetEncoded(a,i,ea);
+
+        if (j < lb) {
+            if (gallop) {
+                j = _intsetGallop(b,j,v);
+            } else {
+                while (j < lb && _intsetGetEncoded(b,j,eb) < v) j++;
+            }
+            if (j < lb && _intsetGetEncoded(b,j,eb) == v) {
+                j++;
+                continue;
+            }
+        }
+        _intsetSet(r,n++,v);
+    }
+    return intsetSetLength(r,n);
+}
+
+#ifdef INTSET_TEST_MAIN
+#include <sys/time.h>
+#include "testhelp.h"
+
+void intsetRepr(intset *is) {
+    int i;
+    for (i = 0; i < intrev32ifbe(is->length); i++) {
+        printf("%lld\n", (long long)_intsetGet(is,i));
+    }
+    printf("\n");
+}
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+intset *createSet(int bits, int size) {
+    uint64_t mask = (1<<bits)-1;
+    uint64_t i, value;
+    intset *is = intsetNew();
+
+    for (i = 0; i < size; i++) {
+        if (bits > 32) {
+            value = (rand()*rand()) & mask;
+        } else {
+            value = rand() & mask;
+        }
+        is = intsetAdd(is,value,NULL);
+    }
+    return is;
+}
+
+/* Returns 1 if the elements of 'is' are strictly increasing. */
+int checkConsistency(intset *is) {
+    int i;
+
+    for (i = 0; i+1 < intrev32ifbe(is->length); i++) {
+        uint32_t encoding = intrev32ifbe(is->encoding);
+
+        if (encoding == INTSET_ENC_INT16) {
+            int16_t *i16 = (int16_t*)is->contents;
+            if (i16[i] >= i16[i+1]) return 0;
+        } else if (encoding == INTSET_ENC_INT32) {
+            int32_t *i32 = (int32_t*)is->contents;
+            if (i32[i] >= i32[i+1]) return 0;
+        } else {
+            int64_t *i64 = (int64_t*)is->contents;
+            if (i64[i] >= i64[i+1]) return 0;
+        }
+    }
+    return 1;
+}
+
+/* Check the set operations against intsetFind() on random sets of
+ * different sizes and encodings. Returns 1 if they all agree. */
+int checkSetOps(intset *a, intset *b) {
+    intset *inter = intsetIntersect(a,b);
+    intset *uni = intsetUnion(a,b);
+    intset *diff = intsetDifference(a,b);
+    uint32_t i, ninter = 0, ndiff = 0;
+    int64_t v;
+    int ok = checkConsistency(inter) && checkConsistency(uni) &&
+             checkConsistency(diff);
+
+    for (i = 0; ok && intsetGet(a,i,&v); i++) {
+        if (intsetFind(b,v)) {
+            ninter++;
+            ok = intsetFind(inter,v);
+        } else {
+            ndiff++;
+            ok = intsetFind(diff,v);
+        }
+        ok = ok && intsetFind(uni,v);
+    }
+    for (i = 0; ok && intsetGet(b,i,&v); i++) ok = intsetFind(uni,v);
+    ok = ok && intsetLen(inter) == ninter && intsetLen(diff) == ndiff &&
+         intsetLen(uni) == intsetLen(a)+intsetLen(b)-ninter;
+    zfree(inter);
+    zfree(uni);
+    zfree(diff);
+    return ok;
+}
+
+int main(void) {
+    uint8_t success;
+    int i;
+    intset *is;
+
+    intsetInit();
+    printf("Search implementation: %s\n", intsetImplName());
+
+    test_cond("Value encodings",
+        _intsetValueEncoding(-32768) == INTSET_ENC_INT16 &&
+        _intsetValueEncoding(+32767) == INTSET_ENC_INT16 &&
+        _intsetValueEncoding(-32769) == INTSET_ENC_INT32 &&
+        _intsetValueEncoding(+32768) == INTSET_ENC_INT32 &&
+        _intsetValueEncoding(-2147483648) == INTSET_ENC_INT32 &&
+        _intsetValueEncoding(+2147483647) == INTSET_ENC_INT32 &&
+        _intsetValueEncoding(-2147483649) == INTSET_ENC_INT64 &&
+        _intsetValueEncoding(+2147483648) == INTSET_ENC_INT64 &&
+        _intsetValueEncoding(-9223372036854775808ull) == INTSET_ENC_INT64 &&
+        _intsetValueEncoding(+9223372036854775807ull) == INTSET_ENC_INT64);
+
+    {
+        int ok = 1;
+
+        is = intsetNew();
+        is = intsetAdd(is,5,&success); ok = ok && success;
+        is = intsetAdd(is,6,&success); ok = ok && success;
+        is = intsetAdd(is,4,&success); ok = ok && success;
+        is = intsetAdd(is,4,&success); ok = ok && !success;
+        test_cond("Basic adding", ok);
+        zfree(is);
+    }
+
+    {
+        int inserts = 0;
+
+        is = intsetNew();
+        for (i = 0; i < 1024; i++) {
+            is = intsetAdd(is,rand()%0x800,&success);
+            if (success) inserts++;
+        }
+        test_cond("Large number of random adds",
+            intrev32ifbe(is->length) == inserts && checkConsistency(is));
+        zfree(is);
+    }
+
+    {
+        int ok;
+
+        is = intsetNew();
+        is = intsetAdd(is,32,NULL);
+        ok = intrev32ifbe(is->encoding) == INTSET_ENC_INT16;
+        is = intsetAdd(is,65535,NULL);
+        test_cond("Upgrade from int16 to int32",
+            ok && intrev32ifbe(is->encoding) == INTSET_ENC_INT32 &&
+            intsetFind(is,32) && intsetFind(is,65535) &&
+            checkConsistency(is));
+        zfree(is);
+
+        is = intsetNew();
+        is = intsetAdd(is,32,NULL);
+        ok = intrev32ifbe(is->encoding) == INTSET_ENC_INT16;
+        is = intsetAdd(is,-65535,NULL);
+        test_cond("Upgrade from int16 to int32 with a negative value",
+            ok && intrev32ifbe(is->encoding) == INTSET_ENC_INT32 &&
+            intsetFind(is,32) && intsetFind(is,-65535) &&
+            checkConsistency(is));
+        zfree(is);
+
+        is = intsetNew();
+        is = intsetAdd(is,65535,NULL);
+        ok = intrev32ifbe(is->encoding) == INTSET_ENC_INT32;
+        is = intsetAdd(is,4294967295,NULL);
+        test_cond("Upgrade from int32 to int64",
+            ok && intrev32ifbe(is->encoding) == INTSET_ENC_INT64 &&
+            intsetFind(is,65535) && intsetFind(is,4294967295) &&
+            checkConsistency(is));
+        zfree(is);
+
+        is = intsetNew();
+        is = intsetAdd(is,65535,NULL);
+        ok = intrev32ifbe(is->encoding) == INTSET_ENC_INT32;
+        is = intsetAdd(is,-4294967295,NULL);
+        test_cond("Upgrade from int32 to int64 with a negative value",
+            ok && intrev32ifbe(is->encoding) == INTSET_ENC_INT64 &&
+            intsetFind(is,65535) && intsetFind(is,-4294967295) &&
+            checkConsistency(is));
+        zfree(is);
+    }
+
+    {
+        int bits[] = {15, 31, 62}, b, ok = 1;
+
+        for (b = 0; b < 3; b++) {
+            uint32_t pos, len;
+            int64_t v = 0;
+
+            is = intsetNew();
+            for (i = 0; i < 2000; i++)
+                is = intsetAdd(is,((int64_t)i*7) << (bits[b]-14),NULL);
+            len = intsetLen(is);
+            for (pos = 0; ok && pos < len; pos++) {
+                uint32_t p;
+
+                intsetGet(is,pos,&v);
+                ok = intsetSearch(is,v,&p) && p == pos;
+                ok = ok && !intsetSearch(is,v+1,&p) && p == pos+1;
+            }
+            zfree(is);
+        }
+        test_cond("Search of every position", ok);
+    }
+
+    {
+        long num = 100000, size = 10000;
+        int i, bits = 20;
+        long long start;
+
+        is = createSet(bits,size);
+        test_cond("Random set is consistent", checkConsistency(is));
+        start = usec();
+        for (i = 0; i < num; i++) intsetSearch(is,rand() % ((1<<bits)-1),NULL);
+        printf("Stress lookups: %ld lookups, %ld element set, %lldusec\n",
+            num,size,usec()-start);
+        zfree(is);
+    }
+
+    {
+        int i, v1, v2, ok = 1;
+
+        is = intsetNew();
+        for (i = 0; ok && i < 0xffff; i++) {
+            v1 = rand() % 0xfff;
+            is = intsetAdd(is,v1,NULL);
+            ok = intsetFind(is,v1);
+
+            v2 = rand() % 0xfff;
+            is = intsetRemove(is,v2,NULL);
+            ok = ok && !intsetFind(is,v2);
+        }
+        test_cond("Stress add+delete", ok && checkConsistency(is));
+        zfree(is);
+    }
+
+    {
+        int sizes[] = {0, 1, 10, 100, 1000, 10000}, x, y;
+        int bits[] = {14, 30, 62}, ba, bb, ok = 1;
+
+        for (x = 0; x < 6; x++) for (y = 0; y < 6; y++)
+        for (ba = 0; ba < 3; ba++) for (bb = 0; bb < 3; bb++) {
+            intset *a = createSet(bits[ba] < 16 ? 12 : 16,sizes[x]);
+            intset *b = createSet(bits[bb] < 16 ? 12 : 16,sizes[y]);
+
+            /* Force the encodings with out of range elements. */
+            a = intsetAdd(a,-((int64_t)1 << bits[ba]),NULL);
+            b = intsetAdd(b,-((int64_t)1 << bits[bb]),NULL);
+            ok = ok && checkSetOps(a,b) && checkSetOps(b,a);
+            zfree(a);
+            zfree(b);
+        }
+        test_cond("Set operations", ok);
+    }
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2009-2012, Pieter Noordhuis <pcnoordhuis at gmail dot com>
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __INTSET_H
+#define __INTSET_H
+#include <stdint.h>
+
+/* 整数集合，所有的整数按照从小到大的顺序以相同的宽度存放 */
+typedef struct intset {
+	//每个整数占用的字节数，2、4或8
+    uint32_t encoding;
+    //整数的个数
+    uint32_t length;
+    //具体存放整数的数组，小端字节序
+    int8_t contents[];
+} intset;
+
+intset *intsetNew(void);    //创建新的整数集合
+intset *intsetAdd(intset *is, int64_t value, uint8_t *success); //添加整数，必要时升级编码
+intset *intsetRemove(intset *is, int64_t value, int *success);  //删除整数
+uint8_t intsetFind(intset *is, int64_t value);  //查找整数是否存在
+int64_t intsetRandom(intset *is);   //随机返回一个整数
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);    //获取pos位置上的整数
+uint32_t intsetLen(intset *is); //返回整数的个数
+size_t intsetBlobLen(intset *is);   //返回整数集合占用的字节数
+intset *intsetIntersect(intset *a, intset *b);  //求交集，返回新的整数集合
+intset *intsetUnion(intset *a, intset *b);  //求并集，返回新的整数集合
+intset *intsetDifference(intset *a, intset *b); //求差集a-b，返回新的整数集合
+void intsetInit(void);  //根据CPU支持的指令集选择查找实现
+const char *intsetImplName(void);   //返回当前使用的查找实现的名称
+
+#endif // __INTSET_H
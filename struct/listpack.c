@@ -0,0 +1,966 @@
+/* listpack.c - A compact list of strings and integers without cascading
+ * updates
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A listpack is a list of strings and integers serialized in a single
+ * allocation, like a ziplist, with a different entry layout:
+ *
+ * <total-bytes> <num-elements> <entry> ... <entry> <end>
+ *
+ * The header is 6 bytes: the total size of the listpack as a 32 bit and the
+ * number of elements as a 16 bit unsigned integer, both little endian. When
+ * there are 65535 elements or more the count is not stored and lpLength()
+ * has to walk the whole listpack. The end marker is the single byte 0xFF.
+ *
+ * Every entry is made of the encoding of the element, followed by its
+ * content, followed by 'backlen': the size in bytes of the encoding plus
+ * the content, written from right to left 7 bits per byte, the high bit of
+ * a byte being set if there is another byte on its left. Going back from
+ * an entry only needs the backlen of the previous one, that is right
+ * before it.
+ *
+ * A ziplist entry instead starts with the length of the previous entry, so
+ * when an entry grows from less than 254 bytes to 254 bytes or more, the
+ * next entry needs 4 more bytes to store it, which can make it grow past
+ * 254 bytes too, and so forth: __ziplistCascadeUpdate() may reallocate and
+ * move the ziplist once per entry. A listpack entry only describes itself,
+ * so inserting, deleting or replacing an entry never touches the others.
+ *
+ * listpack与ziplist类似，但是每个元素在尾部记录的是自身的长度，而不是前一个
+ * 元素的长度，所以插入和删除元素时不会引起连锁更新。
+ *
+ * Encodings, the first byte of every entry:
+ *
+ * 0xxxxxxx                    7 bit unsigned integer
+ * 10xxxxxx                    string up to 63 bytes
+ * 110xxxxx yyyyyyyy           13 bit signed integer
+ * 1110xxxx yyyyyyyy           string up to 4095 bytes
+ * 11110000 <4 bytes length>   string up to 4GB
+ * 11110001 <2 bytes>          16 bit signed integer
+ * 11110010 <3 bytes>          24 bit signed integer
+ * 11110011 <4 bytes>          32 bit signed integer
+ * 11110100 <8 bytes>          64 bit signed integer
+ * 11111111                    end of the listpack
+ *
+ * Lengths and integers are little endian. Like in ziplists, a string that
+ * is the canonical representation of a 64 bit integer is always stored as
+ * an integer, so the API is only about strings: lpGetValue() returns either
+ * a string or an integer, in the same way ziplistGet() does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "zmalloc.h"
+#include "util.h"
+#include "listpack.h"
+#include "redisassert.h"
+
+#define LP_HDR_SIZE 6
+#define LP_HDR_NUMELE_UNKNOWN UINT16_MAX
+#define LP_MAX_INT_ENCODING_LEN 9
+#define LP_MAX_BACKLEN_SIZE 5
+#define LP_EOF 0xFF
+
+#define LP_ENCODING_INT 0
+#define LP_ENCODING_STRING 1
+
+#define LP_ENCODING_7BIT_UINT 0
+#define LP_ENCODING_7BIT_UINT_MASK 0x80
+#define LP_ENCODING_IS_7BIT_UINT(byte) (((byte)&LP_ENCODING_7BIT_UINT_MASK)==LP_ENCODING_7BIT_UINT)
+
+#define LP_ENCODING_6BIT_STR 0x80
+#define LP_ENCODING_6BIT_STR_MASK 0xC0
+#define LP_ENCODING_IS_6BIT_STR(byte) (((byte)&LP_ENCODING_6BIT_STR_MASK)==LP_ENCODING_6BIT_STR)
+
+#define LP_ENCODING_13BIT_INT 0xC0
+#define LP_ENCODING_13BIT_INT_MASK 0xE0
+#define LP_ENCODING_IS_13BIT_INT(byte) (((byte)&LP_ENCODING_13BIT_INT_MASK)==LP_ENCODING_13BIT_INT)
+
+#define LP_ENCODING_12BIT_STR 0xE0
+#define LP_ENCODING_12BIT_STR_MASK 0xF0
+#define LP_ENCODING_IS_12BIT_STR(byte) (((byte)&LP_ENCODING_12BIT_STR_MASK)==LP_ENCODING_12BIT_STR)
+
+#define LP_ENCODING_32BIT_STR 0xF0
+#define LP_ENCODING_16BIT_INT 0xF1
+#define LP_ENCODING_24BIT_INT 0xF2
+#define LP_ENCODING_32BIT_INT 0xF3
+#define LP_ENCODING_64BIT_INT 0xF4
+
+#define LP_ENCODING_6BIT_STR_LEN(p) ((p)[0] & 0x3F)
+#define LP_ENCODING_12BIT_STR_LEN(p) ((((p)[0] & 0xF) << 8) | (p)[1])
+#define LP_ENCODING_32BIT_STR_LEN(p) (((uint32_t)(p)[1]<<0) | \
+                                      ((uint32_t)(p)[2]<<8) | \
+                                      ((uint32_t)(p)[3]<<16) | \
+                                      ((uint32_t)(p)[4]<<24))
+
+/* 读写头部保存的总字节数和元素个数，小端字节序 */
+#define lpGetTotalBytes(p)           (((uint32_t)(p)[0]<<0) | \
+                                      ((uint32_t)(p)[1]<<8) | \
+                                      ((uint32_t)(p)[2]<<16) | \
+                                      ((uint32_t)(p)[3]<<24))
+
+#define lpGetNumElements(p)          (((uint32_t)(p)[4]<<0) | \
+                                      ((uint32_t)(p)[5]<<8))
+#define lpSetTotalBytes(p,v) do { \
+    (p)[0] = (v)&0xff; \
+    (p)[1] = ((v)>>8)&0xff; \
+    (p)[2] = ((v)>>16)&0xff; \
+    (p)[3] = ((v)>>24)&0xff; \
+} while(0)
+
+#define lpSetNumElements(p,v) do { \
+    (p)[4] = (v)&0xff; \
+    (p)[5] = ((v)>>8)&0xff; \
+} while(0)
+
+/* Create a new, empty listpack. */
+/* 创建只有头部和结束符的listpack */
+unsigned char *lpNew(void) {
+    unsigned char *lp = zmalloc(LP_HDR_SIZE+1);
+
+    lpSetTotalBytes(lp,LP_HDR_SIZE+1);
+    lpSetNumElements(lp,0);
+    lp[LP_HDR_SIZE] = LP_EOF;
+    return lp;
+}
+
+/* Free the specified listpack. */
+void lpFree(unsigned char *lp) {
+    zfree(lp);
+}
+
+/* Encode the integer 'v' in the smallest encoding able to hold it, writing
+ * the encoding and the value into 'intenc'. Returns the number of bytes
+ * used. */
+/* 按照能容纳v的最小编码保存整数，返回使用的字节数 */
+static uint64_t lpEncodeInteger(int64_t v, unsigned char *intenc) {
+    if (v >= 0 && v <= 127) {
+        intenc[0] = v;
+        return 1;
+    } else if (v >= -4096 && v <= 4095) {
+        /* 13 bit integer, negative values as two's complement. */
+        if (v < 0) v = ((int64_t)1<<13)+v;
+        intenc[0] = (v>>8)|LP_ENCODING_13BIT_INT;
+        intenc[1] = v&0xff;
+        return 2;
+    } else if (v >= -32768 && v <= 32767) {
+        if (v < 0) v = ((int64_t)1<<16)+v;
+        intenc[0] = LP_ENCODING_16BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = v>>8;
+        return 3;
+    } else if (v >= -8388608 && v <= 8388607) {
+        if (v < 0) v = ((int64_t)1<<24)+v;
+        intenc[0] = LP_ENCODING_24BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = v>>16;
+        return 4;
+    } else if (v >= -2147483648LL && v <= 2147483647LL) {
+        if (v < 0) v = ((int64_t)1<<32)+v;
+        intenc[0] = LP_ENCODING_32BIT_INT;
+        intenc[1] = v&0xff;
+        intenc[2] = (v>>8)&0xff;
+        intenc[3] = (v>>16)&0xff;
+        intenc[4] = v>>24;
+        return 5;
+    } else {
+        uint64_t uv = v;
+        int j;
+
+        intenc[0] = LP_ENCODING_64BIT_INT;
+        for (j = 0; j < 8; j++) intenc[j+1] = (uv>>(j*8))&0xff;
+        return 9;
+    }
+}
+
+/* Find the encoding to use for the element 'ele' of 'size' bytes. If it is
+ * an integer the encoded integer is written into 'intenc' and
+ * LP_ENCODING_INT is returned, otherwise LP_ENCODING_STRING. In both cases
+ * '*enclen' is set to the size of the encoding plus the content. */
+/* 判断元素按照整数还是字符串保存，并计算编码后的长度 */
+static int lpEncodeGetType(unsigned char *ele, uint32_t size,
+                           unsigned char *intenc, uint64_t *enclen) {
+    long long v;
+
+    /* Same rule of ziplists: only strings that string2ll() accepts, that
+     * are the canonical representation of the number, can be integers. */
+    if (size > 0 && size <= 20 && string2ll((char*)ele,size,&v)) {
+        *enclen = lpEncodeInteger(v,intenc);
+        return LP_ENCODING_INT;
+    }
+    if (size < 64) *enclen = 1+size;
+    else if (size < 4096) *enclen = 2+size;
+    else *enclen = 5+(uint64_t)size;
+    return LP_ENCODING_STRING;
+}
+
+/* Write the backlen of an entry of 'l' bytes into 'buf', that must have
+ * room for LP_MAX_BACKLEN_SIZE bytes, and return the number of bytes used.
+ * When 'buf' is NULL only the number of bytes is returned. */
+/* 生成元素尾部的backlen，每个字节保存7位，从右往左读取 */
+static unsigned long lpEncodeBacklen(unsigned char *buf, uint64_t l) {
+    if (l <= 127) {
+        if (buf) buf[0] = l;
+        return 1;
+    } else if (l < 16383) {
+        if (buf) {
+            buf[0] = l>>7;
+            buf[1] = (l&127)|128;
+        }
+        return 2;
+    } else if (l < 2097151) {
+        if (buf) {
+            buf[0] = l>>14;
+            buf[1] = ((l>>7)&127)|128;
+            buf[2] = (l&127)|128;
+        }
+        return 3;
+    } else if (l < 268435455) {
+        if (buf) {
+            buf[0] = l>>21;
+            buf[1] = ((l>>14)&127)|128;
+            buf[2] = ((l>>7)&127)|128;
+            buf[3] = (l&127)|128;
+        }
+        return 4;
+    } else {
+        if (buf) {
+            buf[0] = l>>28;
+            buf[1] = ((l>>21)&127)|128;
+            buf[2] = ((l>>14)&127)|128;
+            buf[3] = ((l>>7)&127)|128;
+            buf[4] = (l&127)|128;
+        }
+        return 5;
+    }
+}
+
+/* Decode the backlen ending at 'p', that points to its last byte. */
+/* 从backlen的最后一个字节开始，从右往左解析出元素的长度 */
+static uint64_t lpDecodeBacklen(unsigned char *p) {
+    uint64_t val = 0;
+    uint64_t shift = 0;
+
+    do {
+        val |= (uint64_t)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+        if (shift > 28) return UINT64_MAX;
+    } while (1);
+    return val;
+}
+
+/* Write the encoding and the content of the string 's' of 'len' bytes
+ * into 'buf'. */
+static void lpEncodeString(unsigned char *buf, unsigned char *s,
+                           uint32_t len) {
+    if (len < 64) {
+        buf[0] = len | LP_ENCODING_6BIT_STR;
+        memcpy(buf+1,s,len);
+    } else if (len < 4096) {
+        buf[0] = (len >> 8) | LP_ENCODING_12BIT_STR;
+        buf[1] = len & 0xff;
+        memcpy(buf+2,s,len);
+    } else {
+        buf[0] = LP_ENCODING_32BIT_STR;
+        buf[1] = len & 0xff;
+        buf[2] = (len >> 8) & 0xff;
+        buf[3] = (len >> 16) & 0xff;
+        buf[4] = (len >> 24) & 0xff;
+        memcpy(buf+5,s,len);
+    }
+}
+
+/* Return the size of the encoding plus the content of the entry at 'p',
+ * backlen excluded. */
+/* 返回元素编码和内容的长度，不包括backlen */
+static uint32_t lpCurrentEncodedSize(unsigned char *p) {
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) return 1;
+    if (LP_ENCODING_IS_6BIT_STR(p[0])) return 1+LP_ENCODING_6BIT_STR_LEN(p);
+    if (LP_ENCODING_IS_13BIT_INT(p[0])) return 2;
+    if (LP_ENCODING_IS_12BIT_STR(p[0])) return 2+LP_ENCODING_12BIT_STR_LEN(p);
+    switch(p[0]) {
+    case LP_ENCODING_16BIT_INT: return 3;
+    case LP_ENCODING_24BIT_INT: return 4;
+    case LP_ENCODING_32BIT_INT: return 5;
+    case LP_ENCODING_64BIT_INT: return 9;
+    case LP_ENCODING_32BIT_STR: return 5+LP_ENCODING_32BIT_STR_LEN(p);
+    case LP_EOF: return 1;
+    }
+    assert(NULL);
+    return 0;
+}
+
+/* Return the address of the entry after the one at 'p', that may be the
+ * end marker. */
+static unsigned char *lpSkip(unsigned char *p) {
+    unsigned long entrylen = lpCurrentEncodedSize(p);
+    entrylen += lpEncodeBacklen(NULL,entrylen);
+    return p+entrylen;
+}
+
+/* Return the entry after the one at 'p', or NULL if 'p' is the last one. */
+/* 返回后一个元素，p是最后一个元素时返回NULL */
+unsigned char *lpNext(unsigned char *lp, unsigned char *p) {
+    ((void) lp);
+    p = lpSkip(p);
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the entry before the one at 'p', or NULL if 'p' is the first one.
+ * 'p' can also be the end marker, then the last entry is returned. */
+/* 根据前一个元素的backlen返回前一个元素，p是第一个元素时返回NULL */
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p) {
+    uint64_t prevlen;
+
+    if (p-lp == LP_HDR_SIZE) return NULL;
+    p--; /* Seek the last byte of the previous entry backlen. */
+    prevlen = lpDecodeBacklen(p);
+    prevlen += lpEncodeBacklen(NULL,prevlen);
+    return p-prevlen+1;
+}
+
+/* Return the first entry, or NULL if the listpack is empty. */
+unsigned char *lpFirst(unsigned char *lp) {
+    unsigned char *p = lp+LP_HDR_SIZE;
+    if (p[0] == LP_EOF) return NULL;
+    return p;
+}
+
+/* Return the last entry, or NULL if the listpack is empty. */
+unsigned char *lpLast(unsigned char *lp) {
+    unsigned char *p = lp+lpGetTotalBytes(lp)-1; /* Seek the end marker. */
+    return lpPrev(lp,p);
+}
+
+/* Return the number of elements. If the count is not in the header the
+ * listpack is walked, and the header updated if the count fits again. */
+/* 返回元素个数，头部没有保存时遍历计算 */
+unsigned long lpLength(unsigned char *lp) {
+    uint32_t numele = lpGetNumElements(lp);
+    unsigned long count = 0;
+    unsigned char *p;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) return numele;
+
+    p = lpFirst(lp);
+    while (p) {
+        count++;
+        p = lpNext(lp,p);
+    }
+    if (count < LP_HDR_NUMELE_UNKNOWN) lpSetNumElements(lp,count);
+    return count;
+}
+
+/* Return the total number of bytes of the listpack. */
+size_t lpBytes(unsigned char *lp) {
+    return lpGetTotalBytes(lp);
+}
+
+/* Get the entry at 'p'. A string sets '*vstr' and '*vlen', an integer sets
+ * '*vlong' and '*vstr' to NULL, like ziplistGet(). Returns 0 if 'p' is NULL
+ * or the end marker, otherwise 1. */
+/* 获取p位置上的元素，字符串保存在vstr和vlen中，整数保存在vlong中 */
+int lpGetValue(unsigned char *p, unsigned char **vstr, unsigned int *vlen,
+               long long *vlong) {
+    uint64_t uval, negstart, negmax;
+
+    if (p == NULL || p[0] == LP_EOF) return 0;
+
+    *vstr = NULL;
+    if (LP_ENCODING_IS_7BIT_UINT(p[0])) {
+        *vlong = p[0] & 0x7f;
+        return 1;
+    } else if (LP_ENCODING_IS_6BIT_STR(p[0])) {
+        *vlen = LP_ENCODING_6BIT_STR_LEN(p);
+        *vstr = p+1;
+        return 1;
+    } else if (LP_ENCODING_IS_13BIT_INT(p[0])) {
+        uval = ((uint64_t)(p[0]&0x1f)<<8) | p[1];
+        negstart = (uint64_t)1<<12;
+        negmax = 8191;
+    } else if (LP_ENCODING_IS_12BIT_STR(p[0])) {
+        *vlen = LP_ENCODING_12BIT_STR_LEN(p);
+        *vstr = p+2;
+        return 1;
+    } else if (p[0] == LP_ENCODING_16BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8;
+        negstart = (uint64_t)1<<15;
+        negmax = UINT16_MAX;
+    } else if (p[0] == LP_ENCODING_24BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 | (uint64_t)p[3]<<16;
+        negstart = (uint64_t)1<<23;
+        negmax = UINT32_MAX>>8;
+    } else if (p[0] == LP_ENCODING_32BIT_INT) {
+        uval = (uint64_t)p[1] | (uint64_t)p[2]<<8 |
+               (uint64_t)p[3]<<16 | (uint64_t)p[4]<<24;
+        negstart = (uint64_t)1<<31;
+        negmax = UINT32_MAX;
+    } else if (p[0] == LP_ENCODING_64BIT_INT) {
+        int j;
+
+        uval = 0;
+        for (j = 8; j >= 1; j--) uval = (uval<<8) | p[j];
+        negstart = (uint64_t)1<<63;
+        negmax = UINT64_MAX;
+    } else if (p[0] == LP_ENCODING_32BIT_STR) {
+        *vlen = LP_ENCODING_32BIT_STR_LEN(p);
+        *vstr = p+5;
+        return 1;
+    } else {
+        assert(NULL);
+        return 0;
+    }
+
+    /* Convert the two's complement value to a signed one. */
+    if (uval >= negstart) {
+        uval = negmax-uval;
+        *vlong = -(long long)uval-1;
+    } else {
+        *vlong = uval;
+    }
+    return 1;
+}
+
+/* Insert, replace or delete an element. 'where' is LP_BEFORE or LP_AFTER
+ * to insert 'ele' of 'size' bytes before or after the entry at 'p', or
+ * LP_REPLACE to replace that entry with it. 'p' can also be the end marker
+ * with LP_BEFORE to append. When 'ele' is NULL the entry at 'p' is
+ * deleted.
+ *
+ * Returns the listpack, that may have been reallocated, or NULL if the
+ * result would be larger than 4GB. When 'newp' is not NULL it is set to the
+ * address of the inserted element, or for a deletion to the entry that
+ * followed the deleted one, NULL if that was the last one. */
+/* 在p之前或之后插入元素、替换p，或者删除p，其他元素都不需要修改 */
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size,
+                        unsigned char *p, int where, unsigned char **newp) {
+    unsigned char intenc[LP_MAX_INT_ENCODING_LEN];
+    unsigned char backlen[LP_MAX_BACKLEN_SIZE];
+    uint64_t enclen = 0;
+    unsigned long backlen_size = 0;
+    unsigned long poff;
+    uint64_t old_bytes, new_bytes;
+    uint32_t replaced_len = 0, numele;
+    int enctype = LP_ENCODING_STRING;
+    int delete = (ele == NULL);
+    unsigned char *dst;
+
+    if (delete) where = LP_REPLACE;
+
+    /* Inserting after an entry is inserting before the next one. */
+    if (where == LP_AFTER) {
+        p = lpSkip(p);
+        where = LP_BEFORE;
+    }
+    poff = p-lp;
+
+    if (!delete) {
+        enctype = lpEncodeGetType(ele,size,intenc,&enclen);
+        backlen_size = lpEncodeBacklen(backlen,enclen);
+    }
+
+    old_bytes = lpGetTotalBytes(lp);
+    if (where == LP_REPLACE) {
+        replaced_len = lpCurrentEncodedSize(p);
+        replaced_len += lpEncodeBacklen(NULL,replaced_len);
+    }
+    new_bytes = old_bytes+enclen+backlen_size-replaced_len;
+    if (new_bytes > UINT32_MAX) return NULL;
+
+    /* Grow before moving the tail forward, shrink after moving it back. */
+    dst = lp+poff;
+    if (new_bytes > old_bytes) {
+        lp = zrealloc(lp,new_bytes);
+        dst = lp+poff;
+    }
+    if (where == LP_BEFORE) {
+        memmove(dst+enclen+backlen_size,dst,old_bytes-poff);
+    } else {
+        memmove(dst+enclen+backlen_size,dst+replaced_len,
+                old_bytes-poff-replaced_len);
+    }
+    if (new_bytes < old_bytes) {
+        lp = zrealloc(lp,new_bytes);
+        dst = lp+poff;
+    }
+
+    if (newp) {
+        *newp = dst;
+        if (delete && dst[0] == LP_EOF) *newp = NULL;
+    }
+    if (!delete) {
+        if (enctype == LP_ENCODING_INT)
+            memcpy(dst,intenc,enclen);
+        else
+            lpEncodeString(dst,ele,size);
+        dst += enclen;
+        memcpy(dst,backlen,backlen_size);
+    }
+
+    /* Update the header. Once the count is unknown it stays so, until
+     * lpLength() counts the elements again. */
+    if (where == LP_BEFORE || delete) {
+        numele = lpGetNumElements(lp);
+        if (numele != LP_HDR_NUMELE_UNKNOWN) {
+            if (delete)
+                lpSetNumElements(lp,numele-1);
+            else
+                lpSetNumElements(lp,numele+1);
+        }
+    }
+    lpSetTotalBytes(lp,new_bytes);
+    return lp;
+}
+
+/* Append the element 'ele' of 'size' bytes. */
+/* 尾部插入元素 */
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    unsigned char *eofptr = lp+lpGetTotalBytes(lp)-1;
+    return lpInsert(lp,ele,size,eofptr,LP_BEFORE,NULL);
+}
+
+/* Prepend the element 'ele' of 'size' bytes. */
+/* 头部插入元素 */
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,lp+LP_HDR_SIZE,LP_BEFORE,NULL);
+}
+
+/* Replace the entry at '*p' with 'ele' of 'size' bytes. '*p' is updated to
+ * the address of the new entry. */
+/* 替换*p位置上的元素 */
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p,
+                         unsigned char *ele, uint32_t size) {
+    return lpInsert(lp,ele,size,*p,LP_REPLACE,p);
+}
+
+/* Delete the entry at 'p'. When 'newp' is not NULL it is set to the entry
+ * that followed, or to NULL if 'p' was the last one. */
+/* 删除p位置上的元素 */
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p,
+                        unsigned char **newp) {
+    return lpInsert(lp,NULL,0,p,LP_REPLACE,newp);
+}
+
+/* Delete 'num' entries starting at '*p', or less if the listpack ends
+ * before. The entries are removed with a single memmove. '*p' is set to the
+ * entry that followed the deleted ones, or to NULL if there is none. */
+/* 从*p开始删除num个元素，只移动一次内存 */
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p,
+                                      unsigned long num) {
+    size_t bytes = lpBytes(lp);
+    unsigned long deleted = 0;
+    unsigned char *eofptr = lp+bytes-1;
+    unsigned char *first, *tail;
+    unsigned long poff;
+    uint32_t numele;
+
+    if (num == 0) return lp;
+
+    first = tail = *p;
+    while (num--) {
+        deleted++;
+        tail = lpSkip(tail);
+        if (tail[0] == LP_EOF) break;
+    }
+
+    poff = first-lp;
+    memmove(first,tail,eofptr-tail+1);
+    bytes -= tail-first;
+    lpSetTotalBytes(lp,bytes);
+    numele = lpGetNumElements(lp);
+    if (numele != LP_HDR_NUMELE_UNKNOWN)
+        lpSetNumElements(lp,numele-deleted);
+    lp = zrealloc(lp,bytes);
+
+    *p = lp+poff;
+    if ((*p)[0] == LP_EOF) *p = NULL;
+    return lp;
+}
+
+/* Delete 'num' entries starting at the one at 'index', see lpSeek(). */
+/* 从index开始删除num个元素 */
+unsigned char *lpDeleteRange(unsigned char *lp, long index,
+                             unsigned long num) {
+    unsigned char *p = lpSeek(lp,index);
+
+    if (p == NULL) return lp;
+    return lpDeleteRangeWithEntry(lp,&p,num);
+}
+
+/* Return the entry at 'index', 0 being the first one and -1 the last one,
+ * or NULL if out of range. When the number of elements is known, the walk
+ * starts from the nearest end. */
+/* 定位到index位置上的元素，从距离更近的一端开始查找 */
+unsigned char *lpSeek(unsigned char *lp, long index) {
+    uint32_t numele = lpGetNumElements(lp);
+    int forward = 1;
+    unsigned char *ele;
+
+    if (numele != LP_HDR_NUMELE_UNKNOWN) {
+        if (index < 0) index = (long)numele+index;
+        if (index < 0 || index >= (long)numele) return NULL;
+        if (index > (long)numele/2) {
+            forward = 0;
+            index -= numele;
+        }
+    } else {
+        if (index < 0) forward = 0;
+    }
+
+    if (forward) {
+        ele = lpFirst(lp);
+        while (index > 0 && ele) {
+            ele = lpNext(lp,ele);
+            index--;
+        }
+    } else {
+        ele = lpLast(lp);
+        while (index < -1 && ele) {
+            ele = lpPrev(lp,ele);
+            index++;
+        }
+    }
+    return ele;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's' of 'slen' bytes,
+ * an integer entry being equal to its canonical representation. */
+/* 比较p位置上的元素是否与给定的字符串相等 */
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong, sval;
+
+    if (!lpGetValue(p,&vstr,&vlen,&vlong)) return 0;
+    if (vstr) return vlen == slen && memcmp(vstr,s,slen) == 0;
+    return slen <= 20 && string2ll((char*)s,slen,&sval) && sval == vlong;
+}
+
+/* Find the entry equal to the string 's' of 'slen' bytes, starting at 'p'
+ * and skipping 'skip' entries between every comparison, like
+ * ziplistFind(). Returns NULL when not found. */
+/* 从p开始查找与给定字符串相等的元素，每次比较之间跳过skip个元素 */
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s,
+                      uint32_t slen, unsigned int skip) {
+    unsigned int skipcnt = 0;
+    int sint = -1; /* Unknown yet if 's' is an integer. */
+    long long sval = 0;
+
+    while (p) {
+        if (skipcnt == 0) {
+            unsigned char *vstr;
+            unsigned int vlen;
+            long long vlong;
+
+            lpGetValue(p,&vstr,&vlen,&vlong);
+            if (vstr) {
+                if (vlen == slen && memcmp(vstr,s,slen) == 0) return p;
+            } else {
+                /* Parse the searched string only once, and only if there
+                 * are integer entries. */
+                if (sint == -1)
+                    sint = slen <= 20 && string2ll((char*)s,slen,&sval);
+                if (sint && vlong == sval) return p;
+            }
+            skipcnt = skip;
+        } else {
+            skipcnt--;
+        }
+        p = lpNext(lp,p);
+    }
+    return NULL;
+}
+
+#ifdef LISTPACK_TEST_MAIN
+#include <assert.h>
+#include <sys/time.h>
+#include <time.h>
+#include "ziplist.h"
+
+/* The reference model: a plain array of malloc'd strings. */
+static char **model;
+static long model_len, model_cap;
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+static void modelInsert(long pos, char *s) {
+    if (model_len == model_cap) {
+        model_cap = model_cap ? model_cap*2 : 16;
+        model = realloc(model,sizeof(char*)*model_cap);
+    }
+    memmove(model+pos+1,model+pos,sizeof(char*)*(model_len-pos));
+    model[pos] = strdup(s);
+    model_len++;
+}
+
+static void modelDelete(long pos, long count) {
+    long j;
+
+    for (j = pos; j < pos+count; j++) free(model[j]);
+    memmove(model+pos,model+pos+count,sizeof(char*)*(model_len-pos-count));
+    model_len -= count;
+}
+
+/* Random value: integers of every encoding width, short strings, strings
+ * around the 64 and 4096 bytes encoding boundaries, and integer lookalikes
+ * that must stay strings. */
+static char *randomValue(void) {
+    static char buf[70000];
+    static const long long ints[] = {0, 127, 128, -1, -4096, 4095, 4096,
+        -4097, 32767, -32768, 32768, 8388607, -8388608, 8388608,
+        2147483647LL, -2147483648LL, 2147483648LL, 9223372036854775807LL,
+        -9223372036854775807LL-1};
+    static const char *fakes[] = {"01", "+1", "-0", " 1", "1 ", "",
+        "9223372036854775808", "1.5"};
+    int len, j, r = rand() % 12;
+
+    if (r < 3) {
+        snprintf(buf,sizeof(buf),"%lld",ints[rand()%(sizeof(ints)/sizeof(ints[0]))]);
+    } else if (r < 5) {
+        snprintf(buf,sizeof(buf),"%lld",(long long)rand()-RAND_MAX/2);
+    } else if (r == 5) {
+        snprintf(buf,sizeof(buf),"%s",fakes[rand()%(sizeof(fakes)/sizeof(fakes[0]))]);
+    } else {
+        if (r < 9) len = rand() % 70;
+        else if (r < 11) len = rand() % 300 + 4000;
+        else len = rand() % 100 ? rand() % 5000 : 68000;
+        for (j = 0; j < len; j++) buf[j] = 'a' + rand() % 26;
+        buf[len] = '\0';
+    }
+    return buf;
+}
+
+/* Return the entry as a string in a static buffer. */
+static char *entryString(unsigned char *p, unsigned int *len) {
+    static char buf[70000];
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+
+    assert(lpGetValue(p,&vstr,&vlen,&vlong));
+    if (vstr) {
+        memcpy(buf,vstr,vlen);
+        buf[vlen] = '\0';
+        *len = vlen;
+    } else {
+        *len = snprintf(buf,sizeof(buf),"%lld",vlong);
+    }
+    return buf;
+}
+
+static void checkConsistency(unsigned char *lp) {
+    unsigned char *p;
+    unsigned int len;
+    long j;
+
+    assert(lpLength(lp) == (unsigned long)model_len);
+    assert(lp[lpBytes(lp)-1] == LP_EOF);
+
+    /* Forward and backward walks see the model. */
+    for (p = lpFirst(lp), j = 0; p; p = lpNext(lp,p), j++) {
+        char *s = entryString(p,&len);
+        assert(j < model_len);
+        assert(len == strlen(model[j]) && memcmp(s,model[j],len) == 0);
+        assert(lpCompare(p,(unsigned char*)model[j],strlen(model[j])));
+    }
+    assert(j == model_len);
+    for (p = lpLast(lp), j = model_len-1; p; p = lpPrev(lp,p), j--)
+        assert(strcmp(entryString(p,&len),model[j]) == 0);
+    assert(j == -1);
+}
+
+static void fuzz(int iterations) {
+    unsigned char *lp = lpNew();
+    int i;
+
+    for (i = 0; i < iterations; i++) {
+        int op = rand() % 9;
+        char *v = randomValue();
+        unsigned long vlen = strlen(v);
+        long pos = model_len ? rand() % model_len : 0;
+        unsigned char *p, *newp;
+
+        /* Keep the listpack small enough for the checks to stay fast. */
+        if (lpBytes(lp) > 100000) op = 5;
+
+        if (op == 0) {
+            lp = lpAppend(lp,(unsigned char*)v,vlen);
+            modelInsert(model_len,v);
+        } else if (op == 1) {
+            lp = lpPrepend(lp,(unsigned char*)v,vlen);
+            modelInsert(0,v);
+        } else if (op == 2 && model_len) {
+            int after = rand() & 1;
+
+            p = lpSeek(lp,rand() & 1 ? pos : pos-model_len);
+            assert(lpCompare(p,(unsigned char*)model[pos],strlen(model[pos])));
+            lp = lpInsert(lp,(unsigned char*)v,vlen,p,
+                          after ? LP_AFTER : LP_BEFORE,&newp);
+            assert(lpCompare(newp,(unsigned char*)v,vlen));
+            modelInsert(after ? pos+1 : pos,v);
+        } else if (op == 3 && model_len) {
+            p = lpSeek(lp,pos);
+            lp = lpReplace(lp,&p,(unsigned char*)v,vlen);
+            assert(lpCompare(p,(unsigned char*)v,vlen));
+            free(model[pos]);
+            model[pos] = strdup(v);
+        } else if (op == 4 && model_len) {
+            p = lpSeek(lp,pos);
+            lp = lpDelete(lp,p,&newp);
+            modelDelete(pos,1);
+            if (pos == model_len) assert(newp == NULL);
+            else assert(lpCompare(newp,(unsigned char*)model[pos],strlen(model[pos])));
+        } else if (op == 5 && model_len) {
+            unsigned long count = rand() % 20 + 1;
+
+            lp = lpDeleteRange(lp,rand() & 1 ? pos : pos-model_len,count);
+            if (count > (unsigned long)(model_len-pos)) count = model_len-pos;
+            modelDelete(pos,count);
+        } else if (op == 6 && model_len) {
+            /* Find with skip 1, as hashes look for fields. */
+            long j, expected = -1;
+
+            for (j = 0; j < model_len; j += 2) {
+                if (strcmp(model[j],model[pos]) == 0) {
+                    expected = j;
+                    break;
+                }
+            }
+            p = lpFind(lp,lpFirst(lp),(unsigned char*)model[pos],
+                       strlen(model[pos]),1);
+            if (expected == -1) {
+                assert(p == NULL);
+            } else {
+                assert(p == lpSeek(lp,expected));
+            }
+        } else if (op == 7) {
+            assert(lpSeek(lp,model_len) == NULL);
+            assert(lpSeek(lp,-model_len-1) == NULL);
+        }
+        checkConsistency(lp);
+    }
+    lpFree(lp);
+    modelDelete(0,model_len);
+}
+
+/* Insert a 300 bytes entry at the head of a list of entries taking 250 to
+ * 253 bytes: every ziplist entry then needs a 5 bytes prevlen, growing past
+ * 253 bytes, so the update cascades through the whole ziplist. Listpack
+ * entries are not affected. */
+static void cascadeBenchmark(void) {
+    char buf[300];
+    long long zltime = 0, lptime = 0, start;
+    int j, k;
+
+    memset(buf,'x',sizeof(buf));
+    for (k = 0; k < 5; k++) {
+        unsigned char *zl = ziplistNew(), *lp = lpNew();
+
+        /* 1 byte prevlen, 2 bytes encoding and 247..250 bytes of data. */
+        for (j = 0; j < 2000; j++) {
+            zl = ziplistPush(zl,(unsigned char*)buf,247+j%4,ZIPLIST_TAIL);
+            lp = lpAppend(lp,(unsigned char*)buf,247+j%4);
+        }
+        start = usec();
+        zl = ziplistPush(zl,(unsigned char*)buf,300,ZIPLIST_HEAD);
+        zltime += usec()-start;
+        start = usec();
+        lp = lpPrepend(lp,(unsigned char*)buf,300);
+        lptime += usec()-start;
+        zfree(zl);
+        lpFree(lp);
+    }
+    printf("ziplist: %lld usec, listpack: %lld usec\n", zltime/5, lptime/5);
+}
+
+int main(int argc, char **argv) {
+    unsigned char *lp;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    unsigned long j;
+    unsigned int seed = argc > 1 ? atoi(argv[1]) : time(NULL);
+
+    printf("Seed %u\n", seed);
+    srand(seed);
+
+    printf("Integers of every width round trip: ");
+    {
+        static const long long ints[] = {0, 127, 128, -1, -4096, 4095,
+            4096, -4097, 32767, -32768, 32768, -32769, 8388607, -8388608,
+            2147483647LL, -2147483648LL, 9223372036854775807LL,
+            -9223372036854775807LL-1};
+        char buf[32];
+
+        lp = lpNew();
+        for (j = 0; j < sizeof(ints)/sizeof(ints[0]); j++) {
+            int len = snprintf(buf,sizeof(buf),"%lld",ints[j]);
+            lp = lpAppend(lp,(unsigned char*)buf,len);
+        }
+        for (j = 0; j < sizeof(ints)/sizeof(ints[0]); j++) {
+            assert(lpGetValue(lpSeek(lp,j),&vstr,&vlen,&vlong));
+            assert(vstr == NULL && vlong == ints[j]);
+        }
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Element count past the header limit: ");
+    {
+        lp = lpNew();
+        for (j = 0; j < 70000; j++) lp = lpAppend(lp,(unsigned char*)"a",1);
+        assert(lpLength(lp) == 70000);
+        assert(lpSeek(lp,69999) == lpLast(lp));
+        assert(lpSeek(lp,-70000) == lpFirst(lp));
+        lp = lpDeleteRange(lp,0,10000);
+        assert(lpLength(lp) == 60000);
+        lpFree(lp);
+        printf("OK\n");
+    }
+
+    printf("Fuzzing against a model: ");
+    fflush(stdout);
+    fuzz(5000);
+    printf("OK\n");
+
+    printf("Prepend to 2000 entries of 250..253 bytes: ");
+    cascadeBenchmark();
+    return 0;
+}
+#endif
@@ -0,0 +1,63 @@
+/* listpack.h - A compact list of strings and integers without cascading
+ * updates
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __LISTPACK_H
+#define __LISTPACK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* 插入位置：在元素之前、之后或者替换元素 */
+#define LP_BEFORE 0
+#define LP_AFTER 1
+#define LP_REPLACE 2
+
+unsigned char *lpNew(void); //创建新的listpack
+void lpFree(unsigned char *lp); //释放listpack
+unsigned char *lpInsert(unsigned char *lp, unsigned char *ele, uint32_t size, unsigned char *p, int where, unsigned char **newp);  //在p之前、之后插入元素或者替换p，ele为NULL时删除p
+unsigned char *lpAppend(unsigned char *lp, unsigned char *ele, uint32_t size);  //尾部插入元素
+unsigned char *lpPrepend(unsigned char *lp, unsigned char *ele, uint32_t size); //头部插入元素
+unsigned char *lpReplace(unsigned char *lp, unsigned char **p, unsigned char *ele, uint32_t size);    //替换*p位置上的元素
+unsigned char *lpDelete(unsigned char *lp, unsigned char *p, unsigned char **newp);    //删除p位置上的元素
+unsigned char *lpDeleteRangeWithEntry(unsigned char *lp, unsigned char **p, unsigned long num);   //从*p开始删除num个元素
+unsigned char *lpDeleteRange(unsigned char *lp, long index, unsigned long num);    //从index开始删除num个元素
+unsigned long lpLength(unsigned char *lp);  //返回元素的个数
+size_t lpBytes(unsigned char *lp);  //返回listpack占用的字节数
+int lpGetValue(unsigned char *p, unsigned char **vstr, unsigned int *vlen, long long *vlong);  //获取p位置上的字符串或者整数
+unsigned char *lpFirst(unsigned char *lp);  //返回第一个元素
+unsigned char *lpLast(unsigned char *lp);   //返回最后一个元素
+unsigned char *lpNext(unsigned char *lp, unsigned char *p); //返回后一个元素
+unsigned char *lpPrev(unsigned char *lp, unsigned char *p); //返回前一个元素
+unsigned char *lpSeek(unsigned char *lp, long index);   //定位到index位置上的元素，负数从尾部算起
+int lpCompare(unsigned char *p, unsigned char *s, uint32_t slen);   //比较元素与给定的字符串
+unsigned char *lpFind(unsigned char *lp, unsigned char *p, unsigned char *s, uint32_t slen, unsigned int skip);   //从p开始查找元素，每次比较之间跳过skip个元素
+
+#endif
@@ -0,0 +1,1468 @@
+/* quicklist.c - A doubly linked list of ziplists
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A quicklist is a doubly linked list of ziplists. Every node holds a
+ * ziplist that is kept small by the fill factor, so that pushing or
+ * inserting only ever reallocates a few KB, while the entries themselves
+ * keep the compact ziplist encoding instead of costing a listNode, a robj
+ * and a sds string each.
+ *
+ * quicklist是由ziplist组成的双向链表，每个结点的ziplist大小受填充因子限制，
+ * 既保留了ziplist紧凑的存储，又避免了对一个很大的ziplist做内存重分配。
+ *
+ * The fill factor is either positive, the max number of entries of a node,
+ * or in the -1..-5 range, selecting a max ziplist size of 4, 8, 16, 32 or
+ * 64 KB. In the first case a node can still not grow past SIZE_SAFETY_LIMIT
+ * bytes unless it holds a single entry.
+ *
+ * Lists used as queues are only accessed at the ends, so the nodes deeper
+ * than 'compress' nodes from both the head and the tail can be kept LZF
+ * compressed. A compressed node is decompressed when an operation reaches
+ * into it, and compressed back once the operation is done with it: by the
+ * iterator when it moves to another node or gets released, by the insert,
+ * replace and delete functions before returning.
+ *
+ * 压缩深度不为0时，距离头尾超过compress个结点的中间结点用LZF压缩保存，
+ * 访问时临时解压，用完后重新压缩。 */
+
+#include <string.h> /* for memcpy */
+#include "quicklist.h"
+#include "zmalloc.h"
+#include "ziplist.h"
+#include "util.h" /* for ll2string */
+#include "lzf.h"
+
+/* Optimization levels for size-based filling */
+/* 负数的填充因子对应的ziplist最大字节数 */
+static const size_t optimization_level[] = {4096, 8192, 16384, 32768, 65536};
+
+/* Maximum size in bytes of any multi-element ziplist.
+ * Larger values will live in their own isolated ziplists. */
+#define SIZE_SAFETY_LIMIT 8192
+
+/* Maximum number of entries per node a positive fill factor can ask for. */
+#define FILL_MAX (1 << 15)
+
+#define sizeMeetsSafetyLimit(sz) ((sz) <= SIZE_SAFETY_LIMIT)
+
+/* Maximum compress depth, nodes kept uncompressed at each end. */
+#define COMPRESS_MAX (1 << 16)
+
+/* Minimum ziplist size in bytes for attempting compression. */
+#define MIN_COMPRESS_BYTES 48
+
+/* Minimum size reduction in bytes to store compressed quicklistNode data.
+ * This also prevents us from storing compression if the compression
+ * resulted in a larger size than the original data. */
+#define MIN_COMPRESS_IMPROVE 8
+
+/* Update the cached byte size of the node's ziplist. */
+#define quicklistNodeUpdateSz(node)                                            \
+    do {                                                                       \
+        (node)->sz = ziplistBlobLen((node)->zl);                               \
+    } while (0)
+
+/* Create a new quicklist.
+ * Free with quicklistRelease(). */
+/* 创建新的quicklist，默认每个结点最大8KB */
+quicklist *quicklistCreate(void) {
+    struct quicklist *quicklist;
+
+    quicklist = zmalloc(sizeof(*quicklist));
+    quicklist->head = quicklist->tail = NULL;
+    quicklist->len = 0;
+    quicklist->count = 0;
+    quicklist->compress = 0;
+    quicklist->fill = -2;
+    return quicklist;
+}
+
+/* 设置压缩深度，超出范围的值被截断 */
+void quicklistSetCompressDepth(quicklist *quicklist, int compress) {
+    if (compress > COMPRESS_MAX) {
+        compress = COMPRESS_MAX;
+    } else if (compress < 0) {
+        compress = 0;
+    }
+    quicklist->compress = compress;
+}
+
+/* 设置填充因子，超出范围的值被截断 */
+void quicklistSetFill(quicklist *quicklist, int fill) {
+    if (fill > FILL_MAX) {
+        fill = FILL_MAX;
+    } else if (fill < -5) {
+        fill = -5;
+    } else if (fill == 0) {
+        fill = 1;
+    }
+    quicklist->fill = fill;
+}
+
+/* 同时设置填充因子和压缩深度 */
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth) {
+    quicklistSetFill(quicklist, fill);
+    quicklistSetCompressDepth(quicklist, depth);
+}
+
+/* Create a new quicklist with some default parameters. */
+/* 按照给定的填充因子和压缩深度创建quicklist */
+quicklist *quicklistNew(int fill, int compress) {
+    quicklist *quicklist = quicklistCreate();
+    quicklistSetOptions(quicklist, fill, compress);
+    return quicklist;
+}
+
+/* 创建新的空结点 */
+static quicklistNode *quicklistCreateNode(void) {
+    quicklistNode *node;
+    node = zmalloc(sizeof(*node));
+    node->zl = NULL;
+    node->count = 0;
+    node->sz = 0;
+    node->next = node->prev = NULL;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    node->recompress = 0;
+    node->extra = 0;
+    return node;
+}
+
+/* Return cached quicklist count */
+/* 返回元素的总数 */
+unsigned long quicklistCount(const quicklist *ql) { return ql->count; }
+
+/* Free entire quicklist. */
+/* 释放所有结点及quicklist本身 */
+void quicklistRelease(quicklist *quicklist) {
+    unsigned long len;
+    quicklistNode *current, *next;
+
+    current = quicklist->head;
+    len = quicklist->len;
+    while (len--) {
+        next = current->next;
+
+        zfree(current->zl);
+        quicklist->count -= current->count;
+
+        zfree(current);
+
+        quicklist->len--;
+        current = next;
+    }
+    zfree(quicklist);
+}
+
+/* Compress the ziplist in 'node' and update encoding details.
+ * Returns 1 if ziplist compressed successfully.
+ * Returns 0 if compression failed or if ziplist too small to compress. */
+/* 压缩结点的ziplist，太小或者压缩效果不明显时不压缩 */
+static int __quicklistCompressNode(quicklistNode *node) {
+    quicklistLZF *lzf;
+
+    /* Whatever the outcome the node is done with: if it stays raw it must
+     * not look like one still waiting to be compressed back. */
+    node->recompress = 0;
+
+    /* Don't bother compressing small values */
+    if (node->sz < MIN_COMPRESS_BYTES)
+        return 0;
+
+    lzf = zmalloc(sizeof(*lzf) + node->sz);
+
+    /* Cancel if compression fails or doesn't compress small enough */
+    if (((lzf->sz = lzf_compress(node->zl, node->sz, lzf->compressed,
+                                 node->sz)) == 0) ||
+        lzf->sz + MIN_COMPRESS_IMPROVE >= node->sz) {
+        /* lzf_compress aborts/rejects compression if value not compressable. */
+        zfree(lzf);
+        return 0;
+    }
+    lzf = zrealloc(lzf, sizeof(*lzf) + lzf->sz);
+    zfree(node->zl);
+    node->zl = (unsigned char *)lzf;
+    node->encoding = QUICKLIST_NODE_ENCODING_LZF;
+    return 1;
+}
+
+/* Compress only uncompressed nodes. */
+#define quicklistCompressNode(_node)                                           \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_RAW) {     \
+            __quicklistCompressNode((_node));                                  \
+        }                                                                      \
+    } while (0)
+
+/* Uncompress the ziplist in 'node' and update encoding details.
+ * Returns 1 on successful decode, 0 on failure to decode. */
+/* 解压结点的ziplist */
+static int __quicklistDecompressNode(quicklistNode *node) {
+    void *decompressed = zmalloc(node->sz);
+    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+
+    if (lzf_decompress(lzf->compressed, lzf->sz, decompressed, node->sz) == 0) {
+        /* Someone requested decompress, but we can't decompress.  Not good. */
+        zfree(decompressed);
+        return 0;
+    }
+    zfree(lzf);
+    node->zl = decompressed;
+    node->encoding = QUICKLIST_NODE_ENCODING_RAW;
+    return 1;
+}
+
+/* Decompress only compressed nodes. The node is going to stay raw, so it
+ * is no longer one to compress back after use. */
+#define quicklistDecompressNode(_node)                                         \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+        }                                                                      \
+        if (_node) (_node)->recompress = 0;                                    \
+    } while (0)
+
+/* Force node to not be immediately re-compressible */
+#define quicklistDecompressNodeForUse(_node)                                   \
+    do {                                                                       \
+        if ((_node) && (_node)->encoding == QUICKLIST_NODE_ENCODING_LZF) {     \
+            __quicklistDecompressNode((_node));                                \
+            (_node)->recompress = 1;                                           \
+        }                                                                      \
+    } while (0)
+
+/* Extract the raw LZF data from this quicklistNode.
+ * Pointer to LZF data is assigned to '*data'.
+ * Return value is the length of compressed LZF data. */
+/* 获取压缩结点的LZF数据及其长度 */
+size_t quicklistGetLzf(const quicklistNode *node, void **data) {
+    quicklistLZF *lzf = (quicklistLZF *)node->zl;
+    *data = lzf->compressed;
+    return lzf->sz;
+}
+
+#define quicklistAllowsCompression(_ql) ((_ql)->compress != 0)
+
+/* Force 'quicklist' to meet compression guidelines set by compress depth.
+ * The only way to guarantee interior nodes get compressed is to iterate
+ * to our "interior" compress depth then compress the next node we find.
+ * If compress depth is larger than the entire list, we return immediately. */
+/* 保证两端compress个结点处于解压状态，并压缩深度之外的node结点 */
+static void __quicklistCompress(const quicklist *quicklist,
+                                quicklistNode *node) {
+    quicklistNode *forward, *reverse;
+    unsigned int depth = 0;
+    int in_depth = 0;
+
+    /* If length is less than our compress depth (from both sides),
+     * we can't compress anything. */
+    if (!quicklistAllowsCompression(quicklist) ||
+        quicklist->len < quicklist->compress * 2)
+        return;
+
+    /* Iterate until we reach compress depth for both sides of the list.
+     * Note: because we do length checks at the *top* of this function,
+     *       we can skip explicit null checks below. Everything exists. */
+    forward = quicklist->head;
+    reverse = quicklist->tail;
+    while (depth++ < quicklist->compress) {
+        quicklistDecompressNode(forward);
+        quicklistDecompressNode(reverse);
+
+        if (forward == node || reverse == node)
+            in_depth = 1;
+
+        /* We passed into compress depth of opposite side of the quicklist
+         * so there's no need to compress anything and we can exit. */
+        if (forward == reverse || forward->next == reverse)
+            return;
+
+        forward = forward->next;
+        reverse = reverse->prev;
+    }
+
+    if (!in_depth)
+        quicklistCompressNode(node);
+
+    /* At this point, forward and reverse are one node beyond depth */
+    quicklistCompressNode(forward);
+    quicklistCompressNode(reverse);
+}
+
+/* Compress 'node' back if it was decompressed for use, otherwise run the
+ * depth check for it. */
+#define quicklistCompress(_ql, _node)                                          \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+        else                                                                   \
+            __quicklistCompress((_ql), (_node));                               \
+    } while (0)
+
+/* If we previously used quicklistDecompressNodeForUse(), just recompress. */
+#define quicklistRecompressOnly(_node)                                         \
+    do {                                                                       \
+        if ((_node)->recompress)                                               \
+            quicklistCompressNode((_node));                                    \
+    } while (0)
+
+/* Insert 'new_node' after 'old_node' if 'after' is 1.
+ * Insert 'new_node' before 'old_node' if 'after' is 0. */
+/* 在old_node前后插入新结点 */
+static void __quicklistInsertNode(quicklist *quicklist,
+                                  quicklistNode *old_node,
+                                  quicklistNode *new_node, int after) {
+    if (after) {
+        new_node->prev = old_node;
+        if (old_node) {
+            new_node->next = old_node->next;
+            if (old_node->next)
+                old_node->next->prev = new_node;
+            old_node->next = new_node;
+        }
+        if (quicklist->tail == old_node)
+            quicklist->tail = new_node;
+    } else {
+        new_node->next = old_node;
+        if (old_node) {
+            new_node->prev = old_node->prev;
+            if (old_node->prev)
+                old_node->prev->next = new_node;
+            old_node->prev = new_node;
+        }
+        if (quicklist->head == old_node)
+            quicklist->head = new_node;
+    }
+    /* If this insert creates the only element so far, initialize head/tail. */
+    if (quicklist->len == 0) {
+        quicklist->head = quicklist->tail = new_node;
+    }
+    quicklist->len++;
+
+    /* The old node may have been pushed past the compress depth. */
+    if (old_node)
+        quicklistCompress(quicklist, old_node);
+}
+
+/* Unlink 'node' from the list and free it, together with its entries. */
+/* 删除整个结点 */
+static void __quicklistDelNode(quicklist *quicklist, quicklistNode *node) {
+    if (node->next)
+        node->next->prev = node->prev;
+    if (node->prev)
+        node->prev->next = node->next;
+
+    if (node == quicklist->tail)
+        quicklist->tail = node->prev;
+
+    if (node == quicklist->head)
+        quicklist->head = node->next;
+
+    quicklist->count -= node->count;
+
+    zfree(node->zl);
+    zfree(node);
+    quicklist->len--;
+
+    /* If we deleted a node within our compress depth, we
+     * now have compressed nodes needing to be decompressed. */
+    __quicklistCompress(quicklist, NULL);
+}
+
+/* Delete one entry from list given the node for the entry and a pointer
+ * to the entry in the node. On return '*p' points to the entry that
+ * followed the deleted one.
+ *
+ * Returns 1 if the entire node was deleted, 0 if node still exists. */
+/* 删除结点中p位置的元素，结点为空时一并删除 */
+static int quicklistDelIndex(quicklist *quicklist, quicklistNode *node,
+                             unsigned char **p) {
+    int gone = 0;
+
+    node->zl = ziplistDelete(node->zl, p);
+    node->count--;
+    if (node->count == 0) {
+        gone = 1;
+        __quicklistDelNode(quicklist, node);
+    } else {
+        quicklistNodeUpdateSz(node);
+    }
+    quicklist->count--;
+    /* If we deleted the node, the original node is no longer valid */
+    return gone ? 1 : 0;
+}
+
+/* Return 1 if a ziplist of 'sz' bytes fits the size class selected by a
+ * negative fill factor. */
+static int _quicklistNodeSizeMeetsOptimizationRequirement(const size_t sz,
+                                                          const int fill) {
+    size_t offset;
+
+    if (fill >= 0)
+        return 0;
+
+    offset = (-fill) - 1;
+    if (offset < (sizeof(optimization_level) / sizeof(*optimization_level))) {
+        if (sz <= optimization_level[offset]) {
+            return 1;
+        } else {
+            return 0;
+        }
+    } else {
+        return 0;
+    }
+}
+
+/* Return 1 if an entry of 'sz' bytes can be added to 'node' without going
+ * over the fill factor. */
+/* 判断结点能否再插入sz大小的元素 */
+static int _quicklistNodeAllowInsert(const quicklistNode *node,
+                                     const int fill, const size_t sz) {
+    int ziplist_overhead;
+    unsigned int new_sz;
+
+    if (!node)
+        return 0;
+
+    /* size of previous offset */
+    if (sz < 254)
+        ziplist_overhead = 1;
+    else
+        ziplist_overhead = 5;
+
+    /* size of forward offset */
+    if (sz < 64)
+        ziplist_overhead += 1;
+    else if (sz < 16384)
+        ziplist_overhead += 2;
+    else
+        ziplist_overhead += 5;
+
+    /* new_sz overestimates if 'sz' encodes to an INT type */
+    new_sz = node->sz + sz + ziplist_overhead;
+    if (_quicklistNodeSizeMeetsOptimizationRequirement(new_sz, fill))
+        return 1;
+    else if (!sizeMeetsSafetyLimit(new_sz))
+        return 0;
+    else if ((int)node->count < fill)
+        return 1;
+    else
+        return 0;
+}
+
+/* Add new entry to head node of quicklist.
+ *
+ * Returns 0 if used existing head.
+ * Returns 1 if new head created. */
+/* 头部插入元素，头结点放不下时新建结点 */
+int quicklistPushHead(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_head = quicklist->head;
+    if (_quicklistNodeAllowInsert(quicklist->head, quicklist->fill, sz)) {
+        quicklist->head->zl =
+            ziplistPush(quicklist->head->zl, value, sz, ZIPLIST_HEAD);
+        quicklistNodeUpdateSz(quicklist->head);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+
+        quicklistNodeUpdateSz(node);
+        __quicklistInsertNode(quicklist, quicklist->head, node, 0);
+    }
+    quicklist->count++;
+    quicklist->head->count++;
+    return (orig_head != quicklist->head);
+}
+
+/* Add new entry to tail node of quicklist.
+ *
+ * Returns 0 if used existing tail.
+ * Returns 1 if new tail created. */
+/* 尾部插入元素，尾结点放不下时新建结点 */
+int quicklistPushTail(quicklist *quicklist, void *value, size_t sz) {
+    quicklistNode *orig_tail = quicklist->tail;
+    if (_quicklistNodeAllowInsert(quicklist->tail, quicklist->fill, sz)) {
+        quicklist->tail->zl =
+            ziplistPush(quicklist->tail->zl, value, sz, ZIPLIST_TAIL);
+        quicklistNodeUpdateSz(quicklist->tail);
+    } else {
+        quicklistNode *node = quicklistCreateNode();
+        node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_TAIL);
+
+        quicklistNodeUpdateSz(node);
+        __quicklistInsertNode(quicklist, quicklist->tail, node, 1);
+    }
+    quicklist->count++;
+    quicklist->tail->count++;
+    return (orig_tail != quicklist->tail);
+}
+
+/* Wrapper to allow argument-based switching between HEAD/TAIL pop */
+/* 根据where在头部或尾部插入元素 */
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz,
+                   int where) {
+    if (where == QUICKLIST_HEAD) {
+        quicklistPushHead(quicklist, value, sz);
+    } else if (where == QUICKLIST_TAIL) {
+        quicklistPushTail(quicklist, value, sz);
+    }
+}
+
+/* Create new node consisting of a pre-formed ziplist.
+ * Used for loading RDBs where entire ziplists have been stored
+ * to be retrieved later. The quicklist takes ownership of 'zl'. */
+/* 将整个ziplist作为新的尾结点，用于RDB的加载 */
+void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl) {
+    quicklistNode *node = quicklistCreateNode();
+
+    node->zl = zl;
+    node->count = ziplistLen(node->zl);
+    node->sz = ziplistBlobLen(zl);
+
+    __quicklistInsertNode(quicklist, quicklist->tail, node, 1);
+    quicklist->count += node->count;
+}
+
+/* Create new (potentially multi-node) quicklist from a single existing
+ * ziplist, that is then owned by the quicklist. When the ziplist already
+ * fits the fill factor it becomes the only node as it is, otherwise its
+ * entries are pushed one after the other. */
+/* 根据ziplist创建quicklist，ziplist符合填充因子时直接作为唯一的结点 */
+quicklist *quicklistCreateFromZiplist(int fill, int compress,
+                                      unsigned char *zl) {
+    quicklist *quicklist = quicklistNew(fill, compress);
+    size_t sz = ziplistBlobLen(zl);
+    unsigned int count = ziplistLen(zl);
+    unsigned char *value;
+    unsigned int vlen;
+    long long longval;
+    char longstr[32] = {0};
+    unsigned char *p;
+
+    if (count == 0) {
+        zfree(zl);
+        return quicklist;
+    }
+
+    if (_quicklistNodeSizeMeetsOptimizationRequirement(sz, quicklist->fill) ||
+        (sizeMeetsSafetyLimit(sz) && (int)count <= quicklist->fill)) {
+        quicklistAppendZiplist(quicklist, zl);
+        return quicklist;
+    }
+
+    p = ziplistIndex(zl, 0);
+    while (ziplistGet(p, &value, &vlen, &longval)) {
+        if (!value) {
+            /* Write the longval as a string so we can re-add it */
+            vlen = ll2string(longstr, sizeof(longstr), longval);
+            value = (unsigned char *)longstr;
+        }
+        quicklistPushTail(quicklist, value, vlen);
+        p = ziplistNext(zl, p);
+    }
+
+    zfree(zl);
+    return quicklist;
+}
+
+/* Split 'node' into two parts, parameterized by 'offset' and 'after'.
+ *
+ * The 'after' argument controls which quicklistNode gets returned.
+ * If 'after'==1, returned node has elements after 'offset'.
+ *                input node keeps elements up to 'offset', including 'offset'.
+ * If 'after'==0, returned node has elements up to 'offset', not included.
+ *                input node keeps elements after 'offset', including 'offset'.
+ *
+ * The returned node is not linked in the list yet. */
+/* 在offset处将结点一分为二 */
+static quicklistNode *_quicklistSplitNode(quicklistNode *node, int offset,
+                                          int after) {
+    size_t zl_sz = node->sz;
+    int orig_start = after ? offset + 1 : 0;
+    int orig_extent = after ? -1 : offset;
+    int new_start = after ? 0 : offset;
+    int new_extent = after ? offset + 1 : -1;
+    quicklistNode *new_node = quicklistCreateNode();
+
+    new_node->zl = zmalloc(zl_sz);
+
+    /* Copy original ziplist so we can split it */
+    memcpy(new_node->zl, node->zl, zl_sz);
+
+    /* -1 here means "continue deleting until the list ends" */
+    node->zl = ziplistDeleteRange(node->zl, orig_start, orig_extent);
+    node->count = ziplistLen(node->zl);
+    quicklistNodeUpdateSz(node);
+
+    new_node->zl = ziplistDeleteRange(new_node->zl, new_start, new_extent);
+    new_node->count = ziplistLen(new_node->zl);
+    quicklistNodeUpdateSz(new_node);
+
+    return new_node;
+}
+
+/* Insert a new entry before or after existing entry 'entry'.
+ *
+ * If after==1, the new value is inserted after 'entry', otherwise
+ * the new value is inserted before 'entry'.
+ *
+ * When the node of 'entry' is full the value goes to the neighbour node if
+ * the entry is at the edge and the neighbour has room, to a new node
+ * otherwise; an insert in the middle of a full node splits it first. */
+/* 在元素前后插入新元素，结点已满时放入相邻结点、新结点或者分裂结点 */
+static void _quicklistInsert(quicklist *quicklist, quicklistEntry *entry,
+                             void *value, const size_t sz, int after) {
+    int full = 0, at_tail = 0, at_head = 0;
+    int fill = quicklist->fill;
+    quicklistNode *node = entry->node;
+    quicklistNode *new_node = NULL;
+    int pos;
+
+    if (!node) {
+        /* we have no reference node, so let's create only node in the list */
+        new_node = quicklistCreateNode();
+        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, NULL, new_node, after);
+        quicklist->count++;
+        return;
+    }
+
+    /* Offsets obtained walking from the tail are negative. */
+    pos = entry->offset >= 0 ? entry->offset : (int)node->count + entry->offset;
+
+    /* Populate accounting flags for easier boolean checks later */
+    if (!_quicklistNodeAllowInsert(node, fill, sz))
+        full = 1;
+
+    if (after && pos == (int)node->count - 1)
+        at_tail = 1;
+    else if (!after && pos == 0)
+        at_head = 1;
+
+    if (!full) {
+        /* Room in the current node: plain ziplist insert. */
+        if (after) {
+            unsigned char *next = ziplistNext(node->zl, entry->zi);
+            if (next == NULL) {
+                node->zl = ziplistPush(node->zl, value, sz, ZIPLIST_TAIL);
+            } else {
+                node->zl = ziplistInsert(node->zl, next, value, sz);
+            }
+        } else {
+            node->zl = ziplistInsert(node->zl, entry->zi, value, sz);
+        }
+        node->count++;
+        quicklistNodeUpdateSz(node);
+    } else if (at_tail && node->next &&
+               _quicklistNodeAllowInsert(node->next, fill, sz)) {
+        /* Full node, entry at its tail: prepend to the next node. */
+        new_node = node->next;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_HEAD);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+    } else if (at_head && node->prev &&
+               _quicklistNodeAllowInsert(node->prev, fill, sz)) {
+        /* Full node, entry at its head: append to the previous node. */
+        new_node = node->prev;
+        quicklistDecompressNodeForUse(new_node);
+        new_node->zl = ziplistPush(new_node->zl, value, sz, ZIPLIST_TAIL);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+    } else if (at_tail || at_head) {
+        /* Full node and full neighbour (or none): create a new node. */
+        new_node = quicklistCreateNode();
+        new_node->zl = ziplistPush(ziplistNew(), value, sz, ZIPLIST_HEAD);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+    } else {
+        /* Insert in the middle of a full node: split it, the new entry
+         * goes on the edge of the half that faces it. */
+        new_node = _quicklistSplitNode(node, pos, after);
+        new_node->zl = ziplistPush(new_node->zl, value, sz,
+                                   after ? ZIPLIST_HEAD : ZIPLIST_TAIL);
+        new_node->count++;
+        quicklistNodeUpdateSz(new_node);
+        __quicklistInsertNode(quicklist, node, new_node, after);
+    }
+
+    /* Compress back what we decompressed, and the new node when it is
+     * past the compress depth. */
+    quicklistRecompressOnly(node);
+    if (new_node)
+        quicklistCompress(quicklist, new_node);
+
+    quicklist->count++;
+}
+
+/* 在entry之前插入元素 */
+void quicklistInsertBefore(quicklist *quicklist, quicklistEntry *entry,
+                           void *value, const size_t sz) {
+    _quicklistInsert(quicklist, entry, value, sz, 0);
+}
+
+/* 在entry之后插入元素 */
+void quicklistInsertAfter(quicklist *quicklist, quicklistEntry *entry,
+                          void *value, const size_t sz) {
+    _quicklistInsert(quicklist, entry, value, sz, 1);
+}
+
+/* Delete one element represented by 'entry'
+ *
+ * 'entry' stores enough metadata to delete the proper position in
+ * the correct ziplist in the correct quicklist node. The iterator is
+ * updated so that the next call to quicklistNext() returns the entry
+ * that followed the deleted one in the iteration direction. */
+/* 删除迭代器当前的元素，并调整迭代器的位置 */
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry) {
+    quicklistNode *prev = entry->node->prev;
+    quicklistNode *next = entry->node->next;
+    long pos = entry->offset >= 0 ? entry->offset :
+                                    (long)entry->node->count + entry->offset;
+    int deleted_node = quicklistDelIndex((quicklist *)entry->quicklist,
+                                         entry->node, &entry->zi);
+
+    /* after delete, the zi is now invalid for any future usage. */
+    iter->zi = NULL;
+
+    if (iter->direction == AL_START_HEAD) {
+        /* The following entry moved to the position of the deleted one. */
+        if (deleted_node || pos >= (long)entry->node->count) {
+            if (!deleted_node)
+                quicklistCompress(entry->quicklist, entry->node);
+            iter->current = next;
+            iter->offset = 0;
+        } else {
+            iter->offset = pos;
+        }
+    } else {
+        if (deleted_node || pos == 0) {
+            if (!deleted_node)
+                quicklistCompress(entry->quicklist, entry->node);
+            iter->current = prev;
+            iter->offset = -1;
+        } else {
+            iter->offset = pos - 1;
+        }
+    }
+}
+
+/* Replace quicklist entry at offset 'index' by 'data' with length 'sz'.
+ *
+ * Returns 1 if replace happened.
+ * Returns 0 if replace failed and no changes happened. */
+/* 替换index位置上的元素 */
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data,
+                            int sz) {
+    quicklistEntry entry;
+    if (quicklistIndex(quicklist, index, &entry)) {
+        entry.node->zl = ziplistDelete(entry.node->zl, &entry.zi);
+        entry.node->zl = ziplistInsert(entry.node->zl, entry.zi, data, sz);
+        quicklistNodeUpdateSz(entry.node);
+        quicklistCompress(quicklist, entry.node);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Delete a range of elements from the quicklist.
+ *
+ * elements may span across multiple quicklistNodes, so we
+ * have to be careful about tracking where we start and end.
+ *
+ * Returns 1 if entries were deleted, 0 if nothing was deleted. */
+/* 删除从start开始的count个元素，整个被覆盖的结点直接释放 */
+int quicklistDelRange(quicklist *quicklist, const long start,
+                      const long count) {
+    unsigned long extent;
+    quicklistEntry entry;
+    quicklistNode *node;
+
+    if (count <= 0)
+        return 0;
+
+    extent = count; /* range is inclusive of start position */
+
+    if (start >= 0 && extent > (quicklist->count - start)) {
+        /* if requesting delete more elements than exist, limit to list size. */
+        extent = quicklist->count - start;
+    } else if (start < 0 && extent > (unsigned long)(-start)) {
+        /* else, if at negative offset, limit max size to rest of list. */
+        extent = -start; /* c.f. LREM -29 29; just delete until end. */
+    }
+
+    if (!quicklistIndex(quicklist, start, &entry))
+        return 0;
+
+    node = entry.node;
+
+    /* iterate over next nodes until everything is deleted. */
+    while (extent) {
+        quicklistNode *next = node->next;
+
+        unsigned long del;
+        int delete_entire_node = 0;
+        if (entry.offset == 0 && extent >= node->count) {
+            /* If we are deleting more than the count of this node, we
+             * can just delete the entire node without ziplist math. */
+            delete_entire_node = 1;
+            del = node->count;
+        } else if (entry.offset >= 0 && extent + entry.offset >= node->count) {
+            /* If deleting more nodes after this one, calculate delete based
+             * on size of current node. */
+            del = node->count - entry.offset;
+        } else if (entry.offset < 0) {
+            /* If offset is negative, we are in the first run of this loop
+             * and we are deleting the entire range
+             * from this start offset to end of list.  Since the Negative
+             * offset is the number of elements until the tail of the list,
+             * just use it directly as the deletion count. */
+            del = -entry.offset;
+
+            /* If the positive offset is greater than the remaining extent,
+             * we only delete the remaining extent, not the entire offset.
+             */
+            if (del > extent)
+                del = extent;
+        } else {
+            /* else, we are deleting less than the extent of this node, so
+             * use extent directly. */
+            del = extent;
+        }
+
+        if (delete_entire_node) {
+            __quicklistDelNode(quicklist, node);
+        } else {
+            /* The first node was decompressed by quicklistIndex() already */
+            quicklistDecompressNodeForUse(node);
+            node->zl = ziplistDeleteRange(node->zl, entry.offset, del);
+            quicklistNodeUpdateSz(node);
+            node->count -= del;
+            quicklist->count -= del;
+            if (node->count == 0)
+                __quicklistDelNode(quicklist, node);
+            else
+                quicklistRecompressOnly(node);
+        }
+
+        extent -= del;
+
+        node = next;
+
+        entry.offset = 0;
+    }
+    return 1;
+}
+
+/* Passthrough to ziplistCompare() */
+/* 比较元素与给定的字符串是否相等 */
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len) {
+    return ziplistCompare(p1, p2, p2_len);
+}
+
+/* Returns a quicklist iterator 'iter'. After the initialization every
+ * call to quicklistNext() will return the next element of the quicklist. */
+/* 获取迭代器，方向有头尾之分 */
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction) {
+    quicklistIter *iter;
+
+    iter = zmalloc(sizeof(*iter));
+
+    if (direction == AL_START_HEAD) {
+        iter->current = quicklist->head;
+        iter->offset = 0;
+    } else {
+        iter->current = quicklist->tail;
+        iter->offset = -1;
+    }
+
+    iter->direction = direction;
+    iter->quicklist = quicklist;
+
+    iter->zi = NULL;
+
+    return iter;
+}
+
+/* Initialize an iterator at a specific offset 'idx' and make the iterator
+ * return nodes in 'direction' direction. */
+/* 获取从idx位置开始的迭代器，idx越界时返回NULL */
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist,
+                                         const int direction,
+                                         const long long idx) {
+    quicklistEntry entry;
+
+    if (quicklistIndex(quicklist, idx, &entry)) {
+        quicklistIter *base = quicklistGetIterator(quicklist, direction);
+        base->zi = NULL;
+        base->current = entry.node;
+        base->offset = entry.offset;
+        return base;
+    } else {
+        return NULL;
+    }
+}
+
+/* Release iterator.
+ * If we still have a valid current node, then re-encode current node. */
+/* 释放迭代器，并重新压缩当前的结点 */
+void quicklistReleaseIterator(quicklistIter *iter) {
+    if (iter->current)
+        quicklistCompress(iter->quicklist, iter->current);
+
+    zfree(iter);
+}
+
+/* Get next element in iterator.
+ *
+ * Note: You must NOT insert into the list while iterating over it.
+ * You *may* delete from the list while iterating using the
+ * quicklistDelEntry() function.
+ * If you insert into the quicklist while iterating, you should
+ * re-create the iterator after your addition.
+ *
+ * iter = quicklistGetIterator(quicklist,<direction>);
+ * quicklistEntry entry;
+ * while (quicklistNext(iter, &entry)) {
+ *     if (entry.value)
+ *          [[ use entry.value with entry.sz ]]
+ *     else
+ *          [[ use entry.longval ]]
+ * }
+ *
+ * Populates 'entry' with values for this iteration.
+ * Returns 0 when iteration is complete or if iteration not possible.
+ * If return value is 0, the contents of 'entry' are not valid.
+ */
+/* 获取迭代器的下一个元素，当前结点遍历完后移到下一个结点 */
+int quicklistNext(quicklistIter *iter, quicklistEntry *entry) {
+    entry->quicklist = iter->quicklist;
+    entry->value = NULL;
+    entry->longval = 0;
+    entry->sz = 0;
+
+    while (iter->current) {
+        entry->node = iter->current;
+
+        if (!iter->zi) {
+            /* If !zi, use current index. */
+            quicklistDecompressNodeForUse(iter->current);
+            iter->zi = ziplistIndex(iter->current->zl, iter->offset);
+        } else {
+            /* else, use existing iterator offset and get prev/next as
+             * necessary. */
+            if (iter->direction == AL_START_HEAD) {
+                iter->zi = ziplistNext(iter->current->zl, iter->zi);
+                iter->offset++;
+            } else {
+                iter->zi = ziplistPrev(iter->current->zl, iter->zi);
+                iter->offset--;
+            }
+        }
+
+        entry->zi = iter->zi;
+        entry->offset = iter->offset;
+
+        if (iter->zi) {
+            /* Populate value from existing ziplist position */
+            ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+            return 1;
+        }
+
+        /* We ran out of ziplist entries.
+         * Pick next node, update offset, then re-run retrieval. */
+        quicklistCompress(iter->quicklist, iter->current);
+        if (iter->direction == AL_START_HEAD) {
+            /* Forward traversal */
+            iter->current = iter->current->next;
+            iter->offset = 0;
+        } else {
+            /* Reverse traversal */
+            iter->current = iter->current->prev;
+            iter->offset = -1;
+        }
+        iter->zi = NULL;
+    }
+    entry->node = NULL;
+    return 0;
+}
+
+/* Populate 'entry' with the element at the specified zero-based index
+ * where 0 is the head, 1 is the element next to head
+ * and so on. Negative integers are used in order to count
+ * from the tail, -1 is the last element, -2 the penultimate
+ * and so on. If the index is out of range 0 is returned.
+ *
+ * Returns 1 if element found
+ * Returns 0 if element not found */
+/* 定位到index位置上的元素，负数表示从尾部开始计数 */
+int quicklistIndex(const quicklist *quicklist, const long long idx,
+                   quicklistEntry *entry) {
+    quicklistNode *n;
+    unsigned long long accum = 0;
+    unsigned long long index;
+    int forward = idx < 0 ? 0 : 1; /* < 0 -> reverse, 0+ -> forward */
+
+    entry->quicklist = quicklist;
+    entry->node = NULL;
+    entry->zi = NULL;
+    entry->value = NULL;
+    entry->longval = 0;
+    entry->sz = 0;
+    entry->offset = 0;
+
+    index = forward ? idx : (-idx) - 1;
+    if (index >= quicklist->count)
+        return 0;
+
+    /* Seek from the nearest end: only the node counts are looked at, the
+     * ziplists are only walked in the node holding the element. */
+    n = forward ? quicklist->head : quicklist->tail;
+    while (n) {
+        if ((accum + n->count) > index) {
+            break;
+        } else {
+            accum += n->count;
+            n = forward ? n->next : n->prev;
+        }
+    }
+
+    if (!n)
+        return 0;
+
+    entry->node = n;
+    if (forward) {
+        /* forward = normal head-to-tail offset. */
+        entry->offset = index - accum;
+    } else {
+        /* reverse = need negative offset for tail-to-head, so undo
+         * the result of the original if (index < 0) above. */
+        entry->offset = (-index) - 1 + accum;
+    }
+
+    /* The caller will use our result, so we don't re-compress here:
+     * the node is compressed back by the insert/replace/delete functions
+     * or, for quicklistGetIteratorAtIdx(), when the iterator is done. */
+    quicklistDecompressNodeForUse(entry->node);
+    entry->zi = ziplistIndex(entry->node->zl, entry->offset);
+    ziplistGet(entry->zi, &entry->value, &entry->sz, &entry->longval);
+    return 1;
+}
+
+/* Pop from quicklist and return result in 'data' ptr. Value of 'data'
+ * is the return value of 'saver' function pointer if the data is NOT a number.
+ *
+ * If the quicklist element is a long long, then the return value is returned in
+ * 'sval'.
+ *
+ * Return value of 0 means no elements available.
+ * Return value of 1 means check 'data' and 'sval' for values.
+ * If 'data' is set, use 'data' and 'sz'.  Otherwise, use 'sval'. */
+/* 弹出头部或尾部的元素，字符串元素交给saver方法保存 */
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data,
+                       unsigned int *sz, long long *sval,
+                       void *(*saver)(unsigned char *data, unsigned int sz)) {
+    unsigned char *p;
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    int pos = (where == QUICKLIST_HEAD) ? 0 : -1;
+    quicklistNode *node;
+
+    if (quicklist->count == 0)
+        return 0;
+
+    if (data)
+        *data = NULL;
+    if (sz)
+        *sz = 0;
+    if (sval)
+        *sval = -123456789;
+
+    if (where == QUICKLIST_HEAD && quicklist->head) {
+        node = quicklist->head;
+    } else if (where == QUICKLIST_TAIL && quicklist->tail) {
+        node = quicklist->tail;
+    } else {
+        return 0;
+    }
+
+    p = ziplistIndex(node->zl, pos);
+    if (ziplistGet(p, &vstr, &vlen, &vlong)) {
+        if (vstr) {
+            if (data)
+                *data = saver(vstr, vlen);
+            if (sz)
+                *sz = vlen;
+        } else {
+            if (data)
+                *data = NULL;
+            if (sval)
+                *sval = vlong;
+        }
+        quicklistDelIndex(quicklist, node, &p);
+        return 1;
+    }
+    return 0;
+}
+
+/* Return a malloc'd copy of data passed in */
+static void *_quicklistSaver(unsigned char *data, unsigned int sz) {
+    unsigned char *vstr;
+    if (data) {
+        vstr = zmalloc(sz);
+        memcpy(vstr, data, sz);
+        return vstr;
+    }
+    return NULL;
+}
+
+/* Default pop function
+ *
+ * Returns malloc'd value from quicklist */
+/* 弹出元素，字符串元素返回zmalloc分配的拷贝 */
+int quicklistPop(quicklist *quicklist, int where, unsigned char **data,
+                 unsigned int *sz, long long *slong) {
+    unsigned char *vstr;
+    unsigned int vlen;
+    long long vlong;
+    if (quicklist->count == 0)
+        return 0;
+    int ret = quicklistPopCustom(quicklist, where, &vstr, &vlen, &vlong,
+                                 _quicklistSaver);
+    if (data)
+        *data = vstr;
+    if (slong)
+        *slong = vlong;
+    if (sz)
+        *sz = vlen;
+    return ret;
+}
+
+#ifdef QUICKLIST_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "testhelp.h"
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* The reference model: a plain array of malloc'd strings. */
+static char **model;
+static long model_len, model_cap;
+
+/* Number of compressed nodes met by checkConsistency(). */
+static long long compressed_seen;
+
+static void modelInsert(long pos, const char *s) {
+    if (model_len == model_cap) {
+        model_cap = model_cap ? model_cap*2 : 64;
+        model = realloc(model,sizeof(char*)*model_cap);
+    }
+    memmove(model+pos+1,model+pos,sizeof(char*)*(model_len-pos));
+    model[pos] = strdup(s);
+    model_len++;
+}
+
+static void modelDelete(long pos, long count) {
+    long j;
+    for (j = pos; j < pos+count; j++) free(model[j]);
+    memmove(model+pos,model+pos+count,sizeof(char*)*(model_len-pos-count));
+    model_len -= count;
+}
+
+/* Return the entry as a string in a static buffer. */
+static char *entryString(quicklistEntry *entry) {
+    static char buf[16384];
+    if (entry->value) {
+        memcpy(buf,entry->value,entry->sz);
+        buf[entry->sz] = '\0';
+    } else {
+        ll2string(buf,sizeof(buf),entry->longval);
+    }
+    return buf;
+}
+
+/* Random value: small integers, short strings or strings big enough to
+ * overflow the size classes. Half of the strings are repetitive enough to
+ * be compressed. */
+static char *randomValue(void) {
+    static char buf[12000];
+    int len, j, r = rand() % 10;
+
+    if (r < 4) {
+        snprintf(buf,sizeof(buf),"%d",rand() % 100000 - 50000);
+        return buf;
+    }
+    len = (r < 9) ? rand() % 40 + 1 : rand() % 10000 + 300;
+    for (j = 0; j < len; j++)
+        buf[j] = (r & 1) ? 'a' + rand() % 26 : 'a' + (j / 7) % 3;
+    buf[len] = '\0';
+    return buf;
+}
+
+/* Check the list structure and compare it with the model in both
+ * directions. Returns 1 if they agree. */
+static int checkConsistency(quicklist *ql) {
+    quicklistNode *node, *prev = NULL;
+    quicklistIter *iter;
+    quicklistEntry entry;
+    unsigned long count = 0;
+    unsigned int len = 0;
+    long j;
+    int ok = 1;
+
+    for (node = ql->head; ok && node; node = node->next) {
+        unsigned char *zl = node->zl;
+
+        ok = node->prev == prev && node->count > 0 && node->recompress == 0;
+        if (ok && quicklistNodeIsCompressed(node)) {
+            quicklistLZF *lzf = (quicklistLZF*)node->zl;
+
+            /* Only nodes past the compress depth on both sides. */
+            ok = ql->compress && len >= ql->compress &&
+                 ql->len - 1 - len >= ql->compress;
+            zl = zmalloc(node->sz);
+            ok = ok && lzf_decompress(lzf->compressed,lzf->sz,zl,node->sz) ==
+                       node->sz;
+            compressed_seen++;
+        }
+        ok = ok && node->count == ziplistLen(zl) &&
+                   node->sz == ziplistBlobLen(zl);
+        if (zl != node->zl) zfree(zl);
+        count += node->count;
+        len++;
+        prev = node;
+    }
+    if (!ok || ql->tail != prev || ql->count != count || ql->len != len ||
+        (long)ql->count != model_len) return 0;
+
+    iter = quicklistGetIterator(ql,AL_START_HEAD);
+    j = 0;
+    while (ok && quicklistNext(iter,&entry))
+        ok = strcmp(entryString(&entry),model[j++]) == 0;
+    ok = ok && j == model_len;
+    quicklistReleaseIterator(iter);
+
+    iter = quicklistGetIterator(ql,AL_START_TAIL);
+    j = model_len;
+    while (ok && quicklistNext(iter,&entry))
+        ok = strcmp(entryString(&entry),model[--j]) == 0;
+    ok = ok && j == 0;
+    quicklistReleaseIterator(iter);
+    return ok;
+}
+
+/* Run random operations on a quicklist and on the model, checking that
+ * they agree after each one. Returns 1 on success. */
+static int fuzz(int fill, int depth, int iterations) {
+    quicklist *ql = quicklistNew(fill,depth);
+    quicklistIter *iter;
+    quicklistEntry entry;
+    int i, ok = 1;
+
+    for (i = 0; ok && i < iterations; i++) {
+        int op = rand() % 12;
+        char *v = randomValue();
+        long pos = model_len ? rand() % model_len : 0;
+
+        if (op < 3) {
+            quicklistPushHead(ql,v,strlen(v));
+            modelInsert(0,v);
+        } else if (op < 6) {
+            quicklistPushTail(ql,v,strlen(v));
+            modelInsert(model_len,v);
+        } else if (op == 6 && model_len) {
+            unsigned char *data;
+            unsigned int sz;
+            long long sval;
+            int where = rand() & 1 ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+            long mpos = where == QUICKLIST_HEAD ? 0 : model_len-1;
+
+            if (!quicklistPop(ql,where,&data,&sz,&sval)) {
+                ok = 0;
+                break;
+            }
+            if (data) {
+                ok = sz == strlen(model[mpos]) &&
+                     memcmp(data,model[mpos],sz) == 0;
+                zfree(data);
+            } else {
+                ok = sval == strtoll(model[mpos],NULL,10);
+            }
+            modelDelete(mpos,1);
+        } else if (op == 7 && model_len) {
+            /* Insert before or after an element reached by index, from
+             * the head or from the tail. */
+            int after = rand() & 1;
+            long idx = rand() & 1 ? pos : pos - model_len;
+
+            if (!quicklistIndex(ql,idx,&entry) ||
+                strcmp(entryString(&entry),model[pos]) != 0) {
+                ok = 0;
+                break;
+            }
+            if (after) {
+                quicklistInsertAfter(ql,&entry,v,strlen(v));
+                modelInsert(pos+1,v);
+            } else {
+                quicklistInsertBefore(ql,&entry,v,strlen(v));
+                modelInsert(pos,v);
+            }
+        } else if (op == 8 && model_len) {
+            ok = quicklistReplaceAtIndex(ql,pos,v,strlen(v));
+            free(model[pos]);
+            model[pos] = strdup(v);
+        } else if (op == 9 && model_len) {
+            long count = rand() % 200 + 1;
+            long start = rand() & 1 ? pos : pos - model_len;
+
+            ok = quicklistDelRange(ql,start,count);
+            if (count > model_len - pos) count = model_len - pos;
+            modelDelete(pos,count);
+        } else if (op == 10 && model_len) {
+            /* Delete every element equal to a random one while iterating,
+             * in a random direction, like LREM does. */
+            char *target = strdup(model[pos]);
+            int dir = rand() & 1 ? AL_START_HEAD : AL_START_TAIL;
+            long j;
+
+            iter = quicklistGetIterator(ql,dir);
+            while (quicklistNext(iter,&entry)) {
+                if (strcmp(entryString(&entry),target) == 0)
+                    quicklistDelEntry(iter,&entry);
+            }
+            quicklistReleaseIterator(iter);
+            for (j = model_len-1; j >= 0; j--)
+                if (strcmp(model[j],target) == 0) modelDelete(j,1);
+            free(target);
+        } else if (op == 11 && model_len) {
+            /* Iterate a range starting at an index. */
+            long j = pos;
+            int steps = 0;
+
+            iter = quicklistGetIteratorAtIdx(ql,AL_START_HEAD,pos);
+            if (iter == NULL) {
+                ok = 0;
+                break;
+            }
+            while (ok && steps++ < 50 && quicklistNext(iter,&entry))
+                ok = strcmp(entryString(&entry),model[j++]) == 0;
+            quicklistReleaseIterator(iter);
+        }
+        ok = ok && checkConsistency(ql);
+    }
+
+    quicklistRelease(ql);
+    modelDelete(0,model_len);
+    return ok;
+}
+
+int main(void) {
+    int fills[] = {-5, -4, -3, -2, -1, 1, 2, 4, 32, 128};
+    unsigned int j;
+    int depth;
+    long long start;
+    char descr[64];
+
+    for (depth = 0; depth <= 2; depth++) {
+        compressed_seen = 0;
+        for (j = 0; j < sizeof(fills)/sizeof(fills[0]); j++) {
+            snprintf(descr,sizeof(descr),"Fuzzing fill %d, compress depth %d",
+                fills[j],depth);
+            test_cond(descr,fuzz(fills[j],depth,2000));
+        }
+        /* The small fills build lists long enough to compress. */
+        test_cond(depth ? "Nodes past the compress depth are compressed" :
+                          "No node is compressed with depth 0",
+            (depth == 0) == (compressed_seen == 0));
+    }
+
+    {
+        unsigned char *zl = ziplistNew();
+        quicklist *ql;
+        char buf[32];
+        int i;
+
+        for (i = 0; i < 5000; i++) {
+            ll2string(buf,sizeof(buf),i);
+            zl = ziplistPush(zl,(unsigned char*)buf,strlen(buf),ZIPLIST_TAIL);
+            modelInsert(model_len,buf);
+        }
+        ql = quicklistCreateFromZiplist(-2,0,zl);
+        test_cond("Quicklist created from a ziplist",
+            ql->len > 1 && checkConsistency(ql));
+        quicklistRelease(ql);
+        modelDelete(0,model_len);
+    }
+
+    printf("Benchmark push/index of 1M entries: ");
+    {
+        quicklist *ql = quicklistCreate();
+        quicklistEntry entry;
+        long i, found = 0;
+
+        start = usec();
+        for (i = 0; i < 1000000; i++)
+            quicklistPushTail(ql,"hello world",11);
+        for (i = 0; i < 1000000; i += 1000)
+            found += quicklistIndex(ql,i,&entry);
+        printf("%lld usec, %u nodes\n", usec()-start, ql->len);
+        test_cond("Every indexed entry is found", found == 1000);
+        quicklistRelease(ql);
+    }
+
+    printf("Memory used by 1M log lines, compress depth 0 and 1:");
+    for (depth = 0; depth <= 1; depth++) {
+        quicklist *ql = quicklistNew(-2,depth);
+        size_t used = zmalloc_used_memory();
+        char buf[128];
+        long i;
+
+        for (i = 0; i < 1000000; i++) {
+            int len = snprintf(buf,sizeof(buf),
+                "job:%ld worker:%ld status:%s elapsed_ms:%ld",
+                i, i % 16, i % 10 ? "done" : "retry", i % 1000);
+            quicklistPushTail(ql,buf,len);
+        }
+        printf(" %zu", zmalloc_used_memory()-used);
+        quicklistRelease(ql);
+    }
+    printf(" bytes\n");
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,159 @@
+/* quicklist.h - A generic doubly linked quicklist implementation
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __QUICKLIST_H__
+#define __QUICKLIST_H__
+
+/* quicklistNode is a 32 byte struct describing a ziplist for a quicklist.
+ * sz is the byte size of the uncompressed ziplist, count is the number of
+ * entries it holds, so that neither needs to walk the ziplist. When the
+ * node is compressed 'zl' points to a quicklistLZF instead. 'recompress'
+ * is set on compressed nodes that were decompressed to be read or
+ * modified, so they are compressed back afterwards. */
+/* quicklist结点，每个结点保存一个大小受限的ziplist */
+typedef struct quicklistNode {
+	//前一结点
+    struct quicklistNode *prev;
+    //后一结点
+    struct quicklistNode *next;
+    //结点保存的ziplist，压缩时指向quicklistLZF
+    unsigned char *zl;
+    //未压缩时ziplist占用的字节数
+    unsigned int sz;
+    //ziplist中的元素个数
+    unsigned int count : 16;
+    //RAW==1或者LZF==2
+    unsigned int encoding : 2;
+    //为1表示结点被临时解压，使用后需要重新压缩
+    unsigned int recompress : 1;
+    unsigned int extra : 13;
+} quicklistNode;
+
+/* quicklistLZF is a 4+N byte struct holding 'sz' followed by 'compressed'.
+ * 'sz' is byte length of 'compressed' field.
+ * 'compressed' is LZF data with total (compressed) length 'sz'
+ * NOTE: uncompressed length is stored in quicklistNode->sz. */
+/* 压缩后的ziplist */
+typedef struct quicklistLZF {
+    unsigned int sz; /* LZF size in bytes*/
+    char compressed[];
+} quicklistLZF;
+
+/* quicklist is a doubly linked list of ziplists. 'count' is the number of
+ * entries in all the ziplists, 'len' the number of nodes. 'fill' bounds
+ * the size of every node: a positive value is the max number of entries
+ * per node, a negative one selects a max size in bytes, see
+ * optimization_level[] in quicklist.c. */
+/* quicklist是由ziplist组成的双向链表 */
+typedef struct quicklist {
+    quicklistNode *head;
+    quicklistNode *tail;
+    //所有ziplist中的元素总数
+    unsigned long count;
+    //结点的个数
+    unsigned int len;
+    //每个结点的填充因子
+    int fill;
+    //两端不压缩的结点个数，0表示不压缩
+    unsigned int compress;
+} quicklist;
+
+/* quicklist迭代器 */
+typedef struct quicklistIter {
+    const quicklist *quicklist;
+    quicklistNode *current;
+    //当前ziplist中的位置，为NULL时根据offset重新定位
+    unsigned char *zi;
+    //在当前ziplist中的偏移量
+    long offset;
+    int direction;
+} quicklistIter;
+
+/* An entry returned by the iterator or by quicklistIndex(). 'value' and
+ * 'sz' are set for string entries, 'longval' for integer ones. */
+/* quicklist中的一个元素 */
+typedef struct quicklistEntry {
+    const quicklist *quicklist;
+    quicklistNode *node;
+    unsigned char *zi;
+    unsigned char *value;
+    long long longval;
+    unsigned int sz;
+    int offset;
+} quicklistEntry;
+
+#define QUICKLIST_HEAD 0
+#define QUICKLIST_TAIL -1
+
+/* quicklist node encodings */
+#define QUICKLIST_NODE_ENCODING_RAW 1
+#define QUICKLIST_NODE_ENCODING_LZF 2
+
+/* quicklist compression disable */
+#define QUICKLIST_NOCOMPRESS 0
+
+#define quicklistNodeIsCompressed(node)                                        \
+    ((node)->encoding == QUICKLIST_NODE_ENCODING_LZF)
+
+/* Iterator directions, same values of the adlist.h ones. */
+#ifndef AL_START_HEAD
+#define AL_START_HEAD 0
+#define AL_START_TAIL 1
+#endif
+
+/* Prototypes */
+quicklist *quicklistCreate(void);   //创建默认填充因子的quicklist
+quicklist *quicklistNew(int fill, int compress);    //按照给定的填充因子和压缩深度创建quicklist
+void quicklistSetCompressDepth(quicklist *quicklist, int depth);    //设置两端不压缩的结点个数
+void quicklistSetFill(quicklist *quicklist, int fill);  //设置填充因子
+void quicklistSetOptions(quicklist *quicklist, int fill, int depth);    //同时设置填充因子和压缩深度
+void quicklistRelease(quicklist *quicklist);    //释放quicklist
+int quicklistPushHead(quicklist *quicklist, void *value, const size_t sz);  //头部插入元素
+int quicklistPushTail(quicklist *quicklist, void *value, const size_t sz);  //尾部插入元素
+void quicklistPush(quicklist *quicklist, void *value, const size_t sz, int where);  //头部或尾部插入元素
+void quicklistAppendZiplist(quicklist *quicklist, unsigned char *zl);   //将整个ziplist作为新结点追加到尾部
+quicklist *quicklistCreateFromZiplist(int fill, int compress, unsigned char *zl);   //根据ziplist创建quicklist
+void quicklistInsertAfter(quicklist *quicklist, quicklistEntry *node, void *value, const size_t sz);    //在元素之后插入
+void quicklistInsertBefore(quicklist *quicklist, quicklistEntry *node, void *value, const size_t sz);   //在元素之前插入
+void quicklistDelEntry(quicklistIter *iter, quicklistEntry *entry); //删除迭代器当前的元素
+int quicklistReplaceAtIndex(quicklist *quicklist, long index, void *data, int sz);  //替换index位置上的元素
+int quicklistDelRange(quicklist *quicklist, const long start, const long count); //删除从start开始的count个元素
+quicklistIter *quicklistGetIterator(const quicklist *quicklist, int direction); //获取迭代器
+quicklistIter *quicklistGetIteratorAtIdx(const quicklist *quicklist, int direction, const long long idx);   //获取从idx位置开始的迭代器
+int quicklistNext(quicklistIter *iter, quicklistEntry *node);   //获取迭代器的下一个元素
+void quicklistReleaseIterator(quicklistIter *iter); //释放迭代器
+int quicklistIndex(const quicklist *quicklist, const long long index, quicklistEntry *entry);    //定位到index位置上的元素
+int quicklistPopCustom(quicklist *quicklist, int where, unsigned char **data, unsigned int *sz, long long *sval, void *(*saver)(unsigned char *data, unsigned int sz));    //弹出元素，字符串由saver方法保存
+int quicklistPop(quicklist *quicklist, int where, unsigned char **data, unsigned int *sz, long long *slong);    //弹出元素
+unsigned long quicklistCount(const quicklist *ql);  //返回元素的总数
+int quicklistCompare(unsigned char *p1, unsigned char *p2, int p2_len); //比较元素与给定的字符串
+size_t quicklistGetLzf(const quicklistNode *node, void **data);    //获取压缩结点的LZF数据
+
+#endif /* __QUICKLIST_H__ */
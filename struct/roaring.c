@@ -0,0 +1,1115 @@
+/* roaring.c - A compressed bitmap for sparse SETBIT strings
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A SETBIT string is a flat array of bytes, so setting a single bit at a
+ * large offset allocates every byte before it. The roaring bitmap only
+ * stores the chunks of 65536 bits that have at least one bit set, each one
+ * in the smallest of three containers: a sorted array of the set positions
+ * when they are few, a plain bitmap when they are many, or a list of runs
+ * of consecutive set bits.
+ *
+ * roaring位图按照高16位把位分成多个容器，只保存有位被设置的容器，每个容器
+ * 根据内容选择有序数组、位图或者连续区间中占用空间最小的一种。
+ *
+ * Bit 'pos' is the bit 'pos' of the string as seen by SETBIT, so byte
+ * pos/8 with the most significant bit first. The bitmap remembers the
+ * length of the string it stands for, so that STRLEN, BITCOUNT and BITPOS
+ * ranges and BITOP results are the same as with the raw encoding.
+ *
+ * Binary operations and conversions expand the containers to 65536 bits
+ * arrays of words, and pick the best container for the result. Runs are
+ * only created this way: SETBIT on a run container turns it back into an
+ * array or a bitmap. */
+
+#include <string.h>
+#include "zmalloc.h"
+#include "endianconv.h"
+#include "roaring.h"
+#include "redisassert.h"
+
+#define RB_KEY(pos) ((uint32_t)((pos) >> 16))
+#define RB_LOW(pos) ((uint32_t)((pos) & 0xffff))
+#define RB_MAX_POS 0xffffffffULL
+#define RB_BITMAP_BYTES (RB_BITMAP_WORDS*8)
+
+/* Serialized container header: key, type and number of entries. */
+#define RB_BLOB_HDR 8
+#define RB_BLOB_CONTAINER_HDR 7
+
+/* -----------------------------------------------------------------------------
+ * Word arrays
+ * -------------------------------------------------------------------------- */
+
+/* Reverse the bits of a byte: the strings store the lowest bit position in
+ * the most significant bit, the words in the least significant one. */
+/* 翻转字节中的位 */
+static unsigned char rbReverseByte(unsigned char b) {
+    b = (b & 0xf0) >> 4 | (b & 0x0f) << 4;
+    b = (b & 0xcc) >> 2 | (b & 0x33) << 2;
+    b = (b & 0xaa) >> 1 | (b & 0x55) << 1;
+    return b;
+}
+
+/* Set the bits 'start' to 'end' (inclusive) of the words array. */
+/* 设置start到end之间的位 */
+static void rbWordsSetRange(uint64_t *w, uint32_t start, uint32_t end) {
+    uint32_t first = start >> 6, last = end >> 6, j;
+    uint64_t fmask = ~0ULL << (start & 63);
+    uint64_t lmask = ~0ULL >> (63 - (end & 63));
+
+    if (first == last) {
+        w[first] |= fmask & lmask;
+        return;
+    }
+    w[first] |= fmask;
+    for (j = first+1; j < last; j++) w[j] = ~0ULL;
+    w[last] |= lmask;
+}
+
+/* Return the first bit >= 'from' with value 'bit', or 65536 if none. */
+/* 返回from之后第一个值为bit的位 */
+static uint32_t rbWordsNext(const uint64_t *w, uint32_t from, int bit) {
+    uint32_t j = from >> 6;
+    uint64_t word;
+
+    if (from >= 65536) return 65536;
+    word = (bit ? w[j] : ~w[j]) & (~0ULL << (from & 63));
+    while (1) {
+        if (word) return (j << 6) + __builtin_ctzll(word);
+        if (++j == RB_BITMAP_WORDS) return 65536;
+        word = bit ? w[j] : ~w[j];
+    }
+}
+
+/* Count the set bits from 'from' to 'to' (inclusive). */
+/* 统计from到to之间被设置的位数 */
+static uint32_t rbWordsCount(const uint64_t *w, uint32_t from, uint32_t to) {
+    uint32_t first = from >> 6, last = to >> 6, j, count;
+    uint64_t fmask = ~0ULL << (from & 63);
+    uint64_t lmask = ~0ULL >> (63 - (to & 63));
+
+    if (first == last)
+        return __builtin_popcountll(w[first] & fmask & lmask);
+    count = __builtin_popcountll(w[first] & fmask);
+    for (j = first+1; j < last; j++) count += __builtin_popcountll(w[j]);
+    return count + __builtin_popcountll(w[last] & lmask);
+}
+
+/* -----------------------------------------------------------------------------
+ * Containers
+ * -------------------------------------------------------------------------- */
+
+/* Return the first index of the array with a value >= 'v'. */
+/* 二分查找第一个大于等于v的元素 */
+static uint32_t rbArrayLowerBound(const uint16_t *a, uint32_t n, uint32_t v) {
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (a[mid] < v) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Return the index of the last run starting at or before 'v', or -1. */
+/* 返回起点小于等于v的最后一个区间 */
+static int32_t rbRunSearch(const uint16_t *r, uint32_t n, uint32_t v) {
+    int32_t lo = 0, hi = (int32_t)n-1, res = -1;
+
+    while (lo <= hi) {
+        int32_t mid = (lo+hi) >> 1;
+        if (r[mid*2] <= v) {
+            res = mid;
+            lo = mid+1;
+        } else {
+            hi = mid-1;
+        }
+    }
+    return res;
+}
+
+static size_t rbContainerDataLen(const rbContainer *c) {
+    switch(c->type) {
+    case RB_ARRAY: return (size_t)c->n*2;
+    case RB_RUN: return (size_t)c->n*4;
+    default: return RB_BITMAP_BYTES;
+    }
+}
+
+/* Make room for 'n' entries in an ARRAY or RUN container. */
+/* 为数组或者区间容器预留n个元素的空间 */
+static void rbContainerReserve(rbContainer *c, uint32_t n) {
+    size_t esize = (c->type == RB_RUN) ? 4 : 2;
+    uint32_t cap;
+
+    if (n <= c->cap) return;
+    cap = c->cap ? c->cap*2 : 4;
+    while (cap < n) cap *= 2;
+    c->data = zrealloc(c->data,cap*esize);
+    c->cap = cap;
+}
+
+static void rbContainerCopy(rbContainer *dst, const rbContainer *src) {
+    size_t len = rbContainerDataLen(src);
+
+    *dst = *src;
+    dst->cap = (src->type == RB_BITMAP) ? 0 : src->n;
+    dst->data = zmalloc(len);
+    memcpy(dst->data,src->data,len);
+}
+
+/* Return the bit 'v' of the container. */
+/* 返回容器中v位置上的位 */
+static int rbContainerGet(const rbContainer *c, uint32_t v) {
+    const uint16_t *a = c->data;
+    uint32_t idx;
+    int32_t run;
+
+    switch(c->type) {
+    case RB_ARRAY:
+        idx = rbArrayLowerBound(a,c->n,v);
+        return idx < c->n && a[idx] == v;
+    case RB_BITMAP:
+        return (((uint64_t*)c->data)[v >> 6] >> (v & 63)) & 1;
+    default:
+        run = rbRunSearch(a,c->n,v);
+        return run >= 0 && v <= (uint32_t)a[run*2]+a[run*2+1];
+    }
+}
+
+/* Expand the container into 'w', a RB_BITMAP_WORDS words array. */
+/* 将容器展开成位图 */
+static void rbContainerToWords(const rbContainer *c, uint64_t *w) {
+    const uint16_t *a = c->data;
+    uint32_t j;
+
+    if (c->type == RB_BITMAP) {
+        memcpy(w,c->data,RB_BITMAP_BYTES);
+        return;
+    }
+    memset(w,0,RB_BITMAP_BYTES);
+    if (c->type == RB_ARRAY) {
+        for (j = 0; j < c->n; j++) w[a[j] >> 6] |= 1ULL << (a[j] & 63);
+    } else {
+        for (j = 0; j < c->n; j++)
+            rbWordsSetRange(w,a[j*2],(uint32_t)a[j*2]+a[j*2+1]);
+    }
+}
+
+/* Fill the container 'c', whose data is not allocated, with the bits of
+ * 'w'. 'type' is the container type to use, or -1 to use the smallest one.
+ * Returns the number of set bits: when it is zero nothing is allocated. */
+/* 根据位图创建容器，type为-1时选择占用空间最小的容器类型 */
+static uint32_t rbContainerFromWords(rbContainer *c, const uint64_t *w, int type) {
+    uint32_t card = 0, runs = 0, j, v, n;
+    uint64_t prev = 0;
+    uint16_t *a;
+
+    for (j = 0; j < RB_BITMAP_WORDS; j++) {
+        card += __builtin_popcountll(w[j]);
+        /* A run starts at every set bit whose previous bit is clear. */
+        runs += __builtin_popcountll(w[j] & ~((w[j] << 1) | prev));
+        prev = w[j] >> 63;
+    }
+    if (card == 0) return 0;
+
+    if (type == -1) {
+        if ((size_t)runs*4 < RB_BITMAP_BYTES &&
+            (card > RB_ARRAY_MAX || runs*4 < card*2))
+            type = RB_RUN;
+        else if (card <= RB_ARRAY_MAX)
+            type = RB_ARRAY;
+        else
+            type = RB_BITMAP;
+    }
+
+    c->type = type;
+    c->card = card;
+    if (type == RB_BITMAP) {
+        c->n = c->cap = 0;
+        c->data = zmalloc(RB_BITMAP_BYTES);
+        memcpy(c->data,w,RB_BITMAP_BYTES);
+    } else if (type == RB_ARRAY) {
+        c->n = c->cap = card;
+        c->data = a = zmalloc((size_t)card*2);
+        n = 0;
+        for (j = 0; j < RB_BITMAP_WORDS; j++) {
+            uint64_t word = w[j];
+            while (word) {
+                a[n++] = (j << 6) + __builtin_ctzll(word);
+                word &= word-1;
+            }
+        }
+    } else {
+        c->n = c->cap = runs;
+        c->data = a = zmalloc((size_t)runs*4);
+        n = 0;
+        v = 0;
+        while ((v = rbWordsNext(w,v,1)) < 65536) {
+            uint32_t end = rbWordsNext(w,v,0);
+            a[n*2] = v;
+            a[n*2+1] = end-1-v;
+            n++;
+            v = end;
+        }
+    }
+    return card;
+}
+
+/* Turn the container into one of the given type. */
+/* 转换容器的类型 */
+static void rbContainerConvert(rbContainer *c, int type) {
+    uint64_t w[RB_BITMAP_WORDS];
+
+    rbContainerToWords(c,w);
+    zfree(c->data);
+    c->data = NULL;
+    rbContainerFromWords(c,w,type);
+}
+
+/* Return the first value >= 'from' with value 'bit', or 65536 if none. */
+/* 返回容器中from之后第一个值为bit的位 */
+static uint32_t rbContainerNext(const rbContainer *c, uint32_t from, int bit) {
+    const uint16_t *a = c->data;
+    uint32_t idx, end;
+    int32_t run;
+
+    if (from >= 65536) return 65536;
+    switch(c->type) {
+    case RB_BITMAP:
+        return rbWordsNext(c->data,from,bit);
+    case RB_ARRAY:
+        idx = rbArrayLowerBound(a,c->n,from);
+        if (bit) return idx < c->n ? a[idx] : 65536;
+        while (idx < c->n && a[idx] == from) {
+            idx++;
+            from++;
+        }
+        return from;
+    default:
+        /* Runs are never adjacent, the bit after a run is always clear. */
+        run = rbRunSearch(a,c->n,from);
+        end = (run >= 0) ? (uint32_t)a[run*2]+a[run*2+1] : 0;
+        if (run >= 0 && from <= end) return bit ? from : end+1;
+        if (!bit) return from;
+        return ((uint32_t)(run+1) < c->n) ? a[(run+1)*2] : 65536;
+    }
+}
+
+/* Count the set bits of the container from 'from' to 'to' (inclusive). */
+/* 统计容器中from到to之间被设置的位数 */
+static uint32_t rbContainerCount(const rbContainer *c, uint32_t from, uint32_t to) {
+    const uint16_t *a = c->data;
+    uint32_t j, count = 0;
+
+    if (from == 0 && to == 65535) return c->card;
+    switch(c->type) {
+    case RB_BITMAP:
+        return rbWordsCount(c->data,from,to);
+    case RB_ARRAY:
+        return rbArrayLowerBound(a,c->n,to+1) - rbArrayLowerBound(a,c->n,from);
+    default:
+        for (j = 0; j < c->n; j++) {
+            uint32_t s = a[j*2], e = s+a[j*2+1];
+            if (s > to) break;
+            if (e < from) continue;
+            if (s < from) s = from;
+            if (e > to) e = to;
+            count += e-s+1;
+        }
+        return count;
+    }
+}
+
+/* Merge two ARRAY containers into 'out', that has room for the values of
+ * both. Returns the number of values. */
+/* 合并两个数组容器 */
+static uint32_t rbArrayOp(const rbContainer *x, const rbContainer *y, int op,
+                          uint16_t *out)
+{
+    const uint16_t *a = x->data, *b = y->data;
+    uint32_t i = 0, j = 0, n = 0;
+
+    while (i < x->n && j < y->n) {
+        if (a[i] < b[j]) {
+            if (op != RB_AND) out[n++] = a[i];
+            i++;
+        } else if (a[i] > b[j]) {
+            if (op != RB_AND) out[n++] = b[j];
+            j++;
+        } else {
+            if (op != RB_XOR) out[n++] = a[i];
+            i++;
+            j++;
+        }
+    }
+    if (op != RB_AND) {
+        while (i < x->n) out[n++] = a[i++];
+        while (j < y->n) out[n++] = b[j++];
+    }
+    return n;
+}
+
+/* -----------------------------------------------------------------------------
+ * Bitmap API
+ * -------------------------------------------------------------------------- */
+
+/* 创建空的位图 */
+roaringBitmap *rbNew(void) {
+    roaringBitmap *rb = zmalloc(sizeof(*rb));
+
+    rb->len = 0;
+    rb->count = 0;
+    rb->cap = 0;
+    rb->c = NULL;
+    return rb;
+}
+
+/* 释放位图 */
+void rbFree(roaringBitmap *rb) {
+    uint32_t j;
+
+    for (j = 0; j < rb->count; j++) zfree(rb->c[j].data);
+    zfree(rb->c);
+    zfree(rb);
+}
+
+/* 复制位图 */
+roaringBitmap *rbDup(roaringBitmap *rb) {
+    roaringBitmap *d = rbNew();
+    uint32_t j;
+
+    d->len = rb->len;
+    d->count = d->cap = rb->count;
+    if (rb->count) {
+        d->c = zmalloc(sizeof(rbContainer)*rb->count);
+        for (j = 0; j < rb->count; j++) rbContainerCopy(&d->c[j],&rb->c[j]);
+    }
+    return d;
+}
+
+/* Return the index of the first container with a key >= 'key'. */
+/* 二分查找第一个key大于等于给定值的容器 */
+static uint32_t rbLowerBound(roaringBitmap *rb, uint32_t key) {
+    uint32_t lo = 0, hi = rb->count;
+
+    while (lo < hi) {
+        uint32_t mid = (lo+hi) >> 1;
+        if (rb->c[mid].key < key) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+/* Append a container to the bitmap, taking ownership of its data. Keys
+ * must be appended in increasing order. */
+/* 在尾部添加容器 */
+static void rbAppendContainer(roaringBitmap *rb, rbContainer *c) {
+    if (rb->count == rb->cap) {
+        rb->cap = rb->cap ? rb->cap*2 : 4;
+        rb->c = zrealloc(rb->c,sizeof(rbContainer)*rb->cap);
+    }
+    rb->c[rb->count++] = *c;
+}
+
+/* 返回pos位置上的位 */
+int rbGetBit(roaringBitmap *rb, uint64_t pos) {
+    uint32_t idx = rbLowerBound(rb,RB_KEY(pos));
+
+    if (pos > RB_MAX_POS) return 0;
+    if (idx == rb->count || rb->c[idx].key != RB_KEY(pos)) return 0;
+    return rbContainerGet(&rb->c[idx],RB_LOW(pos));
+}
+
+/* Set or clear the bit 'pos', growing the length of the string to include
+ * it like SETBIT does. Returns the previous value of the bit. */
+/* 设置pos位置上的位，返回原来的值 */
+int rbSetBit(roaringBitmap *rb, uint64_t pos, int on) {
+    uint32_t key = RB_KEY(pos), v = RB_LOW(pos), idx;
+    rbContainer *c;
+    uint16_t *a;
+    int old;
+
+    assert(pos <= RB_MAX_POS);
+    if ((pos >> 3) >= rb->len) rb->len = (pos >> 3)+1;
+
+    idx = rbLowerBound(rb,key);
+    if (idx == rb->count || rb->c[idx].key != key) {
+        if (!on) return 0;
+        /* Insert an empty ARRAY container. */
+        if (rb->count == rb->cap) {
+            rb->cap = rb->cap ? rb->cap*2 : 4;
+            rb->c = zrealloc(rb->c,sizeof(rbContainer)*rb->cap);
+        }
+        memmove(rb->c+idx+1,rb->c+idx,sizeof(rbContainer)*(rb->count-idx));
+        rb->count++;
+        c = &rb->c[idx];
+        c->key = key;
+        c->type = RB_ARRAY;
+        c->card = c->n = c->cap = 0;
+        c->data = NULL;
+    }
+    c = &rb->c[idx];
+
+    old = rbContainerGet(c,v);
+    if (old == on) return old;
+    if (c->type == RB_RUN)
+        rbContainerConvert(c,c->card > RB_ARRAY_MAX ? RB_BITMAP : RB_ARRAY);
+    if (c->type == RB_ARRAY && on && c->card == RB_ARRAY_MAX)
+        rbContainerConvert(c,RB_BITMAP);
+
+    if (c->type == RB_ARRAY) {
+        uint32_t j;
+
+        if (on) rbContainerReserve(c,c->n+1);
+        a = c->data;
+        j = rbArrayLowerBound(a,c->n,v);
+        if (on) {
+            memmove(a+j+1,a+j,(c->n-j)*2);
+            a[j] = v;
+            c->n++;
+            c->card++;
+        } else {
+            memmove(a+j,a+j+1,(c->n-j-1)*2);
+            c->n--;
+            c->card--;
+        }
+    } else {
+        uint64_t *w = c->data;
+
+        w[v >> 6] ^= 1ULL << (v & 63);
+        if (on) {
+            c->card++;
+        } else {
+            c->card--;
+            if (c->card <= RB_ARRAY_MAX && c->card)
+                rbContainerConvert(c,RB_ARRAY);
+        }
+    }
+
+    /* Containers are never empty. */
+    if (c->card == 0) {
+        zfree(c->data);
+        memmove(rb->c+idx,rb->c+idx+1,sizeof(rbContainer)*(rb->count-idx-1));
+        rb->count--;
+    }
+    return old;
+}
+
+/* Count the set bits from 'start' to 'end' (inclusive). */
+/* 统计start到end位之间被设置的位数 */
+uint64_t rbCount(roaringBitmap *rb, uint64_t start, uint64_t end) {
+    uint32_t skey, ekey, j;
+    uint64_t count = 0;
+
+    if (end > RB_MAX_POS) end = RB_MAX_POS;
+    if (start > end) return 0;
+    skey = RB_KEY(start);
+    ekey = RB_KEY(end);
+    for (j = rbLowerBound(rb,skey); j < rb->count; j++) {
+        rbContainer *c = &rb->c[j];
+        if (c->key > ekey) break;
+        count += rbContainerCount(c,
+            c->key == skey ? RB_LOW(start) : 0,
+            c->key == ekey ? RB_LOW(end) : 65535);
+    }
+    return count;
+}
+
+/* Return the position of the first bit with value 'bit' from 'start' to
+ * 'end' (inclusive), or -1 if there is none. */
+/* 返回start到end位之间第一个值为bit的位置 */
+int64_t rbFirst(roaringBitmap *rb, int bit, uint64_t start, uint64_t end) {
+    uint64_t pos = start;
+    uint32_t j;
+
+    if (end > RB_MAX_POS) end = RB_MAX_POS;
+    if (start > end) return -1;
+    for (j = rbLowerBound(rb,RB_KEY(start)); j < rb->count; j++) {
+        rbContainer *c = &rb->c[j];
+        uint64_t base = (uint64_t)c->key << 16;
+        uint32_t v;
+
+        if (base > end) break;
+        if (!bit && pos < base) break; /* 'pos' is in a gap of zeroes. */
+        v = rbContainerNext(c,pos > base ? pos-base : 0,bit);
+        if (v < 65536) {
+            pos = base+v;
+            return pos <= end ? (int64_t)pos : -1;
+        }
+        pos = base+65536;
+    }
+    if (bit || pos > end) return -1;
+    return pos;
+}
+
+/* Store in 'dst' the AND, OR or XOR of 'dst' and 'src'. Like BITOP the
+ * length of the result is the longest of the two. */
+/* 将dst与src的运算结果保存到dst中 */
+void rbOp(roaringBitmap *dst, roaringBitmap *src, int op) {
+    uint64_t wa[RB_BITMAP_WORDS], wb[RB_BITMAP_WORDS];
+    uint16_t merged[RB_ARRAY_MAX*2];
+    rbContainer *res = NULL, *x, *y;
+    uint32_t total = dst->count+src->count, i = 0, j = 0, n = 0, k;
+
+    if (total) res = zmalloc(sizeof(rbContainer)*total);
+    while (i < dst->count || j < src->count) {
+        x = (i < dst->count) ? &dst->c[i] : NULL;
+        y = (j < src->count) ? &src->c[j] : NULL;
+        if (y == NULL || (x && x->key < y->key)) {
+            if (op == RB_AND) zfree(x->data);
+            else res[n++] = *x;
+            i++;
+            continue;
+        }
+        if (x == NULL || y->key < x->key) {
+            if (op != RB_AND) rbContainerCopy(&res[n++],y);
+            j++;
+            continue;
+        }
+
+        res[n].key = x->key;
+        res[n].data = NULL;
+        if (x->type == RB_ARRAY && y->type == RB_ARRAY) {
+            /* Sparse containers are merged without expanding them. */
+            uint32_t card = rbArrayOp(x,y,op,merged);
+
+            if (card > RB_ARRAY_MAX) {
+                memset(wa,0,sizeof(wa));
+                for (k = 0; k < card; k++)
+                    wa[merged[k] >> 6] |= 1ULL << (merged[k] & 63);
+                if (rbContainerFromWords(&res[n],wa,-1)) n++;
+            } else if (card) {
+                res[n].type = RB_ARRAY;
+                res[n].card = res[n].n = res[n].cap = card;
+                res[n].data = zmalloc((size_t)card*2);
+                memcpy(res[n].data,merged,(size_t)card*2);
+                n++;
+            }
+        } else {
+            rbContainerToWords(x,wa);
+            rbContainerToWords(y,wb);
+            for (k = 0; k < RB_BITMAP_WORDS; k++) {
+                switch(op) {
+                case RB_AND: wa[k] &= wb[k]; break;
+                case RB_OR: wa[k] |= wb[k]; break;
+                case RB_XOR: wa[k] ^= wb[k]; break;
+                }
+            }
+            if (rbContainerFromWords(&res[n],wa,-1)) n++;
+        }
+        zfree(x->data);
+        i++;
+        j++;
+    }
+    zfree(dst->c);
+    dst->c = res;
+    dst->count = n;
+    dst->cap = total;
+    if (src->len > dst->len) dst->len = src->len;
+}
+
+/* Flip the first len*8 bits, like BITOP NOT does on the string. The gaps
+ * between containers become full RUN containers of a single run. */
+/* 对len*8个位取反 */
+void rbNot(roaringBitmap *rb) {
+    uint64_t w[RB_BITMAP_WORDS];
+    uint64_t last;
+    uint32_t lastkey, key, i = 0, n = 0;
+    rbContainer *res;
+
+    if (rb->len == 0) return;
+    last = (uint64_t)rb->len*8-1;
+    if (last > RB_MAX_POS) last = RB_MAX_POS;
+    lastkey = RB_KEY(last);
+    res = zmalloc(sizeof(rbContainer)*(lastkey+1));
+    for (key = 0; key <= lastkey; key++) {
+        uint32_t k;
+
+        res[n].key = key;
+        res[n].data = NULL;
+        if (i < rb->count && rb->c[i].key == key) {
+            rbContainerToWords(&rb->c[i],w);
+            zfree(rb->c[i].data);
+            i++;
+        } else if (key != lastkey) {
+            uint16_t *a = zmalloc(4);
+
+            a[0] = 0;
+            a[1] = 65535;
+            res[n].type = RB_RUN;
+            res[n].card = 65536;
+            res[n].n = res[n].cap = 1;
+            res[n].data = a;
+            n++;
+            continue;
+        } else {
+            memset(w,0,sizeof(w));
+        }
+        for (k = 0; k < RB_BITMAP_WORDS; k++) w[k] = ~w[k];
+        if (key == lastkey && RB_LOW(last) != 65535) {
+            /* Clear the bits past the end of the string. */
+            uint32_t from = RB_LOW(last)+1;
+
+            w[from >> 6] &= ~(~0ULL << (from & 63));
+            for (k = (from >> 6)+1; k < RB_BITMAP_WORDS; k++) w[k] = 0;
+        }
+        if (rbContainerFromWords(&res[n],w,-1)) n++;
+    }
+    zfree(rb->c);
+    rb->c = res;
+    rb->count = n;
+    rb->cap = lastkey+1;
+}
+
+/* Write the bytes 'start' to 'start+len-1' of the string the bitmap stands
+ * for to 'buf', that is 'len' bytes long and already zeroed. */
+/* 将字符串中从start开始的len个字节写入buf中 */
+void rbToBytes(roaringBitmap *rb, unsigned char *buf, size_t start, size_t len) {
+    uint64_t w[RB_BITMAP_WORDS];
+    uint32_t j, k, b;
+
+    if (len == 0) return;
+    for (j = rbLowerBound(rb,RB_KEY((uint64_t)start*8)); j < rb->count; j++) {
+        rbContainer *c = &rb->c[j];
+        size_t base = (size_t)c->key << 13;
+
+        if (base >= start+len) break;
+        if (c->type == RB_ARRAY) {
+            uint16_t *a = c->data;
+            for (k = 0; k < c->n; k++) {
+                size_t off = base + (a[k] >> 3);
+                if (off >= start && off < start+len)
+                    buf[off-start] |= 1 << (7 - (a[k] & 7));
+            }
+            continue;
+        }
+        rbContainerToWords(c,w);
+        for (k = 0; k < RB_BITMAP_WORDS; k++) {
+            if (w[k] == 0) continue;
+            for (b = 0; b < 8; b++) {
+                size_t off = base + k*8 + b;
+                unsigned char byte = (w[k] >> (b*8)) & 0xff;
+                if (byte && off >= start && off < start+len)
+                    buf[off-start] = rbReverseByte(byte);
+            }
+        }
+    }
+}
+
+/* Create the bitmap of the 'len' bytes string 'p'. */
+/* 根据字符串创建位图 */
+roaringBitmap *rbFromBytes(unsigned char *p, size_t len) {
+    roaringBitmap *rb = rbNew();
+    uint64_t w[RB_BITMAP_WORDS];
+    size_t start, j;
+    rbContainer c;
+
+    rb->len = len;
+    for (start = 0; start < len; start += RB_BITMAP_BYTES) {
+        size_t chunk = len-start;
+        int empty = 1;
+
+        if (chunk > RB_BITMAP_BYTES) chunk = RB_BITMAP_BYTES;
+        memset(w,0,sizeof(w));
+        for (j = 0; j < chunk; j++) {
+            if (p[start+j] == 0) continue;
+            w[j >> 3] |= (uint64_t)rbReverseByte(p[start+j]) << ((j & 7)*8);
+            empty = 0;
+        }
+        if (empty) continue;
+        c.key = start / RB_BITMAP_BYTES;
+        c.data = NULL;
+        rbContainerFromWords(&c,w,-1);
+        rbAppendContainer(rb,&c);
+    }
+    return rb;
+}
+
+/* -----------------------------------------------------------------------------
+ * Serialization
+ *
+ * <len:4><count:4> followed by every container as <key:2><type:1><n:4> and
+ * its data: 'n' values for ARRAY, 'n' (start,length-1) pairs for RUN, and
+ * the 1024 words for BITMAP, where 'n' is the number of set bits. Every
+ * integer is little endian.
+ * -------------------------------------------------------------------------- */
+
+/* 序列化后的字节数 */
+size_t rbBlobLen(roaringBitmap *rb) {
+    size_t len = RB_BLOB_HDR;
+    uint32_t j;
+
+    for (j = 0; j < rb->count; j++)
+        len += RB_BLOB_CONTAINER_HDR + rbContainerDataLen(&rb->c[j]);
+    return len;
+}
+
+/* Serialize the bitmap to 'buf', that is rbBlobLen() bytes long. */
+/* 序列化到buf中 */
+void rbSerialize(roaringBitmap *rb, unsigned char *buf) {
+    uint32_t u32, j, k;
+    uint16_t u16;
+
+    u32 = intrev32ifbe((uint32_t)rb->len);
+    memcpy(buf,&u32,4);
+    u32 = intrev32ifbe(rb->count);
+    memcpy(buf+4,&u32,4);
+    buf += RB_BLOB_HDR;
+    for (j = 0; j < rb->count; j++) {
+        rbContainer *c = &rb->c[j];
+        size_t len = rbContainerDataLen(c);
+
+        u16 = intrev16ifbe(c->key);
+        memcpy(buf,&u16,2);
+        buf[2] = c->type;
+        u32 = intrev32ifbe(c->type == RB_BITMAP ? c->card : c->n);
+        memcpy(buf+3,&u32,4);
+        buf += RB_BLOB_CONTAINER_HDR;
+        memcpy(buf,c->data,len);
+#if (BYTE_ORDER != LITTLE_ENDIAN)
+        if (c->type == RB_BITMAP) {
+            for (k = 0; k < RB_BITMAP_WORDS; k++) memrev64(buf+k*8);
+        } else {
+            for (k = 0; k < len/2; k++) memrev16(buf+k*2);
+        }
+#else
+        (void)k;
+#endif
+        buf += len;
+    }
+}
+
+/* Load a bitmap serialized by rbSerialize(), checking that the blob is
+ * well formed, so that a corrupted one can't break the invariants the
+ * other functions rely on. Returns NULL on error. */
+/* 反序列化，数据不合法时返回NULL */
+roaringBitmap *rbDeserialize(unsigned char *buf, size_t len) {
+    roaringBitmap *rb;
+    uint32_t u32, count, j, k;
+    uint16_t u16;
+    int64_t prevkey = -1;
+    uint64_t maxpos = 0;
+
+    if (len < RB_BLOB_HDR) return NULL;
+    rb = rbNew();
+    memcpy(&u32,buf,4);
+    rb->len = intrev32ifbe(u32);
+    memcpy(&u32,buf+4,4);
+    count = intrev32ifbe(u32);
+    buf += RB_BLOB_HDR;
+    len -= RB_BLOB_HDR;
+
+    for (j = 0; j < count; j++) {
+        rbContainer c;
+        size_t dlen;
+        uint16_t *a;
+        uint32_t card = 0;
+
+        if (len < RB_BLOB_CONTAINER_HDR) goto err;
+        memcpy(&u16,buf,2);
+        c.key = intrev16ifbe(u16);
+        c.type = buf[2];
+        memcpy(&u32,buf+3,4);
+        c.n = intrev32ifbe(u32);
+        buf += RB_BLOB_CONTAINER_HDR;
+        len -= RB_BLOB_CONTAINER_HDR;
+        if ((int64_t)c.key <= prevkey || c.n == 0) goto err;
+        if (c.type == RB_ARRAY && c.n > RB_ARRAY_MAX) goto err;
+        if (c.type == RB_RUN && c.n > 32768) goto err;
+        if (c.type == RB_BITMAP) {
+            if (c.n > 65536) goto err;
+            c.card = c.n;
+            c.n = 0;
+        } else if (c.type != RB_ARRAY && c.type != RB_RUN) {
+            goto err;
+        }
+        dlen = rbContainerDataLen(&c);
+        if (len < dlen) goto err;
+        c.cap = c.n;
+        c.data = zmalloc(dlen);
+        memcpy(c.data,buf,dlen);
+        buf += dlen;
+        len -= dlen;
+        rbAppendContainer(rb,&c);
+        prevkey = c.key;
+
+        a = c.data;
+        if (c.type == RB_BITMAP) {
+            uint64_t *w = c.data;
+            for (k = 0; k < RB_BITMAP_WORDS; k++) {
+                memrev64ifbe(w+k);
+                card += __builtin_popcountll(w[k]);
+            }
+            if (card != c.card) goto err;
+            for (k = RB_BITMAP_WORDS; w[k-1] == 0; k--);
+            maxpos = ((uint64_t)c.key << 16) + (k << 6) - 1 -
+                     __builtin_clzll(w[k-1]);
+        } else if (c.type == RB_ARRAY) {
+            for (k = 0; k < c.n; k++) {
+                memrev16ifbe(a+k);
+                if (k && a[k] <= a[k-1]) goto err;
+            }
+            c.card = c.n;
+            maxpos = ((uint64_t)c.key << 16) + a[c.n-1];
+        } else {
+            for (k = 0; k < c.n*2; k++) memrev16ifbe(a+k);
+            for (k = 0; k < c.n; k++) {
+                if ((uint32_t)a[k*2]+a[k*2+1] > 65535) goto err;
+                if (k && a[k*2] <= (uint32_t)a[k*2-2]+a[k*2-1]+1) goto err;
+                card += a[k*2+1]+1;
+            }
+            c.card = card;
+            maxpos = ((uint64_t)c.key << 16) + a[c.n*2-2] + a[c.n*2-1];
+        }
+        rb->c[rb->count-1].card = c.card;
+    }
+    if (len != 0) goto err;
+    if (rb->count && (maxpos >> 3) >= rb->len) goto err;
+    return rb;
+
+err:
+    rbFree(rb);
+    return NULL;
+}
+
+#ifdef ROARING_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include "testhelp.h"
+
+/* The reference model is the string itself. */
+#define MODEL_BYTES (1<<20)
+
+static int modelGet(unsigned char *m, uint64_t pos) {
+    return (m[pos >> 3] >> (7 - (pos & 7))) & 1;
+}
+
+static void modelSet(unsigned char *m, uint64_t pos, int on) {
+    if (on) m[pos >> 3] |= 1 << (7 - (pos & 7));
+    else m[pos >> 3] &= ~(1 << (7 - (pos & 7)));
+}
+
+/* Check the invariants of the containers, and that the bitmap is the
+ * string 'm' of 'len' bytes. Returns 1 if they all hold. */
+static int checkBitmap(roaringBitmap *rb, unsigned char *m, size_t len) {
+    unsigned char *buf = calloc(rb->len+1,1);
+    roaringBitmap *copy;
+    uint32_t j;
+    int ok = rb->len == len;
+
+    for (j = 0; ok && j < rb->count; j++) {
+        uint64_t w[RB_BITMAP_WORDS];
+        rbContainer *c = &rb->c[j];
+
+        ok = c->card > 0 && (j == 0 || c->key > rb->c[j-1].key);
+        if (c->type == RB_ARRAY)
+            ok = ok && c->card == c->n && c->n <= RB_ARRAY_MAX;
+        rbContainerToWords(c,w);
+        ok = ok && rbWordsCount(w,0,65535) == c->card;
+    }
+    if (ok) {
+        rbToBytes(rb,buf,0,rb->len);
+        ok = memcmp(buf,m,len) == 0;
+    }
+
+    /* The serialized form loads back to the same string. */
+    if (ok) {
+        size_t blen = rbBlobLen(rb);
+        unsigned char *blob = malloc(blen);
+
+        rbSerialize(rb,blob);
+        copy = rbDeserialize(blob,blen);
+        if (copy != NULL) {
+            memset(buf,0,rb->len);
+            rbToBytes(copy,buf,0,copy->len);
+            ok = memcmp(buf,m,len) == 0;
+            rbFree(copy);
+        } else {
+            ok = 0;
+        }
+        if (blen > RB_BLOB_HDR && (copy = rbDeserialize(blob,blen-1)) != NULL) {
+            rbFree(copy);
+            ok = 0;
+        }
+        free(blob);
+    }
+    free(buf);
+    return ok;
+}
+
+static uint64_t randomPos(int dense) {
+    uint64_t range = dense ? 70000 : (uint64_t)MODEL_BYTES*8;
+    return (uint64_t)rand() % range;
+}
+
+static size_t modelLen(size_t len, uint64_t pos) {
+    return (pos >> 3) >= len ? (pos >> 3)+1 : len;
+}
+
+int main(void) {
+    unsigned char *m = calloc(MODEL_BYTES,1), *m2 = calloc(MODEL_BYTES,1);
+    roaringBitmap *rb, *rb2;
+    size_t len = 0, len2 = 0;
+    int iter, j, ok;
+
+    /* SETBIT / GETBIT with sparse, dense and run-shaped patterns. */
+    rb = rbNew();
+    ok = 1;
+    for (iter = 0; iter < 200000; iter++) {
+        int dense = (iter / 20000) % 2;
+        uint64_t pos = randomPos(dense);
+        int on = rand() % (dense ? 3 : 4) != 0;
+
+        if (rbSetBit(rb,pos,on) != modelGet(m,pos)) ok = 0;
+        modelSet(m,pos,on);
+        len = modelLen(len,pos);
+        if (rbGetBit(rb,pos) != on) ok = 0;
+    }
+    test_cond("SETBIT and GETBIT", ok && checkBitmap(rb,m,len));
+
+    /* COUNT and FIRST on random ranges. */
+    ok = 1;
+    for (iter = 0; iter < 2000; iter++) {
+        uint64_t s = randomPos(iter % 2), e = s + rand() % 200000, p;
+        uint64_t count = 0;
+        int64_t first1 = -1, first0 = -1;
+
+        if (e >= len*8) e = len*8-1;
+        for (p = s; p <= e && s <= e; p++) {
+            int b = modelGet(m,p);
+            count += b;
+            if (b && first1 == -1) first1 = p;
+            if (!b && first0 == -1) first0 = p;
+        }
+        if (rbCount(rb,s,e) != count || rbFirst(rb,1,s,e) != first1 ||
+            rbFirst(rb,0,s,e) != first0) ok = 0;
+    }
+    test_cond("BITCOUNT and BITPOS on random ranges", ok);
+
+    /* Byte ranges of the string. */
+    ok = 1;
+    for (iter = 0; iter < 200; iter++) {
+        size_t s = rand() % len, n = rand() % 20000;
+        unsigned char *buf;
+
+        if (s+n > len) n = len-s;
+        buf = calloc(n+1,1);
+        rbToBytes(rb,buf,s,n);
+        if (memcmp(buf,m+s,n) != 0) ok = 0;
+        free(buf);
+    }
+    test_cond("Byte ranges of the string", ok);
+
+    /* Binary operations, against a second bitmap built from its bytes. */
+    for (j = 0; j < 20000; j++) {
+        uint64_t pos = randomPos(j % 3 == 0);
+        modelSet(m2,pos,1);
+        len2 = modelLen(len2,pos);
+    }
+    for (j = 0; j < 3; j++) {
+        /* A long run, to have RUN containers in both bitmaps. */
+        uint64_t s = randomPos(0), p;
+        for (p = s; p < s+150000 && p < (uint64_t)MODEL_BYTES*8; p++) {
+            modelSet(m2,p,1);
+            len2 = modelLen(len2,p);
+        }
+    }
+    rb2 = rbFromBytes(m2,len2);
+    test_cond("Bitmap built from a string", checkBitmap(rb2,m2,len2));
+
+    {
+        char *names[] = {"AND", "OR", "XOR"};
+        char descr[64];
+        int op;
+        for (op = RB_AND; op <= RB_XOR; op++) {
+            roaringBitmap *r = rbDup(rb);
+            unsigned char *exp = calloc(MODEL_BYTES,1);
+            size_t k, rlen = len > len2 ? len : len2;
+
+            for (k = 0; k < rlen; k++) {
+                switch(op) {
+                case RB_AND: exp[k] = m[k] & m2[k]; break;
+                case RB_OR: exp[k] = m[k] | m2[k]; break;
+                case RB_XOR: exp[k] = m[k] ^ m2[k]; break;
+                }
+            }
+            rbOp(r,rb2,op);
+            snprintf(descr,sizeof(descr),"BITOP %s",names[op-RB_AND]);
+            test_cond(descr,checkBitmap(r,exp,rlen));
+            rbFree(r);
+            free(exp);
+        }
+    }
+
+    /* NOT, twice. */
+    rbNot(rb2);
+    for (j = 0; j < (int)len2; j++) m2[j] = ~m2[j];
+    test_cond("BITOP NOT", checkBitmap(rb2,m2,len2));
+    rbNot(rb2);
+    for (j = 0; j < (int)len2; j++) m2[j] = ~m2[j];
+    test_cond("BITOP NOT twice", checkBitmap(rb2,m2,len2));
+
+    /* SETBIT on RUN containers turns them back into arrays or bitmaps. */
+    ok = 1;
+    for (iter = 0; iter < 20000; iter++) {
+        uint64_t pos = randomPos(0) % (len2*8);
+        int on = rand() % 2;
+
+        if (rbSetBit(rb2,pos,on) != modelGet(m2,pos)) ok = 0;
+        modelSet(m2,pos,on);
+    }
+    test_cond("SETBIT on RUN containers", ok && checkBitmap(rb2,m2,len2));
+
+    /* A single bit at the highest offset SETBIT accepts. */
+    {
+        roaringBitmap *r = rbNew();
+        uint64_t pos = RB_MAX_POS;
+
+        rbSetBit(r,pos,1);
+        test_cond("SETBIT at the highest offset",
+            r->len == (pos >> 3)+1 && r->count == 1 &&
+            rbCount(r,0,pos) == 1 && rbFirst(r,1,0,pos) == (int64_t)pos &&
+            rbFirst(r,0,pos,pos) == -1);
+        rbSetBit(r,pos,0);
+        test_cond("Clearing it leaves no container",
+            r->count == 0 && rbFirst(r,1,0,pos) == -1);
+        rbFree(r);
+    }
+
+    rbFree(rb);
+    rbFree(rb2);
+    free(m);
+    free(m2);
+    test_report();
+    return 0;
+}
+#endif
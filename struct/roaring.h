@@ -0,0 +1,93 @@
+/* roaring.h - A compressed bitmap for sparse SETBIT strings
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ROARING_H
+#define __ROARING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Container types. An ARRAY holds the sorted low 16 bits of up to
+ * RB_ARRAY_MAX set bits, a BITMAP is a plain 65536 bits array, a RUN holds
+ * sorted (start, length-1) pairs of consecutive set bits. */
+/* 容器类型：有序数组、位图、连续区间 */
+#define RB_ARRAY 0
+#define RB_BITMAP 1
+#define RB_RUN 2
+
+#define RB_ARRAY_MAX 4096
+#define RB_BITMAP_WORDS 1024
+
+/* 二元运算类型 */
+#define RB_AND 0
+#define RB_OR 1
+#define RB_XOR 2
+
+/* A container holds the bits of the bitmap sharing the same high 16 bits
+ * 'key'. 'card' is the number of set bits, 'n' the number of used entries
+ * of 'data' (values for ARRAY, pairs for RUN) and 'cap' its allocated
+ * size in entries. Containers are never empty. */
+/* 容器，保存高16位相同的所有位 */
+typedef struct rbContainer {
+    uint16_t key;
+    uint8_t type;
+    uint32_t card;
+    uint32_t n;
+    uint32_t cap;
+    void *data;
+} rbContainer;
+
+/* 'len' is the length in bytes of the string the bitmap stands for, that
+ * is never shorter than the byte holding the highest set bit. The
+ * containers are sorted by key. */
+/* roaring位图，len为对应字符串的字节长度 */
+typedef struct roaringBitmap {
+    size_t len;
+    uint32_t count;
+    uint32_t cap;
+    rbContainer *c;
+} roaringBitmap;
+
+roaringBitmap *rbNew(void); //创建空的位图
+void rbFree(roaringBitmap *rb); //释放位图
+roaringBitmap *rbDup(roaringBitmap *rb);    //复制位图
+int rbGetBit(roaringBitmap *rb, uint64_t pos);  //返回pos位置上的位
+int rbSetBit(roaringBitmap *rb, uint64_t pos, int on);  //设置pos位置上的位，返回原来的值
+uint64_t rbCount(roaringBitmap *rb, uint64_t start, uint64_t end);  //统计start到end位之间被设置的位数
+int64_t rbFirst(roaringBitmap *rb, int bit, uint64_t start, uint64_t end);  //返回start到end位之间第一个值为bit的位置，不存在时返回-1
+void rbOp(roaringBitmap *dst, roaringBitmap *src, int op);  //将dst与src的AND、OR、XOR结果保存到dst中
+void rbNot(roaringBitmap *rb);  //对len*8个位取反
+void rbToBytes(roaringBitmap *rb, unsigned char *buf, size_t start, size_t len);  //将字符串中从start开始的len个字节写入已经清零的buf中
+roaringBitmap *rbFromBytes(unsigned char *p, size_t len);   //根据字符串创建位图
+size_t rbBlobLen(roaringBitmap *rb);    //序列化后的字节数
+void rbSerialize(roaringBitmap *rb, unsigned char *buf);    //序列化到buf中
+roaringBitmap *rbDeserialize(unsigned char *buf, size_t len);   //反序列化，数据不合法时返回NULL
+
+#endif
@@ -33,9 +33,45 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include "sds.h"
 #include "zmalloc.h"
 
+/* Return the size of the header of the given type. */
+/* 返回指定类型的头部大小 */
+static inline int sdsHdrSize(char type) {
+    switch(type & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return sizeof(struct sdshdr8);
+    case SDS_TYPE_16: return sizeof(struct sdshdr16);
+    case SDS_TYPE_32: return sizeof(struct sdshdr32);
+    default: return sizeof(struct sdshdr64);
+    }
+}
+
+/* Return the smallest header type able to hold 'size' bytes. */
+/* 返回能够保存size个字节的最小的头部类型 */
+static inline char sdsReqType(size_t size) {
+    if (size < 1<<8) return SDS_TYPE_8;
+    if (size < 1<<16) return SDS_TYPE_16;
+#if (LONG_MAX == LLONG_MAX)
+    if (size < 1ll<<32) return SDS_TYPE_32;
+    return SDS_TYPE_64;
+#else
+    return SDS_TYPE_32;
+#endif
+}
+
+/* Set the allocated size of the string, that must fit in its header. */
+/* 设置字符串分配的空间 */
+static inline void sdsSetAlloc(sds s, size_t newlen) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->alloc = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->alloc = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->alloc = newlen; break;
+    default: SDS_HDR(64,s)->alloc = newlen; break;
+    }
+}
+
 /* Create a new sds string with the content specified by the 'init' pointer
  * and 'initlen'.
  * If NULL is used for 'init' the string is initialized with zero bytes.
@@ -50,23 +86,28 @@
  * \0 characters in the middle, as the length is stored in the sds header. */
 /* 创建新字符串方法，传入目标长度，初始化方法 */
 sds sdsnewlen(const void *init, size_t initlen) {
-    struct sdshdr *sh;
+    char type = sdsReqType(initlen);
+    int hdrlen = sdsHdrSize(type);
+    unsigned char *sh;
+    sds s;
 
     if (init) {
-        sh = zmalloc(sizeof(struct sdshdr)+initlen+1);
+        sh = zmalloc(hdrlen+initlen+1);
     } else {
     	//当init函数为NULL时候，又来了zcalloc的方法
-        sh = zcalloc(sizeof(struct sdshdr)+initlen+1);
+        sh = zcalloc(hdrlen+initlen+1);
     }
     if (sh == NULL) return NULL;
-    sh->len = initlen;
-    sh->free = 0;
+    s = (char*)sh+hdrlen;
+    s[-1] = type;
+    sdssetlen(s, initlen);
+    sdsSetAlloc(s, initlen);
     if (initlen && init)
-        memcpy(sh->buf, init, initlen);
+        memcpy(s, init, initlen);
    //最末端同样要加‘\0’结束符
-    sh->buf[initlen] = '\0';
-    //最后是通过返回字符串结构体中的buf代表新的字符串
-    return (char*)sh->buf;
+    s[initlen] = '\0';
+    //最后是通过返回头部之后的buf代表新的字符串
+    return s;
 }
 
 /* Create an empty (zero length) sds string. Even in this case the string
@@ -93,7 +134,7 @@ sds sdsdup(const sds s) {
 /* 释放字符串的空间 */
 void sdsfree(sds s) {
     if (s == NULL) return;
-    zfree(s-sizeof(struct sdshdr));
+    zfree((char*)s-sdsHdrSize(s[-1]));
 }
 
 /* Set the sds string length to the length as obtained with strlen(), so
@@ -112,10 +153,8 @@ void sdsfree(sds s) {
  * remains 6 bytes. */
 /* 更新字符串的长度，当字符串被"\0"这种字符分断时候，逻辑长度不变 */
 void sdsupdatelen(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    int reallen = strlen(s);
-    sh->free += (sh->len-reallen);
-    sh->len = reallen;
+    size_t reallen = strlen(s);
+    sdssetlen(s, reallen);
 }
 
 /* Modify an sds string on-place to make it empty (zero length).
@@ -124,12 +163,10 @@ void sdsupdatelen(sds s) {
  * number of bytes previously available. */
 /* 清空字符串 */
 void sdsclear(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    //空闲的长度增多
-    sh->free += sh->len;
-    sh->len = 0;
+    //长度置0，分配的空间不变，空闲的长度增多
+    sdssetlen(s, 0);
     //字符串中的缓存其实没有被丢底，只是把第一个设成了结束标志，以便下次操作可以复用
-    sh->buf[0] = '\0';
+    s[0] = '\0';
 }
 
 /* Enlarge the free space at the end of the sds string so that the caller
@@ -137,31 +174,52 @@ void sdsclear(sds s) {
  * bytes after the end of the string, plus one more byte for nul term.
  *
  * Note: this does not change the *length* of the sds string as returned
- * by sdslen(), but only the free buffer space we have. */
+ * by sdslen(), but only the free buffer space we have.
+ *
+ * When the new size does not fit the current header type the string is
+ * moved to a new allocation with a larger header. */
 /* 在原有字符串中取得更大的空间，并返回扩展空间后的字符串 */
 sds sdsMakeRoomFor(sds s, size_t addlen) {
-    struct sdshdr *sh, *newsh;
+    void *sh, *newsh;
     //获取当前字符串的可用长度
-    size_t free = sdsavail(s);
+    size_t avail = sdsavail(s);
     size_t len, newlen;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen;
 
 	//如果当前可用空间已经大于需要值，直接返回原字符串
-    if (free >= addlen) return s;
+    if (avail >= addlen) return s;
     len = sdslen(s);
-    sh = (void*) (s-(sizeof(struct sdshdr)));
+    sh = (char*)s-sdsHdrSize(oldtype);
     //计算要获取新字符串所要的长度大小=原长度+addlen
     newlen = (len+addlen);
     if (newlen < SDS_MAX_PREALLOC)
         newlen *= 2;
     else
         newlen += SDS_MAX_PREALLOC;
-    newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1);
-    if (newsh == NULL) return NULL;
 
-	//新字符串可用空间等于新长度减去原使用的长度
-    newsh->free = newlen - len;
-    //返回洗字符串中的buf字符串数组
-    return newsh->buf;
+    type = sdsReqType(newlen);
+    hdrlen = sdsHdrSize(type);
+    if (oldtype == type) {
+        //头部类型不变，直接realloc
+        newsh = zrealloc(sh, hdrlen+newlen+1);
+        if (newsh == NULL) return NULL;
+        s = (char*)newsh+hdrlen;
+    } else {
+        /* The header grows, so the string has to move forward: a realloc
+         * would copy it once and memmove would copy it again. */
+        //头部变大，字符串的位置改变，重新分配空间并复制字符串
+        newsh = zmalloc(hdrlen+newlen+1);
+        if (newsh == NULL) return NULL;
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = (char*)newsh+hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
+	//记录新的分配空间
+    sdsSetAlloc(s, newlen);
+    return s;
 }
 
 /* Reallocate the sds string so that it has no free space at the end. The
@@ -172,15 +230,32 @@ sds sdsMakeRoomFor(sds s, size_t addlen) {
  * references must be substituted with the new pointer returned by the call. */
 /* 移除字符串中的空闲空间 */
 sds sdsRemoveFreeSpace(sds s) {
-    struct sdshdr *sh;
-	//将字符串转成字符串结构进行操作
-    sh = (void*) (s-(sizeof(struct sdshdr)));
-    //长度重新计算了
-    sh = zrealloc(sh, sizeof(struct sdshdr)+sh->len+1);
-    
-    //free数量重新变为0
-    sh->free = 0;
-    return sh->buf;
+    void *sh, *newsh;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen, oldhdrlen = sdsHdrSize(oldtype);
+    size_t len = sdslen(s);
+
+    sh = (char*)s-oldhdrlen;
+    type = sdsReqType(len);
+    hdrlen = sdsHdrSize(type);
+    if (oldtype == type) {
+        //头部类型不变，直接realloc到实际长度
+        newsh = zrealloc(sh, oldhdrlen+len+1);
+        if (newsh == NULL) return NULL;
+        s = (char*)newsh+oldhdrlen;
+    } else {
+        //字符串变短后可以使用更小的头部，重新分配空间并复制字符串
+        newsh = zmalloc(hdrlen+len+1);
+        if (newsh == NULL) return NULL;
+        memcpy((char*)newsh+hdrlen, s, len+1);
+        zfree(sh);
+        s = (char*)newsh+hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
+    //分配的空间等于长度，空闲空间重新变为0
+    sdsSetAlloc(s, len);
+    return s;
 }
 
 /* Return the total size of the allocation of the specifed sds string,
@@ -193,9 +268,14 @@ sds sdsRemoveFreeSpace(sds s) {
 /* 返回字符串的总大小包括
  * 1.字符串指针头部 2.字符串正在使用的长度3.字符串空闲的buffer长度4.末尾的空值 */
 size_t sdsAllocSize(sds s) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+    return sdsHdrSize(s[-1])+sdsalloc(s)+1;
+}
 
-    return sizeof(*sh)+sh->len+sh->free+1;
+/* Return the pointer of the actual allocation of the sds string, that is
+ * the start of its header. */
+/* 返回字符串实际分配的内存的起始地址，即头部的地址 */
+void *sdsAllocPtr(const sds s) {
+    return (void*) (s-sdsHdrSize(s[-1]));
 }
 
 /* Increment the sds length and decrements the left free space at the
@@ -223,15 +303,15 @@ size_t sdsAllocSize(sds s) {
  */
 /* 改变字符串中的长度以使用量的使用情况数值 */
 void sdsIncrLen(sds s, int incr) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+    size_t len = sdslen(s);
 
     if (incr >= 0)
-        assert(sh->free >= (unsigned int)incr);
+        assert(sdsavail(s) >= (unsigned int)incr);
     else
-        assert(sh->len >= (unsigned int)(-incr));
-    sh->len += incr;
-    sh->free -= incr;
-    s[sh->len] = '\0';
+        assert(len >= (unsigned int)(-incr));
+    len += incr;
+    sdssetlen(s, len);
+    s[len] = '\0';
 }
 
 /* Grow the sds to have the specified length. Bytes that were not part of
@@ -241,8 +321,7 @@ void sdsIncrLen(sds s, int incr) {
  * is performed. */
 /* 扩展字符串到指定的长度 */
 sds sdsgrowzero(sds s, size_t len) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    size_t totlen, curlen = sh->len;
+    size_t curlen = sdslen(s);
 
 	//如果当前长度已经大于要求长度，直接返回
     if (len <= curlen) return s;
@@ -252,11 +331,8 @@ sds sdsgrowzero(sds s, size_t len) {
 
     /* Make sure added region doesn't contain garbage */
     //确保多余的字符串不包含垃圾数据，置空处理
-    sh = (void*)(s-(sizeof(struct sdshdr)));
     memset(s+curlen,0,(len-curlen+1)); /* also set trailing \0 byte */
-    totlen = sh->len+sh->free;
-    sh->len = len;
-    sh->free = totlen-sh->len;
+    sdssetlen(s, len);
     return s;
 }
 
@@ -267,18 +343,15 @@ sds sdsgrowzero(sds s, size_t len) {
  * references must be substituted with the new pointer returned by the call. */
 /* 以t作为新添加的len长度buf的数据，实现追加操作 */
 sds sdscatlen(sds s, const void *t, size_t len) {
-    struct sdshdr *sh;
     size_t curlen = sdslen(s);
 	
 	//为原字符串扩展len长度空间
     s = sdsMakeRoomFor(s,len);
     if (s == NULL) return NULL;
-    sh = (void*) (s-(sizeof(struct sdshdr)));
     //多余的数据以t作初始化
     memcpy(s+curlen, t, len);
-    //更改相应的len,free值
-    sh->len = curlen+len;
-    sh->free = sh->free-len;
+    //更改相应的len值
+    sdssetlen(s, curlen+len);
     s[curlen+len] = '\0';
     return s;
 }
@@ -305,19 +378,13 @@ sds sdscatsds(sds s, const sds t) {
  * safe string pointed by 't' of length 'len' bytes. */
 /* 将新申请的字符串全部复制为t字符串的值 */
 sds sdscpylen(sds s, const char *t, size_t len) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
-    size_t totlen = sh->free+sh->len;
-
-    if (totlen < len) {
-        s = sdsMakeRoomFor(s,len-sh->len);
+    if (sdsalloc(s) < len) {
+        s = sdsMakeRoomFor(s,len-sdslen(s));
         if (s == NULL) return NULL;
-        sh = (void*) (s-(sizeof(struct sdshdr)));
-        totlen = sh->free+sh->len;
     }
     memcpy(s, t, len);
     s[len] = '\0';
-    sh->len = len;
-    sh->free = totlen-len;
+    sdssetlen(s, len);
     return s;
 }
 
@@ -492,7 +559,6 @@ sds sdscatprintf(sds s, const char *fmt, ...) {
  */
 /* 字符串格式化输出，输入原字符串，格式，参数 */
 sds sdscatfmt(sds s, char const *fmt, ...) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t initlen = sdslen(s);
     const char *f = fmt;
     int i;
@@ -509,9 +575,8 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
         unsigned long long unum;
 
         /* Make sure there is always space for at least 1 char. */
-        if (sh->free == 0) {
+        if (sdsavail(s) == 0) {
             s = sdsMakeRoomFor(s,1);
-            sh = (void*) (s-(sizeof(struct sdshdr)));
         }
 
         switch(*f) {
@@ -525,15 +590,13 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
                 str = va_arg(ap,char*);
             	//判断普通的str,还是sds类型，计算长度的方法不一样
                 l = (next == 's') ? strlen(str) : sdslen(str);
-                if (sh->free < l) {
+                if (sdsavail(s) < l) {
                     s = sdsMakeRoomFor(s,l);
-                    sh = (void*) (s-(sizeof(struct sdshdr)));
                 }
                 //如果是字符串，直接复制到后面
                 memcpy(s+i,str,l);
-                sh->len += l;
-                sh->free -= l;
                 i += l;
+                sdssetlen(s, i);
                 break;
             case 'i':
             case 'I':
@@ -545,14 +608,12 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
                     char buf[SDS_LLSTR_SIZE];
                     //如果是数字，调用添加数值字符串方法
                     l = sdsll2str(buf,num);
-                    if (sh->free < l) {
+                    if (sdsavail(s) < l) {
                         s = sdsMakeRoomFor(s,l);
-                        sh = (void*) (s-(sizeof(struct sdshdr)));
                     }
                     memcpy(s+i,buf,l);
-                    sh->len += l;
-                    sh->free -= l;
                     i += l;
+                    sdssetlen(s, i);
                 }
                 break;
             case 'u':
@@ -565,28 +626,24 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
                 {
                     char buf[SDS_LLSTR_SIZE];
                     l = sdsull2str(buf,unum);
-                    if (sh->free < l) {
+                    if (sdsavail(s) < l) {
                         s = sdsMakeRoomFor(s,l);
-                        sh = (void*) (s-(sizeof(struct sdshdr)));
                     }
                     memcpy(s+i,buf,l);
-                    sh->len += l;
-                    sh->free -= l;
                     i += l;
+                    sdssetlen(s, i);
                 }
                 break;
             default: /* Handle %% and generally %<unknown>. */
                 s[i++] = next;
-                sh->len += 1;
-                sh->free -= 1;
+                sdssetlen(s, i);
                 break;
             }
             break;
         default:
         	//非操作类型，直接单字符添加
             s[i++] = *f;
-            sh->len += 1;
-            sh->free -= 1;
+            sdssetlen(s, i);
             break;
         }
         f++;
@@ -613,7 +670,6 @@ sds sdscatfmt(sds s, char const *fmt, ...) {
  * Output will be just "Hello World".
  */
 sds sdstrim(sds s, const char *cset) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     char *start, *end, *sp, *ep;
     size_t len;
 
@@ -622,10 +678,9 @@ sds sdstrim(sds s, const char *cset) {
     while(sp <= end && strchr(cset, *sp)) sp++;
     while(ep > start && strchr(cset, *ep)) ep--;
     len = (sp > ep) ? 0 : ((ep-sp)+1);
-    if (sh->buf != sp) memmove(sh->buf, sp, len);
-    sh->buf[len] = '\0';
-    sh->free = sh->free+(sh->len-len);
-    sh->len = len;
+    if (s != sp) memmove(s, sp, len);
+    s[len] = '\0';
+    sdssetlen(s, len);
     return s;
 }
 
@@ -646,7 +701,6 @@ sds sdstrim(sds s, const char *cset) {
  * sdsrange(s,1,-1); => "ello World"
  */
 void sdsrange(sds s, int start, int end) {
-    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
     size_t newlen, len = sdslen(s);
 
     if (len == 0) return;
@@ -669,10 +723,9 @@ void sdsrange(sds s, int start, int end) {
     } else {
         start = 0;
     }
-    if (start && newlen) memmove(sh->buf, sh->buf+start, newlen);
-    sh->buf[newlen] = 0;
-    sh->free = sh->free+(sh->len-newlen);
-    sh->len = newlen;
+    if (start && newlen) memmove(s, s+start, newlen);
+    s[newlen] = 0;
+    sdssetlen(s, newlen);
 }
 
 /* Apply tolower() to every character of the sds string 's'. */
@@ -1033,7 +1086,6 @@ sds sdsjoin(char **argv, int argc, char *sep) {
 
 int main(void) {
     {
-        struct sdshdr *sh;
         sds x = sdsnew("foo"), y;
 
         test_cond("Create a string and obtain the length",
@@ -1144,21 +1196,52 @@ int main(void) {
             memcmp(y,"\"\\a\\n\\x00foo\\r\"",15) == 0)
 
         {
-            int oldfree;
+            size_t oldfree;
 
             sdsfree(x);
             x = sdsnew("0");
-            sh = (void*) (x-(sizeof(struct sdshdr)));
-            test_cond("sdsnew() free/len buffers", sh->len == 1 && sh->free == 0);
+            test_cond("sdsnew() free/len buffers",
+                sdslen(x) == 1 && sdsavail(x) == 0);
+            test_cond("sdsnew() header type",
+                (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_8 &&
+                sdsAllocSize(x) == sizeof(struct sdshdr8)+2);
             x = sdsMakeRoomFor(x,1);
-            sh = (void*) (x-(sizeof(struct sdshdr)));
-            test_cond("sdsMakeRoomFor()", sh->len == 1 && sh->free > 0);
-            oldfree = sh->free;
+            test_cond("sdsMakeRoomFor()", sdslen(x) == 1 && sdsavail(x) > 0);
+            oldfree = sdsavail(x);
             x[1] = '1';
             sdsIncrLen(x,1);
             test_cond("sdsIncrLen() -- content", x[0] == '0' && x[1] == '1');
-            test_cond("sdsIncrLen() -- len", sh->len == 2);
-            test_cond("sdsIncrLen() -- free", sh->free == oldfree-1);
+            test_cond("sdsIncrLen() -- len", sdslen(x) == 2);
+            test_cond("sdsIncrLen() -- free", sdsavail(x) == oldfree-1);
+        }
+
+        {
+            int j, ok = 1;
+
+            /* Grow the string across the 8, 16 and 32 bit headers. */
+            sdsfree(x);
+            x = sdsempty();
+            for (j = 0; j < 70000; j++) {
+                char c = 'a'+(j%10);
+
+                x = sdscatlen(x,&c,1);
+                if (sdslen(x) != (size_t)j+1 ||
+                    x[j] != 'a'+(j%10)) ok = 0;
+            }
+            test_cond("sdscatlen() across header types",
+                ok && (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_32 &&
+                sdsalloc(x) >= 70000 && x[70000] == '\0');
+
+            /* Shrink it back to a 16 bit header. */
+            sdsrange(x,0,999);
+            x = sdsRemoveFreeSpace(x);
+            for (j = 0; j < 1000; j++)
+                if (x[j] != 'a'+(j%10)) ok = 0;
+            test_cond("sdsRemoveFreeSpace() shrinks the header",
+                ok && sdslen(x) == 1000 && sdsavail(x) == 0 &&
+                (x[-1] & SDS_TYPE_MASK) == SDS_TYPE_16 &&
+                sdsAllocSize(x) == sizeof(struct sdshdr16)+1001);
+            sdsfree(x);
         }
     }
     test_report()
@@ -36,31 +36,94 @@
 
 #include <sys/types.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 /* 声明了sds的一种char类型 */
 typedef char *sds;
 
-/* 字符串结构体类型 */
-struct sdshdr {
-	//字符长度
-    unsigned int len;
-    //当前可用空间
-    unsigned int free;
-    //具体存放字符的buf
+/* The header is sized to the string: 'len' and 'alloc' (the bytes
+ * allocated for the string, excluding the header and the null term) use
+ * the smallest of 8, 16, 32 or 64 bits able to hold 'alloc'. The byte just
+ * before the string is always 'flags', whose low bits are the type of the
+ * header, so sds functions find the header from the string pointer alone.
+ * The headers are packed: the string is not aligned. */
+/* 字符串头部按长度分为4种，紧挨着buf的flags字节保存头部类型 */
+struct __attribute__ ((__packed__)) sdshdr8 {
+    uint8_t len;        //字符长度
+    uint8_t alloc;      //分配的空间，不包括头部和结束符
+    unsigned char flags; //低2位为头部类型
+    char buf[];         //具体存放字符的buf
+};
+struct __attribute__ ((__packed__)) sdshdr16 {
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32 {
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
     char buf[];
 };
+struct __attribute__ ((__packed__)) sdshdr64 {
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+
+/* 头部类型 */
+#define SDS_TYPE_8  0
+#define SDS_TYPE_16 1
+#define SDS_TYPE_32 2
+#define SDS_TYPE_64 3
+#define SDS_TYPE_MASK 3
+
+/* 根据字符串指针取得头部 */
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
 
 /* 计算sds的长度，返回的size_t类型的数值 */
 /* size_t,它是一个与机器相关的unsigned类型，其大小足以保证存储内存中对象的大小。 */
 static inline size_t sdslen(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    return sh->len;
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->len;
+    default: return SDS_HDR(64,s)->len;
+    }
+}
+
+/* 返回分配给字符串的空间，不包括头部和结束符 */
+static inline size_t sdsalloc(const sds s) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc;
+    default: return SDS_HDR(64,s)->alloc;
+    }
 }
 
-/* 根据sdshdr中的free标记获取可用空间 */
+/* 获取可用空间 */
 static inline size_t sdsavail(const sds s) {
-    struct sdshdr *sh = (void*)(s-(sizeof(struct sdshdr)));
-    return sh->free;
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: return SDS_HDR(8,s)->alloc - SDS_HDR(8,s)->len;
+    case SDS_TYPE_16: return SDS_HDR(16,s)->alloc - SDS_HDR(16,s)->len;
+    case SDS_TYPE_32: return SDS_HDR(32,s)->alloc - SDS_HDR(32,s)->len;
+    default: return SDS_HDR(64,s)->alloc - SDS_HDR(64,s)->len;
+    }
+}
+
+/* Set the length of the string, that must not exceed sdsalloc(). The null
+ * term is not written. */
+/* 设置字符串的长度，不写入结束符 */
+static inline void sdssetlen(sds s, size_t newlen) {
+    switch(s[-1] & SDS_TYPE_MASK) {
+    case SDS_TYPE_8: SDS_HDR(8,s)->len = newlen; break;
+    case SDS_TYPE_16: SDS_HDR(16,s)->len = newlen; break;
+    case SDS_TYPE_32: SDS_HDR(32,s)->len = newlen; break;
+    default: SDS_HDR(64,s)->len = newlen; break;
+    }
 }
 
 sds sdsnewlen(const void *init, size_t initlen);   //根据给定长度，新生出一个sds
@@ -107,5 +170,6 @@ sds sdsMakeRoomFor(sds s, size_t addlen);
 void sdsIncrLen(sds s, int incr);
 sds sdsRemoveFreeSpace(sds s);
 size_t sdsAllocSize(sds s);
+void *sdsAllocPtr(const sds s); //返回包括头部在内的整块内存的起始地址
 
 #endif
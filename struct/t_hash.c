@@ -31,24 +31,24 @@
 #include <math.h>
 
 /* 下面是方法的归类 */
-void hashTypeTryConversion(robj *o, robj **argv, int start, int end) /* 当hashType为ziplist时，判断对象长度是否超出了服务端可接受的ziplist最大长度，超过则转成哈希字典类型*/
+void hashTypeTryConversion(robj *o, robj **argv, int start, int end) /* 当hashType为listpack时，判断对象长度是否超出了服务端可接受的最大长度，超过则转成哈希字典类型*/
 void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2) /* 当robj用的是字典的编码方式的时候，则经过编码转换 */
-int hashTypeGetFromZiplist(robj *o, robj *field,unsigned char **vstr,unsigned int *vlen,long long *vll) /* 获取ziplist压缩列表中的某个索引位置上的值 */
+int hashTypeGetFromListpack(robj *o, robj *field,unsigned char **vstr,unsigned int *vlen,long long *vll) /* 获取listpack中field对应的值 */
 int hashTypeGetFromHashTable(robj *o, robj *field, robj **value) /* 获取哈希字典中的某个值 */
 robj *hashTypeGetObject(robj *o, robj *field) /* 获取某个key对应的对象类型 */
 int hashTypeExists(robj *o, robj *field)   /* hastType类型判断某个键是否存在 */
-int hashTypeSet(robj *o, robj *field, robj *value) /* hashType设置操作，分2种情况，ziplist,和字典hashtable */
-int hashTypeDelete(robj *o, robj *field)  /* hashType删除操作，分为ziplist的删除操作，和hashtable的删除操作 */
+int hashTypeSet(robj *o, robj *field, robj *value) /* hashType设置操作，分2种情况，listpack,和字典hashtable */
+int hashTypeDelete(robj *o, robj *field)  /* hashType删除操作，分为listpack的删除操作，和hashtable的删除操作 */
 unsigned long hashTypeLength(robj *o)   /* hashType求长度操作 */
 hashTypeIterator *hashTypeInitIterator(robj *subject)  /* 获取hashType迭代器 */
 void hashTypeReleaseIterator(hashTypeIterator *hi) /* 释放hashType迭代器 */
 int hashTypeNext(hashTypeIterator *hi) /* 通过hashType迭代器获取下一个元素 */
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,unsigned char **vstr,unsigned int *vlen,long long *vll) /* 根据当前迭代器的位置，获取当前ziplist的所在位置的key位置，或value该位置上的值 */
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,unsigned char **vstr,unsigned int *vlen,long long *vll) /* 根据当前迭代器的位置，获取当前listpack的所在位置的key位置，或value该位置上的值 */
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst) /* 根据当前迭代器的位置，获取当前dict的所在位置的key位置，或value该位置上的值 */
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what) /* 根据当前迭代器的位置，获取当前key对象 */
 robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key) /* 根据c客户端对象，找到key是否存在，创建或实现添加操作  */
-void hashTypeConvertZiplist(robj *o, int enc) /* 从ziplist压缩表到hashtable的转换 */
-void hashTypeConvert(robj *o, int enc) /* 对象转换操作，例如从ziplist到dict的转换 */
+void hashTypeConvertListpack(robj *o, int enc) /* 从listpack到hashtable的转换 */
+void hashTypeConvert(robj *o, int enc) /* 对象转换操作，例如从listpack到dict的转换 */
 
 /* 哈希命令类型 */
 void hsetCommand(redisClient *c)  /* 客户端设置指令 */
@@ -74,19 +74,19 @@ void hscanCommand(redisClient *c) /* 客户端扫描操作 */
  *----------------------------------------------------------------------------*/
  *
 /* Check the length of a number of objects to see if we need to convert a
- * ziplist to a real hash. Note that we only check string encoded objects
+ * listpack to a real hash. Note that we only check string encoded objects
  * as their string length can be queried in constant time. */
-/* 当hashType为ziplist时，判断对象长度是否超出了服务端可接受的ziplist最大长度，超过则转成哈希字典类型*/
+/* 当hashType为listpack时，判断对象长度是否超出了服务端可接受的最大长度，超过则转成哈希字典类型*/
 void hashTypeTryConversion(robj *o, robj **argv, int start, int end) {
     int i;
 
-    if (o->encoding != REDIS_ENCODING_ZIPLIST) return;
+    if (o->encoding != REDIS_ENCODING_LISTPACK) return;
 
     for (i = start; i <= end; i++) {
-        if (argv[i]->encoding == REDIS_ENCODING_RAW &&
+        if (sdsEncodedObject(argv[i]) &&
             sdslen(argv[i]->ptr) > server.hash_max_ziplist_value)
         {
-        	//判断对象长度是否超出了服务端可接受的ziplist最大长度，超过则转成哈希字典类型
+        	//判断对象长度是否超出了服务端可接受的最大长度，超过则转成哈希字典类型
             hashTypeConvert(o, REDIS_ENCODING_HT);
             break;
         }
@@ -102,30 +102,30 @@ void hashTypeTryObjectEncoding(robj *subject, robj **o1, robj **o2) {
     }
 }
 
-/* Get the value from a ziplist encoded hash, identified by field.
+/* Get the value from a listpack encoded hash, identified by field.
  * Returns -1 when the field cannot be found. */
-/* 获取ziplist压缩列表中的某个索引位置上的值 */
-int hashTypeGetFromZiplist(robj *o, robj *field,
-                           unsigned char **vstr,
-                           unsigned int *vlen,
-                           long long *vll)
+/* 获取listpack中field对应的值 */
+int hashTypeGetFromListpack(robj *o, robj *field,
+                            unsigned char **vstr,
+                            unsigned int *vlen,
+                            long long *vll)
 {
-    unsigned char *zl, *fptr = NULL, *vptr = NULL;
+    unsigned char *lp, *fptr = NULL, *vptr = NULL;
     int ret;
 
-    redisAssert(o->encoding == REDIS_ENCODING_ZIPLIST);
+    redisAssert(o->encoding == REDIS_ENCODING_LISTPACK);
 
     field = getDecodedObject(field);
 
-    zl = o->ptr;
-    fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+    lp = o->ptr;
+    fptr = lpFirst(lp);
     if (fptr != NULL) {
-    	//找到索引位置
-        fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+    	//找到field的位置
+        fptr = lpFind(lp, fptr, field->ptr, sdslen(field->ptr), 1);
         if (fptr != NULL) {
             /* Grab pointer to the value (fptr points to the field) */
             //指向其中的value值的位置
-            vptr = ziplistNext(zl, fptr);
+            vptr = lpNext(lp, fptr);
             redisAssert(vptr != NULL);
         }
     }
@@ -135,7 +135,7 @@ int hashTypeGetFromZiplist(robj *o, robj *field,
 
     if (vptr != NULL) {
     	//获取该值
-        ret = ziplistGet(vptr, vstr, vlen, vll);
+        ret = lpGetValue(vptr, vstr, vlen, vll);
         redisAssert(ret);
         return 0;
     }
@@ -151,7 +151,7 @@ int hashTypeGetFromHashTable(robj *o, robj *field, robj **value) {
 
     redisAssert(o->encoding == REDIS_ENCODING_HT);
     
-    //通过robj->ptr里面存的dict总类或ziplist类开始寻找
+    //通过robj->ptr里面存的dict开始寻找
     de = dictFind(o->ptr, field);
     if (de == NULL) return -1;
     //获取其中的value值
@@ -169,13 +169,13 @@ int hashTypeGetFromHashTable(robj *o, robj *field, robj **value) {
 robj *hashTypeGetObject(robj *o, robj *field) {
     robj *value = NULL;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) {
-        	//在ziplist中获取值
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) {
+        	//在listpack中获取值
             if (vstr) {
                 value = createStringObject((char*)vstr, vlen);
             } else {
@@ -200,12 +200,12 @@ robj *hashTypeGetObject(robj *o, robj *field) {
 /* Test if the specified field exists in the given hash. Returns 1 if the field
  * exists, and 0 when it doesn't. */
 int hashTypeExists(robj *o, robj *field) {
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        if (hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll) == 0) return 1;
+        if (hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll) == 0) return 1;
     } else if (o->encoding == REDIS_ENCODING_HT) {
         robj *aux;
 
@@ -220,47 +220,45 @@ int hashTypeExists(robj *o, robj *field) {
  * Return 0 on insert and 1 on update.
  * This function will take care of incrementing the reference count of the
  * retained fields and value objects. */
-/* hashType设置操作，分2种情况，ziplist,和字典hashtable */
+/* hashType设置操作，分2种情况，listpack,和字典hashtable */
 int hashTypeSet(robj *o, robj *field, robj *value) {
     int update = 0;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *zl, *fptr, *vptr;
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *lp, *fptr, *vptr;
         
         //首先对field和value进行解码
         field = getDecodedObject(field);
         value = getDecodedObject(value);
 
-        zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        lp = o->ptr;
+        fptr = lpFirst(lp);
         if (fptr != NULL) {
-            fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+            fptr = lpFind(lp, fptr, field->ptr, sdslen(field->ptr), 1);
             if (fptr != NULL) {
                 /* Grab pointer to the value (fptr points to the field) */
-                vptr = ziplistNext(zl, fptr);
+                vptr = lpNext(lp, fptr);
                 redisAssert(vptr != NULL);
                 update = 1;
 
-                //设置的操作，其实先删除，再插入语一个新值
-                /* Delete value */
-                zl = ziplistDelete(zl, &vptr);
-
-                /* Insert new value */
-                zl = ziplistInsert(zl, vptr, value->ptr, sdslen(value->ptr));
+                /* Replace the value in place, the other entries do not
+                 * change whatever its new size. */
+                //直接替换value，不会影响其他的元素
+                lp = lpReplace(lp, &vptr, value->ptr, sdslen(value->ptr));
             }
         }
 
         if (!update) {
-            /* Push new field/value pair onto the tail of the ziplist */
-            zl = ziplistPush(zl, field->ptr, sdslen(field->ptr), ZIPLIST_TAIL);
-            zl = ziplistPush(zl, value->ptr, sdslen(value->ptr), ZIPLIST_TAIL);
+            /* Push new field/value pair onto the tail of the listpack */
+            lp = lpAppend(lp, field->ptr, sdslen(field->ptr));
+            lp = lpAppend(lp, value->ptr, sdslen(value->ptr));
         }
-        o->ptr = zl;
+        o->ptr = lp;
         //用完之后，引用计数递减
         decrRefCount(field);
         decrRefCount(value);
 
-        /* Check if the ziplist needs to be converted to a hash table */
+        /* Check if the listpack needs to be converted to a hash table */
         if (hashTypeLength(o) > server.hash_max_ziplist_entries)
             hashTypeConvert(o, REDIS_ENCODING_HT);
     } else if (o->encoding == REDIS_ENCODING_HT) {
@@ -283,19 +281,19 @@ int hashTypeSet(robj *o, robj *field, robj *value) {
 int hashTypeDelete(robj *o, robj *field) {
     int deleted = 0;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *zl, *fptr;
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *lp, *fptr;
 
         field = getDecodedObject(field);
 
-        zl = o->ptr;
-        fptr = ziplistIndex(zl, ZIPLIST_HEAD);
+        lp = o->ptr;
+        fptr = lpFirst(lp);
         if (fptr != NULL) {
-            fptr = ziplistFind(fptr, field->ptr, sdslen(field->ptr), 1);
+            fptr = lpFind(lp, fptr, field->ptr, sdslen(field->ptr), 1);
             if (fptr != NULL) {
-                zl = ziplistDelete(zl,&fptr);
-                zl = ziplistDelete(zl,&fptr);
-                o->ptr = zl;
+                /* Delete both field and value. */
+                lp = lpDeleteRangeWithEntry(lp,&fptr,2);
+                o->ptr = lp;
                 deleted = 1;
             }
         }
@@ -321,8 +319,8 @@ int hashTypeDelete(robj *o, robj *field) {
 unsigned long hashTypeLength(robj *o) {
     unsigned long length = ULONG_MAX;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        length = ziplistLen(o->ptr) / 2;
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        length = lpLength(o->ptr) / 2;
     } else if (o->encoding == REDIS_ENCODING_HT) {
         length = dictSize((dict*)o->ptr);
     } else {
@@ -338,7 +336,7 @@ hashTypeIterator *hashTypeInitIterator(robj *subject) {
     hi->subject = subject;
     hi->encoding = subject->encoding;
 
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         hi->fptr = NULL;
         hi->vptr = NULL;
     } else if (hi->encoding == REDIS_ENCODING_HT) {
@@ -362,27 +360,27 @@ void hashTypeReleaseIterator(hashTypeIterator *hi) {
 /* Move to the next entry in the hash. Return REDIS_OK when the next entry
  * could be found and REDIS_ERR when the iterator reaches the end. */
 int hashTypeNext(hashTypeIterator *hi) {
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *zl;
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *lp;
         unsigned char *fptr, *vptr;
 
-        zl = hi->subject->ptr;
+        lp = hi->subject->ptr;
         fptr = hi->fptr;
         vptr = hi->vptr;
 
         if (fptr == NULL) {
             /* Initialize cursor */
             redisAssert(vptr == NULL);
-            fptr = ziplistIndex(zl, 0);
+            fptr = lpFirst(lp);
         } else {
             /* Advance cursor */
             redisAssert(vptr != NULL);
-            fptr = ziplistNext(zl, vptr);
+            fptr = lpNext(lp, vptr);
         }
         if (fptr == NULL) return REDIS_ERR;
 
         /* Grab pointer to the value (fptr points to the field) */
-        vptr = ziplistNext(zl, fptr);
+        vptr = lpNext(lp, fptr);
         redisAssert(vptr != NULL);
 
         /* fptr, vptr now point to the first or next pair */
@@ -397,30 +395,30 @@ int hashTypeNext(hashTypeIterator *hi) {
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromZiplist`. */
-/* 根据当前迭代器的位置，获取当前ziplist的所在位置的key位置，或value该位置上的值 */
-void hashTypeCurrentFromZiplist(hashTypeIterator *hi, int what,
-                                unsigned char **vstr,
-                                unsigned int *vlen,
-                                long long *vll)
+ * encoded as a listpack. Prototype is similar to `hashTypeGetFromListpack`. */
+/* 根据当前迭代器的位置，获取当前listpack的所在位置的key位置，或value该位置上的值 */
+void hashTypeCurrentFromListpack(hashTypeIterator *hi, int what,
+                                 unsigned char **vstr,
+                                 unsigned int *vlen,
+                                 long long *vll)
 {
     int ret;
 
-    redisAssert(hi->encoding == REDIS_ENCODING_ZIPLIST);
+    redisAssert(hi->encoding == REDIS_ENCODING_LISTPACK);
 
     if (what & REDIS_HASH_KEY) {
-    	//ziplist获取当前key的位置，通过的是hi->fptr指针,key在ziplist其实是index位置的意思，在dict就是我们说的key
-        ret = ziplistGet(hi->fptr, vstr, vlen, vll);
+    	//listpack获取当前key的值，通过的是hi->fptr指针
+        ret = lpGetValue(hi->fptr, vstr, vlen, vll);
         redisAssert(ret);
     } else {
-    	//ziplist获取当前value的值，通过的是hi->vptr指针
-        ret = ziplistGet(hi->vptr, vstr, vlen, vll);
+    	//listpack获取当前value的值，通过的是hi->vptr指针
+        ret = lpGetValue(hi->vptr, vstr, vlen, vll);
         redisAssert(ret);
     }
 }
 
 /* Get the field or value at iterator cursor, for an iterator on a hash value
- * encoded as a ziplist. Prototype is similar to `hashTypeGetFromHashTable`. */
+ * encoded as a hash table. Prototype is similar to `hashTypeGetFromHashTable`. */
 void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst) {
     redisAssert(hi->encoding == REDIS_ENCODING_HT);
 
@@ -437,12 +435,12 @@ void hashTypeCurrentFromHashTable(hashTypeIterator *hi, int what, robj **dst) {
 robj *hashTypeCurrentObject(hashTypeIterator *hi, int what) {
     robj *dst;
 
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             dst = createStringObject((char*)vstr, vlen);
         } else {
@@ -474,12 +472,12 @@ robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key) {
     return o;
 }
 
-/* 从ziplist压缩表到hashtable的转换 */
-void hashTypeConvertZiplist(robj *o, int enc) {
-    redisAssert(o->encoding == REDIS_ENCODING_ZIPLIST);
+/* 从listpack到hashtable的转换 */
+void hashTypeConvertListpack(robj *o, int enc) {
+    redisAssert(o->encoding == REDIS_ENCODING_LISTPACK);
 
-    if (enc == REDIS_ENCODING_ZIPLIST) {
-    	//如果转换方法是ziplist则什么都不做，因为原本传来的就是ziplist
+    if (enc == REDIS_ENCODING_LISTPACK) {
+    	//如果转换方法是listpack则什么都不做，因为原本传来的就是listpack
         /* Nothing to do... */
 
     } else if (enc == REDIS_ENCODING_HT) {
@@ -508,8 +506,8 @@ void hashTypeConvertZiplist(robj *o, int enc) {
             ret = dictAdd(dict, field, value);
             if (ret != DICT_OK) {
             	//ret判断是否添加成功
-                redisLogHexDump(REDIS_WARNING,"ziplist with dup elements dump",
-                    o->ptr,ziplistBlobLen(o->ptr));
+                redisLogHexDump(REDIS_WARNING,"listpack with dup elements dump",
+                    o->ptr,lpBytes(o->ptr));
                 redisAssert(ret == DICT_OK);
             }
         }
@@ -528,8 +526,8 @@ void hashTypeConvertZiplist(robj *o, int enc) {
 }
 
 void hashTypeConvert(robj *o, int enc) {
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        hashTypeConvertZiplist(o, enc);
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        hashTypeConvertListpack(o, enc);
     } else if (o->encoding == REDIS_ENCODING_HT) {
         redisPanic("Not implemented");
     } else {
@@ -677,12 +675,12 @@ static void addHashFieldToReply(redisClient *c, robj *o, robj *field) {
         return;
     }
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        ret = hashTypeGetFromZiplist(o, field, &vstr, &vlen, &vll);
+        ret = hashTypeGetFromListpack(o, field, &vstr, &vlen, &vll);
         if (ret < 0) {
             addReply(c, shared.nullbulk);
         } else {
@@ -772,12 +770,12 @@ void hlenCommand(redisClient *c) {
 }
 
 static void addHashIteratorCursorToReply(redisClient *c, hashTypeIterator *hi, int what) {
-    if (hi->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (hi->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr = NULL;
         unsigned int vlen = UINT_MAX;
         long long vll = LLONG_MAX;
 
-        hashTypeCurrentFromZiplist(hi, what, &vstr, &vlen, &vll);
+        hashTypeCurrentFromListpack(hi, what, &vstr, &vlen, &vll);
         if (vstr) {
             addReplyBulkCBuffer(c, vstr, vlen);
         } else {
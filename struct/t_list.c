@@ -30,19 +30,19 @@
 #include "redis.h"
 
 /* List方法 */
-/* list的操作分为2种，LINKEDLIST普通链表和ZIPLIST压缩列表的相关操作 */
-void listTypeTryConversion(robj *subject, robj *value) /* 判断是否需要将ziplist转为linkedlist */
+/* list的操作分为2种，QUICKLIST快速列表和LISTPACK紧凑列表的相关操作 */
+void listTypeTryConversion(robj *subject, robj *value) /* 判断是否需要将listpack转为quicklist */
 void listTypePush(robj *subject, robj *value, int where) /* 在头部或尾部插入value元素 */
 robj *listTypePop(robj *subject, int where)  /* 在列表的头部或尾弹出元素 */
 unsigned long listTypeLength(robj *subject) /* 列表的长度 */
 listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char direction) /* 返回列表迭代器，方向有头尾之分 */
 void listTypeReleaseIterator(listTypeIterator *li) /* 释放列表迭代器 */
 int listTypeNext(listTypeIterator *li, listTypeEntry *entry) /* 根据列表迭代器，获取下一个元素 */
-robj *listTypeGet(listTypeEntry *entry) /* 获取listType元素，有ziplist和linkedlist */
+robj *listTypeGet(listTypeEntry *entry) /* 获取listType元素，有listpack和quicklist */
 void listTypeInsert(listTypeEntry *entry, robj *value, int where) /* listType了类型插入元素操作 */
 int listTypeEqual(listTypeEntry *entry, robj *o) /* 判断2个元素是否相等 */
 void listTypeDelete(listTypeEntry *entry) /* listType类型删除元素 */
-void listTypeConvert(robj *subject, int enc) /* listType类型的转换操作，这里指的是往linkedList上转 */
+void listTypeConvert(robj *subject, int enc) /* listType类型的转换操作，这里指的是往quicklist上转 */
 	
 /* List的相关命令 */
 void pushGenericCommand(redisClient *c, int where) /* 插入操作命令的原始操作 */
@@ -78,14 +78,14 @@ void brpoplpushCommand(redisClient *c) /* 弹出推入阻塞式命令 */
  * List API
  *----------------------------------------------------------------------------*/
 
-/* Check the argument length to see if it requires us to convert the ziplist
- * to a real list. Only check raw-encoded objects because integer encoded
+/* Check the argument length to see if it requires us to convert the listpack
+ * to a quicklist. Only check raw-encoded objects because integer encoded
  * objects are never too long. */
 void listTypeTryConversion(robj *subject, robj *value) {
-    if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
-    if (value->encoding == REDIS_ENCODING_RAW &&
+    if (subject->encoding != REDIS_ENCODING_LISTPACK) return;
+    if (sdsEncodedObject(value) &&
         sdslen(value->ptr) > server.list_max_ziplist_value)
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+            listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
 }
 
 /* The function pushes an element to the specified list object 'subject',
@@ -94,59 +94,58 @@ void listTypeTryConversion(robj *subject, robj *value) {
  * There is no need for the caller to increment the refcount of 'value' as
  * the function takes care of it if needed. */
 void listTypePush(robj *subject, robj *value, int where) {
-    /* Check if we need to convert the ziplist */
+    /* Check if we need to convert the listpack */
     listTypeTryConversion(subject,value);
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
-        ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
-            listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+    if (subject->encoding == REDIS_ENCODING_LISTPACK &&
+        lpLength(subject->ptr) >= server.list_max_ziplist_entries)
+            listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
 
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+    if (subject->encoding == REDIS_ENCODING_LISTPACK) {
         value = getDecodedObject(value);
-        subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
+        if (where == REDIS_HEAD)
+            subject->ptr = lpPrepend(subject->ptr,value->ptr,sdslen(value->ptr));
+        else
+            subject->ptr = lpAppend(subject->ptr,value->ptr,sdslen(value->ptr));
+        decrRefCount(value);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        value = getDecodedObject(value);
+        quicklistPush(subject->ptr,value->ptr,sdslen(value->ptr),pos);
         decrRefCount(value);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        if (where == REDIS_HEAD) {
-            listAddNodeHead(subject->ptr,value);
-        } else {
-            listAddNodeTail(subject->ptr,value);
-        }
-        incrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+/* Called by quicklistPopCustom() to turn the popped string into an object. */
+static void *listPopSaver(unsigned char *data, unsigned int sz) {
+    return createStringObject((char*)data,sz);
+}
+
 robj *listTypePop(robj *subject, int where) {
     robj *value = NULL;
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (subject->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *p;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
         int pos = (where == REDIS_HEAD) ? 0 : -1;
-        p = ziplistIndex(subject->ptr,pos);
-        if (ziplistGet(p,&vstr,&vlen,&vlong)) {
+        p = lpSeek(subject->ptr,pos);
+        if (lpGetValue(p,&vstr,&vlen,&vlong)) {
             if (vstr) {
                 value = createStringObject((char*)vstr,vlen);
             } else {
                 value = createStringObjectFromLongLong(vlong);
             }
             /* We only need to delete an element when it exists */
-            subject->ptr = ziplistDelete(subject->ptr,&p);
-        }
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list *list = subject->ptr;
-        listNode *ln;
-        if (where == REDIS_HEAD) {
-            ln = listFirst(list);
-        } else {
-            ln = listLast(list);
+            subject->ptr = lpDelete(subject->ptr,p,NULL);
         }
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            incrRefCount(value);
-            listDelNode(list,ln);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        long long vlong;
+        int pos = (where == REDIS_HEAD) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+        if (quicklistPopCustom(subject->ptr,pos,(unsigned char **)&value,
+                               NULL,&vlong,listPopSaver)) {
+            if (!value) value = createStringObjectFromLongLong(vlong);
         }
     } else {
         redisPanic("Unknown list encoding");
@@ -155,10 +154,10 @@ robj *listTypePop(robj *subject, int where) {
 }
 
 unsigned long listTypeLength(robj *subject) {
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
-        return ziplistLen(subject->ptr);
-    } else if (subject->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return listLength((list*)subject->ptr);
+    if (subject->encoding == REDIS_ENCODING_LISTPACK) {
+        return lpLength(subject->ptr);
+    } else if (subject->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCount(subject->ptr);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -170,10 +169,14 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
     li->subject = subject;
     li->encoding = subject->encoding;
     li->direction = direction;
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-        li->zi = ziplistIndex(subject->ptr,index);
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        li->ln = listIndex(subject->ptr,index);
+    li->iter = NULL;
+    if (li->encoding == REDIS_ENCODING_LISTPACK) {
+        li->zi = lpSeek(subject->ptr,index);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        /* REDIS_TAIL means moving towards the tail, that is forward. */
+        int iter_direction =
+            direction == REDIS_HEAD ? AL_START_TAIL : AL_START_HEAD;
+        li->iter = quicklistGetIteratorAtIdx(subject->ptr,iter_direction,index);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -182,6 +185,7 @@ listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char
 
 /* Clean up the iterator. */
 void listTypeReleaseIterator(listTypeIterator *li) {
+    if (li->iter) quicklistReleaseIterator(li->iter);
     zfree(li);
 }
 
@@ -193,26 +197,19 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
     redisAssert(li->subject->encoding == li->encoding);
 
     entry->li = li;
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (li->encoding == REDIS_ENCODING_LISTPACK) {
         entry->zi = li->zi;
         if (entry->zi != NULL) {
             if (li->direction == REDIS_TAIL)
             	//根据方向调用pre或next的方法
-                li->zi = ziplistNext(li->subject->ptr,li->zi);
-            else
-                li->zi = ziplistPrev(li->subject->ptr,li->zi);
-            return 1;
-        }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        entry->ln = li->ln;
-        if (entry->ln != NULL) {
-            if (li->direction == REDIS_TAIL)
-            	//普通的列表的调用方式同上
-                li->ln = li->ln->next;
+                li->zi = lpNext(li->subject->ptr,li->zi);
             else
-                li->ln = li->ln->prev;
+                li->zi = lpPrev(li->subject->ptr,li->zi);
             return 1;
         }
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        //迭代器为NULL说明起始的index越界
+        return li->iter && quicklistNext(li->iter,&entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -223,22 +220,25 @@ int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
 robj *listTypeGet(listTypeEntry *entry) {
     listTypeIterator *li = entry->li;
     robj *value = NULL;
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (li->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
         redisAssert(entry->zi != NULL);
-        if (ziplistGet(entry->zi,&vstr,&vlen,&vlong)) {
+        if (lpGetValue(entry->zi,&vstr,&vlen,&vlong)) {
             if (vstr) {
                 value = createStringObject((char*)vstr,vlen);
             } else {
                 value = createStringObjectFromLongLong(vlong);
             }
         }
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        redisAssert(entry->ln != NULL);
-        value = listNodeValue(entry->ln);
-        incrRefCount(value);
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        if (entry->entry.value) {
+            value = createStringObject((char*)entry->entry.value,
+                                       entry->entry.sz);
+        } else {
+            value = createStringObjectFromLongLong(entry->entry.longval);
+        }
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -247,29 +247,23 @@ robj *listTypeGet(listTypeEntry *entry) {
 
 void listTypeInsert(listTypeEntry *entry, robj *value, int where) {
     robj *subject = entry->li->subject;
-    if (entry->li->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (entry->li->encoding == REDIS_ENCODING_LISTPACK) {
         value = getDecodedObject(value);
-        if (where == REDIS_TAIL) {
-            unsigned char *next = ziplistNext(subject->ptr,entry->zi);
-
-            /* When we insert after the current element, but the current element
-             * is the tail of the list, we need to do a push. */
-            if (next == NULL) {
-                subject->ptr = ziplistPush(subject->ptr,value->ptr,sdslen(value->ptr),REDIS_TAIL);
-            } else {
-                subject->ptr = ziplistInsert(subject->ptr,next,value->ptr,sdslen(value->ptr));
-            }
-        } else {
-            subject->ptr = ziplistInsert(subject->ptr,entry->zi,value->ptr,sdslen(value->ptr));
-        }
+        subject->ptr = lpInsert(subject->ptr,value->ptr,sdslen(value->ptr),
+                                entry->zi,
+                                where == REDIS_TAIL ? LP_AFTER : LP_BEFORE,
+                                NULL);
         decrRefCount(value);
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
+    } else if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        value = getDecodedObject(value);
         if (where == REDIS_TAIL) {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_TAIL);
+            quicklistInsertAfter(subject->ptr,&entry->entry,
+                                 value->ptr,sdslen(value->ptr));
         } else {
-            listInsertNode(subject->ptr,entry->ln,value,AL_START_HEAD);
+            quicklistInsertBefore(subject->ptr,&entry->entry,
+                                  value->ptr,sdslen(value->ptr));
         }
-        incrRefCount(value);
+        decrRefCount(value);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -278,11 +272,11 @@ void listTypeInsert(listTypeEntry *entry, robj *value, int where) {
 /* Compare the given object with the entry at the current position. */
 int listTypeEqual(listTypeEntry *entry, robj *o) {
     listTypeIterator *li = entry->li;
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-        redisAssertWithInfo(NULL,o,o->encoding == REDIS_ENCODING_RAW);
-        return ziplistCompare(entry->zi,o->ptr,sdslen(o->ptr));
-    } else if (li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        return equalStringObjects(o,listNodeValue(entry->ln));
+    redisAssertWithInfo(NULL,o,sdsEncodedObject(o));
+    if (li->encoding == REDIS_ENCODING_LISTPACK) {
+        return lpCompare(entry->zi,o->ptr,sdslen(o->ptr));
+    } else if (li->encoding == REDIS_ENCODING_QUICKLIST) {
+        return quicklistCompare(entry->entry.zi,o->ptr,sdslen(o->ptr));
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -291,45 +285,51 @@ int listTypeEqual(listTypeEntry *entry, robj *o) {
 /* Delete the element pointed to. */
 void listTypeDelete(listTypeEntry *entry) {
     listTypeIterator *li = entry->li;
-    if (li->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p = entry->zi;
-        li->subject->ptr = ziplistDelete(li->subject->ptr,&p);
+    if (li->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *p;
+        li->subject->ptr = lpDelete(li->subject->ptr,entry->zi,&p);
 
-        /* Update position of the iterator depending on the direction */
+        /* Update position of the iterator depending on the direction. 'p'
+         * is NULL when the deleted element was the last one. */
         if (li->direction == REDIS_TAIL)
             li->zi = p;
         else
-            li->zi = ziplistPrev(li->subject->ptr,p);
-    } else if (entry->li->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *next;
-        if (li->direction == REDIS_TAIL)
-            next = entry->ln->next;
-        else
-            next = entry->ln->prev;
-        listDelNode(li->subject->ptr,entry->ln);
-        li->ln = next;
+            li->zi = p ? lpPrev(li->subject->ptr,p) : lpLast(li->subject->ptr);
+    } else if (entry->li->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelEntry(li->iter,&entry->entry);
     } else {
         redisPanic("Unknown list encoding");
     }
 }
 
+/* Convert a listpack encoded list to a quicklist, pushing the elements
+ * one by one so that the nodes are filled as the fill factor says. */
 void listTypeConvert(robj *subject, int enc) {
-    listTypeIterator *li;
-    listTypeEntry entry;
     redisAssertWithInfo(NULL,subject,subject->type == REDIS_LIST);
+    redisAssertWithInfo(NULL,subject,
+                        subject->encoding == REDIS_ENCODING_LISTPACK);
 
-    if (enc == REDIS_ENCODING_LINKEDLIST) {
-        list *l = listCreate();
-        listSetFreeMethod(l,decrRefCountVoid);
-
-        /* listTypeGet returns a robj with incremented refcount */
-        li = listTypeInitIterator(subject,0,REDIS_TAIL);
-        while (listTypeNext(li,&entry)) listAddNodeTail(l,listTypeGet(&entry));
-        listTypeReleaseIterator(li);
+    if (enc == REDIS_ENCODING_QUICKLIST) {
+        quicklist *ql = quicklistNew(server.list_max_ziplist_size,
+                                     server.list_compress_depth);
+        unsigned char *lp = subject->ptr, *p = lpFirst(lp);
+        unsigned char *vstr;
+        unsigned int vlen;
+        long long vlong;
+        char buf[32];
 
-        subject->encoding = REDIS_ENCODING_LINKEDLIST;
-        zfree(subject->ptr);
-        subject->ptr = l;
+        while (lpGetValue(p,&vstr,&vlen,&vlong)) {
+            if (vstr) {
+                quicklistPushTail(ql,vstr,vlen);
+            } else {
+                vlen = ll2string(buf,sizeof(buf),vlong);
+                quicklistPushTail(ql,buf,vlen);
+            }
+            p = lpNext(lp,p);
+        }
+        lpFree(lp);
+        subject->ptr = ql;
+        subject->encoding = REDIS_ENCODING_QUICKLIST;
     } else {
         redisPanic("Unsupported list conversion");
     }
@@ -351,7 +351,7 @@ void pushGenericCommand(redisClient *c, int where) {
     for (j = 2; j < c->argc; j++) {
         c->argv[j] = tryObjectEncoding(c->argv[j]);
         if (!lobj) {
-            lobj = createZiplistObject();
+            lobj = createListpackObject();
             dbAdd(c->db,c->argv[1],lobj);
         }
         listTypePush(lobj,c->argv[j],where);
@@ -389,7 +389,7 @@ void pushxGenericCommand(redisClient *c, robj *refval, robj *val, int where) {
          * convert the list inside the iterator. We don't want to loop over
          * the list twice (once to see if the value can be inserted and once
          * to do the actual insert), so we assume this value can be inserted
-         * and convert the ziplist to a regular list if necessary. */
+         * and convert the listpack to a quicklist if necessary. */
         listTypeTryConversion(subject,val);
 
         /* Seek refval from head to tail */
@@ -404,10 +404,10 @@ void pushxGenericCommand(redisClient *c, robj *refval, robj *val, int where) {
         listTypeReleaseIterator(iter);
 
         if (inserted) {
-            /* Check if the length exceeds the ziplist length threshold. */
-            if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
-                ziplistLen(subject->ptr) > server.list_max_ziplist_entries)
-                    listTypeConvert(subject,REDIS_ENCODING_LINKEDLIST);
+            /* Check if the length exceeds the listpack length threshold. */
+            if (subject->encoding == REDIS_ENCODING_LISTPACK &&
+                lpLength(subject->ptr) > server.list_max_ziplist_entries)
+                    listTypeConvert(subject,REDIS_ENCODING_QUICKLIST);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"linsert",
                                 c->argv[1],c->db->id);
@@ -465,13 +465,13 @@ void lindexCommand(redisClient *c) {
     if ((getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK))
         return;
 
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *p;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
-        p = ziplistIndex(o->ptr,index);
-        if (ziplistGet(p,&vstr,&vlen,&vlong)) {
+        p = lpSeek(o->ptr,index);
+        if (lpGetValue(p,&vstr,&vlen,&vlong)) {
             if (vstr) {
                 value = createStringObject((char*)vstr,vlen);
             } else {
@@ -482,14 +482,22 @@ void lindexCommand(redisClient *c) {
         } else {
             addReply(c,shared.nullbulk);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln = listIndex(o->ptr,index);
-        if (ln != NULL) {
-            value = listNodeValue(ln);
-            addReplyBulk(c,value);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        /* Go through an iterator so that a compressed node is compressed
+         * back once the element was read. */
+        quicklistIter *iter = quicklistGetIteratorAtIdx(o->ptr,
+                                                        AL_START_HEAD,index);
+        quicklistEntry entry;
+        if (iter && quicklistNext(iter,&entry)) {
+            if (entry.value) {
+                addReplyBulkCBuffer(c,entry.value,entry.sz);
+            } else {
+                addReplyBulkLongLong(c,entry.longval);
+            }
         } else {
             addReply(c,shared.nullbulk);
         }
+        if (iter) quicklistReleaseIterator(iter);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -505,29 +513,29 @@ void lsetCommand(redisClient *c) {
         return;
 
     listTypeTryConversion(o,value);
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p, *zl = o->ptr;
-        p = ziplistIndex(zl,index);
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *p = lpSeek(o->ptr,index);
         if (p == NULL) {
             addReply(c,shared.outofrangeerr);
         } else {
-            o->ptr = ziplistDelete(o->ptr,&p);
             value = getDecodedObject(value);
-            o->ptr = ziplistInsert(o->ptr,p,value->ptr,sdslen(value->ptr));
+            o->ptr = lpReplace(o->ptr,&p,value->ptr,sdslen(value->ptr));
             decrRefCount(value);
             addReply(c,shared.ok);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
             server.dirty++;
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln = listIndex(o->ptr,index);
-        if (ln == NULL) {
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        int replaced;
+
+        value = getDecodedObject(value);
+        replaced = quicklistReplaceAtIndex(o->ptr,index,
+                                           value->ptr,sdslen(value->ptr));
+        decrRefCount(value);
+        if (!replaced) {
             addReply(c,shared.outofrangeerr);
         } else {
-            decrRefCount((robj*)listNodeValue(ln));
-            listNodeValue(ln) = value;
-            incrRefCount(value);
             addReply(c,shared.ok);
             signalModifiedKey(c->db,c->argv[1]);
             notifyKeyspaceEvent(REDIS_NOTIFY_LIST,"lset",c->argv[1],c->db->id);
@@ -596,43 +604,48 @@ void lrangeCommand(redisClient *c) {
 
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c,rangelen);
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
-        unsigned char *p = ziplistIndex(o->ptr,start);
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
+        unsigned char *p = lpSeek(o->ptr,start);
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
         while(rangelen--) {
-            ziplistGet(p,&vstr,&vlen,&vlong);
+            lpGetValue(p,&vstr,&vlen,&vlong);
             if (vstr) {
                 addReplyBulkCBuffer(c,vstr,vlen);
             } else {
                 addReplyBulkLongLong(c,vlong);
             }
-            p = ziplistNext(o->ptr,p);
+            p = lpNext(o->ptr,p);
         }
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        listNode *ln;
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistIter *iter;
+        quicklistEntry entry;
 
         /* If we are nearest to the end of the list, reach the element
-         * starting from tail and going backward, as it is faster. */
+         * starting from tail and going backward, as it is faster. The
+         * range is then walked one ziplist node at a time. */
         if (start > llen/2) start -= llen;
-        ln = listIndex(o->ptr,start);
+        iter = quicklistGetIteratorAtIdx(o->ptr,AL_START_HEAD,start);
 
         while(rangelen--) {
-            addReplyBulk(c,ln->value);
-            ln = ln->next;
+            quicklistNext(iter,&entry);
+            if (entry.value) {
+                addReplyBulkCBuffer(c,entry.value,entry.sz);
+            } else {
+                addReplyBulkLongLong(c,entry.longval);
+            }
         }
+        quicklistReleaseIterator(iter);
     } else {
-        redisPanic("List encoding is not LINKEDLIST nor ZIPLIST!");
+        redisPanic("List encoding is not QUICKLIST nor LISTPACK!");
     }
 }
 
 void ltrimCommand(redisClient *c) {
     robj *o;
-    long start, end, llen, j, ltrim, rtrim;
-    list *list;
-    listNode *ln;
+    long start, end, llen, ltrim, rtrim;
 
     if ((getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK) ||
         (getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK)) return;
@@ -659,20 +672,13 @@ void ltrimCommand(redisClient *c) {
     }
 
     /* Remove list elements to perform the trim */
-    if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (o->encoding == REDIS_ENCODING_LISTPACK) {
     	/* 划定范围的删除，分为2侧，左侧与右侧，剩下中间的部分 */
-        o->ptr = ziplistDeleteRange(o->ptr,0,ltrim);
-        o->ptr = ziplistDeleteRange(o->ptr,-rtrim,rtrim);
-    } else if (o->encoding == REDIS_ENCODING_LINKEDLIST) {
-        list = o->ptr;
-        for (j = 0; j < ltrim; j++) {
-            ln = listFirst(list);
-            listDelNode(list,ln);
-        }
-        for (j = 0; j < rtrim; j++) {
-            ln = listLast(list);
-            listDelNode(list,ln);
-        }
+        o->ptr = lpDeleteRange(o->ptr,0,ltrim);
+        o->ptr = lpDeleteRange(o->ptr,-rtrim,rtrim);
+    } else if (o->encoding == REDIS_ENCODING_QUICKLIST) {
+        quicklistDelRange(o->ptr,0,ltrim);
+        quicklistDelRange(o->ptr,-rtrim,rtrim);
     } else {
         redisPanic("Unknown list encoding");
     }
@@ -700,9 +706,8 @@ void lremCommand(redisClient *c) {
     subject = lookupKeyWriteOrReply(c,c->argv[1],shared.czero);
     if (subject == NULL || checkType(c,subject,REDIS_LIST)) return;
 
-    /* Make sure obj is raw when we're dealing with a ziplist */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        obj = getDecodedObject(obj);
+    /* Make sure obj is raw: both encodings compare it with raw entries */
+    obj = getDecodedObject(obj);
 
     listTypeIterator *li;
     if (toremove < 0) {
@@ -723,8 +728,7 @@ void lremCommand(redisClient *c) {
     listTypeReleaseIterator(li);
 
     /* Clean up raw encoded object */
-    if (subject->encoding == REDIS_ENCODING_ZIPLIST)
-        decrRefCount(obj);
+    decrRefCount(obj);
 
     if (listTypeLength(subject) == 0) dbDelete(c->db,c->argv[1]);
     addReplyLongLong(c,removed);
@@ -750,7 +754,7 @@ void lremCommand(redisClient *c) {
 void rpoplpushHandlePush(redisClient *c, robj *dstkey, robj *dstobj, robj *value) {
     /* Create the list if the key does not exist */
     if (!dstobj) {
-        dstobj = createZiplistObject();
+        dstobj = createListpackObject();
         dbAdd(c->db,dstkey,dstobj);
     }
     signalModifiedKey(c->db,dstkey);
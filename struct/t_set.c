@@ -495,7 +495,7 @@ void srandmemberWithCountCommand(redisClient *c) {
 
             if (encoding == REDIS_ENCODING_INTSET) {
                 retval = dictAdd(d,createStringObjectFromLongLong(llele),NULL);
-            } else if (ele->encoding == REDIS_ENCODING_RAW) {
+            } else if (sdsEncodedObject(ele)) {
                 retval = dictAdd(d,dupStringObject(ele),NULL);
             } else if (ele->encoding == REDIS_ENCODING_INT) {
                 retval = dictAdd(d,
@@ -527,7 +527,7 @@ void srandmemberWithCountCommand(redisClient *c) {
             encoding = setTypeRandomElement(set,&ele,&llele);
             if (encoding == REDIS_ENCODING_INTSET) {
                 ele = createStringObjectFromLongLong(llele);
-            } else if (ele->encoding == REDIS_ENCODING_RAW) {
+            } else if (sdsEncodedObject(ele)) {
                 ele = dupStringObject(ele);
             } else if (ele->encoding == REDIS_ENCODING_INT) {
                 ele = createStringObjectFromLongLong((long)ele->ptr);
@@ -592,6 +592,107 @@ int qsortCompareSetsByRevCardinality(const void *s1, const void *s2) {
     return  (o2 ? setTypeSize(o2) : 0) - (o1 ? setTypeSize(o1) : 0);
 }
 
+/* Return 1 if every set that exists is intset encoded. Missing keys (NULL)
+ * are empty sets and don't prevent the intset only paths. */
+/* 判断所有存在的集合是否都是intset编码 */
+int setTypeAllIntsets(robj **sets, unsigned long setnum) {
+    unsigned long j;
+
+    for (j = 0; j < setnum; j++)
+        if (sets[j] && sets[j]->encoding != REDIS_ENCODING_INTSET) return 0;
+    return 1;
+}
+
+/* Create a set object from an intset obtained by a set operation, converting
+ * it to a hash table if it is too big for the current configuration. */
+/* 根据集合运算得到的intset创建集合对象 */
+robj *setTypeCreateFromIntset(intset *is) {
+    robj *o = createObject(REDIS_SET,is);
+
+    o->encoding = REDIS_ENCODING_INTSET;
+    if (intsetLen(is) > server.set_max_intset_entries)
+        setTypeConvert(o,REDIS_ENCODING_HT);
+    return o;
+}
+
+/* Reply with the elements of an intset as a multi bulk reply. */
+/* 以multi bulk形式回复intset中的所有元素 */
+static void addReplyIntset(redisClient *c, intset *is) {
+    int64_t value;
+    uint32_t j;
+
+    addReplyMultiBulkLen(c,intsetLen(is));
+    for (j = 0; intsetGet(is,j,&value); j++)
+        addReplyBulkLongLong(c,value);
+}
+
+/* Store the result of SINTERSTORE, SUNIONSTORE and SDIFFSTORE at 'dstkey',
+ * or just delete the key if the result is empty, and reply with the size
+ * of the result. */
+/* 保存集合运算的结果到dstkey中，结果为空时删除dstkey */
+static void setStoreResult(redisClient *c, robj *dstkey, robj *dstset, char *event) {
+    int deleted = dbDelete(c->db,dstkey);
+
+    if (setTypeSize(dstset) > 0) {
+        dbAdd(c->db,dstkey,dstset);
+        addReplyLongLong(c,setTypeSize(dstset));
+        notifyKeyspaceEvent(REDIS_NOTIFY_SET,event,dstkey,c->db->id);
+    } else {
+        decrRefCount(dstset);
+        addReply(c,shared.czero);
+        if (deleted)
+            notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",
+                dstkey,c->db->id);
+    }
+    signalModifiedKey(c->db,dstkey);
+    server.dirty++;
+}
+
+/* Return 1 if the element returned by setTypeNext() from the first set is
+ * a member of all the other sets. 'encoding' tells if the element is in
+ * 'eleobj' or in 'intobj'. */
+/* 判断第一个集合中的元素是否同时属于其他所有集合 */
+static int sinterIsMemberOfAll(robj **sets, unsigned long setnum, int encoding, robj *eleobj, int64_t intobj) {
+    unsigned long j;
+
+    for (j = 1; j < setnum; j++) {
+        if (sets[j] == sets[0]) continue;
+        if (encoding == REDIS_ENCODING_INTSET) {
+            /* intset with intset is simple... and fast */
+            if (sets[j]->encoding == REDIS_ENCODING_INTSET &&
+                !intsetFind((intset*)sets[j]->ptr,intobj))
+            {
+                return 0;
+            /* in order to compare an integer with an object we
+             * have to use the generic function, creating an object
+             * for this */
+            } else if (sets[j]->encoding == REDIS_ENCODING_HT) {
+                int ismember;
+
+                eleobj = createStringObjectFromLongLong(intobj);
+                ismember = setTypeIsMember(sets[j],eleobj);
+                decrRefCount(eleobj);
+                if (!ismember) return 0;
+            }
+        } else if (encoding == REDIS_ENCODING_HT) {
+            /* Optimization... if the source object is integer
+             * encoded AND the target set is an intset, we can get
+             * a much faster path. */
+            if (eleobj->encoding == REDIS_ENCODING_INT &&
+                sets[j]->encoding == REDIS_ENCODING_INTSET &&
+                !intsetFind((intset*)sets[j]->ptr,(long)eleobj->ptr))
+            {
+                return 0;
+            /* else... object to object check is easy as we use the
+             * type agnostic API here. */
+            } else if (!setTypeIsMember(sets[j],eleobj)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
 void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum, robj *dstkey) {
     robj **sets = zmalloc(sizeof(robj*)*setnum);
     setTypeIterator *si;
@@ -628,6 +729,28 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
      * algorithm's performance */
     qsort(sets,setnum,sizeof(robj*),qsortCompareSetsByCardinality);
 
+    /* When all the sets are intsets we intersect the sorted arrays directly,
+     * starting from the two smallest sets, so that the intermediate result
+     * can only get smaller. */
+    if (setnum > 1 && setTypeAllIntsets(sets,setnum)) {
+        intset *is = intsetIntersect(sets[0]->ptr,sets[1]->ptr);
+
+        for (j = 2; j < setnum && intsetLen(is) > 0; j++) {
+            intset *res = intsetIntersect(is,sets[j]->ptr);
+
+            zfree(is);
+            is = res;
+        }
+        if (dstkey) {
+            setStoreResult(c,dstkey,setTypeCreateFromIntset(is),"sinterstore");
+        } else {
+            addReplyIntset(c,is);
+            zfree(is);
+        }
+        zfree(sets);
+        return;
+    }
+
     /* The first thing we should output is the total number of elements...
      * since this is a multi-bulk write, but at this stage we don't know
      * the intersection set size, so we use a trick, append an empty object
@@ -646,44 +769,8 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
      * not include the element it is discarded */
     si = setTypeInitIterator(sets[0]);
     while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
-        for (j = 1; j < setnum; j++) {
-            if (sets[j] == sets[0]) continue;
-            if (encoding == REDIS_ENCODING_INTSET) {
-                /* intset with intset is simple... and fast */
-                if (sets[j]->encoding == REDIS_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,intobj))
-                {
-                    break;
-                /* in order to compare an integer with an object we
-                 * have to use the generic function, creating an object
-                 * for this */
-                } else if (sets[j]->encoding == REDIS_ENCODING_HT) {
-                    eleobj = createStringObjectFromLongLong(intobj);
-                    if (!setTypeIsMember(sets[j],eleobj)) {
-                        decrRefCount(eleobj);
-                        break;
-                    }
-                    decrRefCount(eleobj);
-                }
-            } else if (encoding == REDIS_ENCODING_HT) {
-                /* Optimization... if the source object is integer
-                 * encoded AND the target set is an intset, we can get
-                 * a much faster path. */
-                if (eleobj->encoding == REDIS_ENCODING_INT &&
-                    sets[j]->encoding == REDIS_ENCODING_INTSET &&
-                    !intsetFind((intset*)sets[j]->ptr,(long)eleobj->ptr))
-                {
-                    break;
-                /* else... object to object check is easy as we use the
-                 * type agnostic API here. */
-                } else if (!setTypeIsMember(sets[j],eleobj)) {
-                    break;
-                }
-            }
-        }
-
         /* Only take action when all sets contain the member */
-        if (j == setnum) {
+        if (sinterIsMemberOfAll(sets,setnum,encoding,eleobj,intobj)) {
             if (!dstkey) {
                 if (encoding == REDIS_ENCODING_HT)
                     addReplyBulk(c,eleobj);
@@ -706,21 +793,7 @@ void sinterGenericCommand(redisClient *c, robj **setkeys, unsigned long setnum,
     if (dstkey) {
         /* Store the resulting set into the target, if the intersection
          * is not an empty set. */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(REDIS_NOTIFY_SET,"sinterstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        setStoreResult(c,dstkey,dstset,"sinterstore");
     } else {
         setDeferredMultiBulkLength(c,replylen,cardinality);
     }
@@ -735,6 +808,88 @@ void sinterstoreCommand(redisClient *c) {
     sinterGenericCommand(c,c->argv+2,c->argc-2,c->argv[1]);
 }
 
+/* Parse the 'numkeys key [key ...] [LIMIT limit]' arguments shared by
+ * SINTERCARD and ZINTERCARD. A limit of 0 means no limit. */
+/* 解析SINTERCARD和ZINTERCARD的numkeys和LIMIT参数 */
+int getIntercardArgsOrReply(redisClient *c, long *numkeys, long *limit) {
+    if (getLongFromObjectOrReply(c,c->argv[1],numkeys,NULL) != REDIS_OK)
+        return REDIS_ERR;
+    if (*numkeys < 1) {
+        addReplyError(c,"numkeys should be greater than 0");
+        return REDIS_ERR;
+    }
+    if (*numkeys > c->argc-2) {
+        addReplyError(c,"Number of keys can't be greater than number of args");
+        return REDIS_ERR;
+    }
+
+    *limit = 0;
+    if (c->argc == *numkeys+4 &&
+        !strcasecmp(c->argv[*numkeys+2]->ptr,"limit"))
+    {
+        if (getLongFromObjectOrReply(c,c->argv[*numkeys+3],limit,NULL) != REDIS_OK)
+            return REDIS_ERR;
+        if (*limit < 0) {
+            addReplyError(c,"LIMIT can't be negative");
+            return REDIS_ERR;
+        }
+    } else if (c->argc != *numkeys+2) {
+        addReply(c,shared.syntaxerr);
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/* SINTERCARD numkeys key [key ...] [LIMIT limit]
+ *
+ * Reply with the size of the intersection without building it. The sets
+ * are probed starting from the smallest like SINTER does, and the scan
+ * stops as soon as 'limit' common members are found. */
+void sintercardCommand(redisClient *c) {
+    setTypeIterator *si;
+    robj **sets, *eleobj;
+    int64_t intobj;
+    long numkeys, limit, j;
+    unsigned long cardinality = 0;
+    int encoding;
+
+    if (getIntercardArgsOrReply(c,&numkeys,&limit) != REDIS_OK) return;
+
+    sets = zmalloc(sizeof(robj*)*numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *setobj = lookupKeyRead(c->db,c->argv[j+2]);
+
+        if (setobj && checkType(c,setobj,REDIS_SET)) {
+            zfree(sets);
+            return;
+        }
+        sets[j] = setobj;
+    }
+
+    /* A missing key is an empty set, so the intersection is empty too. Type
+     * errors are still reported for all the keys, like SINTER does. */
+    for (j = 0; j < numkeys; j++) {
+        if (sets[j] == NULL) {
+            zfree(sets);
+            addReply(c,shared.czero);
+            return;
+        }
+    }
+    qsort(sets,numkeys,sizeof(robj*),qsortCompareSetsByCardinality);
+
+    si = setTypeInitIterator(sets[0]);
+    while((encoding = setTypeNext(si,&eleobj,&intobj)) != -1) {
+        if (sinterIsMemberOfAll(sets,numkeys,encoding,eleobj,intobj)) {
+            cardinality++;
+            if (limit && cardinality == (unsigned long)limit) break;
+        }
+    }
+    setTypeReleaseIterator(si);
+
+    addReplyLongLong(c,cardinality);
+    zfree(sets);
+}
+
 #define REDIS_OP_UNION 0
 #define REDIS_OP_DIFF 1
 #define REDIS_OP_INTER 2
@@ -761,6 +916,48 @@ void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *
         sets[j] = setobj;
     }
 
+    /* When all the sets are intsets the result is computed merging the
+     * sorted arrays, and never needs to create an object per element. */
+    if (setTypeAllIntsets(sets,setnum)) {
+        intset *is = NULL;
+
+        if (op == REDIS_OP_UNION) {
+            is = intsetNew();
+            for (j = 0; j < setnum; j++) {
+                intset *res;
+
+                if (!sets[j]) continue;
+                res = intsetUnion(is,sets[j]->ptr);
+                zfree(is);
+                is = res;
+            }
+        } else if (sets[0]) {
+            /* DIFF: start from a copy of the first set. */
+            is = zmalloc(intsetBlobLen(sets[0]->ptr));
+            memcpy(is,sets[0]->ptr,intsetBlobLen(sets[0]->ptr));
+            for (j = 1; j < setnum && intsetLen(is) > 0; j++) {
+                intset *res;
+
+                if (!sets[j]) continue;
+                res = intsetDifference(is,sets[j]->ptr);
+                zfree(is);
+                is = res;
+            }
+        } else {
+            is = intsetNew();
+        }
+
+        if (dstkey) {
+            setStoreResult(c,dstkey,setTypeCreateFromIntset(is),
+                op == REDIS_OP_UNION ? "sunionstore" : "sdiffstore");
+        } else {
+            addReplyIntset(c,is);
+            zfree(is);
+        }
+        zfree(sets);
+        return;
+    }
+
     /* Select what DIFF algorithm to use.
      *
      * Algorithm 1 is O(N*M) where N is the size of the element first set
@@ -877,22 +1074,8 @@ void sunionDiffGenericCommand(redisClient *c, robj **setkeys, int setnum, robj *
     } else {
         /* If we have a target key where to store the resulting set
          * create this key with the result set inside */
-        int deleted = dbDelete(c->db,dstkey);
-        if (setTypeSize(dstset) > 0) {
-            dbAdd(c->db,dstkey,dstset);
-            addReplyLongLong(c,setTypeSize(dstset));
-            notifyKeyspaceEvent(REDIS_NOTIFY_SET,
-                op == REDIS_OP_UNION ? "sunionstore" : "sdiffstore",
-                dstkey,c->db->id);
-        } else {
-            decrRefCount(dstset);
-            addReply(c,shared.czero);
-            if (deleted)
-                notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",
-                    dstkey,c->db->id);
-        }
-        signalModifiedKey(c->db,dstkey);
-        server.dirty++;
+        setStoreResult(c,dstkey,dstset,
+            op == REDIS_OP_UNION ? "sunionstore" : "sdiffstore");
     }
     zfree(sets);
 }
@@ -207,6 +207,7 @@ void setrangeCommand(redisClient *c) {
     robj *o;
     long offset;
     sds value = c->argv[3]->ptr;
+    int chunked;
 
     if (getLongFromObjectOrReply(c,c->argv[2],&offset,NULL) != REDIS_OK)
         return;
@@ -228,7 +229,13 @@ void setrangeCommand(redisClient *c) {
         if (checkStringLength(c,offset+sdslen(value)) != REDIS_OK)
             return;
 
-        o = createObject(REDIS_STRING,sdsempty());
+        /* Long strings are chunked, the zeros before 'offset' are not
+         * allocated then. */
+        chunked = (size_t)offset+sdslen(value) > REDIS_STRING_CHUNKED_MIN_LEN;
+        if (chunked)
+            o = createStringChunkedObject(csNew());
+        else
+            o = createObject(REDIS_STRING,sdsempty());
         dbAdd(c->db,c->argv[1],o);
     } else {
         size_t olen;
@@ -248,19 +255,30 @@ void setrangeCommand(redisClient *c) {
         if (checkStringLength(c,offset+sdslen(value)) != REDIS_OK)
             return;
 
-        /* Create a copy when the object is shared or encoded. */
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
+        /* Create a copy when the object is shared or encoded. Strings that
+         * grow past the threshold are chunked, like with APPEND. */
+        chunked = o->encoding == REDIS_ENCODING_CHUNKED ||
+                  ((size_t)offset+sdslen(value) > olen &&
+                   (size_t)offset+sdslen(value) > REDIS_STRING_CHUNKED_MIN_LEN);
+        if (chunked)
+            o = dbUnshareChunkedStringValue(c->db,c->argv[1],o);
+        else
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
     }
 
     if (sdslen(value) > 0) {
-        o->ptr = sdsgrowzero(o->ptr,offset+sdslen(value));
-        memcpy((char*)o->ptr+offset,value,sdslen(value));
+        if (chunked) {
+            csSetRange(o->ptr,offset,value,sdslen(value));
+        } else {
+            o->ptr = sdsgrowzero(o->ptr,offset+sdslen(value));
+            memcpy((char*)o->ptr+offset,value,sdslen(value));
+        }
         signalModifiedKey(c->db,c->argv[1]);
         notifyKeyspaceEvent(REDIS_NOTIFY_STRING,
             "setrange",c->argv[1],c->db->id);
         server.dirty++;
     }
-    addReplyLongLong(c,sdslen(o->ptr));
+    addReplyLongLong(c,stringObjectLen(o));
 }
 
 void getrangeCommand(redisClient *c) {
@@ -279,6 +297,14 @@ void getrangeCommand(redisClient *c) {
     if (o->encoding == REDIS_ENCODING_INT) {
         str = llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        /* Only the requested bytes of the bitmap are produced below. */
+        str = NULL;
+        strlen = ((roaringBitmap*)o->ptr)->len;
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        /* Only the segments holding the range are read. */
+        str = NULL;
+        strlen = ((chunkString*)o->ptr)->len;
     } else {
         str = o->ptr;
         strlen = sdslen(str);
@@ -295,6 +321,15 @@ void getrangeCommand(redisClient *c) {
      * nothing can be returned is: start > end. */
     if (start > end || strlen == 0) {
         addReply(c,shared.emptybulk);
+    } else if (str == NULL) {
+        robj *range = createObject(REDIS_STRING,sdsnewlen(NULL,end-start+1));
+
+        if (o->encoding == REDIS_ENCODING_ROARING)
+            rbToBytes(o->ptr,range->ptr,start,end-start+1);
+        else
+            csGetRange(o->ptr,start,end-start+1,range->ptr);
+        addReplyBulk(c,range);
+        decrRefCount(range);
     } else {
         addReplyBulkCBuffer(c,(char*)str+start,end-start+1);
     }
@@ -487,11 +522,19 @@ void appendCommand(redisClient *c) {
         if (checkStringLength(c,totlen) != REDIS_OK)
             return;
 
-        /* Append the value */
+        /* Append the value. Long strings are chunked, so that appending
+         * never reallocates the data already in the string. */
         //追加命令字符串
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
-        o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
-        totlen = sdslen(o->ptr);
+        if (o->encoding == REDIS_ENCODING_CHUNKED ||
+            totlen > REDIS_STRING_CHUNKED_MIN_LEN)
+        {
+            o = dbUnshareChunkedStringValue(c->db,c->argv[1],o);
+            csAppend(o->ptr,append->ptr,sdslen(append->ptr));
+        } else {
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
+            o->ptr = sdscatlen(o->ptr,append->ptr,sdslen(append->ptr));
+        }
+        totlen = stringObjectLen(o);
     }
     
     //获取回复
@@ -38,7 +38,11 @@
  *
  * The elements are added to a hash table mapping Redis objects to scores.
  * At the same time the elements are added to a skip list mapping scores
- * to Redis objects (so objects are sorted by scores in this "view"). */
+ * to Redis objects (so objects are sorted by scores in this "view").
+ *
+ * Once a sorted set grows past zset-max-skiplist-entries the skip list is
+ * replaced by a B+tree (see zbtree.c), that keeps the elements in
+ * contiguous leaves instead of one heap node per element. */
 
 /* This skiplist implementation is almost a C translation of the original
  * algorithm described by William Pugh in "Skip Lists: A Probabilistic
@@ -629,7 +633,119 @@ zskiplistNode *zslLastInLexRange(zskiplist *zsl, zlexrangespec *range) {
 }
 
 /*-----------------------------------------------------------------------------
- * Ziplist-backed sorted set API
+ * B+tree-backed sorted set API
+ *----------------------------------------------------------------------------*/
+
+/* Predicates for zbtSeek(). They are false up to some element and true from
+ * there on, so we look for the first element >= min, and for the first
+ * element > max, whose previous element is the last one <= max. */
+static int zbtScoreGteMin(double score, void *obj, void *privdata) {
+    REDIS_NOTUSED(obj);
+    return zslValueGteMin(score,privdata);
+}
+
+static int zbtScoreGtMax(double score, void *obj, void *privdata) {
+    REDIS_NOTUSED(obj);
+    return !zslValueLteMax(score,privdata);
+}
+
+static int zbtLexGteMin(double score, void *obj, void *privdata) {
+    REDIS_NOTUSED(score);
+    return zslLexValueGteMin(obj,privdata);
+}
+
+static int zbtLexGtMax(double score, void *obj, void *privdata) {
+    REDIS_NOTUSED(score);
+    return !zslLexValueLteMax(obj,privdata);
+}
+
+/* Set 'it' to the first element in the specified range. Returns 0 when no
+ * element is contained in the range. */
+/* 定位到分值范围内的第一个元素 */
+int zbtFirstInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    if (!zbtSeek(zbt,zbtScoreGteMin,range,it)) return 0;
+    return zslValueLteMax(zbtIterScore(it),range);
+}
+
+/* Set 'it' to the last element in the specified range. Returns 0 when no
+ * element is contained in the range. */
+/* 定位到分值范围内的最后一个元素 */
+int zbtLastInRange(zbtree *zbt, zrangespec *range, zbtreeIter *it) {
+    if (zbtSeek(zbt,zbtScoreGtMax,range,it)) {
+        if (!zbtPrev(it)) return 0;
+    } else {
+        if (!zbtLast(zbt,it)) return 0;
+    }
+    return zslValueGteMin(zbtIterScore(it),range);
+}
+
+/* Same as zbtFirstInRange() for a lex range. */
+int zbtFirstInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    if (!zbtSeek(zbt,zbtLexGteMin,range,it)) return 0;
+    return zslLexValueLteMax(zbtIterObj(it),range);
+}
+
+/* Same as zbtLastInRange() for a lex range. */
+int zbtLastInLexRange(zbtree *zbt, zlexrangespec *range, zbtreeIter *it) {
+    if (zbtSeek(zbt,zbtLexGtMax,range,it)) {
+        if (!zbtPrev(it)) return 0;
+    } else {
+        if (!zbtLast(zbt,it)) return 0;
+    }
+    return zslLexValueGteMin(zbtIterObj(it),range);
+}
+
+/* Return the 1-based rank of the element at 'it'. */
+static unsigned long zbtIterRank(zbtree *zbt, zbtreeIter *it) {
+    return zbtGetRank(zbt,zbtIterScore(it),zbtIterObj(it));
+}
+
+/* Delete the elements with rank between start and end, 1-based and both
+ * inclusive, from the tree and from the dict of the sorted set. The
+ * elements of a range are adjacent in the leaves, so they are removed
+ * from the dict walking the range, then from the tree a leaf at a time. */
+/* 删除排名在start到end之间的元素，同时从字典中删除 */
+unsigned long zbtDeleteRangeByRankFromZset(zset *zs, unsigned long start, unsigned long end) {
+    zbtreeIter it;
+    unsigned long j;
+
+    redisAssert(zbtGetElementByRank(zs->zbt,start,&it));
+    for (j = start; j <= end; j++) {
+        /* The tree still has a reference, the element stays valid. */
+        dictDelete(zs->dict,zbtIterObj(&it));
+        zbtNext(&it);
+    }
+    return zbtDeleteRangeByRank(zs->zbt,start,end);
+}
+
+/* Delete all the elements with score in the specified range. */
+/* 删除分值范围内的所有元素 */
+unsigned long zbtDeleteRangeByScoreFromZset(zset *zs, zrangespec *range) {
+    zbtreeIter it;
+    unsigned long start, end;
+
+    if (!zbtFirstInRange(zs->zbt,range,&it)) return 0;
+    start = zbtIterRank(zs->zbt,&it);
+    redisAssert(zbtLastInRange(zs->zbt,range,&it));
+    end = zbtIterRank(zs->zbt,&it);
+    return zbtDeleteRangeByRankFromZset(zs,start,end);
+}
+
+/* Delete all the elements in the specified lex range. */
+/* 删除字典序范围内的所有元素 */
+unsigned long zbtDeleteRangeByLexFromZset(zset *zs, zlexrangespec *range) {
+    zbtreeIter it;
+    unsigned long start, end;
+
+    if (!zbtFirstInLexRange(zs->zbt,range,&it)) return 0;
+    start = zbtIterRank(zs->zbt,&it);
+    redisAssert(zbtLastInLexRange(zs->zbt,range,&it));
+    end = zbtIterRank(zs->zbt,&it);
+    return zbtDeleteRangeByRankFromZset(zs,start,end);
+}
+
+/*-----------------------------------------------------------------------------
+ * Listpack-backed sorted set API
  *----------------------------------------------------------------------------*/
 
 double zzlGetScore(unsigned char *sptr) {
@@ -640,7 +756,7 @@ double zzlGetScore(unsigned char *sptr) {
     double score;
 
     redisAssert(sptr != NULL);
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGetValue(sptr,&vstr,&vlen,&vlong));
 
     if (vstr) {
         memcpy(buf,vstr,vlen);
@@ -653,16 +769,16 @@ double zzlGetScore(unsigned char *sptr) {
     return score;
 }
 
-/* Return a ziplist element as a Redis string object.
+/* Return a listpack element as a Redis string object.
  * This simple abstraction can be used to simplifies some code at the
  * cost of some performance. */
-robj *ziplistGetObject(unsigned char *sptr) {
+robj *lpGetObject(unsigned char *sptr) {
     unsigned char *vstr;
     unsigned int vlen;
     long long vlong;
 
     redisAssert(sptr != NULL);
-    redisAssert(ziplistGet(sptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGetValue(sptr,&vstr,&vlen,&vlong));
 
     if (vstr) {
         return createStringObject((char*)vstr,vlen);
@@ -679,7 +795,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
     unsigned char vbuf[32];
     int minlen, cmp;
 
-    redisAssert(ziplistGet(eptr,&vstr,&vlen,&vlong));
+    redisAssert(lpGetValue(eptr,&vstr,&vlen,&vlong));
     if (vstr == NULL) {
         /* Store string representation of long long in buf. */
         vlen = ll2string((char*)vbuf,sizeof(vbuf),vlong);
@@ -693,7 +809,7 @@ int zzlCompareElements(unsigned char *eptr, unsigned char *cstr, unsigned int cl
 }
 
 unsigned int zzlLength(unsigned char *zl) {
-    return ziplistLen(zl)/2;
+    return lpLength(zl)/2;
 }
 
 /* Move to next entry based on the values in eptr and sptr. Both are set to
@@ -702,9 +818,9 @@ void zzlNext(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     redisAssert(*eptr != NULL && *sptr != NULL);
 
-    _eptr = ziplistNext(zl,*sptr);
+    _eptr = lpNext(zl,*sptr);
     if (_eptr != NULL) {
-        _sptr = ziplistNext(zl,_eptr);
+        _sptr = lpNext(zl,_eptr);
         redisAssert(_sptr != NULL);
     } else {
         /* No next entry. */
@@ -721,9 +837,9 @@ void zzlPrev(unsigned char *zl, unsigned char **eptr, unsigned char **sptr) {
     unsigned char *_eptr, *_sptr;
     redisAssert(*eptr != NULL && *sptr != NULL);
 
-    _sptr = ziplistPrev(zl,*eptr);
+    _sptr = lpPrev(zl,*eptr);
     if (_sptr != NULL) {
-        _eptr = ziplistPrev(zl,_sptr);
+        _eptr = lpPrev(zl,_sptr);
         redisAssert(_eptr != NULL);
     } else {
         /* No previous entry. */
@@ -745,13 +861,13 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
             (range->min == range->max && (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-1); /* Last score. */
+    p = lpSeek(zl,-1); /* Last score. */
     if (p == NULL) return 0; /* Empty sorted set */
     score = zzlGetScore(p);
     if (!zslValueGteMin(score,range))
         return 0;
 
-    p = ziplistIndex(zl,1); /* First score. */
+    p = lpSeek(zl,1); /* First score. */
     redisAssert(p != NULL);
     score = zzlGetScore(p);
     if (!zslValueLteMax(score,range))
@@ -763,14 +879,14 @@ int zzlIsInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the first element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -782,7 +898,7 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     return NULL;
@@ -791,14 +907,14 @@ unsigned char *zzlFirstInRange(unsigned char *zl, zrangespec *range) {
 /* Find pointer to the last element contained in the specified range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
     double score;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInRange(zl,range)) return NULL;
 
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssert(sptr != NULL);
 
         score = zzlGetScore(sptr);
@@ -811,9 +927,9 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -822,14 +938,14 @@ unsigned char *zzlLastInRange(unsigned char *zl, zrangespec *range) {
 }
 
 static int zzlLexValueGteMin(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = lpGetObject(p);
     int res = zslLexValueGteMin(value,spec);
     decrRefCount(value);
     return res;
 }
 
 static int zzlLexValueLteMax(unsigned char *p, zlexrangespec *spec) {
-    robj *value = ziplistGetObject(p);
+    robj *value = lpGetObject(p);
     int res = zslLexValueLteMax(value,spec);
     decrRefCount(value);
     return res;
@@ -846,12 +962,12 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
             (range->minex || range->maxex)))
         return 0;
 
-    p = ziplistIndex(zl,-2); /* Last element. */
+    p = lpSeek(zl,-2); /* Last element. */
     if (p == NULL) return 0;
     if (!zzlLexValueGteMin(p,range))
         return 0;
 
-    p = ziplistIndex(zl,0); /* First element. */
+    p = lpSeek(zl,0); /* First element. */
     redisAssert(p != NULL);
     if (!zzlLexValueLteMax(p,range))
         return 0;
@@ -862,7 +978,7 @@ int zzlIsInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the first element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -876,9 +992,9 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
         }
 
         /* Move to next element. */
-        sptr = ziplistNext(zl,eptr); /* This element score. Skip it. */
+        sptr = lpNext(zl,eptr); /* This element score. Skip it. */
         redisAssert(sptr != NULL);
-        eptr = ziplistNext(zl,sptr); /* Next element. */
+        eptr = lpNext(zl,sptr); /* Next element. */
     }
 
     return NULL;
@@ -887,7 +1003,7 @@ unsigned char *zzlFirstInLexRange(unsigned char *zl, zlexrangespec *range) {
 /* Find pointer to the last element contained in the specified lex range.
  * Returns NULL when no element is contained in the range. */
 unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
-    unsigned char *eptr = ziplistIndex(zl,-2), *sptr;
+    unsigned char *eptr = lpSeek(zl,-2), *sptr;
 
     /* If everything is out of range, return early. */
     if (!zzlIsInLexRange(zl,range)) return NULL;
@@ -902,9 +1018,9 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 
         /* Move to previous element by moving to the score of previous element.
          * When this returns NULL, we know there also is no element. */
-        sptr = ziplistPrev(zl,eptr);
+        sptr = lpPrev(zl,eptr);
         if (sptr != NULL)
-            redisAssert((eptr = ziplistPrev(zl,sptr)) != NULL);
+            redisAssert((eptr = lpPrev(zl,sptr)) != NULL);
         else
             eptr = NULL;
     }
@@ -913,14 +1029,14 @@ unsigned char *zzlLastInLexRange(unsigned char *zl, zlexrangespec *range) {
 }
 
 unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
 
-        if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
+        if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr))) {
             /* Matching element, pull out score. */
             if (score != NULL) *score = zzlGetScore(sptr);
             decrRefCount(ele);
@@ -928,58 +1044,52 @@ unsigned char *zzlFind(unsigned char *zl, robj *ele, double *score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     decrRefCount(ele);
     return NULL;
 }
 
-/* Delete (element,score) pair from ziplist. Use local copy of eptr because we
+/* Delete (element,score) pair from listpack. Use local copy of eptr because we
  * don't want to modify the one given as argument. */
 unsigned char *zzlDelete(unsigned char *zl, unsigned char *eptr) {
     unsigned char *p = eptr;
 
-    /* TODO: add function to ziplist API to delete N elements from offset. */
-    zl = ziplistDelete(zl,&p);
-    zl = ziplistDelete(zl,&p);
+    zl = lpDeleteRangeWithEntry(zl,&p,2);
     return zl;
 }
 
 unsigned char *zzlInsertAt(unsigned char *zl, unsigned char *eptr, robj *ele, double score) {
-    unsigned char *sptr;
     char scorebuf[128];
     int scorelen;
-    size_t offset;
 
-    redisAssertWithInfo(NULL,ele,ele->encoding == REDIS_ENCODING_RAW);
+    redisAssertWithInfo(NULL,ele,sdsEncodedObject(ele));
     scorelen = d2string(scorebuf,sizeof(scorebuf),score);
     if (eptr == NULL) {
-        zl = ziplistPush(zl,ele->ptr,sdslen(ele->ptr),ZIPLIST_TAIL);
-        zl = ziplistPush(zl,(unsigned char*)scorebuf,scorelen,ZIPLIST_TAIL);
+        zl = lpAppend(zl,ele->ptr,sdslen(ele->ptr));
+        zl = lpAppend(zl,(unsigned char*)scorebuf,scorelen);
     } else {
-        /* Keep offset relative to zl, as it might be re-allocated. */
-        offset = eptr-zl;
-        zl = ziplistInsert(zl,eptr,ele->ptr,sdslen(ele->ptr));
-        eptr = zl+offset;
+        /* Insert the element before eptr, lpInsert() returns its new
+         * address as the listpack might be re-allocated. */
+        zl = lpInsert(zl,ele->ptr,sdslen(ele->ptr),eptr,LP_BEFORE,&eptr);
 
         /* Insert score after the element. */
-        redisAssertWithInfo(NULL,ele,(sptr = ziplistNext(zl,eptr)) != NULL);
-        zl = ziplistInsert(zl,sptr,(unsigned char*)scorebuf,scorelen);
+        zl = lpInsert(zl,(unsigned char*)scorebuf,scorelen,eptr,LP_AFTER,NULL);
     }
 
     return zl;
 }
 
-/* Insert (element,score) pair in ziplist. This function assumes the element is
+/* Insert (element,score) pair in listpack. This function assumes the element is
  * not yet present in the list. */
 unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
-    unsigned char *eptr = ziplistIndex(zl,0), *sptr;
+    unsigned char *eptr = lpSeek(zl,0), *sptr;
     double s;
 
     ele = getDecodedObject(ele);
     while (eptr != NULL) {
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,ele,sptr != NULL);
         s = zzlGetScore(sptr);
 
@@ -998,7 +1108,7 @@ unsigned char *zzlInsert(unsigned char *zl, robj *ele, double score) {
         }
 
         /* Move to next element. */
-        eptr = ziplistNext(zl,sptr);
+        eptr = lpNext(zl,sptr);
     }
 
     /* Push on tail of list when it was not yet inserted. */
@@ -1019,14 +1129,12 @@ unsigned char *zzlDeleteRangeByScore(unsigned char *zl, zrangespec *range, unsig
     eptr = zzlFirstInRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr is set to NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         score = zzlGetScore(sptr);
         if (zslValueLteMax(score,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1047,13 +1155,11 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
     eptr = zzlFirstInLexRange(zl,range);
     if (eptr == NULL) return zl;
 
-    /* When the tail of the ziplist is deleted, eptr will point to the sentinel
-     * byte and ziplistNext will return NULL. */
-    while ((sptr = ziplistNext(zl,eptr)) != NULL) {
+    /* When the tail of the listpack is deleted, eptr is set to NULL. */
+    while (eptr && (sptr = lpNext(zl,eptr)) != NULL) {
         if (zzlLexValueLteMax(eptr,range)) {
             /* Delete both the element and the score. */
-            zl = ziplistDelete(zl,&eptr);
-            zl = ziplistDelete(zl,&eptr);
+            zl = lpDeleteRangeWithEntry(zl,&eptr,2);
             num++;
         } else {
             /* No longer in range. */
@@ -1070,7 +1176,7 @@ unsigned char *zzlDeleteRangeByLex(unsigned char *zl, zlexrangespec *range, unsi
 unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsigned int end, unsigned long *deleted) {
     unsigned int num = (end-start)+1;
     if (deleted) *deleted = num;
-    zl = ziplistDeleteRange(zl,2*(start-1),2*num);
+    zl = lpDeleteRange(zl,2*(start-1),2*num);
     return zl;
 }
 
@@ -1080,10 +1186,12 @@ unsigned char *zzlDeleteRangeByRank(unsigned char *zl, unsigned int start, unsig
 
 unsigned int zsetLength(robj *zobj) {
     int length = -1;
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         length = zzlLength(zobj->ptr);
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
         length = ((zset*)zobj->ptr)->zsl->length;
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        length = ((zset*)zobj->ptr)->zbt->length;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1097,28 +1205,30 @@ void zsetConvert(robj *zobj, int encoding) {
     double score;
 
     if (zobj->encoding == encoding) return;
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
         unsigned int vlen;
         long long vlong;
 
-        if (encoding != REDIS_ENCODING_SKIPLIST)
+        if (encoding != REDIS_ENCODING_SKIPLIST &&
+            encoding != REDIS_ENCODING_BTREE)
             redisPanic("Unknown target encoding");
 
         zs = zmalloc(sizeof(*zs));
         zs->dict = dictCreate(&zsetDictType,NULL);
         zs->zsl = zslCreate();
+        zs->zbt = NULL;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(NULL,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(NULL,zobj,sptr != NULL);
 
         while (eptr != NULL) {
             score = zzlGetScore(sptr);
-            redisAssertWithInfo(NULL,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(NULL,zobj,lpGetValue(eptr,&vstr,&vlen,&vlong));
             if (vstr == NULL)
                 ele = createStringObjectFromLongLong(vlong);
             else
@@ -1131,17 +1241,48 @@ void zsetConvert(robj *zobj, int encoding) {
             zzlNext(zl,&eptr,&sptr);
         }
 
-        zfree(zobj->ptr);
+        lpFree(zobj->ptr);
         zobj->ptr = zs;
         zobj->encoding = REDIS_ENCODING_SKIPLIST;
+
+        /* This only happens loading a listpack with more elements than
+         * both limits, so simply go through the skiplist. */
+        if (encoding == REDIS_ENCODING_BTREE)
+            zsetConvert(zobj,encoding);
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST &&
+               encoding == REDIS_ENCODING_BTREE)
+    {
+        dictEntry *de;
+
+        /* The skiplist references of the elements are moved to the tree,
+         * and the scores from the nodes to the dict entries. The elements
+         * come in order, so every leaf is filled before the next one. */
+        zs = zobj->ptr;
+        zs->zbt = zbtCreate(&zsetBtreeType);
+        node = zs->zsl->header->level[0].forward;
+        zfree(zs->zsl->header);
+        zfree(zs->zsl);
+        zs->zsl = NULL;
+
+        while (node) {
+            zbtInsert(zs->zbt,node->score,node->obj);
+            de = dictFind(zs->dict,node->obj);
+            redisAssertWithInfo(NULL,zobj,de != NULL);
+            dictSetDoubleVal(de,node->score);
+
+            next = node->level[0].forward;
+            zfree(node);
+            node = next;
+        }
+        zobj->encoding = REDIS_ENCODING_BTREE;
     } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
-        unsigned char *zl = ziplistNew();
+        unsigned char *zl = lpNew();
 
-        if (encoding != REDIS_ENCODING_ZIPLIST)
+        if (encoding != REDIS_ENCODING_LISTPACK)
             redisPanic("Unknown target encoding");
 
         /* Approach similar to zslFree(), since we want to free the skiplist at
-         * the same time as creating the ziplist. */
+         * the same time as creating the listpack. */
         zs = zobj->ptr;
         dictRelease(zs->dict);
         node = zs->zsl->header->level[0].forward;
@@ -1160,7 +1301,26 @@ void zsetConvert(robj *zobj, int encoding) {
 
         zfree(zs);
         zobj->ptr = zl;
-        zobj->encoding = REDIS_ENCODING_ZIPLIST;
+        zobj->encoding = REDIS_ENCODING_LISTPACK;
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        unsigned char *zl = lpNew();
+        zbtreeIter it;
+        int ok;
+
+        if (encoding != REDIS_ENCODING_LISTPACK)
+            redisPanic("Unknown target encoding");
+
+        zs = zobj->ptr;
+        for (ok = zbtFirst(zs->zbt,&it); ok; ok = zbtNext(&it)) {
+            ele = getDecodedObject(zbtIterObj(&it));
+            zl = zzlInsertAt(zl,NULL,ele,zbtIterScore(&it));
+            decrRefCount(ele);
+        }
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        zobj->ptr = zl;
+        zobj->encoding = REDIS_ENCODING_LISTPACK;
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1203,7 +1363,7 @@ void zaddGenericCommand(redisClient *c, int incr) {
         {
             zobj = createZsetObject();
         } else {
-            zobj = createZsetZiplistObject();
+            zobj = createZsetListpackObject();
         }
         dbAdd(c->db,key,zobj);
     } else {
@@ -1216,10 +1376,10 @@ void zaddGenericCommand(redisClient *c, int incr) {
     for (j = 0; j < elements; j++) {
         score = scores[j];
 
-        if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
             unsigned char *eptr;
 
-            /* Prefer non-encoded element when dealing with ziplists. */
+            /* Prefer non-encoded element when dealing with listpacks. */
             ele = c->argv[3+j*2];
             if ((eptr = zzlFind(zobj->ptr,ele,&curscore)) != NULL) {
                 if (incr) {
@@ -1248,7 +1408,9 @@ void zaddGenericCommand(redisClient *c, int incr) {
                 server.dirty++;
                 added++;
             }
-        } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+        } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+                   zobj->encoding == REDIS_ENCODING_BTREE)
+        {
             zset *zs = zobj->ptr;
             zskiplistNode *znode;
             dictEntry *de;
@@ -1257,7 +1419,7 @@ void zaddGenericCommand(redisClient *c, int incr) {
             de = dictFind(zs->dict,ele);
             if (de != NULL) {
                 curobj = dictGetKey(de);
-                curscore = *(double*)dictGetVal(de);
+                curscore = zsetDictScore(zobj,de);
 
                 if (incr) {
                     score += curscore;
@@ -1273,18 +1435,36 @@ void zaddGenericCommand(redisClient *c, int incr) {
                  * delete the key object from the skiplist, since the
                  * dictionary still has a reference to it. */
                 if (score != curscore) {
-                    redisAssertWithInfo(c,curobj,zslDelete(zs->zsl,curscore,curobj));
-                    znode = zslInsert(zs->zsl,score,curobj);
-                    incrRefCount(curobj); /* Re-inserted in skiplist. */
-                    dictGetVal(de) = &znode->score; /* Update score ptr. */
+                    if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+                        redisAssertWithInfo(c,curobj,zslDelete(zs->zsl,curscore,curobj));
+                        znode = zslInsert(zs->zsl,score,curobj);
+                        incrRefCount(curobj); /* Re-inserted in skiplist. */
+                        dictGetVal(de) = &znode->score; /* Update score ptr. */
+                    } else {
+                        redisAssertWithInfo(c,curobj,zbtDelete(zs->zbt,curscore,curobj));
+                        zbtInsert(zs->zbt,score,curobj);
+                        incrRefCount(curobj); /* Re-inserted in the tree. */
+                        dictSetDoubleVal(de,score);
+                    }
                     server.dirty++;
                     updated++;
                 }
             } else {
-                znode = zslInsert(zs->zsl,score,ele);
-                incrRefCount(ele); /* Inserted in skiplist. */
-                redisAssertWithInfo(c,NULL,dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
-                incrRefCount(ele); /* Added to dictionary. */
+                if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+                    znode = zslInsert(zs->zsl,score,ele);
+                    incrRefCount(ele); /* Inserted in skiplist. */
+                    redisAssertWithInfo(c,NULL,dictAdd(zs->dict,ele,&znode->score) == DICT_OK);
+                    incrRefCount(ele); /* Added to dictionary. */
+                    if (zs->zsl->length > server.zset_max_skiplist_entries)
+                        zsetConvert(zobj,REDIS_ENCODING_BTREE);
+                } else {
+                    zbtInsert(zs->zbt,score,ele);
+                    incrRefCount(ele); /* Inserted in the tree. */
+                    de = dictAddRaw(zs->dict,ele);
+                    redisAssertWithInfo(c,NULL,de != NULL);
+                    dictSetDoubleVal(de,score);
+                    incrRefCount(ele); /* Added to dictionary. */
+                }
                 server.dirty++;
                 added++;
             }
@@ -1322,7 +1502,7 @@ void zremCommand(redisClient *c) {
     if ((zobj = lookupKeyWriteOrReply(c,key,shared.czero)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *eptr;
 
         for (j = 2; j < c->argc; j++) {
@@ -1336,7 +1516,9 @@ void zremCommand(redisClient *c) {
                 }
             }
         }
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
         double score;
@@ -1346,9 +1528,12 @@ void zremCommand(redisClient *c) {
             if (de != NULL) {
                 deleted++;
 
-                /* Delete from the skiplist */
-                score = *(double*)dictGetVal(de);
-                redisAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
+                /* Delete from the skiplist or the tree */
+                score = zsetDictScore(zobj,de);
+                if (zobj->encoding == REDIS_ENCODING_SKIPLIST)
+                    redisAssertWithInfo(c,c->argv[j],zslDelete(zs->zsl,score,c->argv[j]));
+                else
+                    redisAssertWithInfo(c,c->argv[j],zbtDelete(zs->zbt,score,c->argv[j]));
 
                 /* Delete from the hash table */
                 dictDelete(zs->dict,c->argv[j]);
@@ -1425,7 +1610,7 @@ void zremrangeGenericCommand(redisClient *c, int rangetype) {
     }
 
     /* Step 3: Perform the range deletion operation. */
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         switch(rangetype) {
         case ZRANGE_RANK:
             zobj->ptr = zzlDeleteRangeByRank(zobj->ptr,start+1,end+1,&deleted);
@@ -1459,6 +1644,24 @@ void zremrangeGenericCommand(redisClient *c, int rangetype) {
             dbDelete(c->db,key);
             keyremoved = 1;
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        switch(rangetype) {
+        case ZRANGE_RANK:
+            deleted = zbtDeleteRangeByRankFromZset(zs,start+1,end+1);
+            break;
+        case ZRANGE_SCORE:
+            deleted = zbtDeleteRangeByScoreFromZset(zs,&range);
+            break;
+        case ZRANGE_LEX:
+            deleted = zbtDeleteRangeByLexFromZset(zs,&lexrange);
+            break;
+        }
+        if (htNeedsResize(zs->dict)) dictResize(zs->dict);
+        if (dictSize(zs->dict) == 0) {
+            dbDelete(c->db,key);
+            keyremoved = 1;
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -1520,6 +1723,11 @@ typedef struct {
                 zset *zs;
                 zskiplistNode *node;
             } sl;
+            struct {
+                zset *zs;
+                zbtreeIter it;
+                int valid;
+            } bt;
         } zset;
     } iter;
 } zsetopsrc;
@@ -1539,6 +1747,8 @@ typedef struct {
 typedef struct {
     int flags;
     unsigned char _buf[32]; /* Private buffer. */
+    sds _sds;               /* Private string, reused across zuiNext(). */
+    robj _obj;              /* Private object, see zuiLookupObjectFromValue(). */
     robj *ele;
     unsigned char *estr;
     unsigned int elen;
@@ -1567,16 +1777,19 @@ void zuiInitIterator(zsetopsrc *op) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             it->zl.zl = op->subject->ptr;
-            it->zl.eptr = ziplistIndex(it->zl.zl,0);
+            it->zl.eptr = lpSeek(it->zl.zl,0);
             if (it->zl.eptr != NULL) {
-                it->zl.sptr = ziplistNext(it->zl.zl,it->zl.eptr);
+                it->zl.sptr = lpNext(it->zl.zl,it->zl.eptr);
                 redisAssert(it->zl.sptr != NULL);
             }
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             it->sl.zs = op->subject->ptr;
             it->sl.node = it->sl.zs->zsl->header->level[0].forward;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            it->bt.zs = op->subject->ptr;
+            it->bt.valid = zbtFirst(it->bt.zs->zbt,&it->bt.it);
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1600,10 +1813,12 @@ void zuiClearIterator(zsetopsrc *op) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             REDIS_NOTUSED(it); /* skip */
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             REDIS_NOTUSED(it); /* skip */
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            REDIS_NOTUSED(it); /* skip */
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1626,11 +1841,14 @@ int zuiLength(zsetopsrc *op) {
             redisPanic("Unknown set encoding");
         }
     } else if (op->type == REDIS_ZSET) {
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             return zzlLength(op->subject->ptr);
         } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
             zset *zs = op->subject->ptr;
             return zs->zsl->length;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            zset *zs = op->subject->ptr;
+            return zs->zbt->length;
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1643,13 +1861,17 @@ int zuiLength(zsetopsrc *op) {
  * and move to the next element. If not valid, this means we have reached the
  * end of the structure and can abort. */
 int zuiNext(zsetopsrc *op, zsetopval *val) {
+    sds buf;
+
     if (op->subject == NULL)
         return 0;
 
     if (val->flags & OPVAL_DIRTY_ROBJ)
         decrRefCount(val->ele);
 
+    buf = val->_sds;
     memset(val,0,sizeof(zsetopval));
+    val->_sds = buf;
 
     if (op->type == REDIS_SET) {
         iterset *it = &op->iter.set;
@@ -1676,11 +1898,11 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
         }
     } else if (op->type == REDIS_ZSET) {
         iterzset *it = &op->iter.zset;
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
             /* No need to check both, but better be explicit. */
             if (it->zl.eptr == NULL || it->zl.sptr == NULL)
                 return 0;
-            redisAssert(ziplistGet(it->zl.eptr,&val->estr,&val->elen,&val->ell));
+            redisAssert(lpGetValue(it->zl.eptr,&val->estr,&val->elen,&val->ell));
             val->score = zzlGetScore(it->zl.sptr);
 
             /* Move to next element. */
@@ -1693,6 +1915,14 @@ int zuiNext(zsetopsrc *op, zsetopval *val) {
 
             /* Move to next element. */
             it->sl.node = it->sl.node->level[0].forward;
+        } else if (op->encoding == REDIS_ENCODING_BTREE) {
+            if (!it->bt.valid)
+                return 0;
+            val->ele = zbtIterObj(&it->bt.it);
+            val->score = zbtIterScore(&it->bt.it);
+
+            /* Move to next element. */
+            it->bt.valid = zbtNext(&it->bt.it);
         } else {
             redisPanic("Unknown sorted set encoding");
         }
@@ -1710,7 +1940,7 @@ int zuiLongLongFromValue(zsetopval *val) {
             if (val->ele->encoding == REDIS_ENCODING_INT) {
                 val->ell = (long)val->ele->ptr;
                 val->flags |= OPVAL_VALID_LL;
-            } else if (val->ele->encoding == REDIS_ENCODING_RAW) {
+            } else if (sdsEncodedObject(val->ele)) {
                 if (string2ll(val->ele->ptr,sdslen(val->ele->ptr),&val->ell))
                     val->flags |= OPVAL_VALID_LL;
             } else {
@@ -1729,7 +1959,9 @@ int zuiLongLongFromValue(zsetopval *val) {
 
 robj *zuiObjectFromValue(zsetopval *val) {
     if (val->ele == NULL) {
-        if (val->estr != NULL) {
+        /* An integer may have been printed in _buf by zuiBufferFromValue(),
+         * still create the shared or integer encoded object for it. */
+        if (val->estr != NULL && val->estr != val->_buf) {
             val->ele = createStringObject((char*)val->estr,val->elen);
         } else {
             val->ele = createStringObjectFromLongLong(val->ell);
@@ -1745,7 +1977,7 @@ int zuiBufferFromValue(zsetopval *val) {
             if (val->ele->encoding == REDIS_ENCODING_INT) {
                 val->elen = ll2string((char*)val->_buf,sizeof(val->_buf),(long)val->ele->ptr);
                 val->estr = val->_buf;
-            } else if (val->ele->encoding == REDIS_ENCODING_RAW) {
+            } else if (sdsEncodedObject(val->ele)) {
                 val->elen = sdslen(val->ele->ptr);
                 val->estr = val->ele->ptr;
             } else {
@@ -1759,6 +1991,41 @@ int zuiBufferFromValue(zsetopval *val) {
     return 1;
 }
 
+/* Return an object to look up the value in a dict of Redis objects. Unlike
+ * zuiObjectFromValue() nothing is allocated for values coming from a
+ * listpack or an intset: the private object of 'val' points to the value,
+ * using the same encoding zuiObjectFromValue() would use so that the dict
+ * compares them cheaply. It is only valid until the next zuiNext(). */
+/* 返回用于在字典中查找的对象，不为listpack和intset中的元素创建新对象 */
+robj *zuiLookupObjectFromValue(zsetopval *val) {
+    if (val->ele != NULL) return val->ele;
+
+    val->_obj.type = REDIS_STRING;
+    val->_obj.refcount = 1;
+    if ((val->estr == NULL || val->estr == val->_buf) &&
+        val->ell >= LONG_MIN && val->ell <= LONG_MAX)
+    {
+        val->_obj.encoding = REDIS_ENCODING_INT;
+        val->_obj.ptr = (void*)((long)val->ell);
+    } else {
+        zuiBufferFromValue(val);
+        if (val->_sds == NULL) val->_sds = sdsempty();
+        val->_sds = sdscpylen(val->_sds,(char*)val->estr,val->elen);
+        val->_obj.encoding = REDIS_ENCODING_RAW;
+        val->_obj.ptr = val->_sds;
+    }
+    return &val->_obj;
+}
+
+/* Release the private string of 'val' once done with it. */
+/* 释放zsetopval中的私有字符串 */
+void zuiReleaseValue(zsetopval *val) {
+    if (val->flags & OPVAL_DIRTY_ROBJ)
+        decrRefCount(val->ele);
+    sdsfree(val->_sds);
+    memset(val,0,sizeof(zsetopval));
+}
+
 /* Find value pointed to by val in the source pointer to by op. When found,
  * return 1 and store its score in target. Return 0 otherwise. */
 int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
@@ -1777,8 +2044,7 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             }
         } else if (op->encoding == REDIS_ENCODING_HT) {
             dict *ht = op->subject->ptr;
-            zuiObjectFromValue(val);
-            if (dictFind(ht,val->ele) != NULL) {
+            if (dictFind(ht,zuiLookupObjectFromValue(val)) != NULL) {
                 *score = 1.0;
                 return 1;
             } else {
@@ -1788,20 +2054,27 @@ int zuiFind(zsetopsrc *op, zsetopval *val, double *score) {
             redisPanic("Unknown set encoding");
         }
     } else if (op->type == REDIS_ZSET) {
-        zuiObjectFromValue(val);
+        if (op->encoding == REDIS_ENCODING_LISTPACK) {
+            unsigned char *zl = op->subject->ptr;
+            unsigned char *eptr;
 
-        if (op->encoding == REDIS_ENCODING_ZIPLIST) {
-            if (zzlFind(op->subject->ptr,val->ele,score) != NULL) {
-                /* Score is already set by zzlFind. */
+            /* Compare the listpack entries with the value as a string,
+             * only the elements are compared skipping the scores. */
+            zuiBufferFromValue(val);
+            eptr = lpFind(zl,lpFirst(zl),val->estr,val->elen,1);
+            if (eptr != NULL) {
+                *score = zzlGetScore(lpNext(zl,eptr));
                 return 1;
             } else {
                 return 0;
             }
-        } else if (op->encoding == REDIS_ENCODING_SKIPLIST) {
+        } else if (op->encoding == REDIS_ENCODING_SKIPLIST ||
+                   op->encoding == REDIS_ENCODING_BTREE)
+        {
             zset *zs = op->subject->ptr;
             dictEntry *de;
-            if ((de = dictFind(zs->dict,val->ele)) != NULL) {
-                *score = *(double*)dictGetVal(de);
+            if ((de = dictFind(zs->dict,zuiLookupObjectFromValue(val))) != NULL) {
+                *score = zsetDictScore(op->subject,de);
                 return 1;
             } else {
                 return 0;
@@ -1840,17 +2113,216 @@ inline static void zunionInterAggregate(double *target, double val, int aggregat
     }
 }
 
+/* An element of the result of ZUNIONSTORE / ZINTERSTORE. The result is
+ * collected in an array that is sorted once and then turned into the
+ * destination sorted set, instead of inserting the elements one by one. */
+typedef struct {
+    robj *ele;
+    double score;
+} zsetopres;
+
+/* Return 1 if all the inputs are intsets. */
+static int zuiAllIntsets(zsetopsrc *src, long setnum) {
+    long j;
+
+    for (j = 0; j < setnum; j++) {
+        if (src[j].subject == NULL ||
+            src[j].type != REDIS_SET ||
+            src[j].encoding != REDIS_ENCODING_INTSET) return 0;
+    }
+    return 1;
+}
+
+/* Intersect inputs that are all intsets. Intsets are sorted by member, so
+ * a merge join walks every input once instead of searching every element
+ * of the smallest one in all the others. Store the elements in 'res' and
+ * return how many they are. */
+/* 所有输入都是有序的intset时，用归并的方式求交集 */
+static unsigned long zuiInterIntsets(zsetopsrc *src, long setnum, int aggregate, zsetopres *res) {
+    uint32_t *pos = zcalloc(sizeof(uint32_t)*setnum);
+    unsigned long reslen = 0;
+    int64_t value, other;
+    long j;
+
+    while (intsetGet(src[0].subject->ptr,pos[0]++,&value)) {
+        double score = src[0].weight;
+
+        if (isnan(score)) score = 0;
+        for (j = 1; j < setnum; j++) {
+            intset *is = src[j].subject->ptr;
+
+            /* Skip the members lower than the current one. */
+            while (intsetGet(is,pos[j],&other) && other < value) pos[j]++;
+            if (pos[j] == intsetLen(is)) goto done; /* Nothing else in common. */
+            if (other != value) break;
+            zunionInterAggregate(&score,src[j].weight,aggregate);
+        }
+
+        /* Only continue when present in every input. */
+        if (j == setnum) {
+            res[reslen].ele = createStringObjectFromLongLong(value);
+            res[reslen].score = score;
+            reslen++;
+        }
+    }
+
+done:
+    zfree(pos);
+    return reslen;
+}
+
+/* Intersect any kind of inputs, sorted by cardinality, the smallest one not
+ * empty: the elements of the smallest input are searched in all the others.
+ * Store the elements in 'res' and return how many they are. */
+/* 通用的求交集方式，在其他输入中查找最小输入的每个元素 */
+static unsigned long zuiInterGeneric(zsetopsrc *src, long setnum, int aggregate,
+                                     zsetopval *zval, zsetopres *res)
+{
+    unsigned long reslen = 0;
+    long j;
+
+    /* Precondition: as src[0] is non-empty and the inputs are ordered by
+     * size, all src[i > 0] are non-empty too. */
+    zuiInitIterator(&src[0]);
+    while (zuiNext(&src[0],zval)) {
+        double score, value;
+
+        score = src[0].weight * zval->score;
+        if (isnan(score)) score = 0;
+
+        for (j = 1; j < setnum; j++) {
+            /* It is not safe to access the zset we are iterating, so
+             * explicitly check for equal object. */
+            if (src[j].subject == src[0].subject) {
+                value = zval->score*src[j].weight;
+                zunionInterAggregate(&score,value,aggregate);
+            } else if (zuiFind(&src[j],zval,&value)) {
+                value *= src[j].weight;
+                zunionInterAggregate(&score,value,aggregate);
+            } else {
+                break;
+            }
+        }
+
+        /* Only continue when present in every input. */
+        if (j == setnum) {
+            robj *tmp = zuiObjectFromValue(zval);
+
+            incrRefCount(tmp); /* added to the result */
+            res[reslen].ele = tmp;
+            res[reslen].score = score;
+            reslen++;
+        }
+    }
+    zuiClearIterator(&src[0]);
+    return reslen;
+}
+
+/* Order the result like the skiplist does: by score, then by element. */
+static int zuiCompareResult(const void *r1, const void *r2) {
+    const zsetopres *a = r1, *b = r2;
+
+    if (a->score < b->score) return -1;
+    if (a->score > b->score) return 1;
+    return compareStringObjects(a->ele,b->ele);
+}
+
+/* Sort the 'len' elements of 'res' and create the destination sorted set
+ * with the encoding it would eventually get, taking over the references
+ * of the elements. The elements are appended in order: a skiplist is
+ * linked in a single pass keeping the last node of every level, without
+ * searching the insertion point of every element. */
+/* 对结果排序后直接构造目标有序集合，跳跃表按顺序一次链接完成 */
+static robj *zuiCreateFromResult(zsetopres *res, unsigned long len) {
+    size_t maxelelen = 0;
+    unsigned long j;
+    robj *zobj;
+    zset *zs;
+
+    qsort(res,len,sizeof(zsetopres),zuiCompareResult);
+
+    if (len <= server.zset_max_ziplist_entries) {
+        for (j = 0; j < len; j++) {
+            /* Don't care about integer-encoded strings. */
+            if (sdsEncodedObject(res[j].ele) &&
+                sdslen(res[j].ele->ptr) > maxelelen)
+                    maxelelen = sdslen(res[j].ele->ptr);
+        }
+    }
+
+    if (len <= server.zset_max_ziplist_entries &&
+        maxelelen <= server.zset_max_ziplist_value)
+    {
+        zobj = createZsetListpackObject();
+        for (j = 0; j < len; j++) {
+            robj *ele = getDecodedObject(res[j].ele);
+
+            zobj->ptr = zzlInsertAt(zobj->ptr,NULL,ele,res[j].score);
+            decrRefCount(ele);
+            decrRefCount(res[j].ele);
+        }
+    } else if (len > server.zset_max_skiplist_entries) {
+        dictEntry *de;
+
+        zobj = createZsetBtreeObject();
+        zs = zobj->ptr;
+        dictExpand(zs->dict,len);
+        for (j = 0; j < len; j++) {
+            zbtInsert(zs->zbt,res[j].score,res[j].ele);
+            de = dictAddRaw(zs->dict,res[j].ele);
+            dictSetDoubleVal(de,res[j].score);
+            incrRefCount(res[j].ele); /* added to dictionary */
+        }
+    } else {
+        zskiplistNode *update[ZSKIPLIST_MAXLEVEL], *x;
+        unsigned long rank[ZSKIPLIST_MAXLEVEL];
+        zskiplist *zsl;
+        int i, level;
+
+        zobj = createZsetObject();
+        zs = zobj->ptr;
+        zsl = zs->zsl;
+        dictExpand(zs->dict,len);
+        for (i = 0; i < ZSKIPLIST_MAXLEVEL; i++) {
+            update[i] = zsl->header;
+            rank[i] = 0;
+        }
+
+        for (j = 0; j < len; j++) {
+            level = zslRandomLevel();
+            if (level > zsl->level) zsl->level = level;
+            x = zslCreateNode(level,res[j].score,res[j].ele);
+            for (i = 0; i < level; i++) {
+                x->level[i].forward = NULL;
+                update[i]->level[i].forward = x;
+                update[i]->level[i].span = j+1-rank[i];
+                update[i] = x;
+                rank[i] = j+1;
+            }
+            x->backward = zsl->tail;
+            zsl->tail = x;
+            dictAdd(zs->dict,res[j].ele,&x->score);
+            incrRefCount(res[j].ele); /* added to dictionary */
+        }
+
+        /* The last node of every level spans up to the end of the list. */
+        for (i = 0; i < zsl->level; i++)
+            update[i]->level[i].span = len-rank[i];
+        zsl->length = len;
+    }
+    return zobj;
+}
+
 void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     int i, j;
     long setnum;
     int aggregate = REDIS_AGGR_SUM;
     zsetopsrc *src;
     zsetopval zval;
+    zsetopres *res = NULL;
+    unsigned long reslen = 0;
     robj *tmp;
-    unsigned int maxelelen = 0;
     robj *dstobj;
-    zset *dstzset;
-    zskiplistNode *znode;
     int touched = 0;
 
     /* expect setnum input keys to be given */
@@ -1932,50 +2404,18 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
      * algorithm's performance */
     qsort(src,setnum,sizeof(zsetopsrc),zuiCompareByCardinality);
 
-    dstobj = createZsetObject();
-    dstzset = dstobj->ptr;
     memset(&zval, 0, sizeof(zval));
 
     if (op == REDIS_OP_INTER) {
         /* Skip everything if the smallest input is empty. */
         if (zuiLength(&src[0]) > 0) {
-            /* Precondition: as src[0] is non-empty and the inputs are ordered
-             * by size, all src[i > 0] are non-empty too. */
-            zuiInitIterator(&src[0]);
-            while (zuiNext(&src[0],&zval)) {
-                double score, value;
-
-                score = src[0].weight * zval.score;
-                if (isnan(score)) score = 0;
-
-                for (j = 1; j < setnum; j++) {
-                    /* It is not safe to access the zset we are
-                     * iterating, so explicitly check for equal object. */
-                    if (src[j].subject == src[0].subject) {
-                        value = zval.score*src[j].weight;
-                        zunionInterAggregate(&score,value,aggregate);
-                    } else if (zuiFind(&src[j],&zval,&value)) {
-                        value *= src[j].weight;
-                        zunionInterAggregate(&score,value,aggregate);
-                    } else {
-                        break;
-                    }
-                }
+            /* The result can't be larger than the smallest input. */
+            res = zmalloc(sizeof(zsetopres)*zuiLength(&src[0]));
 
-                /* Only continue when present in every input. */
-                if (j == setnum) {
-                    tmp = zuiObjectFromValue(&zval);
-                    znode = zslInsert(dstzset->zsl,score,tmp);
-                    incrRefCount(tmp); /* added to skiplist */
-                    dictAdd(dstzset->dict,tmp,&znode->score);
-                    incrRefCount(tmp); /* added to dictionary */
-
-                    if (tmp->encoding == REDIS_ENCODING_RAW)
-                        if (sdslen(tmp->ptr) > maxelelen)
-                            maxelelen = sdslen(tmp->ptr);
-                }
-            }
-            zuiClearIterator(&src[0]);
+            if (zuiAllIntsets(src,setnum))
+                reslen = zuiInterIntsets(src,setnum,aggregate,res);
+            else
+                reslen = zuiInterGeneric(src,setnum,aggregate,&zval,res);
         }
     } else if (op == REDIS_OP_UNION) {
         dict *accumulator = dictCreate(&setDictType,NULL);
@@ -2000,18 +2440,12 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
                 score = src[i].weight * zval.score;
                 if (isnan(score)) score = 0;
 
-                /* Search for this element in the accumulating dictionary. */
-                de = dictFind(accumulator,zuiObjectFromValue(&zval));
+                /* Search for this element in the accumulating dictionary,
+                 * an object is only created if it has to be added. */
+                de = dictFind(accumulator,zuiLookupObjectFromValue(&zval));
                 /* If we don't have it, we need to create a new entry. */
                 if (de == NULL) {
                     tmp = zuiObjectFromValue(&zval);
-                    /* Remember the longest single element encountered,
-                     * to understand if it's possible to convert to ziplist
-                     * at the end. */
-                    if (tmp->encoding == REDIS_ENCODING_RAW) {
-                        if (sdslen(tmp->ptr) > maxelelen)
-                            maxelelen = sdslen(tmp->ptr);
-                    }
                     /* Add the element with its initial score. */
                     de = dictAddRaw(accumulator,tmp);
                     incrRefCount(tmp);
@@ -2029,21 +2463,16 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
             zuiClearIterator(&src[i]);
         }
 
-        /* Step 2: convert the dictionary into the final sorted set. */
+        /* Step 2: move the elements with their final score to the result
+         * array, the accumulator gives up its references when released. */
+        res = zmalloc(sizeof(zsetopres)*(dictSize(accumulator)+1));
         di = dictGetIterator(accumulator);
-
-        /* We now are aware of the final size of the resulting sorted set,
-         * let's resize the dictionary embedded inside the sorted set to the
-         * right size, in order to save rehashing time. */
-        dictExpand(dstzset->dict,dictSize(accumulator));
-
         while((de = dictNext(di)) != NULL) {
-            robj *ele = dictGetKey(de);
-            score = dictGetDoubleVal(de);
-            znode = zslInsert(dstzset->zsl,score,ele);
-            incrRefCount(ele); /* added to skiplist */
-            dictAdd(dstzset->dict,ele,&znode->score);
-            incrRefCount(ele); /* added to dictionary */
+            tmp = dictGetKey(de);
+            incrRefCount(tmp);
+            res[reslen].ele = tmp;
+            res[reslen].score = dictGetDoubleVal(de);
+            reslen++;
         }
         dictReleaseIterator(di);
 
@@ -2052,18 +2481,15 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
     } else {
         redisPanic("Unknown operator");
     }
+    zuiReleaseValue(&zval);
 
     if (dbDelete(c->db,dstkey)) {
         signalModifiedKey(c->db,dstkey);
         touched = 1;
         server.dirty++;
     }
-    if (dstzset->zsl->length) {
-        /* Convert to ziplist when in limits. */
-        if (dstzset->zsl->length <= server.zset_max_ziplist_entries &&
-            maxelelen <= server.zset_max_ziplist_value)
-                zsetConvert(dstobj,REDIS_ENCODING_ZIPLIST);
-
+    if (reslen) {
+        dstobj = zuiCreateFromResult(res,reslen);
         dbAdd(c->db,dstkey,dstobj);
         addReplyLongLong(c,zsetLength(dstobj));
         if (!touched) signalModifiedKey(c->db,dstkey);
@@ -2072,11 +2498,11 @@ void zunionInterGenericCommand(redisClient *c, robj *dstkey, int op) {
             dstkey,c->db->id);
         server.dirty++;
     } else {
-        decrRefCount(dstobj);
         addReply(c,shared.czero);
         if (touched)
             notifyKeyspaceEvent(REDIS_NOTIFY_GENERIC,"del",dstkey,c->db->id);
     }
+    zfree(res);
     zfree(src);
 }
 
@@ -2088,6 +2514,65 @@ void zinterstoreCommand(redisClient *c) {
     zunionInterGenericCommand(c,c->argv[1], REDIS_OP_INTER);
 }
 
+/* ZINTERCARD numkeys key [key ...] [LIMIT limit]
+ *
+ * Reply with the size of the intersection without building it. Like
+ * ZINTERSTORE the inputs may also be plain sets. The elements of the
+ * smallest input are searched in the others with zuiFind(), that does not
+ * allocate anything, and the scan stops once 'limit' are found. */
+void zintercardCommand(redisClient *c) {
+    zsetopsrc *src;
+    zsetopval zval;
+    long numkeys, limit, j;
+    unsigned long cardinality = 0;
+    double score;
+
+    if (getIntercardArgsOrReply(c,&numkeys,&limit) != REDIS_OK) return;
+
+    src = zcalloc(sizeof(zsetopsrc) * numkeys);
+    for (j = 0; j < numkeys; j++) {
+        robj *obj = lookupKeyRead(c->db,c->argv[j+2]);
+        if (obj != NULL) {
+            if (obj->type != REDIS_ZSET && obj->type != REDIS_SET) {
+                zfree(src);
+                addReply(c,shared.wrongtypeerr);
+                return;
+            }
+
+            src[j].subject = obj;
+            src[j].type = obj->type;
+            src[j].encoding = obj->encoding;
+        } else {
+            src[j].subject = NULL;
+        }
+        src[j].weight = 1.0;
+    }
+
+    /* Missing keys are empty inputs and sort first. */
+    qsort(src,numkeys,sizeof(zsetopsrc),zuiCompareByCardinality);
+
+    memset(&zval, 0, sizeof(zval));
+    if (zuiLength(&src[0]) > 0) {
+        zuiInitIterator(&src[0]);
+        while (zuiNext(&src[0],&zval)) {
+            for (j = 1; j < numkeys; j++) {
+                /* It is not safe to access the zset we are iterating. */
+                if (src[j].subject == src[0].subject) continue;
+                if (!zuiFind(&src[j],&zval,&score)) break;
+            }
+            if (j == numkeys) {
+                cardinality++;
+                if (limit && cardinality == (unsigned long)limit) break;
+            }
+        }
+        zuiClearIterator(&src[0]);
+    }
+    zuiReleaseValue(&zval);
+
+    addReplyLongLong(c,cardinality);
+    zfree(src);
+}
+
 void zrangeGenericCommand(redisClient *c, int reverse) {
     robj *key = c->argv[1];
     robj *zobj;
@@ -2128,7 +2613,7 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
     /* Return the result in form of a multi-bulk reply */
     addReplyMultiBulkLen(c, withscores ? (rangelen*2) : rangelen);
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2136,16 +2621,16 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
         long long vlong;
 
         if (reverse)
-            eptr = ziplistIndex(zl,-2-(2*start));
+            eptr = lpSeek(zl,-2-(2*start));
         else
-            eptr = ziplistIndex(zl,2*start);
+            eptr = lpSeek(zl,2*start);
 
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         while (rangelen--) {
             redisAssertWithInfo(c,zobj,eptr != NULL && sptr != NULL);
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(c,zobj,lpGetValue(eptr,&vstr,&vlen,&vlong));
             if (vstr == NULL)
                 addReplyBulkLongLong(c,vlong);
             else
@@ -2185,6 +2670,21 @@ void zrangeGenericCommand(redisClient *c, int reverse) {
                 addReplyDouble(c,ln->score);
             ln = reverse ? ln->backward : ln->level[0].forward;
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeIter it;
+
+        redisAssertWithInfo(c,zobj,zbtGetElementByRank(zs->zbt,
+            reverse ? llen-start : start+1,&it));
+
+        /* The range is contiguous in the leaves. */
+        while(rangelen--) {
+            addReplyBulk(c,zbtIterObj(&it));
+            if (withscores)
+                addReplyDouble(c,zbtIterScore(&it));
+            if (rangelen)
+                redisAssertWithInfo(c,zobj,reverse ? zbtPrev(&it) : zbtNext(&it));
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2248,7 +2748,7 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.emptymultibulk)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2271,7 +2771,7 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2298,8 +2798,8 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
                 if (!zslValueLteMax(score,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always succeed */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            /* We know the element exists, so lpGetValue should always succeed */
+            redisAssertWithInfo(c,zobj,lpGetValue(eptr,&vstr,&vlen,&vlong));
 
             rangelen++;
             if (vstr == NULL) {
@@ -2374,6 +2874,62 @@ void genericZrangebyscoreCommand(redisClient *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeIter it;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInRange(zs->zbt,&range,&it);
+        } else {
+            valid = zbtFirstInRange(zs->zbt,&range,&it);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* Jump over the offset by rank instead of walking it, the score of
+         * the element we land on is checked in the next loop. A negative
+         * offset walks past the end like in the other encodings. */
+        if (offset < 0) {
+            valid = 0;
+        } else if (offset > 0) {
+            unsigned long rank = zbtIterRank(zs->zbt,&it);
+
+            if (reverse)
+                valid = (unsigned long)offset < rank &&
+                        zbtGetElementByRank(zs->zbt,rank-offset,&it);
+            else
+                valid = zbtGetElementByRank(zs->zbt,rank+offset,&it);
+        }
+
+        while (valid && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslValueGteMin(zbtIterScore(&it),&range)) break;
+            } else {
+                if (!zslValueLteMax(zbtIterScore(&it),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtIterObj(&it));
+
+            if (withscores) {
+                addReplyDouble(c,zbtIterScore(&it));
+            }
+
+            /* Move to next element */
+            valid = reverse ? zbtPrev(&it) : zbtNext(&it);
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2409,7 +2965,7 @@ void zcountCommand(redisClient *c) {
     if ((zobj = lookupKeyReadOrReply(c, key, shared.czero)) == NULL ||
         checkType(c, zobj, REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         double score;
@@ -2424,7 +2980,7 @@ void zcountCommand(redisClient *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         score = zzlGetScore(sptr);
         redisAssertWithInfo(c,zobj,zslValueLteMax(score,&range));
 
@@ -2463,6 +3019,18 @@ void zcountCommand(redisClient *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeIter it;
+
+        /* The count is the difference of the ranks of the first and the
+         * last element in range. */
+        if (zbtFirstInRange(zs->zbt,&range,&it)) {
+            unsigned long first = zbtIterRank(zs->zbt,&it);
+
+            redisAssertWithInfo(c,zobj,zbtLastInRange(zs->zbt,&range,&it));
+            count = zbtIterRank(zs->zbt,&it)-first+1;
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2490,7 +3058,7 @@ void zlexcountCommand(redisClient *c) {
         return;
     }
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
@@ -2505,7 +3073,7 @@ void zlexcountCommand(redisClient *c) {
         }
 
         /* First element is in range */
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,zzlLexValueLteMax(eptr,&range));
 
         /* Iterate over elements in range */
@@ -2541,6 +3109,16 @@ void zlexcountCommand(redisClient *c) {
                 count -= (zsl->length - rank);
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeIter it;
+
+        if (zbtFirstInLexRange(zs->zbt,&range,&it)) {
+            unsigned long first = zbtIterRank(zs->zbt,&it);
+
+            redisAssertWithInfo(c,zobj,zbtLastInLexRange(zs->zbt,&range,&it));
+            count = zbtIterRank(zs->zbt,&it)-first+1;
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2600,7 +3178,7 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
         return;
     }
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
         unsigned char *vstr;
@@ -2623,7 +3201,7 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
 
         /* Get score pointer for the first element. */
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
 
         /* We don't know in advance how many matching elements there are in the
          * list, so we push this object that will represent the multi-bulk
@@ -2648,9 +3226,9 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
                 if (!zzlLexValueLteMax(eptr,&range)) break;
             }
 
-            /* We know the element exists, so ziplistGet should always
+            /* We know the element exists, so lpGetValue should always
              * succeed. */
-            redisAssertWithInfo(c,zobj,ziplistGet(eptr,&vstr,&vlen,&vlong));
+            redisAssertWithInfo(c,zobj,lpGetValue(eptr,&vstr,&vlen,&vlong));
 
             rangelen++;
             if (vstr == NULL) {
@@ -2718,6 +3296,57 @@ void genericZrangebylexCommand(redisClient *c, int reverse) {
                 ln = ln->level[0].forward;
             }
         }
+    } else if (zobj->encoding == REDIS_ENCODING_BTREE) {
+        zset *zs = zobj->ptr;
+        zbtreeIter it;
+        int valid;
+
+        /* If reversed, get the last element in range as starting point. */
+        if (reverse) {
+            valid = zbtLastInLexRange(zs->zbt,&range,&it);
+        } else {
+            valid = zbtFirstInLexRange(zs->zbt,&range,&it);
+        }
+
+        /* No "first" element in the specified interval. */
+        if (!valid) {
+            addReply(c, shared.emptymultibulk);
+            zslFreeLexRange(&range);
+            return;
+        }
+
+        /* We don't know in advance how many matching elements there are in the
+         * list, so we push this object that will represent the multi-bulk
+         * length in the output buffer, and will "fix" it later */
+        replylen = addDeferredMultiBulkLength(c);
+
+        /* Jump over the offset by rank, see genericZrangebyscoreCommand(). */
+        if (offset < 0) {
+            valid = 0;
+        } else if (offset > 0) {
+            unsigned long rank = zbtIterRank(zs->zbt,&it);
+
+            if (reverse)
+                valid = (unsigned long)offset < rank &&
+                        zbtGetElementByRank(zs->zbt,rank-offset,&it);
+            else
+                valid = zbtGetElementByRank(zs->zbt,rank+offset,&it);
+        }
+
+        while (valid && limit--) {
+            /* Abort when the element is no longer in range. */
+            if (reverse) {
+                if (!zslLexValueGteMin(zbtIterObj(&it),&range)) break;
+            } else {
+                if (!zslLexValueLteMax(zbtIterObj(&it),&range)) break;
+            }
+
+            rangelen++;
+            addReplyBulk(c,zbtIterObj(&it));
+
+            /* Move to next element */
+            valid = reverse ? zbtPrev(&it) : zbtNext(&it);
+        }
     } else {
         redisPanic("Unknown sorted set encoding");
     }
@@ -2752,19 +3381,21 @@ void zscoreCommand(redisClient *c) {
     if ((zobj = lookupKeyReadOrReply(c,key,shared.nullbulk)) == NULL ||
         checkType(c,zobj,REDIS_ZSET)) return;
 
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         if (zzlFind(zobj->ptr,c->argv[2],&score) != NULL)
             addReplyDouble(c,score);
         else
             addReply(c,shared.nullbulk);
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
         dictEntry *de;
 
         c->argv[2] = tryObjectEncoding(c->argv[2]);
         de = dictFind(zs->dict,c->argv[2]);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
+            score = zsetDictScore(zobj,de);
             addReplyDouble(c,score);
         } else {
             addReply(c,shared.nullbulk);
@@ -2785,19 +3416,19 @@ void zrankGenericCommand(redisClient *c, int reverse) {
         checkType(c,zobj,REDIS_ZSET)) return;
     llen = zsetLength(zobj);
 
-    redisAssertWithInfo(c,ele,ele->encoding == REDIS_ENCODING_RAW);
-    if (zobj->encoding == REDIS_ENCODING_ZIPLIST) {
+    redisAssertWithInfo(c,ele,sdsEncodedObject(ele));
+    if (zobj->encoding == REDIS_ENCODING_LISTPACK) {
         unsigned char *zl = zobj->ptr;
         unsigned char *eptr, *sptr;
 
-        eptr = ziplistIndex(zl,0);
+        eptr = lpSeek(zl,0);
         redisAssertWithInfo(c,zobj,eptr != NULL);
-        sptr = ziplistNext(zl,eptr);
+        sptr = lpNext(zl,eptr);
         redisAssertWithInfo(c,zobj,sptr != NULL);
 
         rank = 1;
         while(eptr != NULL) {
-            if (ziplistCompare(eptr,ele->ptr,sdslen(ele->ptr)))
+            if (lpCompare(eptr,ele->ptr,sdslen(ele->ptr)))
                 break;
             rank++;
             zzlNext(zl,&eptr,&sptr);
@@ -2811,17 +3442,21 @@ void zrankGenericCommand(redisClient *c, int reverse) {
         } else {
             addReply(c,shared.nullbulk);
         }
-    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST) {
+    } else if (zobj->encoding == REDIS_ENCODING_SKIPLIST ||
+               zobj->encoding == REDIS_ENCODING_BTREE)
+    {
         zset *zs = zobj->ptr;
-        zskiplist *zsl = zs->zsl;
         dictEntry *de;
         double score;
 
         ele = c->argv[2] = tryObjectEncoding(c->argv[2]);
         de = dictFind(zs->dict,ele);
         if (de != NULL) {
-            score = *(double*)dictGetVal(de);
-            rank = zslGetRank(zsl,score,ele);
+            score = zsetDictScore(zobj,de);
+            if (zobj->encoding == REDIS_ENCODING_BTREE)
+                rank = zbtGetRank(zs->zbt,score,ele);
+            else
+                rank = zslGetRank(zs->zsl,score,ele);
             redisAssertWithInfo(c,ele,rank); /* Existing elements always have a rank. */
             if (reverse)
                 addReplyLongLong(c,llen-rank);
@@ -2852,3 +3487,214 @@ void zscanCommand(redisClient *c) {
         checkType(c,o,REDIS_ZSET)) return;
     scanGenericCommand(c,o,cursor);
 }
+
+#ifdef ZSET_BENCHMARK_MAIN
+/* Build with:
+ *   cc -O2 -DZSET_BENCHMARK_MAIN -ffunction-sections -fdata-sections \
+ *      -Wl,--gc-sections -I../main -I../data -I../wrapper -I../tool \
+ *      -I../net -I../event t_zset.c sds.c dict.c listpack.c intset.c \
+ *      zbtree.c quicklist.c ziplist.c roaring.c chunkstr.c \
+ *      ../wrapper/object.c ../wrapper/zmalloc.c ../tool/util.c \
+ *      -lm -o zset-benchmark
+ *
+ * Only what is reachable from here is linked: the few server globals that
+ * it needs are defined below. The assertion handlers of debug.c would pull
+ * in the whole server, so they just abort.
+ *
+ * Times ZINTERSTORE and ZUNIONSTORE as they work now against the way they
+ * worked before: intsets intersected searching every element of the smallest
+ * one in the others, and the destination built inserting every element in a
+ * skiplist, then converted to its final encoding. */
+#include <sys/time.h>
+
+struct redisServer server;
+struct sharedObjectsStruct shared;
+
+static unsigned int benchObjHash(const void *key) {
+    robj *o = getDecodedObject((robj*)key);
+    unsigned int hash = dictGenHashFunction(o->ptr,sdslen(o->ptr));
+
+    decrRefCount(o);
+    return hash;
+}
+
+static int benchObjKeyCompare(void *privdata, const void *key1, const void *key2) {
+    DICT_NOTUSED(privdata);
+    return equalStringObjects((robj*)key1,(robj*)key2);
+}
+
+static void benchObjDestructor(void *privdata, void *val) {
+    DICT_NOTUSED(privdata);
+    decrRefCount(val);
+}
+
+dictType setDictType = {
+    benchObjHash, NULL, NULL, benchObjKeyCompare, benchObjDestructor, NULL
+};
+dictType zsetDictType = {
+    benchObjHash, NULL, NULL, benchObjKeyCompare, benchObjDestructor, NULL
+};
+
+static int benchBtreeCompare(void *a, void *b) {
+    return compareStringObjects(a,b);
+}
+
+static void benchBtreeRetain(void *obj) {
+    incrRefCount(obj);
+}
+
+static void benchBtreeRelease(void *obj) {
+    decrRefCount(obj);
+}
+
+zbtreeType zsetBtreeType = {
+    benchBtreeCompare, benchBtreeRetain, benchBtreeRelease
+};
+
+void _redisAssert(char *estr, char *file, int line) {
+    REDIS_NOTUSED(estr);
+    REDIS_NOTUSED(file);
+    REDIS_NOTUSED(line);
+    abort();
+}
+
+void _redisAssertWithInfo(redisClient *c, robj *o, char *estr, char *file, int line) {
+    REDIS_NOTUSED(c);
+    REDIS_NOTUSED(o);
+    _redisAssert(estr,file,line);
+}
+
+void _redisPanic(char *msg, char *file, int line) {
+    _redisAssert(msg,file,line);
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* The destination as it was built before zuiCreateFromResult(), taking
+ * over the references of the elements of 'res'. */
+static robj *benchOldCreate(zsetopres *res, unsigned long len) {
+    robj *zobj = createZsetObject();
+    zset *zs = zobj->ptr;
+    size_t maxelelen = 0;
+    unsigned long j;
+
+    dictExpand(zs->dict,len);
+    for (j = 0; j < len; j++) {
+        zskiplistNode *znode = zslInsert(zs->zsl,res[j].score,res[j].ele);
+
+        dictAdd(zs->dict,res[j].ele,&znode->score);
+        incrRefCount(res[j].ele); /* added to dictionary */
+        if (sdsEncodedObject(res[j].ele) &&
+            sdslen(res[j].ele->ptr) > maxelelen)
+                maxelelen = sdslen(res[j].ele->ptr);
+    }
+    if (len <= server.zset_max_ziplist_entries &&
+        maxelelen <= server.zset_max_ziplist_value)
+            zsetConvert(zobj,REDIS_ENCODING_LISTPACK);
+    else if (len > server.zset_max_skiplist_entries)
+            zsetConvert(zobj,REDIS_ENCODING_BTREE);
+    return zobj;
+}
+
+/* Build the destination from 'len' random elements both ways. */
+static void benchCreate(unsigned long len) {
+    zsetopres *res1 = zmalloc(sizeof(zsetopres)*len);
+    zsetopres *res2 = zmalloc(sizeof(zsetopres)*len);
+    long long start, told, tnew;
+    unsigned long j;
+    robj *o1, *o2;
+
+    for (j = 0; j < len; j++) {
+        char buf[32];
+        int buflen = snprintf(buf,sizeof(buf),"element:%lu",j);
+
+        res1[j].ele = createStringObject(buf,buflen);
+        res1[j].score = rand() % (len*4);
+        res2[j] = res1[j];
+        incrRefCount(res2[j].ele);
+    }
+    start = usec();
+    o1 = benchOldCreate(res1,len);
+    told = usec()-start;
+    start = usec();
+    o2 = zuiCreateFromResult(res2,len);
+    tnew = usec()-start;
+    printf("create %8lu elements (%-8s): old %8lld usec, new %8lld usec\n",
+        len,strEncoding(o2->encoding),told,tnew);
+    decrRefCount(o1);
+    decrRefCount(o2);
+    zfree(res1);
+    zfree(res2);
+}
+
+/* Intersect 'setnum' intsets of 'len' random members each both ways. */
+static void benchInterIntsets(long setnum, unsigned long len) {
+    zsetopsrc *src = zcalloc(sizeof(zsetopsrc)*setnum);
+    zsetopres *res1 = zmalloc(sizeof(zsetopres)*len);
+    zsetopres *res2 = zmalloc(sizeof(zsetopres)*len);
+    unsigned long len1, len2, j;
+    long long start, told, tnew;
+    zsetopval zval;
+    robj *o1, *o2;
+    long i;
+
+    for (i = 0; i < setnum; i++) {
+        src[i].subject = createIntsetObject();
+        src[i].type = REDIS_SET;
+        src[i].encoding = REDIS_ENCODING_INTSET;
+        src[i].weight = 1.0+i;
+        /* Members in ascending order are appended, not inserted: about
+         * half of the values of 0..len*2 are taken. */
+        for (j = 0; intsetLen(src[i].subject->ptr) < len; j++) {
+            if (rand() % (len*2-j) < len-intsetLen(src[i].subject->ptr))
+                src[i].subject->ptr = intsetAdd(src[i].subject->ptr,j,NULL);
+        }
+    }
+    memset(&zval,0,sizeof(zval));
+
+    start = usec();
+    len1 = zuiInterGeneric(src,setnum,REDIS_AGGR_SUM,&zval,res1);
+    o1 = benchOldCreate(res1,len1);
+    told = usec()-start;
+    start = usec();
+    len2 = zuiInterIntsets(src,setnum,REDIS_AGGR_SUM,res2);
+    o2 = zuiCreateFromResult(res2,len2);
+    tnew = usec()-start;
+    printf("inter %ld x %8lu intset members (%8lu/%8lu found): "
+        "old %8lld usec, new %8lld usec\n",setnum,len,len1,len2,told,tnew);
+
+    zuiReleaseValue(&zval);
+    decrRefCount(o1);
+    decrRefCount(o2);
+    for (j = 0; j < (unsigned long)setnum; j++) decrRefCount(src[j].subject);
+    zfree(src);
+    zfree(res1);
+    zfree(res2);
+}
+
+int main(void) {
+    int j;
+
+    server.zset_max_ziplist_entries = REDIS_ZSET_MAX_ZIPLIST_ENTRIES;
+    server.zset_max_ziplist_value = REDIS_ZSET_MAX_ZIPLIST_VALUE;
+    server.zset_max_skiplist_entries = REDIS_ZSET_MAX_SKIPLIST_ENTRIES;
+    for (j = 0; j < REDIS_SHARED_INTEGERS; j++) {
+        shared.integers[j] = createObject(REDIS_STRING,(void*)(long)j);
+        shared.integers[j]->encoding = REDIS_ENCODING_INT;
+    }
+    srand(1234);
+
+    benchCreate(100);
+    benchCreate(10000);
+    benchCreate(60000);
+    benchCreate(1000000);
+    benchInterIntsets(2,1000);
+    benchInterIntsets(3,100000);
+    benchInterIntsets(3,1000000);
+    return 0;
+}
+#endif
@@ -0,0 +1,844 @@
+/* zbtree.c - A B+tree of (score, element) pairs with subtree counts
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* The zbtree is the ordered index of sorted sets too big for a skiplist to
+ * be a good fit. A skiplist allocates a node per element, and walking a
+ * range follows a pointer to a different place of the heap for every
+ * element. Here the elements are stored ZBTREE_NODE_SIZE at a time in the
+ * leaves, scores and element pointers in two arrays, and the leaves are
+ * linked together, so a range is read sequentially, one node after the
+ * other, and finding a score is a binary search in a few nodes.
+ *
+ * zbtree是元素较多的有序集合使用的B+树，每个叶子结点连续保存多个元素的分值和
+ * 指针，范围遍历时顺序访问内存，不需要像跳跃表一样每个元素访问一个结点。
+ *
+ * Every inner node stores the number of elements of each of its subtrees,
+ * so the rank of an element, or the element at a given rank, is found
+ * summing the counts on the way down, in O(log(N)) like the spans of the
+ * skiplist.
+ *
+ * Separators are never updated when an element is deleted: they keep a
+ * reference to the element, so they stay valid and still separate the
+ * children. They are only replaced when entries move between two nodes.
+ *
+ * 分隔键持有元素的引用，删除元素时不需要更新。 */
+
+#include <string.h>
+#include "zmalloc.h"
+#include "zbtree.h"
+#include "redisassert.h"
+
+#define LEAF(x) ((zbtreeLeaf*)(x))
+#define INNER(x) ((zbtreeInner*)(x))
+
+/* Compare the entry 'i' of the node 'x' with the pair (score, obj). */
+/* 比较结点x的第i项与(score, obj)的大小 */
+static int zbtCompare(zbtree *zbt, zbtreeNode *x, int i, double score, void *obj) {
+    if (x->score[i] < score) return -1;
+    if (x->score[i] > score) return 1;
+    return zbt->type->compare(x->obj[i],obj);
+}
+
+static zbtreeNode *zbtCreateLeaf(void) {
+    zbtreeLeaf *l = zmalloc(sizeof(*l));
+
+    l->node.leaf = 1;
+    l->node.n = 0;
+    l->prev = l->next = NULL;
+    return &l->node;
+}
+
+static zbtreeNode *zbtCreateInner(void) {
+    zbtreeInner *in = zmalloc(sizeof(*in));
+
+    in->node.leaf = 0;
+    in->node.n = 0;
+    return &in->node;
+}
+
+/* Create a new, empty tree. The root is an empty leaf. */
+/* 创建空的B+树，根结点为空的叶子结点 */
+zbtree *zbtCreate(zbtreeType *type) {
+    zbtree *zbt = zmalloc(sizeof(*zbt));
+
+    zbt->type = type;
+    zbt->root = zbtCreateLeaf();
+    zbt->head = zbt->tail = LEAF(zbt->root);
+    zbt->length = 0;
+    zbt->height = 1;
+    return zbt;
+}
+
+static void zbtFreeNode(zbtree *zbt, zbtreeNode *x) {
+    unsigned int j;
+
+    for (j = 0; j < x->n; j++) {
+        if (x->obj[j]) zbt->type->release(x->obj[j]);
+        if (!x->leaf) zbtFreeNode(zbt,INNER(x)->child[j]);
+    }
+    zfree(x);
+}
+
+/* Free the tree, releasing every element and separator. */
+/* 释放B+树，释放所有元素和分隔键的引用 */
+void zbtFree(zbtree *zbt) {
+    zbtFreeNode(zbt,zbt->root);
+    zfree(zbt);
+}
+
+/* Return the number of elements in the subtree rooted at 'x'. */
+/* 返回子树中的元素个数 */
+static unsigned long zbtNodeCount(zbtreeNode *x) {
+    unsigned long count = 0;
+    unsigned int j;
+
+    if (x->leaf) return x->n;
+    for (j = 0; j < x->n; j++) count += INNER(x)->count[j];
+    return count;
+}
+
+/* Return the index of the first element of the leaf 'x' that is greater or
+ * equal than (score, obj), or x->n if there is none. */
+/* 二分查找叶子结点中第一个不小于(score, obj)的元素 */
+static int zbtLeafSearch(zbtree *zbt, zbtreeNode *x, double score, void *obj) {
+    int lo = 0, hi = x->n;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(zbt,x,mid,score,obj) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* Return the index of the child of the inner node 'x' where (score, obj)
+ * belongs: the last one whose separator is lower or equal than it. */
+/* 二分查找(score, obj)所在的子结点，即最后一个分隔键不大于它的子结点 */
+static int zbtChildIndex(zbtree *zbt, zbtreeNode *x, double score, void *obj) {
+    int lo = 1, hi = x->n;
+
+    while (lo < hi) {
+        int mid = (lo+hi)/2;
+        if (zbtCompare(zbt,x,mid,score,obj) <= 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo-1;
+}
+
+/* Copy 'count' entries of 'src' starting at 'from' into 'dst' at 'to',
+ * with the counts and children when the nodes are inner nodes. */
+/* 在两个结点之间复制count项 */
+static void zbtCopyEntries(zbtreeNode *dst, int to, zbtreeNode *src, int from, int count) {
+    memcpy(dst->score+to,src->score+from,sizeof(double)*count);
+    memcpy(dst->obj+to,src->obj+from,sizeof(void*)*count);
+    if (!src->leaf) {
+        memcpy(INNER(dst)->count+to,INNER(src)->count+from,
+            sizeof(unsigned long)*count);
+        memcpy(INNER(dst)->child+to,INNER(src)->child+from,
+            sizeof(zbtreeNode*)*count);
+    }
+}
+
+/* Move the entries of 'x' from 'from' to the end by 'delta' positions,
+ * to the right if it is positive. x->n is not updated. */
+/* 将从from开始的项移动delta个位置，不更新n */
+static void zbtShiftEntries(zbtreeNode *x, int from, int delta) {
+    int count = x->n - from;
+
+    memmove(x->score+from+delta,x->score+from,sizeof(double)*count);
+    memmove(x->obj+from+delta,x->obj+from,sizeof(void*)*count);
+    if (!x->leaf) {
+        memmove(INNER(x)->count+from+delta,INNER(x)->count+from,
+            sizeof(unsigned long)*count);
+        memmove(INNER(x)->child+from+delta,INNER(x)->child+from,
+            sizeof(zbtreeNode*)*count);
+    }
+}
+
+/* Insert the entry (score, obj) at position 'i' of 'x'. For inner nodes
+ * the caller sets the count and the child. */
+/* 在结点x的位置i插入一项 */
+static void zbtInsertEntry(zbtreeNode *x, int i, double score, void *obj) {
+    zbtShiftEntries(x,i,1);
+    x->score[i] = score;
+    x->obj[i] = obj;
+    x->n++;
+}
+
+/* Move the entries of 'x' from 'at' to the end into a new node, that is
+ * returned. It may be empty when 'at' is x->n. */
+/* 分裂结点，从at开始的项移动到新结点中 */
+static zbtreeNode *zbtSplit(zbtree *zbt, zbtreeNode *x, int at) {
+    zbtreeNode *r = x->leaf ? zbtCreateLeaf() : zbtCreateInner();
+
+    zbtCopyEntries(r,0,x,at,x->n-at);
+    r->n = x->n-at;
+    x->n = at;
+    if (x->leaf) {
+        LEAF(r)->prev = LEAF(x);
+        LEAF(r)->next = LEAF(x)->next;
+        if (LEAF(x)->next)
+            LEAF(x)->next->prev = LEAF(r);
+        else
+            zbt->tail = LEAF(r);
+        LEAF(x)->next = LEAF(r);
+    }
+    return r;
+}
+
+/* Get the separator the parent of the new node 'r' needs for it. A leaf
+ * gives its first element, retained once more, an inner node gives away
+ * the separator of its first child, that it does not need anymore. */
+/* 获取新结点在父结点中的分隔键 */
+static void zbtTakeSeparator(zbtree *zbt, zbtreeNode *r, double *score, void **obj) {
+    *score = r->score[0];
+    *obj = r->obj[0];
+    if (r->leaf)
+        zbt->type->retain(*obj);
+    else
+        r->obj[0] = NULL;
+}
+
+/* Insert (score, obj) in the subtree rooted at 'x'. When 'x' was full and
+ * had to be split, the new node on its right is returned, and the caller
+ * has to add it to the parent of 'x'. */
+/* 在子树中插入元素，结点分裂时返回右边的新结点 */
+static zbtreeNode *zbtInsertNode(zbtree *zbt, zbtreeNode *x, double score, void *obj) {
+    zbtreeNode *r = NULL, *target = x, *c;
+    unsigned long ccount;
+    double sscore;
+    void *sobj;
+    int i, at;
+
+    if (x->leaf) {
+        i = zbtLeafSearch(zbt,x,score,obj);
+        if (x->n == ZBTREE_NODE_SIZE) {
+            /* Appending to the last leaf only moves the new element to a
+             * new leaf, so that adding the elements in order, like
+             * when loading a sorted set, fills the leaves completely. */
+            at = (i == ZBTREE_NODE_SIZE && LEAF(x) == zbt->tail) ?
+                 ZBTREE_NODE_SIZE : ZBTREE_NODE_SIZE/2;
+            r = zbtSplit(zbt,x,at);
+            if (i > at || r->n == 0) {
+                target = r;
+                i -= at;
+            }
+        }
+        zbtInsertEntry(target,i,score,obj);
+        return r;
+    }
+
+    i = zbtChildIndex(zbt,x,score,obj);
+    c = zbtInsertNode(zbt,INNER(x)->child[i],score,obj);
+    INNER(x)->count[i]++;
+    if (c == NULL) return NULL;
+
+    /* The child was split, add the new node as child i+1. */
+    ccount = zbtNodeCount(c);
+    INNER(x)->count[i] -= ccount;
+    zbtTakeSeparator(zbt,c,&sscore,&sobj);
+    i++;
+    if (x->n == ZBTREE_NODE_SIZE) {
+        at = ZBTREE_NODE_SIZE/2;
+        r = zbtSplit(zbt,x,at);
+        if (i > at) {
+            target = r;
+            i -= at;
+        }
+    }
+    zbtInsertEntry(target,i,sscore,sobj);
+    INNER(target)->count[i] = ccount;
+    INNER(target)->child[i] = c;
+    return r;
+}
+
+/* Insert the element 'obj' with the given score. The tree takes over the
+ * reference of the caller. The element must not be already in the tree. */
+/* 插入元素，B+树获得调用者持有的引用 */
+void zbtInsert(zbtree *zbt, double score, void *obj) {
+    zbtreeNode *r = zbtInsertNode(zbt,zbt->root,score,obj);
+    zbtreeNode *root;
+    unsigned long rcount;
+
+    zbt->length++;
+    if (r == NULL) return;
+
+    /* The root was split: the tree grows by one level. */
+    rcount = zbtNodeCount(r);
+    root = zbtCreateInner();
+    root->n = 2;
+    root->score[0] = 0;
+    root->obj[0] = NULL;
+    INNER(root)->child[0] = zbt->root;
+    INNER(root)->count[0] = zbt->length-rcount;
+    zbtTakeSeparator(zbt,r,&root->score[1],&root->obj[1]);
+    INNER(root)->child[1] = r;
+    INNER(root)->count[1] = rcount;
+    zbt->root = root;
+    zbt->height++;
+}
+
+/* Move the first 'k' entries of the child l+1 of 'p' to the end of the
+ * child 'l'. */
+/* 将右边兄弟结点的前k项移动到左边结点的尾部 */
+static void zbtMoveLeft(zbtree *zbt, zbtreeInner *p, int l, int k) {
+    zbtreeNode *a = p->child[l], *b = p->child[l+1];
+    unsigned long moved = 0;
+    int j;
+
+    zbtCopyEntries(a,a->n,b,0,k);
+    if (a->leaf) {
+        moved = k;
+    } else {
+        /* The separator of the first child of 'b' comes down from 'p',
+         * the one of the child 'k' goes up to 'p'. */
+        a->score[a->n] = p->node.score[l+1];
+        a->obj[a->n] = p->node.obj[l+1];
+        p->node.score[l+1] = b->score[k];
+        p->node.obj[l+1] = b->obj[k];
+        for (j = 0; j < k; j++) moved += INNER(b)->count[j];
+    }
+    a->n += k;
+    zbtShiftEntries(b,k,-k);
+    b->n -= k;
+    if (b->leaf) {
+        zbt->type->release(p->node.obj[l+1]);
+        p->node.score[l+1] = b->score[0];
+        p->node.obj[l+1] = b->obj[0];
+        zbt->type->retain(b->obj[0]);
+    } else {
+        b->obj[0] = NULL;
+    }
+    p->count[l] += moved;
+    p->count[l+1] -= moved;
+}
+
+/* Move the last 'k' entries of the child 'l' of 'p' to the start of the
+ * child l+1. */
+/* 将左边结点的后k项移动到右边兄弟结点的头部 */
+static void zbtMoveRight(zbtree *zbt, zbtreeInner *p, int l, int k) {
+    zbtreeNode *a = p->child[l], *b = p->child[l+1];
+    unsigned long moved = 0;
+    int j;
+
+    zbtShiftEntries(b,0,k);
+    zbtCopyEntries(b,0,a,a->n-k,k);
+    if (b->leaf) {
+        moved = k;
+        zbt->type->release(p->node.obj[l+1]);
+        p->node.score[l+1] = b->score[0];
+        p->node.obj[l+1] = b->obj[0];
+        zbt->type->retain(b->obj[0]);
+    } else {
+        /* The old first child of 'b' gets its separator from 'p', and the
+         * separator of the new first child goes up to 'p'. */
+        b->score[k] = p->node.score[l+1];
+        b->obj[k] = p->node.obj[l+1];
+        p->node.score[l+1] = b->score[0];
+        p->node.obj[l+1] = b->obj[0];
+        b->obj[0] = NULL;
+        for (j = 0; j < k; j++) moved += INNER(b)->count[j];
+    }
+    a->n -= k;
+    b->n += k;
+    p->count[l] -= moved;
+    p->count[l+1] += moved;
+}
+
+/* Merge the child l+1 of 'p' into the child 'l'. */
+/* 将右边兄弟结点合并到左边结点中 */
+static void zbtMerge(zbtree *zbt, zbtreeInner *p, int l) {
+    zbtreeNode *a = p->child[l], *b = p->child[l+1];
+
+    zbtCopyEntries(a,a->n,b,0,b->n);
+    if (a->leaf) {
+        LEAF(a)->next = LEAF(b)->next;
+        if (LEAF(b)->next)
+            LEAF(b)->next->prev = LEAF(a);
+        else
+            zbt->tail = LEAF(a);
+        zbt->type->release(p->node.obj[l+1]);
+    } else {
+        a->score[a->n] = p->node.score[l+1];
+        a->obj[a->n] = p->node.obj[l+1];
+    }
+    a->n += b->n;
+    p->count[l] += p->count[l+1];
+    zbtShiftEntries(&p->node,l+2,-1);
+    p->node.n--;
+    zfree(b);
+}
+
+/* The child 'i' of 'p' has less than ZBTREE_NODE_MIN entries: merge it with
+ * a sibling, or take entries from it so that both have at least half. */
+/* 子结点i的项数过少时，与兄弟结点合并或者从兄弟结点移入部分项 */
+static void zbtRebalance(zbtree *zbt, zbtreeInner *p, int i) {
+    int l = (i+1 < (int)p->node.n) ? i : i-1;
+    zbtreeNode *a, *b;
+
+    if (l < 0) return;
+    a = p->child[l];
+    b = p->child[l+1];
+    if (a->n + b->n <= ZBTREE_NODE_SIZE)
+        zbtMerge(zbt,p,l);
+    else if (a->n < b->n)
+        zbtMoveLeft(zbt,p,l,(b->n-a->n)/2);
+    else
+        zbtMoveRight(zbt,p,l,(a->n-b->n)/2);
+}
+
+/* Delete up to 'num' elements starting at the 0-based 'rank' inside the
+ * subtree rooted at 'x', stopping at the end of the leaf. Returns the
+ * number of deleted elements. */
+/* 从rank开始删除最多num个元素，只删除同一个叶子结点中的元素，返回删除的个数 */
+static unsigned long zbtDeleteNode(zbtree *zbt, zbtreeNode *x, unsigned long rank, unsigned long num) {
+    unsigned long deleted, j;
+    int i = 0;
+
+    if (x->leaf) {
+        deleted = x->n-rank;
+        if (deleted > num) deleted = num;
+        for (j = rank; j < rank+deleted; j++)
+            zbt->type->release(x->obj[j]);
+        zbtShiftEntries(x,rank+deleted,-(int)deleted);
+        x->n -= deleted;
+        return deleted;
+    }
+
+    while (rank >= INNER(x)->count[i]) rank -= INNER(x)->count[i++];
+    deleted = zbtDeleteNode(zbt,INNER(x)->child[i],rank,num);
+    INNER(x)->count[i] -= deleted;
+    if (INNER(x)->child[i]->n < ZBTREE_NODE_MIN) zbtRebalance(zbt,INNER(x),i);
+    return deleted;
+}
+
+/* Delete all the elements with rank between start and end, both inclusive.
+ * Start and end are 1-based, like in zslDeleteRangeByRank(), and must be
+ * in range. Returns the number of deleted elements. */
+/* 删除排名在start到end之间的元素，排名从1开始 */
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end) {
+    unsigned long removed = 0, num = end-start+1;
+    zbtreeNode *old;
+
+    assert(start >= 1 && start <= end && end <= zbt->length);
+    while (removed < num) {
+        removed += zbtDeleteNode(zbt,zbt->root,start-1,num-removed);
+
+        /* Merges may leave an inner root with a single child. */
+        while (!zbt->root->leaf && zbt->root->n == 1) {
+            old = zbt->root;
+            zbt->root = INNER(old)->child[0];
+            zfree(old);
+            zbt->height--;
+        }
+    }
+    zbt->length -= removed;
+    return removed;
+}
+
+/* Delete the element 'obj' with the given score. Returns 1 if it was found
+ * and deleted, 0 otherwise. */
+/* 删除元素，成功返回1，不存在返回0 */
+int zbtDelete(zbtree *zbt, double score, void *obj) {
+    unsigned long rank = zbtGetRank(zbt,score,obj);
+
+    if (rank == 0) return 0;
+    zbtDeleteRangeByRank(zbt,rank,rank);
+    return 1;
+}
+
+/* Return the 1-based rank of the element 'obj' with the given score, or 0
+ * when it is not in the tree. */
+/* 返回元素的排名，从1开始，不存在时返回0 */
+unsigned long zbtGetRank(zbtree *zbt, double score, void *obj) {
+    zbtreeNode *x = zbt->root;
+    unsigned long rank = 0;
+    int i, j;
+
+    while (!x->leaf) {
+        i = zbtChildIndex(zbt,x,score,obj);
+        for (j = 0; j < i; j++) rank += INNER(x)->count[j];
+        x = INNER(x)->child[i];
+    }
+    i = zbtLeafSearch(zbt,x,score,obj);
+    if (i < (int)x->n && zbtCompare(zbt,x,i,score,obj) == 0)
+        return rank+i+1;
+    return 0;
+}
+
+/* Set 'it' to the element with the given 1-based rank. Returns 0 if the
+ * rank is out of range. */
+/* 定位到排名为rank的元素，排名从1开始，超出范围时返回0 */
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it) {
+    zbtreeNode *x = zbt->root;
+    int i;
+
+    if (rank == 0 || rank > zbt->length) return 0;
+    rank--;
+    while (!x->leaf) {
+        i = 0;
+        while (rank >= INNER(x)->count[i]) rank -= INNER(x)->count[i++];
+        x = INNER(x)->child[i];
+    }
+    it->leaf = LEAF(x);
+    it->idx = rank;
+    return 1;
+}
+
+/* Set 'it' to the first element for which 'pred' is true. The predicate
+ * must be false up to some element and true from there on, like "the score
+ * is greater or equal than min". Returns 0 if it is true for no element.
+ *
+ * A separator is lower or equal than the elements of its child, so when
+ * 'pred' is true for the separator of the child i+1 it is true for all its
+ * elements, and the first element we look for is in the child 'i' or is
+ * the first one after it. */
+/* 定位到第一个使pred成立的元素，pred对有序的元素必须先不成立后成立 */
+int zbtSeek(zbtree *zbt, int (*pred)(double score, void *obj, void *privdata), void *privdata, zbtreeIter *it) {
+    zbtreeNode *x = zbt->root;
+    int lo, hi, mid;
+
+    while (!x->leaf) {
+        lo = 1;
+        hi = x->n;
+        while (lo < hi) {
+            mid = (lo+hi)/2;
+            if (pred(x->score[mid],x->obj[mid],privdata))
+                hi = mid;
+            else
+                lo = mid+1;
+        }
+        x = INNER(x)->child[lo-1];
+    }
+
+    lo = 0;
+    hi = x->n;
+    while (lo < hi) {
+        mid = (lo+hi)/2;
+        if (pred(x->score[mid],x->obj[mid],privdata))
+            hi = mid;
+        else
+            lo = mid+1;
+    }
+    it->leaf = LEAF(x);
+    it->idx = lo;
+    if (lo == (int)x->n) {
+        it->leaf = LEAF(x)->next;
+        it->idx = 0;
+    }
+    return it->leaf != NULL;
+}
+
+/* Set 'it' to the first element. Returns 0 if the tree is empty. */
+/* 定位到第一个元素 */
+int zbtFirst(zbtree *zbt, zbtreeIter *it) {
+    it->leaf = zbt->head;
+    it->idx = 0;
+    return zbt->length != 0;
+}
+
+/* Set 'it' to the last element. Returns 0 if the tree is empty. */
+/* 定位到最后一个元素 */
+int zbtLast(zbtree *zbt, zbtreeIter *it) {
+    it->leaf = zbt->tail;
+    it->idx = zbt->tail->node.n-1;
+    return zbt->length != 0;
+}
+
+/* Move 'it' to the next element. Returns 0 when there is none. */
+/* 移动到后一个元素，没有时返回0 */
+int zbtNext(zbtreeIter *it) {
+    if (++it->idx < (int)it->leaf->node.n) return 1;
+    it->leaf = it->leaf->next;
+    it->idx = 0;
+    return it->leaf != NULL;
+}
+
+/* Move 'it' to the previous element. Returns 0 when there is none. */
+/* 移动到前一个元素，没有时返回0 */
+int zbtPrev(zbtreeIter *it) {
+    if (--it->idx >= 0) return 1;
+    it->leaf = it->leaf->prev;
+    if (it->leaf == NULL) return 0;
+    it->idx = it->leaf->node.n-1;
+    return 1;
+}
+
+#ifdef ZBTREE_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "testhelp.h"
+
+long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Test elements: refcounted strings, so leaked or double released
+ * references are caught. */
+typedef struct testObj {
+    int refcount;
+    char str[16];
+} testObj;
+
+static long live_objs;
+static int refcount_ok = 1;
+
+static testObj *createTestObj(long v) {
+    testObj *o = zmalloc(sizeof(*o));
+    o->refcount = 1;
+    snprintf(o->str,sizeof(o->str),"e%ld",v);
+    live_objs++;
+    return o;
+}
+
+static int testCompare(void *a, void *b) {
+    return strcmp(((testObj*)a)->str,((testObj*)b)->str);
+}
+
+static void testRetain(void *o) {
+    ((testObj*)o)->refcount++;
+}
+
+static void testRelease(void *o) {
+    testObj *t = o;
+    if (t->refcount <= 0) {
+        refcount_ok = 0;
+        return;
+    }
+    if (--t->refcount == 0) {
+        zfree(t);
+        live_objs--;
+    }
+}
+
+static zbtreeType testType = {testCompare,testRetain,testRelease};
+
+/* The reference model: a sorted array of (score, element) pairs. */
+typedef struct modelEntry {
+    double score;
+    char str[16];
+} modelEntry;
+
+static modelEntry *model;
+static long model_len;
+
+static int modelCompare(const void *a, const void *b) {
+    const modelEntry *x = a, *y = b;
+    if (x->score < y->score) return -1;
+    if (x->score > y->score) return 1;
+    return strcmp(x->str,y->str);
+}
+
+/* Check every invariant of the subtree 'x', and that the leaves are linked
+ * in order. Returns the number of elements, or -1 if an invariant does not
+ * hold. */
+static long checkNode(zbtree *zbt, zbtreeNode *x, int depth,
+                      zbtreeLeaf **leaf) {
+    long count = 0;
+    unsigned int j;
+
+    if (x != zbt->root && x->n == 0) return -1;
+    for (j = 1; j < x->n; j++) {
+        if ((x->leaf || j > 1) &&
+            zbtCompare(zbt,x,j-1,x->score[j],x->obj[j]) >= 0) return -1;
+    }
+    if (x->leaf) {
+        if (depth != zbt->height || LEAF(x)->prev != *leaf) return -1;
+        if (*leaf ? (*leaf)->next != LEAF(x) : zbt->head != LEAF(x))
+            return -1;
+        *leaf = LEAF(x);
+        return x->n;
+    }
+    if (x->obj[0] != NULL) return -1;
+    for (j = 0; j < x->n; j++) {
+        zbtreeNode *c = INNER(x)->child[j];
+        long cc = checkNode(zbt,c,depth+1,leaf);
+        zbtreeNode *first = c, *last;
+
+        if (cc < 0 || (unsigned long)cc != INNER(x)->count[j]) return -1;
+        count += cc;
+
+        /* The separator is <= the first element of the child and > the
+         * last element of the previous child. */
+        while (!first->leaf) first = INNER(first)->child[0];
+        if (j > 0) {
+            if (zbtCompare(zbt,first,0,x->score[j],x->obj[j]) < 0) return -1;
+            last = INNER(x)->child[j-1];
+            while (!last->leaf) last = INNER(last)->child[last->n-1];
+            if (zbtCompare(zbt,last,last->n-1,x->score[j],x->obj[j]) >= 0)
+                return -1;
+        }
+    }
+    return count;
+}
+
+/* Returns 1 if the tree is valid and holds the same elements as the model,
+ * in both directions. */
+static int checkTree(zbtree *zbt) {
+    zbtreeLeaf *leaf = NULL;
+    zbtreeIter it;
+    long j = 0;
+    int ok;
+
+    if (checkNode(zbt,zbt->root,1,&leaf) != (long)zbt->length ||
+        zbt->tail != leaf || leaf->next != NULL ||
+        (long)zbt->length != model_len) return 0;
+
+    for (ok = zbtFirst(zbt,&it); ok; ok = zbtNext(&it), j++) {
+        if (j == model_len || zbtIterScore(&it) != model[j].score ||
+            strcmp(((testObj*)zbtIterObj(&it))->str,model[j].str))
+            return 0;
+    }
+    if (j != model_len) return 0;
+    for (ok = zbtLast(zbt,&it); ok; ok = zbtPrev(&it)) j--;
+    return j == 0;
+}
+
+static int scoreGte(double score, void *obj, void *privdata) {
+    (void)obj;
+    return score >= *(double*)privdata;
+}
+
+int main(void) {
+    zbtree *zbt;
+    zbtreeIter it;
+    long j, k, iter;
+    long long start;
+    double sum = 0;
+    int ok = 1;
+
+    /* Fuzz every operation against the model, with few distinct scores so
+     * that equal scores are ordered by element, and sizes that grow and
+     * shrink the tree by a few levels. */
+    zbt = zbtCreate(&testType);
+    model = zmalloc(sizeof(modelEntry)*100000);
+    for (iter = 0; ok && iter < 60000; iter++) {
+        int op = rand() % 100;
+        long target = (iter / 10000) % 2 ? 200 : 40000;
+
+        if (op < 55 + (model_len < target ? 20 : -20)) {
+            long v = rand() % 200000;
+            modelEntry e;
+            testObj *o;
+
+            e.score = rand() % 1000;
+            snprintf(e.str,sizeof(e.str),"e%ld",v);
+            if (bsearch(&e,model,model_len,sizeof(e),modelCompare)) continue;
+            model[model_len++] = e;
+            qsort(model,model_len,sizeof(e),modelCompare);
+            o = createTestObj(v);
+            zbtInsert(zbt,e.score,o);
+        } else if (op < 90 && model_len) {
+            long pos = rand() % model_len;
+            testObj *o = zmalloc(sizeof(*o));
+
+            strcpy(o->str,model[pos].str);
+            ok = zbtGetRank(zbt,model[pos].score,o) == (unsigned long)pos+1 &&
+                 zbtDelete(zbt,model[pos].score,o) == 1 &&
+                 zbtDelete(zbt,model[pos].score,o) == 0;
+            zfree(o);
+            memmove(model+pos,model+pos+1,sizeof(modelEntry)*(model_len-pos-1));
+            model_len--;
+        } else if (model_len) {
+            long s = rand() % model_len, e = s + rand() % 300;
+            if (e >= model_len) e = model_len-1;
+            ok = zbtDeleteRangeByRank(zbt,s+1,e+1) == (unsigned long)(e-s+1);
+            memmove(model+s,model+e+1,sizeof(modelEntry)*(model_len-e-1));
+            model_len -= e-s+1;
+        }
+
+        if (ok && iter % 1000 == 0) ok = checkTree(zbt);
+        if (ok && model_len) {
+            long pos = rand() % model_len;
+            double min = model[pos].score;
+
+            ok = zbtGetElementByRank(zbt,pos+1,&it) &&
+                 zbtIterScore(&it) == model[pos].score &&
+                 !strcmp(((testObj*)zbtIterObj(&it))->str,model[pos].str);
+
+            while (pos > 0 && model[pos-1].score == min) pos--;
+            ok = ok && zbtSeek(zbt,scoreGte,&min,&it) &&
+                 !strcmp(((testObj*)zbtIterObj(&it))->str,model[pos].str);
+            min = 1000;
+            ok = ok && !zbtSeek(zbt,scoreGte,&min,&it);
+        }
+    }
+    test_cond("Fuzzing against a model", ok && checkTree(zbt));
+    zbtFree(zbt);
+    test_cond("Every element reference is released once",
+        refcount_ok && live_objs == 0);
+
+    /* In order insertion fills the leaves. */
+    zbt = zbtCreate(&testType);
+    for (j = 0; j < 100000; j++) zbtInsert(zbt,j,createTestObj(j));
+    for (k = 0, j = 0; j < 100000; j += ZBTREE_NODE_SIZE) {
+        if (zbtGetElementByRank(zbt,j+1,&it) && it.idx == 0) k++;
+    }
+    test_cond("In order insertion fills the leaves",
+        k == 100000/ZBTREE_NODE_SIZE+1);
+    test_cond("Deleting every rank leaves a single empty leaf",
+        zbtDeleteRangeByRank(zbt,1,100000) == 100000 &&
+        zbt->root->leaf && zbt->height == 1);
+    zbtFree(zbt);
+    test_cond("Every element reference is released after a range delete",
+        refcount_ok && live_objs == 0);
+
+    /* Timings on a large tree. */
+    zbt = zbtCreate(&testType);
+    start = usec();
+    for (j = 0; j < 1000000; j++)
+        zbtInsert(zbt,rand() % 10000000,createTestObj(j));
+    printf("Insert 1M random scores: %lld usec, height %d\n",
+        usec()-start, zbt->height);
+    start = usec();
+    for (j = 0; j < 1000; j++) {
+        double min = rand() % 10000000;
+        if (zbtSeek(zbt,scoreGte,&min,&it)) {
+            for (k = 0; k < 1000; k++) {
+                sum += zbtIterScore(&it);
+                if (!zbtNext(&it)) break;
+            }
+        }
+    }
+    printf("1000 range scans of 1000 elements: %lld usec (sum %.0f)\n",
+        usec()-start, sum);
+    zbtFree(zbt);
+    zfree(model);
+    test_report();
+    return 0;
+}
+#endif
@@ -0,0 +1,108 @@
+/* zbtree.h - A B+tree of (score, element) pairs with subtree counts
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __ZBTREE_H
+#define __ZBTREE_H
+
+/* Max number of entries of a node. A node that is not the root never has
+ * less than ZBTREE_NODE_MIN entries. */
+#define ZBTREE_NODE_SIZE 64
+#define ZBTREE_NODE_MIN (ZBTREE_NODE_SIZE/2)
+
+/* The elements are opaque to the tree, that orders them by score first and
+ * by 'compare' when the scores are equal. The tree owns a reference to
+ * every element it holds, and inner nodes take one more reference to the
+ * elements they use as separators with 'retain'. */
+/* B+树元素的比较、增加引用和释放方法 */
+typedef struct zbtreeType {
+    int (*compare)(void *a, void *b);
+    void (*retain)(void *obj);
+    void (*release)(void *obj);
+} zbtreeType;
+
+/* Entries of leaves and inner nodes are kept in parallel arrays, so a
+ * binary search over the scores only touches a few adjacent cache lines.
+ * In a leaf the entries are the elements, in an inner node entry i is the
+ * separator of child i: it is lower or equal than every element of the
+ * child, and greater than every element of child i-1. The separator of
+ * child 0 is never used and its 'obj' is always NULL. */
+/* B+树结点的公共部分，叶子结点保存元素，内部结点保存每个子结点的分隔键 */
+typedef struct zbtreeNode {
+    unsigned int leaf:1;
+    unsigned int n:31;
+    double score[ZBTREE_NODE_SIZE];
+    void *obj[ZBTREE_NODE_SIZE];
+} zbtreeNode;
+
+/* 叶子结点，通过双向链表连接，用于范围遍历 */
+typedef struct zbtreeLeaf {
+    zbtreeNode node;
+    struct zbtreeLeaf *prev, *next;
+} zbtreeLeaf;
+
+/* 内部结点，count保存每个子树中的元素个数，用于计算排名 */
+typedef struct zbtreeInner {
+    zbtreeNode node;
+    unsigned long count[ZBTREE_NODE_SIZE];
+    zbtreeNode *child[ZBTREE_NODE_SIZE];
+} zbtreeInner;
+
+typedef struct zbtree {
+    zbtreeType *type;
+    zbtreeNode *root;
+    zbtreeLeaf *head, *tail;
+    unsigned long length;
+    int height;
+} zbtree;
+
+/* A position in the tree, used to walk the leaves in both directions. */
+/* B+树中的位置，叶子结点和在叶子结点中的下标 */
+typedef struct zbtreeIter {
+    zbtreeLeaf *leaf;
+    int idx;
+} zbtreeIter;
+
+#define zbtIterScore(it) ((it)->leaf->node.score[(it)->idx])
+#define zbtIterObj(it) ((it)->leaf->node.obj[(it)->idx])
+
+zbtree *zbtCreate(zbtreeType *type);    //创建空的B+树
+void zbtFree(zbtree *zbt);  //释放B+树及其所有元素的引用
+void zbtInsert(zbtree *zbt, double score, void *obj);   //插入元素，B+树获得obj的引用
+int zbtDelete(zbtree *zbt, double score, void *obj);    //删除元素，释放B+树持有的引用
+unsigned long zbtDeleteRangeByRank(zbtree *zbt, unsigned long start, unsigned long end);    //删除排名在start到end之间的元素，排名从1开始
+unsigned long zbtGetRank(zbtree *zbt, double score, void *obj); //返回元素的排名，从1开始，不存在时返回0
+int zbtGetElementByRank(zbtree *zbt, unsigned long rank, zbtreeIter *it);   //定位到排名为rank的元素，排名从1开始
+int zbtSeek(zbtree *zbt, int (*pred)(double score, void *obj, void *privdata), void *privdata, zbtreeIter *it);  //定位到第一个使pred成立的元素
+int zbtFirst(zbtree *zbt, zbtreeIter *it);  //定位到第一个元素
+int zbtLast(zbtree *zbt, zbtreeIter *it);   //定位到最后一个元素
+int zbtNext(zbtreeIter *it);    //移动到后一个元素
+int zbtPrev(zbtreeIter *it);    //移动到前一个元素
+
+#endif
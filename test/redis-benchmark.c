@@ -45,6 +45,7 @@
 #include "sds.h"
 #include "adlist.h"
 #include "zmalloc.h"
+#include "shmring.h"
 
 #define REDIS_NOTUSED(V) ((void) V)
 #define RANDPTR_INITIAL_SIZE 8
@@ -86,6 +87,7 @@ static struct config {
     sds dbnumstr;
     char *tests;
     char *auth;
+    size_t shmring;         /* Ring size if --shmring is used, otherwise 0 */
 } config;
 
 typedef struct _client {
@@ -109,6 +111,7 @@ typedef struct _client {
     int selectlen;  /* If non-zero, a SELECT of 'selectlen' bytes is currently
                        used as a prefix of the pipline of commands. This gets
                        discarded the first time it's sent. */
+    shmRingConn *shm;       /* Shared memory rings, with --shmring */
 } *client;
 
 /* Prototypes */
@@ -121,6 +124,7 @@ static void freeAllClients(void) /* 释放所有的Client */
 static void resetClient(client c) /* 重置Client */
 static void randomizeClientKey(client c) /* 随机填充client里的randptr中的key值 */
 static void clientDone(client c) /* Client完成后的调用方法 */
+static void readRing(client c) /* 把回复环中的数据交给hiredis解析 */
 static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) /* 读事件的处理方法 */
 static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) /* 写事件方法处理 */
 static client createClient(char *cmd, size_t len, client from) /* 创建一个基准的Client */
@@ -168,6 +172,10 @@ static void freeClient(client c) {
     //删除文件的读写事件
     aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
     aeDeleteFileEvent(config.el,c->context->fd,AE_READABLE);
+    if (c->shm) {
+        aeDeleteFileEvent(config.el,c->shm->rfd,AE_READABLE);
+        shmRingConnFree(c->shm);
+    }
     //释放Client中所占的空间
     redisFree(c->context);
     sdsfree(c->obuf);
@@ -243,6 +251,34 @@ static void clientDone(client c) {
     }
 }
 
+/* With --shmring the replies are not read from the socket: move everything
+ * the server wrote in the reply ring to the hiredis reader, then let the
+ * server know we are going to sleep. Requests that didn't fit in the
+ * request ring are written again now that the server consumed some. */
+/* 把回复环中的数据交给hiredis解析 */
+static void readRing(client c) {
+    char buf[16*1024];
+    ssize_t nread;
+
+    shmRingClearWakeup(c->shm);
+    if (shmRingPeerClosed(c->shm)) {
+        fprintf(stderr,"Error: Server closed the connection\n");
+        exit(1);
+    }
+    do {
+        while((nread = shmRingRead(&c->shm->in,buf,sizeof(buf))) > 0) {
+            redisReaderFeed(c->context->reader,buf,nread);
+            shmRingNotifySpace(c->shm);
+        }
+        if (nread == -1) {
+            fprintf(stderr,"Error: Reading from the ring: %s\n",strerror(errno));
+            exit(1);
+        }
+    } while(!shmRingWaitData(&c->shm->in));
+    if (c->written < sdslen(c->obuf))
+        aeCreateFileEvent(config.el,c->context->fd,AE_WRITABLE,writeHandler,c);
+}
+
 /* 读事件的处理方法 */
 static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     client c = privdata;
@@ -257,7 +293,8 @@ static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     //计算延时，然后比较延时，取得第一个read 的event事件
     if (c->latency < 0) c->latency = ustime()-(c->start);
 
-    if (redisBufferRead(c->context) != REDIS_OK) {
+    if (c->shm) readRing(c);
+    if (!c->shm && redisBufferRead(c->context) != REDIS_OK) {
     	//首先判断能否读
         fprintf(stderr,"Error: %s\n",c->context->errstr);
         exit(1);
@@ -330,8 +367,23 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 
     if (sdslen(c->obuf) > c->written) {
         void *ptr = c->obuf+c->written;
-        //调用写事件的关键
-        int nwritten = write(c->context->fd,ptr,sdslen(c->obuf)-c->written);
+        int nwritten;
+
+        if (c->shm) {
+            /* If the request ring is full wait for readRing() to be called
+             * when the server consumed it. */
+            nwritten = shmRingWrite(&c->shm->out,ptr,sdslen(c->obuf)-c->written);
+            if (nwritten > 0) {
+                shmRingNotifyData(c->shm);
+            } else if (nwritten == 0) {
+                if (shmRingWaitSpace(&c->shm->out))
+                    aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
+                return;
+            }
+        } else {
+            //调用写事件的关键
+            nwritten = write(c->context->fd,ptr,sdslen(c->obuf)-c->written);
+        }
         if (nwritten == -1) {
             if (errno != EPIPE)
                 fprintf(stderr, "Writing to socket: %s\n", strerror(errno));
@@ -342,8 +394,9 @@ static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
         if (sdslen(c->obuf) == c->written) {
         	//写事件完成，删除写事件
             aeDeleteFileEvent(config.el,c->context->fd,AE_WRITABLE);
-            //创建读事件
-            aeCreateFileEvent(config.el,c->context->fd,AE_READABLE,readHandler,c);
+            //创建读事件，共享内存模式下读事件已经注册在eventfd上
+            if (!c->shm)
+                aeCreateFileEvent(config.el,c->context->fd,AE_READABLE,readHandler,c);
         }
     }
 }
@@ -395,6 +448,21 @@ static client createClient(char *cmd, size_t len, client from) {
     /* Suppress hiredis cleanup of unused buffers for max speed. */
     c->context->reader->maxbuf = 0;
 
+    /* Move the connection to shared memory: from now on the socket is not
+     * used anymore, and replies are signaled on the eventfd of the ring. */
+    c->shm = NULL;
+    if (config.shmring) {
+        char err[256];
+
+        c->shm = shmRingClientConnect(c->context->fd,config.shmring,err);
+        if (c->shm == NULL) {
+            fprintf(stderr,"Could not start SHMRING on %s: %s\n",
+                config.hostsocket,err);
+            exit(1);
+        }
+        aeCreateFileEvent(config.el,c->shm->rfd,AE_READABLE,readHandler,c);
+    }
+
     /* Build the request buffer:
      * Queue N requests accordingly to the pipeline size, or simply clone
      * the example client buffer. */
@@ -612,6 +680,9 @@ int parseOptions(int argc, const char **argv) {
             config.tests = sdscat(config.tests,(char*)argv[++i]);
             config.tests = sdscat(config.tests,",");
             sdstolower(config.tests);
+        } else if (!strcmp(argv[i],"--shmring")) {
+            if (lastarg) goto invalid;
+            config.shmring = shmRingRoundSize(atoll(argv[++i]));
         } else if (!strcmp(argv[i],"--dbnum")) {
             if (lastarg) goto invalid;
             config.dbnum = atoi(argv[++i]);
@@ -659,7 +730,10 @@ usage:
 " -l                 Loop. Run the tests forever\n"
 " -t <tests>         Only run the comma separated list of tests. The test\n"
 "                    names are the same as the ones produced as output.\n"
-" -I                 Idle mode. Just open N idle connections and wait.\n\n"
+" -I                 Idle mode. Just open N idle connections and wait.\n"
+" --shmring <size>   With -s, move every connection to a pair of shared\n"
+"                    memory rings of <size> bytes (the server needs\n"
+"                    unixsocket-shmring yes) to compare with sockets.\n\n"
 "Examples:\n\n"
 " Run the benchmark with the default configuration against 127.0.0.1:6379:\n"
 "   $ redis-benchmark\n\n"
@@ -669,6 +743,9 @@ usage:
 "   $ redis-benchmark -t set -n 1000000 -r 100000000\n\n"
 " Benchmark 127.0.0.1:6379 for a few commands producing CSV output:\n"
 "   $ redis-benchmark -t ping,set,get -n 100000 --csv\n\n"
+" Compare the unix socket with the shared memory transport:\n"
+"   $ redis-benchmark -s /tmp/redis.sock -t get,set -P 16 -q\n"
+"   $ redis-benchmark -s /tmp/redis.sock -t get,set -P 16 -q --shmring 1048576\n\n"
 " Benchmark a specific command line:\n"
 "   $ redis-benchmark -r 10000 -n 10000 eval 'return redis.call(\"ping\")' 0\n\n"
 " Fill a list with 10000 random elements:\n"
@@ -749,12 +826,18 @@ int main(int argc, const char **argv) {
     config.tests = NULL;
     config.dbnum = 0;
     config.auth = NULL;
+    config.shmring = 0;
 	
 	//根据输入的参数配置
     i = parseOptions(argc,argv);
     argc -= i;
     argv += i;
 
+    if (config.shmring && config.hostsocket == NULL) {
+        fprintf(stderr,"--shmring requires a unix socket (-s)\n");
+        exit(1);
+    }
+
     config.latency = zmalloc(sizeof(long long)*config.requests);
 
     if (config.keepalive == 0) {
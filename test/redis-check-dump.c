@@ -54,6 +54,11 @@
 #define REDIS_SET_INTSET 11
 #define REDIS_ZSET_ZIPLIST 12
 #define REDIS_HASH_ZIPLIST 13
+#define REDIS_LIST_QUICKLIST 14
+#define REDIS_LIST_LISTPACK 15
+#define REDIS_HASH_LISTPACK 16
+#define REDIS_ZSET_LISTPACK 17
+#define REDIS_STRING_ROARING 18
 
 /* Objects encoding. Some kind of objects like Strings and Hashes can be
  * internally represented in multiple ways. The 'encoding' field of the object
@@ -192,7 +197,7 @@ int checkType(unsigned char t) {
     /* In case a new object type is added, update the following
      * condition as necessary. */
     return
-        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_HASH_ZIPLIST) ||
+        (t >= REDIS_HASH_ZIPMAP && t <= REDIS_STRING_ROARING) ||
         t <= REDIS_HASH ||
         t >= REDIS_EXPIRETIME_MS;
 }
@@ -229,7 +234,7 @@ int processHeader(void) {
     }
 
     dump_version = (int)strtol(buf + 5, NULL, 10);
-    if (dump_version < 1 || dump_version > 6) {
+    if (dump_version < 1 || dump_version > 9) {
         ERROR("Unknown RDB format version: %d\n", dump_version);
     }
     return dump_version;
@@ -479,6 +484,7 @@ int loadPair(entry *e) {
 
     uint32_t length = 0;
     if (e->type == REDIS_LIST ||
+        e->type == REDIS_LIST_QUICKLIST ||
         e->type == REDIS_SET  ||
         e->type == REDIS_ZSET ||
         e->type == REDIS_HASH) {
@@ -496,6 +502,10 @@ int loadPair(entry *e) {
     case REDIS_SET_INTSET:
     case REDIS_ZSET_ZIPLIST:
     case REDIS_HASH_ZIPLIST:
+    case REDIS_LIST_LISTPACK:
+    case REDIS_HASH_LISTPACK:
+    case REDIS_ZSET_LISTPACK:
+    case REDIS_STRING_ROARING:
     	//因为类似ziplist,zipmap等结构体其实是一个个结点连接而成的超级字符串，所以是直接读取
         if (!processStringObject(NULL)) {
             SHIFT_ERROR(offset, "Error reading entry value");
@@ -503,8 +513,9 @@ int loadPair(entry *e) {
         }
     break;
     case REDIS_LIST:
+    case REDIS_LIST_QUICKLIST:
     case REDIS_SET:
-        //而上面这2种是传统的结构，要分结点读取
+        //而上面这几种是传统的结构，要分结点读取，quicklist的每个结点是一个ziplist字符串
         for (i = 0; i < length; i++) {
             offset = CURR_OFFSET;
             if (!processStringObject(NULL)) {
@@ -833,6 +844,11 @@ int main(int argc, char **argv) {
     sprintf(types[REDIS_SET], "SET");
     sprintf(types[REDIS_ZSET], "ZSET");
     sprintf(types[REDIS_HASH], "HASH");
+    sprintf(types[REDIS_LIST_QUICKLIST], "LIST_QUICKLIST");
+    sprintf(types[REDIS_LIST_LISTPACK], "LIST_LISTPACK");
+    sprintf(types[REDIS_HASH_LISTPACK], "HASH_LISTPACK");
+    sprintf(types[REDIS_ZSET_LISTPACK], "ZSET_LISTPACK");
+    sprintf(types[REDIS_STRING_ROARING], "STRING_ROARING");
 
     /* Object types only used for dumping to disk */
     sprintf(types[REDIS_EXPIRETIME], "EXPIRETIME");
@@ -47,10 +47,9 @@ int __failed_tests = 0;
 int __test_num = 0;
 
 /* 宏定义测试方法，输入参数，输入描述语，判断的式子作为参数 */
-/* 有完全体现了函数式编程的思想 */
+/* 有完全体现了函数式编程的思想，判断式子在 if 处调用 */
 #define test_cond(descr,_c) do { \
     __test_num++; printf("%d - %s: ", __test_num, descr); \
-    //判断式子在此处调用
     if(_c) printf("PASSED\n"); else {printf("FAILED\n"); __failed_tests++;} \
 } while(0);
 
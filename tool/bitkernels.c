@@ -0,0 +1,655 @@
+/* bitkernels.c -- Vectorized kernels of BITCOUNT, BITPOS and BITOP
+ *
+ * Copyright (c) 2009-2012, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* BITCOUNT, BITPOS and BITOP spend all their time in three loops over the
+ * string: counting the set bits, skipping the bytes that are all zeros or
+ * all ones, and combining the input strings word by word. On strings of
+ * many megabytes these loops are the whole cost of the command.
+ *
+ * Every loop has a portable implementation, the code Redis always used, and
+ * x86 ones using the POPCNT instruction, AVX2 and AVX-512 VPOPCNTDQ. The
+ * fastest set supported by the CPU is selected at startup by
+ * bitKernelsInit(), the portable one is used when it is never called.
+ *
+ * BITOP works on blocks of BITK_BLOCK bytes: the first input is copied into
+ * the block of the result, then every other input is combined with it while
+ * it is still in the L1 cache. This way there is no limit to the number of
+ * keys, and every input is read just once, sequentially. */
+
+#include "fmacros.h"
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include "config.h"
+#include "redisassert.h"
+#include "bitkernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define HAVE_BITK_X86 1
+#include <immintrin.h>
+#if !defined(__clang__) && __GNUC__ >= 8
+#define HAVE_BITK_AVX512 1
+#endif
+#endif
+
+/* Implementations, from the slowest to the fastest. */
+/* 各个实现在bitKernelsTable中的下标 */
+#define BITK_GENERIC 0
+#define BITK_POPCNT 1
+#define BITK_AVX2 2
+#define BITK_AVX512 3
+
+/* Bytes of the result computed at a time by BITOP. */
+#define BITK_BLOCK 4096
+
+/* Combine 'n' bytes of 's' with the ones of 'd' according to 'op', storing
+ * the result in 'd'. With BITOP_NOT 'd' is set to the negation of 's'. */
+typedef void bitOpBlockProc(int op, unsigned char *d, const unsigned char *s,
+                            size_t n);
+
+/* -----------------------------------------------------------------------------
+ * Portable implementation
+ * -------------------------------------------------------------------------- */
+
+/* Count number of bits set in the binary array pointed by 's' and long
+ * 'count' bytes. The implementation of this function is required to
+ * work with a input string length up to 512 MB. */
+/* 统计位数的通用实现，每次处理16个字节 */
+static size_t bitPopcountGeneric(void *s, long count) {
+    size_t bits = 0;
+    unsigned char *p = s;
+    uint32_t *p4;
+    static const unsigned char bitsinbyte[256] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8};
+
+    /* Count initial bytes not aligned to 32 bit. */
+    while((unsigned long)p & 3 && count) {
+        bits += bitsinbyte[*p++];
+        count--;
+    }
+
+    /* Count bits 16 bytes at a time */
+    p4 = (uint32_t*)p;
+    while(count>=16) {
+        uint32_t aux1, aux2, aux3, aux4;
+
+        aux1 = *p4++;
+        aux2 = *p4++;
+        aux3 = *p4++;
+        aux4 = *p4++;
+        count -= 16;
+
+        aux1 = aux1 - ((aux1 >> 1) & 0x55555555);
+        aux1 = (aux1 & 0x33333333) + ((aux1 >> 2) & 0x33333333);
+        aux2 = aux2 - ((aux2 >> 1) & 0x55555555);
+        aux2 = (aux2 & 0x33333333) + ((aux2 >> 2) & 0x33333333);
+        aux3 = aux3 - ((aux3 >> 1) & 0x55555555);
+        aux3 = (aux3 & 0x33333333) + ((aux3 >> 2) & 0x33333333);
+        aux4 = aux4 - ((aux4 >> 1) & 0x55555555);
+        aux4 = (aux4 & 0x33333333) + ((aux4 >> 2) & 0x33333333);
+        bits += ((((aux1 + (aux1 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
+                ((((aux2 + (aux2 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
+                ((((aux3 + (aux3 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
+                ((((aux4 + (aux4 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
+    }
+    /* Count the remaining bytes. */
+    p = (unsigned char*)p4;
+    while(count--) bits += bitsinbyte[*p++];
+    return bits;
+}
+
+/* Return the position of the first bit set to one (if 'bit' is 1) or
+ * zero (if 'bit' is 0) in the bitmap starting at 's' and long 'count' bytes.
+ *
+ * The function is guaranteed to return a value >= 0 if 'bit' is 0 since if
+ * no zero bit is found, it returns count*8 assuming the string is zero
+ * padded on the right. However if 'bit' is 1 it is possible that there is
+ * not a single set bit in the bitmap. In this special case -1 is returned. */
+/* 查找第一个值为bit的位的通用实现，每次跳过一个字 */
+static long bitBitposGeneric(void *s, unsigned long count, int bit) {
+    unsigned long *l;
+    unsigned char *c;
+    unsigned long skipval, word = 0, one;
+    long pos = 0; /* Position of bit, to return to the caller. */
+    unsigned long j;
+
+    /* Process whole words first, seeking for first word that is not
+     * all ones or all zeros respectively if we are lookig for zeros
+     * or ones. This is much faster with large strings having contiguous
+     * blocks of 1 or 0 bits compared to the vanilla bit per bit processing.
+     *
+     * Note that if we start from an address that is not aligned
+     * to sizeof(unsigned long) we consume it byte by byte until it is
+     * aligned. */
+
+    /* Skip initial bits not aligned to sizeof(unsigned long) byte by byte. */
+    skipval = bit ? 0 : UCHAR_MAX;
+    c = (unsigned char*) s;
+    while((unsigned long)c & (sizeof(*l)-1) && count) {
+        if (*c != skipval) break;
+        c++;
+        count--;
+        pos += 8;
+    }
+
+    /* Skip bits with full word step. */
+    skipval = bit ? 0 : ULONG_MAX;
+    l = (unsigned long*) c;
+    while (count >= sizeof(*l)) {
+        if (*l != skipval) break;
+        l++;
+        count -= sizeof(*l);
+        pos += sizeof(*l)*8;
+    }
+
+    /* Load bytes into "word" considering the first byte as the most significant
+     * (we basically consider it as written in big endian, since we consider the
+     * string as a set of bits from left to right, with the first bit at position
+     * zero.
+     *
+     * Note that the loading is designed to work even when the bytes left
+     * (count) are less than a full word. We pad it with zero on the right. */
+    c = (unsigned char*)l;
+    for (j = 0; j < sizeof(*l); j++) {
+        word <<= 8;
+        if (count) {
+            word |= *c;
+            c++;
+            count--;
+        }
+    }
+
+    /* Special case:
+     * If bits in the string are all zero and we are looking for one,
+     * return -1 to signal that there is not a single "1" in the whole
+     * string. This can't happen when we are looking for "0" as we assume
+     * that the right of the string is zero padded. */
+    if (bit == 1 && word == 0) return -1;
+
+    /* Last word left, scan bit by bit. The first thing we need is to
+     * have a single "1" set in the most significant position in an
+     * unsigned long. We don't know the size of the long so we use a
+     * simple trick. */
+    one = ULONG_MAX; /* All bits set to 1.*/
+    one >>= 1;       /* All bits set to 1 but the MSB. */
+    one = ~one;      /* All bits set to 0 but the MSB. */
+
+    while(one) {
+        if (((one & word) != 0) == bit) return pos;
+        pos++;
+        one >>= 1;
+    }
+
+    /* If we reached this point, there is a bug in the algorithm, since
+     * the case of no match is handled as a special case before. */
+    assert(0);
+    return 0; /* Just to avoid warnings. */
+}
+
+/* Loop of bitOpBlockGeneric() for a given operator. Words are loaded with
+ * memcpy() since the inputs are not guaranteed to be aligned. */
+#define BITK_GENERIC_LOOP(OPER) do { \
+    for (; j+sizeof(unsigned long)*4 <= n; j += sizeof(unsigned long)*4) { \
+        unsigned long a[4], b[4]; \
+        memcpy(a,d+j,sizeof(a)); \
+        memcpy(b,s+j,sizeof(b)); \
+        a[0] OPER b[0]; \
+        a[1] OPER b[1]; \
+        a[2] OPER b[2]; \
+        a[3] OPER b[3]; \
+        memcpy(d+j,a,sizeof(a)); \
+    } \
+    for (; j < n; j++) d[j] OPER s[j]; \
+} while(0)
+
+/* 通用实现，每次处理4个字 */
+static void bitOpBlockGeneric(int op, unsigned char *d, const unsigned char *s,
+                              size_t n)
+{
+    size_t j = 0;
+
+    /* Different branches per different operations for speed (sorry). */
+    switch(op) {
+    case BITOP_AND: BITK_GENERIC_LOOP(&=); break;
+    case BITOP_OR:  BITK_GENERIC_LOOP(|=); break;
+    case BITOP_XOR: BITK_GENERIC_LOOP(^=); break;
+    case BITOP_NOT:
+        for (; j+sizeof(unsigned long) <= n; j += sizeof(unsigned long)) {
+            unsigned long a;
+            memcpy(&a,s+j,sizeof(a));
+            a = ~a;
+            memcpy(d+j,&a,sizeof(a));
+        }
+        for (; j < n; j++) d[j] = ~s[j];
+        break;
+    }
+}
+
+/* -----------------------------------------------------------------------------
+ * x86 implementations
+ * -------------------------------------------------------------------------- */
+
+#ifdef HAVE_BITK_X86
+/* 使用POPCNT指令统计位数，每次处理32个字节 */
+__attribute__((target("popcnt")))
+static size_t bitPopcountPOPCNT(void *s, long count) {
+    unsigned char *p = s;
+    uint64_t w[4], a = 0, b = 0, c = 0, d = 0;
+
+    /* Four independent sums, so that the popcnt instructions don't wait
+     * for each other. */
+    while (count >= 32) {
+        memcpy(w,p,sizeof(w));
+        a += __builtin_popcountll(w[0]);
+        b += __builtin_popcountll(w[1]);
+        c += __builtin_popcountll(w[2]);
+        d += __builtin_popcountll(w[3]);
+        p += 32;
+        count -= 32;
+    }
+    while (count >= 8) {
+        memcpy(w,p,sizeof(w[0]));
+        a += __builtin_popcountll(w[0]);
+        p += 8;
+        count -= 8;
+    }
+    while (count--) b += __builtin_popcount(*p++);
+    return a+b+c+d;
+}
+
+/* Count the bits of every byte of the 32 bytes at 'p' with a 16 entries
+ * lookup table for every nibble (vpshufb), adding them to the bytes of
+ * 'cnt'. The caller sums the bytes into four 64 bit lanes with vpsadbw. */
+/* 查表统计32个字节中每个字节被设置的位数，累加到cnt中 */
+__attribute__((target("avx2,popcnt")))
+static inline void bitPopcount32AVX2(const unsigned char *p, __m256i *cnt) {
+    const __m256i lookup = _mm256_setr_epi8(0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,
+                                            0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i v = _mm256_loadu_si256((const __m256i*)p);
+    __m256i lo = _mm256_and_si256(v,low);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v,4),low);
+
+    *cnt = _mm256_add_epi8(*cnt,_mm256_shuffle_epi8(lookup,lo));
+    *cnt = _mm256_add_epi8(*cnt,_mm256_shuffle_epi8(lookup,hi));
+}
+
+/* 使用AVX2指令统计位数，每次处理128个字节 */
+__attribute__((target("avx2,popcnt")))
+static size_t bitPopcountAVX2(void *s, long count) {
+    unsigned char *p = s;
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t lanes[4];
+
+    while (count >= 128) {
+        /* Every byte of 'cnt' is at most 4*8, no overflow. */
+        __m256i cnt = _mm256_setzero_si256();
+
+        bitPopcount32AVX2(p,&cnt);
+        bitPopcount32AVX2(p+32,&cnt);
+        bitPopcount32AVX2(p+64,&cnt);
+        bitPopcount32AVX2(p+96,&cnt);
+        acc = _mm256_add_epi64(acc,_mm256_sad_epu8(cnt,_mm256_setzero_si256()));
+        p += 128;
+        count -= 128;
+    }
+    _mm256_storeu_si256((__m256i*)lanes,acc);
+    return lanes[0]+lanes[1]+lanes[2]+lanes[3]+bitPopcountPOPCNT(p,count);
+}
+
+/* Skip 128 bytes at a time as long as they are all zeros when looking for
+ * a one, or all ones when looking for a zero, then find the bit in the
+ * rest of the string with the portable implementation. */
+/* 使用AVX2指令跳过全0或全1的块，每次处理128个字节 */
+__attribute__((target("avx2,popcnt")))
+static long bitBitposAVX2(void *s, unsigned long count, int bit) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    unsigned char *p = s;
+    unsigned long skipped = 0;
+    long pos;
+
+    while (count >= 128) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)p);
+        __m256i b = _mm256_loadu_si256((const __m256i*)(p+32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(p+64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(p+96));
+
+        if (bit) {
+            __m256i v = _mm256_or_si256(_mm256_or_si256(a,b),
+                                        _mm256_or_si256(c,d));
+            if (!_mm256_testz_si256(v,v)) break;
+        } else {
+            __m256i v = _mm256_and_si256(_mm256_and_si256(a,b),
+                                         _mm256_and_si256(c,d));
+            if (!_mm256_testc_si256(v,ones)) break;
+        }
+        p += 128;
+        count -= 128;
+        skipped += 128;
+    }
+    pos = bitBitposGeneric(p,count,bit);
+    return (pos == -1) ? -1 : pos+(long)(skipped*8);
+}
+
+/* Loop of bitOpBlockAVX2() for a given operator. */
+#define BITK_AVX2_LOOP(VOP,OPER) do { \
+    for (; j+128 <= n; j += 128) { \
+        __m256i a0 = _mm256_loadu_si256((const __m256i*)(d+j)); \
+        __m256i a1 = _mm256_loadu_si256((const __m256i*)(d+j+32)); \
+        __m256i a2 = _mm256_loadu_si256((const __m256i*)(d+j+64)); \
+        __m256i a3 = _mm256_loadu_si256((const __m256i*)(d+j+96)); \
+        a0 = VOP(a0,_mm256_loadu_si256((const __m256i*)(s+j))); \
+        a1 = VOP(a1,_mm256_loadu_si256((const __m256i*)(s+j+32))); \
+        a2 = VOP(a2,_mm256_loadu_si256((const __m256i*)(s+j+64))); \
+        a3 = VOP(a3,_mm256_loadu_si256((const __m256i*)(s+j+96))); \
+        _mm256_storeu_si256((__m256i*)(d+j),a0); \
+        _mm256_storeu_si256((__m256i*)(d+j+32),a1); \
+        _mm256_storeu_si256((__m256i*)(d+j+64),a2); \
+        _mm256_storeu_si256((__m256i*)(d+j+96),a3); \
+    } \
+    for (; j+32 <= n; j += 32) { \
+        __m256i a = _mm256_loadu_si256((const __m256i*)(d+j)); \
+        a = VOP(a,_mm256_loadu_si256((const __m256i*)(s+j))); \
+        _mm256_storeu_si256((__m256i*)(d+j),a); \
+    } \
+    for (; j < n; j++) d[j] OPER s[j]; \
+} while(0)
+
+/* 使用AVX2指令做位运算，每次处理128个字节 */
+__attribute__((target("avx2,popcnt")))
+static void bitOpBlockAVX2(int op, unsigned char *d, const unsigned char *s,
+                           size_t n)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t j = 0;
+
+    switch(op) {
+    case BITOP_AND: BITK_AVX2_LOOP(_mm256_and_si256,&=); break;
+    case BITOP_OR:  BITK_AVX2_LOOP(_mm256_or_si256,|=); break;
+    case BITOP_XOR: BITK_AVX2_LOOP(_mm256_xor_si256,^=); break;
+    case BITOP_NOT:
+        for (; j+32 <= n; j += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(s+j));
+            _mm256_storeu_si256((__m256i*)(d+j),_mm256_xor_si256(a,ones));
+        }
+        for (; j < n; j++) d[j] = ~s[j];
+        break;
+    }
+}
+
+#ifdef HAVE_BITK_AVX512
+/* 使用AVX-512 VPOPCNTDQ指令统计位数，每次处理256个字节 */
+__attribute__((target("avx512f,avx512vpopcntdq,popcnt")))
+static size_t bitPopcountAVX512(void *s, long count) {
+    unsigned char *p = s;
+    __m512i a = _mm512_setzero_si512(), b = _mm512_setzero_si512();
+    __m512i c = _mm512_setzero_si512(), d = _mm512_setzero_si512();
+
+    while (count >= 256) {
+        a = _mm512_add_epi64(a,_mm512_popcnt_epi64(_mm512_loadu_si512(p)));
+        b = _mm512_add_epi64(b,_mm512_popcnt_epi64(_mm512_loadu_si512(p+64)));
+        c = _mm512_add_epi64(c,_mm512_popcnt_epi64(_mm512_loadu_si512(p+128)));
+        d = _mm512_add_epi64(d,_mm512_popcnt_epi64(_mm512_loadu_si512(p+192)));
+        p += 256;
+        count -= 256;
+    }
+    a = _mm512_add_epi64(_mm512_add_epi64(a,b),_mm512_add_epi64(c,d));
+    return _mm512_reduce_add_epi64(a)+bitPopcountPOPCNT(p,count);
+}
+#endif
+#endif
+
+/* -----------------------------------------------------------------------------
+ * Selection of the implementation
+ * -------------------------------------------------------------------------- */
+
+/* The AVX-512 set only has its own popcount: BITPOS and BITOP are bound by
+ * the memory bandwidth already with AVX2. */
+/* 各个实现，下标为BITK_*，按照速度从慢到快排列 */
+static struct bitKernels {
+    const char *name;
+    size_t (*popcount)(void *s, long count);
+    long (*bitpos)(void *s, unsigned long count, int bit);
+    bitOpBlockProc *opblock;
+} bitKernelsTable[] = {
+    {"generic",bitPopcountGeneric,bitBitposGeneric,bitOpBlockGeneric},
+#ifdef HAVE_BITK_X86
+    {"popcnt",bitPopcountPOPCNT,bitBitposGeneric,bitOpBlockGeneric},
+    {"avx2",bitPopcountAVX2,bitBitposAVX2,bitOpBlockAVX2},
+#ifdef HAVE_BITK_AVX512
+    {"avx512",bitPopcountAVX512,bitBitposAVX2,bitOpBlockAVX2},
+#endif
+#endif
+};
+
+#define BITK_NUM_IMPL ((int)(sizeof(bitKernelsTable)/sizeof(bitKernelsTable[0])))
+
+static struct bitKernels *bitKernels = bitKernelsTable;
+
+/* Return non zero if the CPU supports the implementation 'j'. */
+/* 判断CPU是否支持下标为j的实现 */
+static int bitKernelsSupported(int j) {
+#ifdef HAVE_BITK_X86
+    __builtin_cpu_init();
+    switch(j) {
+    case BITK_POPCNT:
+        return __builtin_cpu_supports("popcnt");
+    case BITK_AVX2:
+        return __builtin_cpu_supports("popcnt") &&
+               __builtin_cpu_supports("avx2");
+#ifdef HAVE_BITK_AVX512
+    case BITK_AVX512:
+        return __builtin_cpu_supports("popcnt") &&
+               __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512vpopcntdq");
+#endif
+    }
+#endif
+    return j == BITK_GENERIC;
+}
+
+/* Select the fastest implementation supported by this CPU. Must be called
+ * before any other thread uses the kernels. */
+/* 根据CPU支持的指令集选择位运算实现 */
+void bitKernelsInit(void) {
+    int j;
+
+    for (j = BITK_NUM_IMPL-1; j > BITK_GENERIC; j--)
+        if (bitKernelsSupported(j)) break;
+    bitKernels = bitKernelsTable+j;
+}
+
+/* 返回当前使用的位运算实现的名称 */
+const char *bitKernelsImplName(void) {
+    return bitKernels->name;
+}
+
+/* 统计count个字节中被设置的位数 */
+size_t bitKernelPopcount(void *s, long count) {
+    return bitKernels->popcount(s,count);
+}
+
+/* 返回第一个值为bit的位的位置，bit为1且不存在时返回-1 */
+long bitKernelBitpos(void *s, unsigned long count, int bit) {
+    return bitKernels->bitpos(s,count,bit);
+}
+
+/* Store in 'dst' the result of 'op' applied to the first 'len' bytes of the
+ * 'numkeys' strings of 'src', that must all be at least 'len' bytes long.
+ * BITOP_NOT only uses src[0]. */
+/* 分块计算numkeys个字符串的位运算，结果保存到dst中 */
+static void bitOpWith(struct bitKernels *k, int op, unsigned char *dst,
+                      unsigned char **src, unsigned long numkeys, size_t len)
+{
+    size_t off, n;
+    unsigned long i;
+
+    for (off = 0; off < len; off += n) {
+        n = (len-off < BITK_BLOCK) ? len-off : BITK_BLOCK;
+        if (op == BITOP_NOT) {
+            k->opblock(op,dst+off,src[0]+off,n);
+            continue;
+        }
+        memcpy(dst+off,src[0]+off,n);
+        for (i = 1; i < numkeys; i++)
+            k->opblock(op,dst+off,src[i]+off,n);
+    }
+}
+
+/* 对numkeys个字符串的前len个字节做位运算，结果保存到dst中 */
+void bitKernelOp(int op, unsigned char *dst, unsigned char **src,
+                 unsigned long numkeys, size_t len)
+{
+    bitOpWith(bitKernels,op,dst,src,numkeys,len);
+}
+
+/* 位运算实现的性能测试，比较各个实现的结果并输出每秒处理的数据量 */
+#ifdef BITKERNELS_BENCHMARK_MAIN
+/* Build with:
+ *   cc -O2 -DBITKERNELS_BENCHMARK_MAIN -I../data -I../wrapper -I../struct \
+ *      bitkernels.c -o bitkernels-benchmark
+ *
+ * Usage: bitkernels-benchmark [max size in MB, default 512] */
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+/* assert() reports through the handler of debug.c, which would pull in the
+ * whole server: just abort. */
+void _redisAssert(char *estr, char *file, int line) {
+    (void)estr;
+    (void)file;
+    (void)line;
+    abort();
+}
+
+static long long usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000000)+tv.tv_usec;
+}
+
+/* Enough repetitions to process about 256 MB of input. */
+static int benchRuns(size_t bytes) {
+    size_t runs = ((size_t)256*1024*1024)/bytes;
+    return runs ? (int)runs : 1;
+}
+
+static void benchPrint(const char *test, struct bitKernels *k, size_t bytes,
+                       int runs, long long elapsed)
+{
+    double gbs = (double)bytes*runs/(elapsed ? elapsed : 1)/1000;
+    printf("  %-8s %-8s %8.2f GB/s\n", test, k->name, gbs);
+}
+
+static void benchSize(size_t size) {
+    unsigned long numkeys, i;
+    unsigned char **src, *dst, *ref;
+    size_t count0 = 0;
+    long pos0 = 0;
+    int j, r, runs;
+
+    /* Up to 8 keys, and no more than 1 GB of inputs. */
+    numkeys = ((size_t)1024*1024*1024)/size;
+    if (numkeys > 8) numkeys = 8;
+    if (numkeys < 2) numkeys = 2;
+
+    src = malloc(sizeof(unsigned char*)*numkeys);
+    for (i = 0; i < numkeys; i++) {
+        size_t b;
+        src[i] = malloc(size);
+        /* Mostly ones, so that AND doesn't converge to all zeros. */
+        for (b = 0; b < size; b++) src[i][b] = (unsigned char)(rand() | rand());
+    }
+    dst = malloc(size);
+    ref = malloc(size);
+    printf("%zu KB, BITOP AND of %lu keys:\n", size/1024, numkeys);
+
+    for (j = 0; j < BITK_NUM_IMPL; j++) {
+        struct bitKernels *k = bitKernelsTable+j;
+        long long start;
+        size_t count = 0;
+        long pos = 0;
+
+        if (!bitKernelsSupported(j)) continue;
+
+        /* BITCOUNT */
+        runs = benchRuns(size);
+        start = usec();
+        for (r = 0; r < runs; r++) count += k->popcount(src[0],size);
+        benchPrint("bitcount",k,size,runs,usec()-start);
+
+        /* BITPOS of the only bit set, at the end of the string. */
+        memset(dst,0,size);
+        dst[size-1] = 1;
+        start = usec();
+        for (r = 0; r < runs; r++) pos += k->bitpos(dst,size,1);
+        benchPrint("bitpos",k,size,runs,usec()-start);
+
+        /* BITOP, the throughput is the one of the inputs. */
+        runs = benchRuns(size*numkeys);
+        start = usec();
+        for (r = 0; r < runs; r++)
+            bitOpWith(k,BITOP_AND,dst,src,numkeys,size);
+        benchPrint("bitop",k,size*numkeys,runs,usec()-start);
+
+        /* All the implementations must agree. */
+        count /= benchRuns(size);
+        pos /= benchRuns(size);
+        if (j == BITK_GENERIC) {
+            count0 = count;
+            pos0 = pos;
+            memcpy(ref,dst,size);
+        } else if (count != count0 || pos != pos0 || memcmp(ref,dst,size)) {
+            printf("Mismatch between %s and %s!\n", k->name,
+                bitKernelsTable[0].name);
+            exit(1);
+        }
+    }
+
+    for (i = 0; i < numkeys; i++) free(src[i]);
+    free(src);
+    free(dst);
+    free(ref);
+}
+
+int main(int argc, char **argv) {
+    size_t sizes[] = {1, 16, 256, 4*1024, 64*1024, 512*1024}; /* KB */
+    size_t max = 512;
+    unsigned int j;
+
+    if (argc > 1) max = strtoul(argv[1],NULL,10);
+    bitKernelsInit();
+    printf("Selected implementation: %s\n", bitKernelsImplName());
+    for (j = 0; j < sizeof(sizes)/sizeof(sizes[0]); j++)
+        if (sizes[j] <= max*1024) benchSize(sizes[j]*1024);
+    return 0;
+}
+#endif
@@ -29,6 +29,7 @@
  */
 
 #include "redis.h"
+#include "bitkernels.h"
 
 /* -----------------------------------------------------------------------------
  * Helpers and low level bit functions.
@@ -56,146 +57,50 @@ static int getBitOffsetFromArgument(redisClient *c, robj *o, size_t *offset) {
 }
 
 /* Count number of bits set in the binary array pointed by 's' and long
- * 'count' bytes. The implementation of this function is required to
- * work with a input string length up to 512 MB. */
+ * 'count' bytes. The work is done by the fastest kernel supported by the
+ * CPU, see bitkernels.c. */
 size_t redisPopcount(void *s, long count) {
-    size_t bits = 0;
-    unsigned char *p = s;
-    uint32_t *p4;
-    static const unsigned char bitsinbyte[256] = {0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8};
-
-    /* Count initial bytes not aligned to 32 bit. */
-    while((unsigned long)p & 3 && count) {
-        bits += bitsinbyte[*p++];
-        count--;
-    }
-
-    /* Count bits 16 bytes at a time */
-    p4 = (uint32_t*)p;
-    while(count>=16) {
-        uint32_t aux1, aux2, aux3, aux4;
-
-        aux1 = *p4++;
-        aux2 = *p4++;
-        aux3 = *p4++;
-        aux4 = *p4++;
-        count -= 16;
-
-        aux1 = aux1 - ((aux1 >> 1) & 0x55555555);
-        aux1 = (aux1 & 0x33333333) + ((aux1 >> 2) & 0x33333333);
-        aux2 = aux2 - ((aux2 >> 1) & 0x55555555);
-        aux2 = (aux2 & 0x33333333) + ((aux2 >> 2) & 0x33333333);
-        aux3 = aux3 - ((aux3 >> 1) & 0x55555555);
-        aux3 = (aux3 & 0x33333333) + ((aux3 >> 2) & 0x33333333);
-        aux4 = aux4 - ((aux4 >> 1) & 0x55555555);
-        aux4 = (aux4 & 0x33333333) + ((aux4 >> 2) & 0x33333333);
-        bits += ((((aux1 + (aux1 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
-                ((((aux2 + (aux2 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
-                ((((aux3 + (aux3 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24) +
-                ((((aux4 + (aux4 >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24);
-    }
-    /* Count the remaining bytes. */
-    p = (unsigned char*)p4;
-    while(count--) bits += bitsinbyte[*p++];
-    return bits;
+    return bitKernelPopcount(s,count);
 }
 
-/* Return the position of the first bit set to one (if 'bit' is 1) or
- * zero (if 'bit' is 0) in the bitmap starting at 's' and long 'count' bytes.
- *
- * The function is guaranteed to return a value >= 0 if 'bit' is 0 since if
- * no zero bit is found, it returns count*8 assuming the string is zero
- * padded on the right. However if 'bit' is 1 it is possible that there is
- * not a single set bit in the bitmap. In this special case -1 is returned. */
-long redisBitpos(void *s, unsigned long count, int bit) {
-    unsigned long *l;
-    unsigned char *c;
-    unsigned long skipval, word = 0, one;
-    long pos = 0; /* Position of bit, to return to the caller. */
-    unsigned long j;
+/* Count the bits set in the bytes 'start' to 'end' (inclusive) of a chunked
+ * string, one segment at a time. */
+/* 分段统计分段字符串中start到end字节之间被设置的位数 */
+static size_t chunkedPopcount(chunkString *cs, size_t start, size_t end) {
+    size_t bits = 0, n;
 
-    /* Process whole words first, seeking for first word that is not
-     * all ones or all zeros respectively if we are lookig for zeros
-     * or ones. This is much faster with large strings having contiguous
-     * blocks of 1 or 0 bits compared to the vanilla bit per bit processing.
-     *
-     * Note that if we start from an address that is not aligned
-     * to sizeof(unsigned long) we consume it byte by byte until it is
-     * aligned. */
-
-    /* Skip initial bits not aligned to sizeof(unsigned long) byte by byte. */
-    skipval = bit ? 0 : UCHAR_MAX;
-    c = (unsigned char*) s;
-    while((unsigned long)c & (sizeof(*l)-1) && count) {
-        if (*c != skipval) break;
-        c++;
-        count--;
-        pos += 8;
-    }
+    while (start <= end) {
+        const unsigned char *p = csSegment(cs,start,&n);
 
-    /* Skip bits with full word step. */
-    skipval = bit ? 0 : ULONG_MAX;
-    l = (unsigned long*) c;
-    while (count >= sizeof(*l)) {
-        if (*l != skipval) break;
-        l++;
-        count -= sizeof(*l);
-        pos += sizeof(*l)*8;
+        if (n > end-start+1) n = end-start+1;
+        bits += redisPopcount((void*)p,n);
+        start += n;
     }
+    return bits;
+}
 
-    /* Load bytes into "word" considering the first byte as the most significant
-     * (we basically consider it as written in big endian, since we consider the
-     * string as a set of bits from left to right, with the first bit at position
-     * zero.
-     *
-     * Note that the loading is designed to work even when the bytes left
-     * (count) are less than a full word. We pad it with zero on the right. */
-    c = (unsigned char*)l;
-    for (j = 0; j < sizeof(*l); j++) {
-        word <<= 8;
-        if (count) {
-            word |= *c;
-            c++;
-            count--;
-        }
-    }
+/* Like bitKernelBitpos() for the 'count' bytes starting at 'start' of a
+ * chunked string: the position returned is relative to 'start'. */
+/* 在分段字符串中从start开始的count个字节中查找第一个值为bit的位 */
+static long chunkedBitpos(chunkString *cs, size_t start, size_t count, int bit) {
+    size_t off = 0, n;
 
-    /* Special case:
-     * If bits in the string are all zero and we are looking for one,
-     * return -1 to signal that there is not a single "1" in the whole
-     * string. This can't happen when we are looking for "0" as we assume
-     * that the right of the string is zero padded. */
-    if (bit == 1 && word == 0) return -1;
-
-    /* Last word left, scan bit by bit. The first thing we need is to
-     * have a single "1" set in the most significant position in an
-     * unsigned long. We don't know the size of the long so we use a
-     * simple trick. */
-    one = ULONG_MAX; /* All bits set to 1.*/
-    one >>= 1;       /* All bits set to 1 but the MSB. */
-    one = ~one;      /* All bits set to 0 but the MSB. */
-
-    while(one) {
-        if (((one & word) != 0) == bit) return pos;
-        pos++;
-        one >>= 1;
-    }
+    while (off < count) {
+        const unsigned char *p = csSegment(cs,start+off,&n);
+        long pos;
 
-    /* If we reached this point, there is a bug in the algorithm, since
-     * the case of no match is handled as a special case before. */
-    redisPanic("End of redisBitpos() reached.");
-    return 0; /* Just to avoid warnings. */
+        if (n > count-off) n = count-off;
+        pos = bitKernelBitpos((void*)p,n,bit);
+        if (pos != -1 && (size_t)pos < n*8) return off*8+pos;
+        off += n;
+    }
+    return bit ? -1 : (long)(count*8);
 }
 
 /* -----------------------------------------------------------------------------
  * Bits related string commands: GETBIT, SETBIT, BITCOUNT, BITOP.
  * -------------------------------------------------------------------------- */
 
-#define BITOP_AND   0
-#define BITOP_OR    1
-#define BITOP_XOR   2
-#define BITOP_NOT   3
-
 /* SETBIT key offset bitvalue */
 void setbitCommand(redisClient *c) {
     robj *o;
@@ -217,28 +122,73 @@ void setbitCommand(redisClient *c) {
         return;
     }
 
+    byte = bitoffset >> 3;
     o = lookupKeyWrite(c->db,c->argv[1]);
     if (o == NULL) {
-        o = createObject(REDIS_STRING,sdsempty());
+        /* New bitmaps are roaring bitmaps, so that setting a bit at a large
+         * offset does not allocate all the zero bytes before it. */
+        o = createStringRoaringObject(rbNew());
         dbAdd(c->db,c->argv[1],o);
     } else {
         if (checkType(c,o,REDIS_STRING)) return;
-        o = dbUnshareStringValue(c->db,c->argv[1],o);
+        if (o->encoding == REDIS_ENCODING_ROARING) {
+            if (o->refcount != 1) {
+                o = createStringRoaringObject(rbDup(o->ptr));
+                dbOverwrite(c->db,c->argv[1],o);
+            }
+        } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+            /* Chunked strings are modified in place, see below. */
+            o = dbUnshareChunkedStringValue(c->db,c->argv[1],o);
+        } else if ((size_t)byte >= stringObjectLen(o) +
+                                   REDIS_BITMAP_MAX_RAW_GROWTH)
+        {
+            /* The raw string would grow by too many zero bytes: turn it
+             * into a roaring bitmap instead. */
+            robj *dec = getDecodedObject(o);
+
+            o = createStringRoaringObject(
+                rbFromBytes(dec->ptr,sdslen(dec->ptr)));
+            decrRefCount(dec);
+            dbOverwrite(c->db,c->argv[1],o);
+        } else {
+            o = dbUnshareStringValue(c->db,c->argv[1],o);
+        }
     }
 
-    /* Grow sds value to the right length if necessary */
-    byte = bitoffset >> 3;
-    o->ptr = sdsgrowzero(o->ptr,byte+1);
+    if (o->encoding == REDIS_ENCODING_ROARING) {
+        bitval = rbSetBit(o->ptr,bitoffset,on);
+        signalModifiedKey(c->db,c->argv[1]);
+        notifyKeyspaceEvent(REDIS_NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
+        server.dirty++;
+        addReply(c, bitval ? shared.cone : shared.czero);
+        return;
+    }
 
-    /* Get current values */
-    byteval = ((uint8_t*)o->ptr)[byte];
+    /* Get current values. Grow sds value to the right length if
+     * necessary. */
+    if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        unsigned char b = 0;
+
+        if ((size_t)byte < ((chunkString*)o->ptr)->len)
+            csGetRange(o->ptr,byte,1,&b);
+        byteval = b;
+    } else {
+        o->ptr = sdsgrowzero(o->ptr,byte+1);
+        byteval = ((uint8_t*)o->ptr)[byte];
+    }
     bit = 7 - (bitoffset & 0x7);
     bitval = byteval & (1 << bit);
 
     /* Update byte with new bit value and return original value */
     byteval &= ~(1 << bit);
     byteval |= ((on & 0x1) << bit);
-    ((uint8_t*)o->ptr)[byte] = byteval;
+    if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        unsigned char b = byteval;
+
+        csSetRange(o->ptr,byte,&b,1);
+    } else {
+        ((uint8_t*)o->ptr)[byte] = byteval;
+    }
     signalModifiedKey(c->db,c->argv[1]);
     notifyKeyspaceEvent(REDIS_NOTIFY_STRING,"setbit",c->argv[1],c->db->id);
     server.dirty++;
@@ -261,7 +211,16 @@ void getbitCommand(redisClient *c) {
 
     byte = bitoffset >> 3;
     bit = 7 - (bitoffset & 0x7);
-    if (o->encoding != REDIS_ENCODING_RAW) {
+    if (o->encoding == REDIS_ENCODING_ROARING) {
+        bitval = rbGetBit(o->ptr,bitoffset);
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        unsigned char b;
+
+        if (byte < ((chunkString*)o->ptr)->len) {
+            csGetRange(o->ptr,byte,1,&b);
+            bitval = b & (1 << bit);
+        }
+    } else if (!sdsEncodedObject(o)) {
         if (byte < (size_t)ll2string(llbuf,sizeof(llbuf),(long)o->ptr))
             bitval = llbuf[byte] & (1 << bit);
     } else {
@@ -272,6 +231,43 @@ void getbitCommand(redisClient *c) {
     addReply(c, bitval ? shared.cone : shared.czero);
 }
 
+/* Compute BITOP when at least one of the inputs is a roaring bitmap. Raw
+ * strings are converted to bitmaps, missing keys are empty bitmaps, and
+ * the result is a roaring bitmap as long as the longest input, like the
+ * string BITOP would produce. */
+/* 输入中有roaring位图时的BITOP运算，结果也是roaring位图 */
+static roaringBitmap *roaringBitop(unsigned long op, robj **objects,
+                                   unsigned long numkeys)
+{
+    roaringBitmap *res = NULL, *rb;
+    unsigned long j;
+    int rbop = (op == BITOP_AND) ? RB_AND :
+               (op == BITOP_OR) ? RB_OR : RB_XOR;
+
+    for (j = 0; j < numkeys; j++) {
+        robj *o = objects[j];
+        int owned = 1;
+
+        if (o == NULL) {
+            rb = rbNew();
+        } else if (o->encoding == REDIS_ENCODING_ROARING) {
+            rb = (j == 0) ? rbDup(o->ptr) : o->ptr;
+            owned = (j == 0);
+        } else {
+            rb = rbFromBytes(o->ptr,sdslen(o->ptr));
+        }
+
+        if (j == 0) {
+            res = rb;
+        } else {
+            rbOp(res,rb,rbop);
+            if (owned) rbFree(rb);
+        }
+    }
+    if (op == BITOP_NOT) rbNot(res);
+    return res;
+}
+
 /* BITOP op_name target_key src_key1 src_key2 src_key3 ... src_keyN */
 void bitopCommand(redisClient *c) {
     char *opname = c->argv[1]->ptr;
@@ -283,6 +279,8 @@ void bitopCommand(redisClient *c) {
                                        and max len. */
     unsigned long minlen = 0;    /* Min len among the input keys. */
     unsigned char *res = NULL; /* Resulting string. */
+    roaringBitmap *rbres = NULL; /* Resulting bitmap, for roaring inputs. */
+    int roaring = 0; /* True if one of the inputs is a roaring bitmap. */
 
     /* Parse the operation name. */
     if ((opname[0] == 'a' || opname[0] == 'A') && !strcasecmp(opname,"and"))
@@ -331,82 +329,37 @@ void bitopCommand(redisClient *c) {
             zfree(objects);
             return;
         }
-        objects[j] = getDecodedObject(o);
-        src[j] = objects[j]->ptr;
-        len[j] = sdslen(objects[j]->ptr);
+        if (o->encoding == REDIS_ENCODING_ROARING) {
+            /* Bitmaps are combined as they are, see roaringBitop(). */
+            incrRefCount(o);
+            objects[j] = o;
+            src[j] = NULL;
+            len[j] = ((roaringBitmap*)o->ptr)->len;
+            roaring = 1;
+        } else {
+            objects[j] = getDecodedObject(o);
+            src[j] = objects[j]->ptr;
+            len[j] = sdslen(objects[j]->ptr);
+        }
         if (len[j] > maxlen) maxlen = len[j];
         if (j == 0 || len[j] < minlen) minlen = len[j];
     }
 
     /* Compute the bit operation, if at least one string is not empty. */
-    if (maxlen) {
+    if (maxlen && roaring) {
+        rbres = roaringBitop(op,objects,numkeys);
+    } else if (maxlen) {
         res = (unsigned char*) sdsnewlen(NULL,maxlen);
         unsigned char output, byte;
         unsigned long i;
 
         /* Fast path: as far as we have data for all the input bitmaps we
          * can take a fast path that performs much better than the
-         * vanilla algorithm. */
+         * vanilla algorithm. It works with any number of keys. */
         j = 0;
-        if (minlen && numkeys <= 16) {
-            unsigned long *lp[16];
-            unsigned long *lres = (unsigned long*) res;
-
-            /* Note: sds pointer is always aligned to 8 byte boundary. */
-            memcpy(lp,src,sizeof(unsigned long*)*numkeys);
-            memcpy(res,src[0],minlen);
-
-            /* Different branches per different operations for speed (sorry). */
-            if (op == BITOP_AND) {
-                while(minlen >= sizeof(unsigned long)*4) {
-                    for (i = 1; i < numkeys; i++) {
-                        lres[0] &= lp[i][0];
-                        lres[1] &= lp[i][1];
-                        lres[2] &= lp[i][2];
-                        lres[3] &= lp[i][3];
-                        lp[i]+=4;
-                    }
-                    lres+=4;
-                    j += sizeof(unsigned long)*4;
-                    minlen -= sizeof(unsigned long)*4;
-                }
-            } else if (op == BITOP_OR) {
-                while(minlen >= sizeof(unsigned long)*4) {
-                    for (i = 1; i < numkeys; i++) {
-                        lres[0] |= lp[i][0];
-                        lres[1] |= lp[i][1];
-                        lres[2] |= lp[i][2];
-                        lres[3] |= lp[i][3];
-                        lp[i]+=4;
-                    }
-                    lres+=4;
-                    j += sizeof(unsigned long)*4;
-                    minlen -= sizeof(unsigned long)*4;
-                }
-            } else if (op == BITOP_XOR) {
-                while(minlen >= sizeof(unsigned long)*4) {
-                    for (i = 1; i < numkeys; i++) {
-                        lres[0] ^= lp[i][0];
-                        lres[1] ^= lp[i][1];
-                        lres[2] ^= lp[i][2];
-                        lres[3] ^= lp[i][3];
-                        lp[i]+=4;
-                    }
-                    lres+=4;
-                    j += sizeof(unsigned long)*4;
-                    minlen -= sizeof(unsigned long)*4;
-                }
-            } else if (op == BITOP_NOT) {
-                while(minlen >= sizeof(unsigned long)*4) {
-                    lres[0] = ~lres[0];
-                    lres[1] = ~lres[1];
-                    lres[2] = ~lres[2];
-                    lres[3] = ~lres[3];
-                    lres+=4;
-                    j += sizeof(unsigned long)*4;
-                    minlen -= sizeof(unsigned long)*4;
-                }
-            }
+        if (minlen) {
+            bitKernelOp(op,res,src,numkeys,minlen);
+            j = minlen;
         }
 
         /* j is set to the next byte to process by the previous loop. */
@@ -433,7 +386,12 @@ void bitopCommand(redisClient *c) {
     zfree(objects);
 
     /* Store the computed value into the target key */
-    if (maxlen) {
+    if (rbres) {
+        o = createStringRoaringObject(rbres);
+        setKey(c->db,targetkey,o);
+        notifyKeyspaceEvent(REDIS_NOTIFY_STRING,"set",targetkey,c->db->id);
+        decrRefCount(o);
+    } else if (maxlen) {
         o = createObject(REDIS_STRING,res);
         setKey(c->db,targetkey,o);
         notifyKeyspaceEvent(REDIS_NOTIFY_STRING,"set",targetkey,c->db->id);
@@ -458,10 +416,17 @@ void bitcountCommand(redisClient *c) {
         checkType(c,o,REDIS_STRING)) return;
 
     /* Set the 'p' pointer to the string, that can be just a stack allocated
-     * array if our string was integer encoded. */
+     * array if our string was integer encoded. Bitmaps are counted without
+     * converting them to strings. */
     if (o->encoding == REDIS_ENCODING_INT) {
         p = (unsigned char*) llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        p = NULL;
+        strlen = ((roaringBitmap*)o->ptr)->len;
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        p = NULL;
+        strlen = ((chunkString*)o->ptr)->len;
     } else {
         p = (unsigned char*) o->ptr;
         strlen = sdslen(o->ptr);
@@ -493,6 +458,11 @@ void bitcountCommand(redisClient *c) {
      * zero can be returned is: start > end. */
     if (start > end) {
         addReply(c,shared.czero);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        addReplyLongLong(c,rbCount(o->ptr,(uint64_t)start*8,
+                                          (uint64_t)end*8+7));
+    } else if (p == NULL) {
+        addReplyLongLong(c,chunkedPopcount(o->ptr,start,end));
     } else {
         long bytes = end-start+1;
 
@@ -527,10 +497,17 @@ void bitposCommand(redisClient *c) {
     if (checkType(c,o,REDIS_STRING)) return;
 
     /* Set the 'p' pointer to the string, that can be just a stack allocated
-     * array if our string was integer encoded. */
+     * array if our string was integer encoded. Bitmaps are searched without
+     * converting them to strings. */
     if (o->encoding == REDIS_ENCODING_INT) {
         p = (unsigned char*) llbuf;
         strlen = ll2string(llbuf,sizeof(llbuf),(long)o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        p = NULL;
+        strlen = ((roaringBitmap*)o->ptr)->len;
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        p = NULL;
+        strlen = ((chunkString*)o->ptr)->len;
     } else {
         p = (unsigned char*) o->ptr;
         strlen = sdslen(o->ptr);
@@ -567,15 +544,24 @@ void bitposCommand(redisClient *c) {
      * not contain a 0 nor a 1. */
     if (start > end) {
         addReplyLongLong(c, -1);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        long long pos = rbFirst(o->ptr,bit,(uint64_t)start*8,
+                                           (uint64_t)end*8+7);
+
+        /* Like below, with no explicit end the string is considered to be
+         * padded with zeroes on the right. */
+        if (pos == -1 && bit == 0 && !end_given) pos = ((long long)end+1)*8;
+        addReplyLongLong(c,pos);
     } else {
         long bytes = end-start+1;
-        long pos = redisBitpos(p+start,bytes,bit);
+        long pos = p ? bitKernelBitpos(p+start,bytes,bit) :
+                       chunkedBitpos(o->ptr,start,bytes,bit);
 
         /* If we are looking for clear bits, and the user specified an exact
          * range with start-end, we can't consider the right of the range as
          * zero padded (as we do when no explicit end is given).
          *
-         * So if redisBitpos() returns the first bit outside the range,
+         * So if bitKernelBitpos() returns the first bit outside the range,
          * we return -1 to the caller, to mean, in the specified range there
          * is not a single "0" bit. */
         if (end_given && bit == 0 && pos == bytes*8) {
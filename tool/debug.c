@@ -172,7 +172,7 @@ void computeDatasetDigest(unsigned char *final) {
             } else if (o->type == REDIS_ZSET) {
                 unsigned char eledigest[20];
 
-                if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+                if (o->encoding == REDIS_ENCODING_LISTPACK) {
                     unsigned char *zl = o->ptr;
                     unsigned char *eptr, *sptr;
                     unsigned char *vstr;
@@ -180,13 +180,13 @@ void computeDatasetDigest(unsigned char *final) {
                     long long vll;
                     double score;
 
-                    eptr = ziplistIndex(zl,0);
+                    eptr = lpSeek(zl,0);
                     redisAssert(eptr != NULL);
-                    sptr = ziplistNext(zl,eptr);
+                    sptr = lpNext(zl,eptr);
                     redisAssert(sptr != NULL);
 
                     while (eptr != NULL) {
-                        redisAssert(ziplistGet(eptr,&vstr,&vlen,&vll));
+                        redisAssert(lpGetValue(eptr,&vstr,&vlen,&vll));
                         score = zzlGetScore(sptr);
 
                         memset(eledigest,0,20);
@@ -202,16 +202,18 @@ void computeDatasetDigest(unsigned char *final) {
                         xorDigest(digest,eledigest,20);
                         zzlNext(zl,&eptr,&sptr);
                     }
-                } else if (o->encoding == REDIS_ENCODING_SKIPLIST) {
+                } else if (o->encoding == REDIS_ENCODING_SKIPLIST ||
+                           o->encoding == REDIS_ENCODING_BTREE)
+                {
                     zset *zs = o->ptr;
                     dictIterator *di = dictGetIterator(zs->dict);
                     dictEntry *de;
 
                     while((de = dictNext(di)) != NULL) {
                         robj *eleobj = dictGetKey(de);
-                        double *score = dictGetVal(de);
+                        double score = zsetDictScore(o,de);
 
-                        snprintf(buf,sizeof(buf),"%.17g",*score);
+                        snprintf(buf,sizeof(buf),"%.17g",score);
                         memset(eledigest,0,20);
                         mixObjectDigest(eledigest,eleobj);
                         mixDigest(eledigest,buf,strlen(buf));
@@ -287,6 +289,7 @@ void debugCommand(redisClient *c) {
         dictEntry *de;
         robj *val;
         char *strenc;
+        char extra[256] = {0};
 
         if ((de = dictFind(c->db->dict,c->argv[2]->ptr)) == NULL) {
             addReply(c,shared.nokeyerr);
@@ -295,13 +298,38 @@ void debugCommand(redisClient *c) {
         val = dictGetVal(de);
         strenc = strEncoding(val->encoding);
 
+        if (val->encoding == REDIS_ENCODING_QUICKLIST) {
+            quicklist *ql = val->ptr;
+            quicklistNode *node;
+            double avg = ql->len ? (double)ql->count/ql->len : 0;
+            unsigned long long used = 0, compressed = 0;
+
+            /* Raw size of the ziplists and the size they actually take,
+             * the LZF one for compressed nodes. */
+            //统计解压前后的字节数
+            for (node = ql->head; node; node = node->next) {
+                used += node->sz;
+                if (quicklistNodeIsCompressed(node)) {
+                    void *data;
+                    compressed += quicklistGetLzf(node,&data);
+                } else {
+                    compressed += node->sz;
+                }
+            }
+            snprintf(extra,sizeof(extra),
+                " ql_nodes:%u ql_avg_node:%.2f ql_ziplist_max:%d"
+                " ql_compressed:%u ql_uncompressed_size:%llu"
+                " ql_compressed_size:%llu",
+                ql->len, avg, ql->fill, ql->compress, used, compressed);
+        }
+
         addReplyStatusFormat(c,
             "Value at:%p refcount:%d "
             "encoding:%s serializedlength:%lld "
-            "lru:%d lru_seconds_idle:%lu",
+            "lru:%d lru_seconds_idle:%lu%s",
             (void*)val, val->refcount,
             strenc, (long long) rdbSavedObjectLen(val),
-            val->lru, estimateObjectIdleTime(val));
+            val->lru, estimateObjectIdleTime(val), extra);
     } else if (!strcasecmp(c->argv[1]->ptr,"sdslen") && c->argc == 3) {
         dictEntry *de;
         robj *val;
@@ -314,7 +342,7 @@ void debugCommand(redisClient *c) {
         val = dictGetVal(de);
         key = dictGetKey(de);
 
-        if (val->type != REDIS_STRING || val->encoding != REDIS_ENCODING_RAW) {
+        if (val->type != REDIS_STRING || !sdsEncodedObject(val)) {
             addReplyError(c,"Not an sds encoded string.");
         } else {
             addReplyStatusFormat(c,
@@ -411,7 +439,7 @@ void _redisAssertPrintClientInfo(redisClient *c) {
         char *arg;
 
         if (c->argv[j]->type == REDIS_STRING &&
-            c->argv[j]->encoding == REDIS_ENCODING_RAW)
+            sdsEncodedObject(c->argv[j]))
         {
             arg = (char*) c->argv[j]->ptr;
         } else {
@@ -428,7 +456,7 @@ void redisLogObjectDebugInfo(robj *o) {
     redisLog(REDIS_WARNING,"Object type: %d", o->type);
     redisLog(REDIS_WARNING,"Object encoding: %d", o->encoding);
     redisLog(REDIS_WARNING,"Object refcount: %d", o->refcount);
-    if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_RAW) {
+    if (o->type == REDIS_STRING && sdsEncodedObject(o)) {
         redisLog(REDIS_WARNING,"Object raw string len: %zu", sdslen(o->ptr));
         if (sdslen(o->ptr) < 4096) {
             sds repr = sdscatrepr(sdsempty(),o->ptr,sdslen(o->ptr));
@@ -445,6 +473,8 @@ void redisLogObjectDebugInfo(robj *o) {
         redisLog(REDIS_WARNING,"Sorted set size: %d", (int) zsetLength(o));
         if (o->encoding == REDIS_ENCODING_SKIPLIST)
             redisLog(REDIS_WARNING,"Skiplist level: %d", (int) ((zset*)o->ptr)->zsl->level);
+        else if (o->encoding == REDIS_ENCODING_BTREE)
+            redisLog(REDIS_WARNING,"B+tree height: %d", ((zset*)o->ptr)->zbt->height);
     }
 }
 
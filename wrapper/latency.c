@@ -61,6 +61,7 @@ dictType latencyTimeSeriesDictType = {
 /* ---------------------------- Latency API --------------------------------- */
 void latencyMonitorInit(void) /* 延时监听初始化操作，创建Event字典对象 */
 void latencyAddSample(char *event, mstime_t latency) /* 添加Sample到指定的Event对象的Sample列表中 */
+void latencyAddEventLoopSamples(aeEventLoop *el) /* 把事件循环上一次迭代中各阶段的耗时加入延时监控 */
 int latencyResetEvent(char *event_to_reset) /* 重置Event事件的延迟，删除字典中的event的记录 */
 void analyzeLatencyForEvent(char *event, struct latencyStats *ls) /* 分析某个时间Event的延时结果，结果信息存入latencyStats结构体中 */
 sds createLatencyReport(void) /* 根据延时Sample的结果，创建阅读性比较好的分析报告 */
@@ -118,6 +119,23 @@ void latencyAddSample(char *event, mstime_t latency) {
     if (ts->idx == LATENCY_TS_LEN) ts->idx = 0;
 }
 
+/* Add the timings of the latest event loop iteration, as measured by
+ * aeProcessEvents() and aeMain(), as latency events. Called by beforeSleep(),
+ * when the previous iteration is complete. The time blocked in the poll
+ * call is expected to be large on an idle server, so only the part of it
+ * exceeding the requested timeout is reported. */
+/* 把事件循环上一次迭代中各阶段的耗时加入延时监控 */
+void latencyAddEventLoopSamples(aeEventLoop *el) {
+    aeLoopStats *stats = &el->stats;
+
+    if (!server.latency_monitor_threshold) return;
+    latencyAddSampleIfNeeded("eventloop-poll",stats->last_poll_overrun/1000);
+    latencyAddSampleIfNeeded("eventloop-file-events",stats->last_file/1000);
+    latencyAddSampleIfNeeded("eventloop-time-events",stats->last_time/1000);
+    latencyAddSampleIfNeeded("eventloop-before-sleep",
+        stats->last_beforesleep/1000);
+}
+
 /* Reset data for the specified event, or all the events data if 'event' is
  * NULL.
  *
@@ -369,6 +387,30 @@ sds createLatencyReport(void) {
             advices++;
         }
 
+        /* Event loop phases. */
+        if (!strcasecmp(event,"eventloop-poll")) {
+            advise_scheduler = 1;
+            advices++;
+        }
+
+        if (!strcasecmp(event,"eventloop-file-events")) {
+            advise_slowlog_inspect = 1;
+            advise_large_objects = 1;
+            advices += 2;
+        }
+
+        if (!strcasecmp(event,"eventloop-time-events")) {
+            advise_hz = 1;
+            advise_large_objects = 1;
+            advices += 2;
+        }
+
+        if (!strcasecmp(event,"eventloop-before-sleep")) {
+            advise_write_load_info = 1;
+            advise_disk_contention = 1;
+            advices += 2;
+        }
+
         report = sdscatlen(report,"\n",1);
     }
     dictReleaseIterator(di);
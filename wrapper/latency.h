@@ -78,6 +78,7 @@ struct latencyStats {
 
 void latencyMonitorInit(void); /* 延时监听初始化操作，创建Event字典对象 */
 void latencyAddSample(char *event, mstime_t latency); /* 添加Sample到指定的Event对象的Sample列表中 */
+void latencyAddEventLoopSamples(aeEventLoop *el); /* 把事件循环上一次迭代中各阶段的耗时加入延时监控 */
 
 /* Latency monitoring macros. */
 
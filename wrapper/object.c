@@ -38,22 +38,28 @@
 
 /* ------------  API --------------------- */
 robj *createObject(int type, void *ptr) /* 最初的创建robj对象方法，后面的创建方法与此类似 */	
+robj *createRawStringObject(char *ptr, size_t len)
+robj *createEmbeddedStringObject(char *ptr, size_t len) /* 创建robj与sds在同一块内存中的字符串对象 */
 robj *createStringObject(char *ptr, size_t len)
 robj *createStringObjectFromLongLong(long long value)
 robj *createStringObjectFromLongDouble(long double value)
 robj *dupStringObject(robj *o)
-robj *createListObject(void)
-robj *createZiplistObject(void)
+robj *createQuicklistObject(void) /* 创建quicklist编码的列表对象 */
+robj *createListpackObject(void) /* 创建listpack编码的列表对象 */
 robj *createSetObject(void)
 robj *createIntsetObject(void)
 robj *createHashObject(void)
 robj *createZsetObject(void)
-robj *createZsetZiplistObject(void)
+robj *createZsetListpackObject(void) /* 创建listpack编码的有序集合对象 */
+robj *createZsetBtreeObject(void) /* 创建B+树编码的有序集合对象 */
+robj *createStringRoaringObject(roaringBitmap *rb) /* 创建roaring位图编码的字符串对象 */
+robj *createStringChunkedObject(chunkString *cs) /* 创建分段编码的字符串对象 */
+void stringObjectToRaw(robj *o) /* 将roaring位图或分段编码的字符串就地转换成RAW编码 */
 void freeStringObject(robj *o) /* free Obj中的特定对象，这里free的是r->ptr */
 void freeListObject(robj *o)
 void freeSetObject(robj *o)
 void freeZsetObject(robj *o)
-void freeHashObject(robj *o) /* 释放hashObject有2种形式，1个是o-ptr的字典对象，还有1个回事压缩表o->ptr */
+void freeHashObject(robj *o) /* 释放hashObject有2种形式，1个是o-ptr的字典对象，还有1个是listpack */
 void incrRefCount(robj *o) /* robj对象增减引用计数,递增robj中的refcount的值 */
 void decrRefCount(robj *o) /* 递减robj中的引用计数，引用到0后，释放对象 */
 void decrRefCountVoid(void *o)
@@ -93,10 +99,56 @@ robj *createObject(int type, void *ptr) {
     return o;
 }
 
-robj *createStringObject(char *ptr, size_t len) {
+/* Create a string object with encoding REDIS_ENCODING_RAW, that is a plain
+ * string object where o->ptr points to a proper sds string. */
+robj *createRawStringObject(char *ptr, size_t len) {
     return createObject(REDIS_STRING,sdsnewlen(ptr,len));
 }
 
+/* Create a string object with encoding REDIS_ENCODING_EMBSTR, that is
+ * an object where the sds string is actually an unmodifiable string
+ * allocated in the same chunk as the object itself. */
+/* 创建robj与sds在同一块内存中的字符串对象，只需要一次内存分配 */
+robj *createEmbeddedStringObject(char *ptr, size_t len) {
+    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    struct sdshdr8 *sh = (void*)(o+1);
+
+    o->type = REDIS_STRING;
+    o->encoding = REDIS_ENCODING_EMBSTR;
+    o->ptr = sh+1;
+    o->refcount = 1;
+    o->lru = server.lruclock;
+
+    //EMBSTR字符串长度不超过REDIS_ENCODING_EMBSTR_SIZE_LIMIT，总是使用8位的头部
+    sh->len = len;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
+    if (ptr) {
+        memcpy(sh->buf,ptr,len);
+        sh->buf[len] = '\0';
+    } else {
+        memset(sh->buf,0,len+1);
+    }
+    return o;
+}
+
+/* Create a string object with EMBSTR encoding if it is smaller than
+ * REDIS_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
+ * used.
+ *
+ * The current limit of 44 is chosen so that the biggest string object
+ * we allocate as EMBSTR will still fit into the 64 byte arena of jemalloc:
+ * 16 bytes of robj, 3 bytes of sdshdr8, 44 bytes of string and the null
+ * term. */
+/* 短字符串采用EMBSTR编码，长字符串采用RAW编码 */
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
+robj *createStringObject(char *ptr, size_t len) {
+    if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
+        return createEmbeddedStringObject(ptr,len);
+    else
+        return createRawStringObject(ptr,len);
+}
+
 robj *createStringObjectFromLongLong(long long value) {
     robj *o;
     if (value >= 0 && value < REDIS_SHARED_INTEGERS) {
@@ -138,23 +190,44 @@ robj *createStringObjectFromLongDouble(long double value) {
     return createStringObject(buf,len);
 }
 
+/* Duplicate a string object, with the guarantee that the returned object
+ * has the same encoding as the original one. */
 robj *dupStringObject(robj *o) {
-    redisAssertWithInfo(NULL,o,o->encoding == REDIS_ENCODING_RAW);
-    return createStringObject(o->ptr,sdslen(o->ptr));
+    robj *d;
+
+    redisAssertWithInfo(NULL,o,o->type == REDIS_STRING);
+    switch(o->encoding) {
+    case REDIS_ENCODING_RAW:
+        return createRawStringObject(o->ptr,sdslen(o->ptr));
+    case REDIS_ENCODING_EMBSTR:
+        return createEmbeddedStringObject(o->ptr,sdslen(o->ptr));
+    case REDIS_ENCODING_INT:
+        d = createObject(REDIS_STRING, NULL);
+        d->encoding = REDIS_ENCODING_INT;
+        d->ptr = o->ptr;
+        return d;
+    case REDIS_ENCODING_ROARING:
+        return createStringRoaringObject(rbDup(o->ptr));
+    case REDIS_ENCODING_CHUNKED:
+        return createStringChunkedObject(csDup(o->ptr));
+    default:
+        redisPanic("Wrong encoding.");
+        break;
+    }
 }
 
-robj *createListObject(void) {
-    list *l = listCreate();
+robj *createQuicklistObject(void) {
+    quicklist *l = quicklistNew(server.list_max_ziplist_size,
+                                 server.list_compress_depth);
     robj *o = createObject(REDIS_LIST,l);
-    listSetFreeMethod(l,decrRefCountVoid);
-    o->encoding = REDIS_ENCODING_LINKEDLIST;
+    o->encoding = REDIS_ENCODING_QUICKLIST;
     return o;
 }
 
-robj *createZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(REDIS_LIST,zl);
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+robj *createListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(REDIS_LIST,lp);
+    o->encoding = REDIS_ENCODING_LISTPACK;
     return o;
 }
 
@@ -173,9 +246,9 @@ robj *createIntsetObject(void) {
 }
 
 robj *createHashObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(REDIS_HASH, zl);
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+    unsigned char *lp = lpNew();
+    robj *o = createObject(REDIS_HASH, lp);
+    o->encoding = REDIS_ENCODING_LISTPACK;
     return o;
 }
 
@@ -185,32 +258,96 @@ robj *createZsetObject(void) {
 
     zs->dict = dictCreate(&zsetDictType,NULL);
     zs->zsl = zslCreate();
+    zs->zbt = NULL;
     o = createObject(REDIS_ZSET,zs);
     o->encoding = REDIS_ENCODING_SKIPLIST;
     return o;
 }
 
-robj *createZsetZiplistObject(void) {
-    unsigned char *zl = ziplistNew();
-    robj *o = createObject(REDIS_ZSET,zl);
-    o->encoding = REDIS_ENCODING_ZIPLIST;
+robj *createZsetListpackObject(void) {
+    unsigned char *lp = lpNew();
+    robj *o = createObject(REDIS_ZSET,lp);
+    o->encoding = REDIS_ENCODING_LISTPACK;
+    return o;
+}
+
+robj *createZsetBtreeObject(void) {
+    zset *zs = zmalloc(sizeof(*zs));
+    robj *o;
+
+    zs->dict = dictCreate(&zsetDictType,NULL);
+    zs->zsl = NULL;
+    zs->zbt = zbtCreate(&zsetBtreeType);
+    o = createObject(REDIS_ZSET,zs);
+    o->encoding = REDIS_ENCODING_BTREE;
+    return o;
+}
+
+/* Create a string object holding a roaring bitmap, the encoding SETBIT
+ * uses for bitmaps that would mostly be zero bytes as raw strings. The
+ * object takes ownership of 'rb'. */
+/* 创建roaring位图编码的字符串对象 */
+robj *createStringRoaringObject(roaringBitmap *rb) {
+    robj *o = createObject(REDIS_STRING,rb);
+    o->encoding = REDIS_ENCODING_ROARING;
     return o;
 }
 
-/* free Obj中的特定对象 */
+/* Create a string object holding a chunked string, the encoding APPEND and
+ * SETRANGE use for strings too long to be reallocated cheaply. The object
+ * takes ownership of 'cs'. */
+/* 创建分段编码的字符串对象 */
+robj *createStringChunkedObject(chunkString *cs) {
+    robj *o = createObject(REDIS_STRING,cs);
+    o->encoding = REDIS_ENCODING_CHUNKED;
+    return o;
+}
+
+/* Turn a roaring bitmap or chunked string into a RAW one in place, for the
+ * commands that need the actual bytes. The value does not change, so this
+ * is safe even if the object is shared. Other encodings are left
+ * untouched. */
+/* 将roaring位图或分段编码的字符串就地转换成RAW编码 */
+void stringObjectToRaw(robj *o) {
+    sds s;
+
+    if (o->encoding == REDIS_ENCODING_ROARING) {
+        roaringBitmap *rb = o->ptr;
+
+        s = sdsnewlen(NULL,rb->len);
+        rbToBytes(rb,(unsigned char*)s,0,rb->len);
+        rbFree(rb);
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        chunkString *cs = o->ptr;
+
+        s = sdsnewlen(NULL,cs->len);
+        csGetRange(cs,0,cs->len,s);
+        csFree(cs);
+    } else {
+        return;
+    }
+    o->ptr = s;
+    o->encoding = REDIS_ENCODING_RAW;
+}
+
+/* free Obj中的特定对象，EMBSTR编码的sds随robj一起释放 */
 void freeStringObject(robj *o) {
     if (o->encoding == REDIS_ENCODING_RAW) {
         sdsfree(o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        rbFree(o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        csFree(o->ptr);
     }
 }
 
 void freeListObject(robj *o) {
     switch (o->encoding) {
-    case REDIS_ENCODING_LINKEDLIST:
-        listRelease((list*) o->ptr);
+    case REDIS_ENCODING_QUICKLIST:
+        quicklistRelease(o->ptr);
         break;
-    case REDIS_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case REDIS_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         redisPanic("Unknown list encoding type");
@@ -239,22 +376,28 @@ void freeZsetObject(robj *o) {
         zslFree(zs->zsl);
         zfree(zs);
         break;
-    case REDIS_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case REDIS_ENCODING_BTREE:
+        zs = o->ptr;
+        dictRelease(zs->dict);
+        zbtFree(zs->zbt);
+        zfree(zs);
+        break;
+    case REDIS_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         redisPanic("Unknown sorted set encoding");
     }
 }
 
-/* 释放hashObject有2种形式，1个是o-ptr的字典对象，还有1个回事压缩表o->ptr */
+/* 释放hashObject有2种形式，1个是o-ptr的字典对象，还有1个是listpack */
 void freeHashObject(robj *o) {
     switch (o->encoding) {
     case REDIS_ENCODING_HT:
         dictRelease((dict*) o->ptr);
         break;
-    case REDIS_ENCODING_ZIPLIST:
-        zfree(o->ptr);
+    case REDIS_ENCODING_LISTPACK:
+        lpFree(o->ptr);
         break;
     default:
         redisPanic("Unknown hash encoding type");
@@ -340,8 +483,11 @@ robj *tryObjectEncoding(robj *o) {
     sds s = o->ptr;
     size_t len;
 
-    if (o->encoding != REDIS_ENCODING_RAW)
-    	//如果robj已经被编码了，则直接返回
+    /* We try some specialized encoding only for objects that are
+     * RAW or EMBSTR encoded, in other words objects that are still
+     * represented by an actual array of chars. */
+    if (!sdsEncodedObject(o))
+    	//如果robj已经被编码成整数了，则直接返回
         return o; /* Already encoded */
 
     /* It's not safe to encode shared objects: shared objects can be shared
@@ -356,18 +502,26 @@ robj *tryObjectEncoding(robj *o) {
     /* Check if we can represent this string as a long integer */
     len = sdslen(s);
     if (len > 21 || !string2l(s,len,&value)) {
-        /* We can't encode the object...
+        /* We can't encode the object as an integer...
          *
-         * Do the last try, and at least optimize the SDS string inside
+         * If the string is small and is still RAW encoded,
+         * try the EMBSTR encoding which is more efficient.
+         * In this representation the object and the SDS string are
+         * allocated in the same chunk of memory to save space and
+         * cache misses. */
+        if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT) {
+            robj *emb;
+
+            if (o->encoding == REDIS_ENCODING_EMBSTR) return o;
+            emb = createEmbeddedStringObject(s,len);
+            decrRefCount(o);
+            return emb;
+        }
+
+        /* Do the last try, and at least optimize the SDS string inside
          * the string object to require little space, in case there
-         * is more than 10% of free space at the end of the SDS string.
-         *
-         * We do that for larger strings, using the arbitrary value
-         * of 32 bytes. This code was backported from the unstable branch
-         * where this is performed when the object is too large to be
-         * encoded as EMBSTR. */
-        if (len > 32 &&
-            o->encoding == REDIS_ENCODING_RAW &&
+         * is more than 10% of free space at the end of the SDS string. */
+        if (o->encoding == REDIS_ENCODING_RAW &&
             sdsavail(s) > len/10)
         {
         	//调用sdsRemoveFreeSpace把0->ptr中的字符串中的空格给移除掉
@@ -392,11 +546,18 @@ robj *tryObjectEncoding(robj *o) {
         decrRefCount(o);
         incrRefCount(shared.integers[value]);
         return shared.integers[value];
-    } else {
+    } else if (o->encoding == REDIS_ENCODING_RAW) {
         o->encoding = REDIS_ENCODING_INT;
         sdsfree(o->ptr);
         o->ptr = (void*) value;
         return o;
+    } else {
+        /* The sds of an EMBSTR object can't be freed alone. */
+        robj *enc = createObject(REDIS_STRING, (void*) value);
+
+        enc->encoding = REDIS_ENCODING_INT;
+        decrRefCount(o);
+        return enc;
     }
 }
 
@@ -406,7 +567,7 @@ robj *tryObjectEncoding(robj *o) {
 robj *getDecodedObject(robj *o) {
     robj *dec;
 
-    if (o->encoding == REDIS_ENCODING_RAW) {
+    if (sdsEncodedObject(o)) {
     	//如果没有编码方式，则直接增加引用计数，并返回
         incrRefCount(o);
         return o;
@@ -417,6 +578,20 @@ robj *getDecodedObject(robj *o) {
         ll2string(buf,32,(long)o->ptr);
         dec = createStringObject(buf,strlen(buf));
         return dec;
+    } else if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_ROARING) {
+        roaringBitmap *rb = o->ptr;
+
+        //roaring位图转换成对应的字符串
+        dec = createObject(REDIS_STRING,sdsnewlen(NULL,rb->len));
+        rbToBytes(rb,dec->ptr,0,rb->len);
+        return dec;
+    } else if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_CHUNKED) {
+        chunkString *cs = o->ptr;
+
+        //将所有的段复制到一个连续的字符串中
+        dec = createObject(REDIS_STRING,sdsnewlen(NULL,cs->len));
+        csGetRange(cs,0,cs->len,dec->ptr);
+        return dec;
     } else {
         redisPanic("Unknown encoding type");
     }
@@ -439,14 +614,28 @@ int compareStringObjectsWithFlags(robj *a, robj *b, int flags) {
     size_t alen, blen, minlen;
 
     if (a == b) return 0;
-    if (a->encoding != REDIS_ENCODING_RAW) {
+    if (a->encoding == REDIS_ENCODING_ROARING ||
+        b->encoding == REDIS_ENCODING_ROARING ||
+        a->encoding == REDIS_ENCODING_CHUNKED ||
+        b->encoding == REDIS_ENCODING_CHUNKED)
+    {
+        int cmp;
+
+        a = getDecodedObject(a);
+        b = getDecodedObject(b);
+        cmp = compareStringObjectsWithFlags(a,b,flags);
+        decrRefCount(a);
+        decrRefCount(b);
+        return cmp;
+    }
+    if (!sdsEncodedObject(a)) {
         alen = ll2string(bufa,sizeof(bufa),(long) a->ptr);
         astr = bufa;
     } else {
         astr = a->ptr;
         alen = sdslen(astr);
     }
-    if (b->encoding != REDIS_ENCODING_RAW) {
+    if (!sdsEncodedObject(b)) {
         blen = ll2string(bufb,sizeof(bufb),(long) b->ptr);
         bstr = bufb;
     } else {
@@ -480,7 +669,8 @@ int collateStringObjects(robj *a, robj *b) {
  * this function is faster then checking for (compareStringObject(a,b) == 0)
  * because it can perform some more optimization. */
 int equalStringObjects(robj *a, robj *b) {
-    if (a->encoding != REDIS_ENCODING_RAW && b->encoding != REDIS_ENCODING_RAW){
+    if (a->encoding == REDIS_ENCODING_INT &&
+        b->encoding == REDIS_ENCODING_INT){
         return a->ptr == b->ptr;
     } else {
         return compareStringObjects(a,b) == 0;
@@ -489,8 +679,12 @@ int equalStringObjects(robj *a, robj *b) {
 
 size_t stringObjectLen(robj *o) {
     redisAssertWithInfo(NULL,o,o->type == REDIS_STRING);
-    if (o->encoding == REDIS_ENCODING_RAW) {
+    if (sdsEncodedObject(o)) {
         return sdslen(o->ptr);
+    } else if (o->encoding == REDIS_ENCODING_ROARING) {
+        return ((roaringBitmap*)o->ptr)->len;
+    } else if (o->encoding == REDIS_ENCODING_CHUNKED) {
+        return ((chunkString*)o->ptr)->len;
     } else {
         char buf[32];
 
@@ -507,7 +701,7 @@ int getDoubleFromObject(robj *o, double *target) {
         value = 0;
     } else {
         redisAssertWithInfo(NULL,o,o->type == REDIS_STRING);
-        if (o->encoding == REDIS_ENCODING_RAW) {
+        if (sdsEncodedObject(o)) {
             errno = 0;
             value = strtod(o->ptr, &eptr);
             if (isspace(((char*)o->ptr)[0]) ||
@@ -520,6 +714,14 @@ int getDoubleFromObject(robj *o, double *target) {
         } else if (o->encoding == REDIS_ENCODING_INT) {
         	//如果原本的编码方式已经是数值的时候，直接转化o->ptr就行了
             value = (long)o->ptr;
+        } else if (o->encoding == REDIS_ENCODING_ROARING ||
+                   o->encoding == REDIS_ENCODING_CHUNKED)
+        {
+            robj *dec = getDecodedObject(o);
+            int retval = getDoubleFromObject(dec,target);
+
+            decrRefCount(dec);
+            return retval;
         } else {
             redisPanic("Unknown string encoding");
         }
@@ -550,7 +752,7 @@ int getLongDoubleFromObject(robj *o, long double *target) {
         value = 0;
     } else {
         redisAssertWithInfo(NULL,o,o->type == REDIS_STRING);
-        if (o->encoding == REDIS_ENCODING_RAW) {
+        if (sdsEncodedObject(o)) {
             errno = 0;
             value = strtold(o->ptr, &eptr);
             if (isspace(((char*)o->ptr)[0]) || eptr[0] != '\0' ||
@@ -558,6 +760,14 @@ int getLongDoubleFromObject(robj *o, long double *target) {
                 return REDIS_ERR;
         } else if (o->encoding == REDIS_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == REDIS_ENCODING_ROARING ||
+                   o->encoding == REDIS_ENCODING_CHUNKED)
+        {
+            robj *dec = getDecodedObject(o);
+            int retval = getLongDoubleFromObject(dec,target);
+
+            decrRefCount(dec);
+            return retval;
         } else {
             redisPanic("Unknown string encoding");
         }
@@ -588,7 +798,7 @@ int getLongLongFromObject(robj *o, long long *target) {
         value = 0;
     } else {
         redisAssertWithInfo(NULL,o,o->type == REDIS_STRING);
-        if (o->encoding == REDIS_ENCODING_RAW) {
+        if (sdsEncodedObject(o)) {
             errno = 0;
             value = strtoll(o->ptr, &eptr, 10);
             if (isspace(((char*)o->ptr)[0]) || eptr[0] != '\0' ||
@@ -596,6 +806,14 @@ int getLongLongFromObject(robj *o, long long *target) {
                 return REDIS_ERR;
         } else if (o->encoding == REDIS_ENCODING_INT) {
             value = (long)o->ptr;
+        } else if (o->encoding == REDIS_ENCODING_ROARING ||
+                   o->encoding == REDIS_ENCODING_CHUNKED)
+        {
+            robj *dec = getDecodedObject(o);
+            int retval = getLongLongFromObject(dec,target);
+
+            decrRefCount(dec);
+            return retval;
         } else {
             redisPanic("Unknown string encoding");
         }
@@ -637,12 +855,18 @@ int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *
 char *strEncoding(int encoding) {
     switch(encoding) {
     case REDIS_ENCODING_RAW: return "raw";
+    case REDIS_ENCODING_EMBSTR: return "embstr";
     case REDIS_ENCODING_INT: return "int";
     case REDIS_ENCODING_HT: return "hashtable";
     case REDIS_ENCODING_LINKEDLIST: return "linkedlist";
     case REDIS_ENCODING_ZIPLIST: return "ziplist";
+    case REDIS_ENCODING_QUICKLIST: return "quicklist";
+    case REDIS_ENCODING_LISTPACK: return "listpack";
     case REDIS_ENCODING_INTSET: return "intset";
     case REDIS_ENCODING_SKIPLIST: return "skiplist";
+    case REDIS_ENCODING_BTREE: return "btree";
+    case REDIS_ENCODING_ROARING: return "roaring";
+    case REDIS_ENCODING_CHUNKED: return "chunked";
     default: return "unknown";
     }
 }